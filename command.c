@@ -58,6 +58,12 @@ cmdInfo_t cmdInfo[]=
    {PI_CMD_CF1,   "CF1",   195, 2}, // gpioCustom1
    {PI_CMD_CF2,   "CF2",   195, 6}, // gpioCustom2
 
+   {PI_CMD_CSTAT, "CSTAT", 101, 8}, // gpioCmdStats
+   {PI_CMD_CSTATZ,"CSTATZ",101, 0}, // gpioCmdStatsReset
+
+   {PI_CMD_FC,    "FC",    112, 0}, // gpioFifoClose
+   {PI_CMD_FO,    "FO",    112, 2}, // gpioFifoOpen
+
    {PI_CMD_GDC,   "GDC",   112, 2}, // gpioGetPWMdutycycle
    {PI_CMD_GPW,   "GPW",   112, 2}, // gpioGetServoPulsewidth
 
@@ -117,6 +123,9 @@ cmdInfo_t cmdInfo[]=
 
    {PI_CMD_PROC,  "PROC",  115, 2}, // gpioStoreScript
    {PI_CMD_PROCD, "PROCD", 112, 0}, // gpioDeleteScript
+   {PI_CMD_PROCE, "PROCE", 131, 0}, // gpioScriptTrigger
+   {PI_CMD_PROCF, "PROCF", 121, 0}, // gpioScriptProfile
+   {PI_CMD_PROCFG,"PROCFG",112, 9}, // gpioScriptGetProfile
    {PI_CMD_PROCP, "PROCP", 112, 7}, // gpioScriptStatus
    {PI_CMD_PROCR, "PROCR", 191, 0}, // gpioRunScript
    {PI_CMD_PROCS, "PROCS", 112, 0}, // gpioStopScript
@@ -164,19 +173,32 @@ cmdInfo_t cmdInfo[]=
    {PI_CMD_WRITE, "WRITE", 121, 0}, // gpioWrite
 
    {PI_CMD_WVAG,  "WVAG",  192, 2}, // gpioWaveAddGeneric
+   {PI_CMD_WVAGM, "WVAGM", 198, 2}, // gpioWaveAddMulti
    {PI_CMD_WVAS,  "WVAS",  196, 2}, // gpioWaveAddSerial
+   {PI_CMD_WVASM, "WVASM", 200, 2}, // gpioWaveAddSerialMulti
+   {PI_CMD_WVAST, "WVAST", 192, 2}, // gpioWaveAddSteps
    {PI_CMD_WVBSY, "WVBSY", 101, 2}, // gpioWaveTxBusy
    {PI_CMD_WVCHA, "WVCHA", 197, 0}, // gpioWaveChain
+   {PI_CMD_WVCHX, "WVCHX", 193, 10}, // gpioWaveChainEx
+   {PI_CMD_WVLDI, "WVLDI", 197, 6}, // gpioWaveLoadImage
    {PI_CMD_WVCLR, "WVCLR", 101, 0}, // gpioWaveClear
    {PI_CMD_WVCRE, "WVCRE", 101, 2}, // gpioWaveCreate
+   {PI_CMD_WVCRP, "WVCRP", 111, 2}, // gpioWaveCreatePatchable
+   {PI_CMD_WVCRS, "WVCRS", 101, 2}, // gpioWaveCreateShared
    {PI_CMD_WVDEL, "WVDEL", 112, 0}, // gpioWaveDelete
    {PI_CMD_WVGO,  "WVGO" , 101, 2}, // gpioWaveTxStart
    {PI_CMD_WVGOR, "WVGOR", 101, 2}, // gpioWaveTxStart
    {PI_CMD_WVHLT, "WVHLT", 101, 0}, // gpioWaveTxStop
    {PI_CMD_WVNEW, "WVNEW", 101, 0}, // gpioWaveAddNew
+   {PI_CMD_WVPAT, "WVPAT", 199, 2}, // gpioWavePatch
    {PI_CMD_WVSC,  "WVSC",  112, 2}, // gpioWaveGet*Cbs
    {PI_CMD_WVSM,  "WVSM",  112, 2}, // gpioWaveGet*Micros
    {PI_CMD_WVSP,  "WVSP",  112, 2}, // gpioWaveGet*Pulses
+   {PI_CMD_WVSTH, "WVSTH", 101, 0}, // gpioWaveStreamStop
+   {PI_CMD_WVSTI, "WVSTI", 112, 2}, // gpioWaveStreamInfo
+   {PI_CMD_WVSTR, "WVSTR", 101, 0}, // gpioWaveStreamStart
+   {PI_CMD_WVSTS, "WVSTS", 192, 2}, // gpioWaveStreamSteps
+   {PI_CMD_WVSTW, "WVSTW", 192, 2}, // gpioWaveStreamWrite
    {PI_CMD_WVTX,  "WVTX",  112, 2}, // gpioWaveTxSend
    {PI_CMD_WVTXR, "WVTXR", 112, 2}, // gpioWaveTxSend
 
@@ -222,7 +244,36 @@ cmdInfo_t cmdInfo[]=
    {PI_CMD_X    , "X"    , 124, 0},
    {PI_CMD_XA   , "XA"   , 113, 0},
    {PI_CMD_XOR  , "XOR"  , 111, 0},
+   {PI_CMD_EMIT , "EMIT" , 122, 0},
+   {PI_CMD_EMITV, "EMITV", 121, 0},
+   {PI_CMD_EMITP, "EMITP", 121, 0},
+   {PI_CMD_BCMP , "BCMP" , 121, 0},
+   {PI_CMD_BCRC8, "BCRC8", 122, 0},
+   {PI_CMD_BCRC16,"BCRC16",122, 0},
+   {PI_CMD_BLDB , "BLDB" , 123, 0},
+   {PI_CMD_BLDL , "BLDL" , 123, 0},
+   {PI_CMD_BMOV , "BMOV" , 121, 0},
+   {PI_CMD_BXOR , "BXOR" , 112, 0},
+   {PI_CMD_WTICK, "WTICK", 101, 0},
+   {PI_CMD_WLEV , "WLEV" , 101, 0},
+
+};
+
+int cmdInfoEntries = sizeof(cmdInfo)/sizeof(cmdInfo_t);
+
+/* 0 leaves parsed scripts as written, to check the optimiser against */
 
+int cmdOptimise = 1;
+
+/* names of the script optimiser's superinstructions, never parsed */
+
+static cmdInfo_t cmdFused[]=
+{
+   {CMD_CMPJZ,  "CMPJZ",  0, 0},
+   {CMD_CMPJNZ, "CMPJNZ", 0, 0},
+   {CMD_CMPJM,  "CMPJM",  0, 0},
+   {CMD_CMPJP,  "CMPJP",  0, 0},
+   {CMD_DCRJNZ, "DCRJNZ", 0, 0},
 };
 
 
@@ -239,6 +290,11 @@ BS2 bits         Set gpios in bank 2\n\
 \n\
 CF1 ...          Custom function 1\n\
 CF2 ...          Custom function 2\n\
+CSTAT            Get command call counts and latencies\n\
+CSTATZ           Clear command call counts and latencies\n\
+\n\
+FC h             Close pipe command channel\n\
+FO flags         Open pipe command channel /dev/pigcmdh /dev/pigouth\n\
 \n\
 GDC g            Get PWM dutycycle for gpio\n\
 GPW g            Get servo pulsewidth for gpio\n\
@@ -283,8 +339,11 @@ PFG g            Get gpio PWM frequency\n\
 PFS g v          Set gpio PWM frequency\n\
 PIGPV            Get pigpio library version\n\
 PRG g            Get gpio PWM range\n\
-PROC text        Store script\n\
+PROC text        Store script, each store gets a new sid\n\
 PROCD sid        Delete script\n\
+PROCE sid g edge Run script on gpio edge\n\
+PROCF sid prof   Start(1)/stop(0)/clear(2) script profiling\n\
+PROCFG sid       Get script profile\n\
 PROCP sid        Get script status and parameters\n\
 PROCR sid ...    Run script\n\
 PROCS sid        Stop script\n\
@@ -317,19 +376,32 @@ TRIG g micros l  Trigger level for micros on gpio\n\
 W/WRITE g l      Write level to gpio\n\
 WDOG g millis    Set millisecond watchdog on gpio\n\
 WVAG triplets    Wave add generic pulses\n\
+WVAGM n counts triplets | Wave add n pulse trains\n\
 WVAS g baud bitlen stopbits offset ... | Wave add serial data\n\
+WVASM n g baud bitlen stopbits offset count ... | Wave add n serial channels\n\
+WVAST v0 vmax v1 acc us flags g_step g_dir steps ... | Wave add stepper move\n\
 WVBSY            Check if wave busy\n\
 WVCHA            Transmit a chain of waves\n\
+WVCHX flags ...  Compile (and transmit) an extended chain of waves\n\
+WVLDI ...        Load waveforms compiled by pigwave\n\
 WVCLR            Wave clear\n\
 WVCRE            Create wave from added pulses\n\
-WVDEL wid        Delete waves w and higher\n\
+WVCRP bits       Create patchable wave from added pulses\n\
+WVCRS            Create wave shared with identical waves\n\
+WVDEL wid        Delete wave w\n\
 WVGO             Wave transmit (DEPRECATED)\n\
 WVGOR            Wave transmit repeatedly (DEPRECATED)\n\
 WVHLT            Wave stop\n\
 WVNEW            Start a new empty wave\n\
-WVSC 0,1,2       Wave get DMA control block stats\n\
+WVPAT wid slot levels | Patch levels of patchable wave\n\
+WVSC 0-4         Wave get DMA control block stats\n\
 WVSM 0,1,2       Wave get micros stats\n\
 WVSP 0,1,2       Wave get pulses stats\n\
+WVSTH            Wave stream stop\n\
+WVSTI 0-3        Wave stream info\n\
+WVSTR            Wave stream start\n\
+WVSTS v0 vmax v1 acc us flags g_step g_dir steps ... | Wave stream stepper move\n\
+WVSTW triplets   Wave stream write pulses\n\
 WVTX wid         Transmit wave as one-shot\n\
 WVTXR wid        Transmit wave repeatedly\n\
 \n\
@@ -463,63 +535,229 @@ static errInfo_t errInfo[]=
    {PI_TOO_MANY_COUNTS  , "too many chain counters"},
    {PI_BAD_CHAIN_CMD    , "malformed chain command string"},
    {PI_REUSED_WID       , "wave already used in chain"},
+   {PI_BAD_STREAM       , "bad streamed transfer length or flags"},
+   {PI_BAD_CACHE_PATH   , "bad script cache path"},
+   {PI_BAD_EDGE         , "edge not 0-3"},
+   {PI_NOTIFY_FULL      , "notification event queue full"},
+   {PI_BAD_EVENT_CNT    , "event record not 1-16 values"},
+   {PI_BAD_BUF_RANGE    , "script buffer offset or length too big"},
+   {PI_BAD_PROF_MODE    , "script profile mode not 0-2"},
+   {PI_BAD_TRAIN_CNT    , "bad number of pulse trains or pulses"},
+   {PI_NO_WAVE_STREAM   , "the wave stream isn't running"},
+   {PI_BAD_STREAM_INFO  , "wave stream info item not 0-3"},
+   {PI_BAD_PATCH        , "wave not patchable or bad slots"},
+   {PI_BAD_STEP_AXES    , "bad number of stepper axes or steps"},
+   {PI_BAD_STEP_PROFILE , "bad stepper speeds or step micros"},
+   {PI_STREAM_FULL      , "not enough wave stream space"},
+   {PI_BAD_CHAIN_LOOP   , "chain loop not closed or badly placed"},
+   {PI_BAD_WAVE_IMAGE   , "wave image malformed or for another version"},
 
 };
 
 static char * fmtMdeStr="RW540123";
 static char * fmtPudStr="ODU";
 
-static int cmdMatch(char *str)
+/*
+   Command names are looked up in an open addressed hash table of
+   cmdInfo indices.  The table is filled once, when the library (or
+   program) is loaded, so lookups need no locking.
+*/
+
+#define CMD_HASH_SIZE 512 /* power of 2, well over twice cmdInfo */
+
+static uint16_t cmdHash[CMD_HASH_SIZE]; /* cmdInfo index + 1, 0 empty */
+
+static uint32_t cmdHashStr(char *str, int *len)
 {
+   uint32_t h;
    int i;
 
+   /* FNV-1a of the upper cased name */
+
+   h = 2166136261U;
+
+   for (i=0; str[i]; i++)
+   {
+      h ^= (uint8_t)toupper((uint8_t)str[i]);
+      h *= 16777619U;
+   }
+
+   *len = i;
+
+   return h;
+}
+
+static void __attribute__((constructor)) cmdHashInit(void)
+{
+   int i, len;
+   uint32_t h;
+
    for (i=0; i<(sizeof(cmdInfo)/sizeof(cmdInfo_t)); i++)
    {
-      if (strcasecmp(str, cmdInfo[i].name) == 0) return i;
+      h = cmdHashStr(cmdInfo[i].name, &len) & (CMD_HASH_SIZE-1);
+
+      while (cmdHash[h])
+      {
+         /* a duplicate name keeps its first entry */
+
+         if (strcasecmp(cmdInfo[cmdHash[h]-1].name, cmdInfo[i].name) == 0)
+            break;
+
+         h = (h+1) & (CMD_HASH_SIZE-1);
+      }
+
+      if (!cmdHash[h]) cmdHash[h] = i + 1;
    }
+}
+
+static int cmdMatch(char *str)
+{
+   int len;
+   uint32_t h;
+
+   h = cmdHashStr(str, &len) & (CMD_HASH_SIZE-1);
+
+   while (cmdHash[h])
+   {
+      if (strcasecmp(str, cmdInfo[cmdHash[h]-1].name) == 0)
+         return cmdHash[h] - 1;
+
+      h = (h+1) & (CMD_HASH_SIZE-1);
+   }
+
    return CMD_UNKNOWN_CMD;
 }
 
 static int getNum(char *str, unsigned *val, int8_t *opt)
 {
-   int f, n;
-   unsigned v;
+   char *s;
+   int neg, digits, base, d;
+   uint32_t v;
+   int8_t kind;
+
+   /*
+      Single pass equivalent of trying sscanf " %i %n", " v%i %n",
+      and " p%i %n" in turn.
+   */
 
    *opt = 0;
 
-   f = sscanf(str, " %i %n", &v, &n);
+   s = str;
+
+   while (isspace((uint8_t)*s)) s++;
+
+   kind = CMD_NUMERIC;
+
+   if      (*s == 'v') {kind = CMD_VAR; s++;}
+   else if (*s == 'p') {kind = CMD_PAR; s++;}
 
-   if (f == 1)
+   if (kind != CMD_NUMERIC) while (isspace((uint8_t)*s)) s++;
+
+   neg = 0;
+
+   if      (*s == '-') {neg = 1; s++;}
+   else if (*s == '+') s++;
+
+   base = 10;
+
+   if (*s == '0')
    {
-      *val = v;
-      *opt = CMD_NUMERIC;
-      return n;
+      if (((s[1] == 'x') || (s[1] == 'X')) && isxdigit((uint8_t)s[2]))
+      {
+         base = 16;
+         s += 2;
+      }
+      else base = 8;
    }
 
-   f = sscanf(str, " v%i %n", &v, &n);
+   v = 0;
+   digits = 0;
 
-   if (f == 1)
+   while (1)
    {
-      *val = v;
-      if (v < PI_MAX_SCRIPT_VARS) *opt = CMD_VAR;
-      else *opt = -CMD_VAR;
-      return n;
+      if      ((*s >= '0') && (*s <= '9')) d = *s - '0';
+      else if ((*s >= 'a') && (*s <= 'f')) d = *s - 'a' + 10;
+      else if ((*s >= 'A') && (*s <= 'F')) d = *s - 'A' + 10;
+      else break;
+
+      if (d >= base) break;
+
+      v = (v * base) + d;
+      digits++;
+      s++;
    }
 
-   f = sscanf(str, " p%i %n", &v, &n);
+   if (!digits) return 0;
+
+   if (neg) v = -v;
 
-   if (f == 1)
+   while (isspace((uint8_t)*s)) s++;
+
+   *val = v;
+
+   switch (kind)
    {
-      *val = v;
-      if (v < PI_MAX_SCRIPT_PARAMS) *opt = CMD_PAR;
-      else *opt = -CMD_PAR;
-      return n;
+      case CMD_VAR:
+         if (v < PI_MAX_SCRIPT_VARS) *opt = CMD_VAR;
+         else *opt = -CMD_VAR;
+         break;
+
+      case CMD_PAR:
+         if (v < PI_MAX_SCRIPT_PARAMS) *opt = CMD_PAR;
+         else *opt = -CMD_PAR;
+         break;
+
+      default:
+         *opt = CMD_NUMERIC;
    }
 
-   return 0;
+   return s - str;
 }
 
-static char intCmdStr[32];
+static int getToken(char *str, char *token, int size)
+{
+   char *s;
+   int n;
+
+   /* equivalent of sscanf " %<size-1>s %n" */
+
+   s = str;
+
+   while (isspace((uint8_t)*s)) s++;
+
+   n = 0;
+
+   while (*s && !isspace((uint8_t)*s) && (n < (size-1))) token[n++] = *s++;
+
+   token[n] = 0;
+
+   while (isspace((uint8_t)*s)) s++;
+
+   return s - str;
+}
+
+static __thread char intCmdStr[32]; /* cmdParse runs in several threads */
+
+char *cmdName(int cmd)
+{
+   int i;
+   char *name;
+
+   /* the last entry is the long form of the name */
+
+   name = "?";
+
+   for (i=0; i<(sizeof(cmdInfo)/sizeof(cmdInfo_t)); i++)
+   {
+      if (cmdInfo[i].cmd == cmd) name = cmdInfo[i].name;
+   }
+
+   for (i=0; i<(sizeof(cmdFused)/sizeof(cmdInfo_t)); i++)
+   {
+      if (cmdFused[i].cmd == cmd) name = cmdFused[i].name;
+   }
+   return name;
+}
 
 char *cmdStr(void)
 {
@@ -541,7 +779,7 @@ int cmdParse(
 
    bzero(&ctl->opt, sizeof(ctl->opt));
 
-   sscanf(buf+ctl->eaten, " %31s %n", intCmdStr, &pp);
+   pp = getToken(buf+ctl->eaten, intCmdStr, sizeof(intCmdStr));
 
    ctl->eaten += pp;
 
@@ -560,10 +798,11 @@ int cmdParse(
 
    switch (cmdInfo[idx].vt)
    {
-      case 101: /* BR1  BR2  H  HELP  HWVER
+      case 101: /* BR1  BR2  CSTAT  CSTATZ  H  HELP  HWVER
                    DCRA  HALT  INRA  NO
                    PIGPV  POPA  PUSHA  RET  T  TICK  WVBSY  WVCLR
-                   WVCRE  WVGO  WVGOR  WVHLT  WVNEW
+                   WVCRE  WVCRS  WVGO  WVGOR  WVHLT  WVNEW  WVSTH  WVSTR
+                   WLEV  WTICK
 
                    No parameters, always valid.
                 */
@@ -571,7 +810,7 @@ int cmdParse(
 
          break;
 
-      case 111: /* BC1  BC2  BS1  BS2  
+      case 111: /* BC1  BC2  BS1  BS2  WVCRP
                    ADD  AND  CMP  DIV  LDA  LDAB  MLT
                    MOD  OR  RLA  RRA  STAB  SUB  WAIT  XOR
 
@@ -583,10 +822,11 @@ int cmdParse(
 
          break;
 
-      case 112: /* BI2CC GDC  GPW  I2CC
+      case 112: /* BI2CC FC  FO  GDC  GPW  I2CC
                    I2CRB MG  MICS  MILS  MODEG  NC  NP  PFG  PRG
-                   PROCD  PROCP  PROCS  PRRG  R  READ  SLRC  SPIC
-                   WVDEL  WVSC  WVSM  WVSP  WVTX  WVTXR
+                   PROCD  PROCFG  PROCP  PROCS  PRRG  R  READ  SLRC  SPIC
+                   WVDEL  WVSC  WVSM  WVSP  WVSTI  WVTX  WVTXR
+                   BXOR
 
                    One positive parameter.
                 */
@@ -658,7 +898,8 @@ int cmdParse(
          break;
 
       case 121: /* HC I2CRD  I2CRR  I2CRW  I2CWB I2CWQ  P  PFS  PRS
-                   PWM  S  SERVO  SLR  W  WDOG  WRITE
+                   PROCF  PWM  S  SERVO  SLR  W  WDOG  WRITE
+                   BCMP  BMOV  EMITP  EMITV
 
                    Two positive parameters.
                 */
@@ -671,6 +912,7 @@ int cmdParse(
          break;
 
       case 122: /* NB
+                   BCRC8  BCRC16  EMIT
 
                    Two parameters, first positive, second any value.
                 */
@@ -682,7 +924,7 @@ int cmdParse(
 
          break;
 
-      case 123: /* LD  RL  RR
+      case 123: /* BLDB  BLDL  LD  RL  RR
 
                    Two parameters, first register, second any value.
                 */
@@ -754,7 +996,7 @@ int cmdParse(
 
          break;
 
-      case 131: /* BI2CO HP I2CO  I2CPC  I2CRI  I2CWB  I2CWW  SLRO
+      case 131: /* BI2CO HP I2CO  I2CPC  I2CRI  I2CWB  I2CWW  PROCE  SLRO
                    SPIO  TRIG
 
                    Three positive parameters.
@@ -826,7 +1068,7 @@ int cmdParse(
 
          break;
 
-      case 192: /* WVAG
+      case 192: /* WVAG  WVAST  WVSTS  WVSTW
 
                    One or more triplets (gpios on, gpios off, delay),
                    any value.
@@ -852,7 +1094,7 @@ int cmdParse(
 
          break;
 
-      case 193: /* BI2CZ  I2CWD  I2CZ  SERW  SPIW  SPIX
+      case 193: /* BI2CZ  I2CWD  I2CZ  SERW  SPIW  SPIX  WVCHX
 
                    Two or more parameters, first >=0, rest 0-255.
                 */
@@ -1013,7 +1255,7 @@ int cmdParse(
 
          break;
 
-      case 197: /* WVCHA
+      case 197: /* WVCHA  WVLDI
 
                    One or more parameters, all 0-255.
                 */
@@ -1038,6 +1280,131 @@ int cmdParse(
 
          break;
 
+      case 198: /* WVAGM
+
+                   The number of trains n (1-PI_WAVE_MAX_TRAINS), n
+                   pulse counts, then the pulses of each train as
+                   triplets (gpios on, gpios off, delay).
+                */
+
+         ctl->eaten += getNum(buf+ctl->eaten, &p[1], &ctl->opt[1]);
+
+         if ((ctl->opt[1] != CMD_NUMERIC) ||
+             ((int)p[1] < 1) || ((int)p[1] > PI_WAVE_MAX_TRAINS)) break;
+
+         pars = 0;
+         tp2 = 0;
+         p32 = (int32_t *)ext;
+
+         while (pars < CMD_MAX_PARAM)
+         {
+            ctl->eaten += getNum(buf+ctl->eaten, &tp1, &to1);
+            if ((to1 == CMD_NUMERIC) &&
+                ((pars >= p[1]) || ((int)tp1 >= 0)))
+            {
+               if (pars < p[1]) tp2 += tp1;
+               pars++;
+               *p32++ = tp1;
+            }
+            else break;
+         }
+
+         p[3] = pars * 4;
+
+         if ((pars >= p[1]) && ((pars - p[1]) == (tp2 * 3))) valid = 1;
+
+         break;
+
+      case 199: /* WVPAT
+
+                   Two or more parameters, first two >=0, rest any
+                   value.
+                */
+         ctl->eaten += getNum(buf+ctl->eaten, &p[1], &ctl->opt[1]);
+         ctl->eaten += getNum(buf+ctl->eaten, &p[2], &ctl->opt[2]);
+
+         if ((ctl->opt[1] == CMD_NUMERIC) &&
+             (ctl->opt[2] == CMD_NUMERIC) &&
+             ((int)p[1]>=0) && ((int)p[2]>=0))
+         {
+            pars = 0;
+            p32 = (int32_t *)ext;
+
+            while (pars < CMD_MAX_PARAM)
+            {
+               ctl->eaten += getNum(buf+ctl->eaten, &tp1, &to1);
+               if (to1 == CMD_NUMERIC)
+               {
+                  pars++;
+                  *p32++ = tp1;
+               }
+               else break;
+            }
+
+            p[3] = pars * 4;
+
+            if (pars > 0) valid = 1;
+         }
+
+         break;
+
+      case 200: /* WVASM
+
+                   The number of channels n (1-PI_WAVE_MAX_TRAINS), then
+                   for each channel gpio, baud, databits, stophalfbits,
+                   offset, and count (all >=0) followed by count bytes.
+
+                   p1 n
+                   p3 len
+                   ---------
+                   uint32_t gpio, baud, databits, stophalfbits,
+                      offset, count
+                   uint8_t[count]
+                   ... for each channel
+                */
+
+         ctl->eaten += getNum(buf+ctl->eaten, &p[1], &ctl->opt[1]);
+
+         if ((ctl->opt[1] != CMD_NUMERIC) ||
+             ((int)p[1] < 1) || ((int)p[1] > PI_WAVE_MAX_TRAINS)) break;
+
+         pars = 0;
+         p8 = ext;
+
+         for (i=0; i<p[1]; i++)
+         {
+            for (n=0; n<6; n++)
+            {
+               ctl->eaten += getNum(buf+ctl->eaten, &tp1, &to1);
+               if ((to1 != CMD_NUMERIC) || ((int)tp1 < 0)) break;
+               memcpy(p8, &tp1, 4);
+               p8 += 4;
+            }
+
+            if (n < 6) break;
+
+            /* the last of the six is the count of bytes */
+
+            tp3 = tp1;
+
+            for (n2=0; (n2<tp3) && (pars<CMD_MAX_PARAM); n2++)
+            {
+               ctl->eaten += getNum(buf+ctl->eaten, &tp2, &to2);
+               if ((to2 != CMD_NUMERIC) || ((int)tp2 < 0) || ((int)tp2 > 255))
+                  break;
+               *p8++ = tp2;
+               pars++;
+            }
+
+            if (n2 < tp3) break;
+         }
+
+         p[3] = p8 - ext;
+
+         if (i == p[1]) valid = 1;
+
+         break;
+
 
    }
 
@@ -1055,6 +1422,469 @@ char * cmdErrStr(int error)
    return "unknown error";
 }
 
+static int optTarget(uint32_t cmd)
+{
+   /* the parameter of a jump which holds its target step, or 0 */
+
+   switch (cmd)
+   {
+      case PI_CMD_CALL:
+      case PI_CMD_JM:
+      case PI_CMD_JMP:
+      case PI_CMD_JNZ:
+      case PI_CMD_JP:
+      case PI_CMD_JZ:
+         return 1;
+
+      case CMD_CMPJZ:
+      case CMD_CMPJNZ:
+      case CMD_CMPJM:
+      case CMD_CMPJP:
+      case CMD_DCRJNZ:
+         return 2;
+   }
+
+   return 0;
+}
+
+static uint32_t optCond(uint32_t cmd)
+{
+   /* the plain conditional jump taken on the same F, or 0 */
+
+   switch (cmd)
+   {
+      case PI_CMD_JM:
+      case PI_CMD_JNZ:
+      case PI_CMD_JP:
+      case PI_CMD_JZ:
+         return cmd;
+
+      case CMD_CMPJZ:  return PI_CMD_JZ;
+      case CMD_CMPJNZ: return PI_CMD_JNZ;
+      case CMD_CMPJM:  return PI_CMD_JM;
+      case CMD_CMPJP:  return PI_CMD_JP;
+      case CMD_DCRJNZ: return PI_CMD_JNZ;
+   }
+
+   return 0;
+}
+
+static int optWritesF(uint32_t cmd)
+{
+   /* commands set F to their result */
+
+   if (cmd < PI_CMD_SCRIPT) return 1;
+
+   switch (cmd)
+   {
+      case PI_CMD_ADD:   case PI_CMD_AND:    case PI_CMD_CMP:
+      case PI_CMD_DCR:   case PI_CMD_DCRA:   case PI_CMD_DIV:
+      case PI_CMD_INR:   case PI_CMD_INRA:   case PI_CMD_MLT:
+      case PI_CMD_MOD:   case PI_CMD_OR:     case PI_CMD_RL:
+      case PI_CMD_RLA:   case PI_CMD_RR:     case PI_CMD_RRA:
+      case PI_CMD_SUB:   case PI_CMD_SYS:    case PI_CMD_WAIT:
+      case PI_CMD_XOR:   case PI_CMD_EMIT:   case PI_CMD_EMITV:
+      case PI_CMD_EMITP: case PI_CMD_BCMP:   case PI_CMD_BCRC8:
+      case PI_CMD_BCRC16:case PI_CMD_BLDB:   case PI_CMD_BLDL:
+      case PI_CMD_BMOV:  case PI_CMD_BXOR:   case PI_CMD_WTICK:
+      case PI_CMD_WLEV:
+      case CMD_CMPJZ:    case CMD_CMPJNZ:    case CMD_CMPJM:
+      case CMD_CMPJP:    case CMD_DCRJNZ:
+         return 1;
+   }
+
+   return 0;
+}
+
+static int optDeadF(cmdScript_t *s, int i)
+{
+   uint32_t cmd;
+
+   /* is F overwritten before anything can test it, starting at step i */
+
+   for (; i<s->instrs; i++)
+   {
+      cmd = s->instr[i].p[0];
+
+      if (optWritesF(cmd)) return 1;
+
+      if (optTarget(cmd) || (cmd == PI_CMD_RET)) return 0;
+
+      if (cmd == PI_CMD_HALT) return 1;
+   }
+
+   return 1;
+}
+
+static int optEval(uint32_t cmd, int a, int k, int *r)
+{
+   /* A op k, for the ops which are safe to fold */
+
+   switch (cmd)
+   {
+      case PI_CMD_ADD: *r = (unsigned)a + k; return 1;
+      case PI_CMD_SUB: *r = (unsigned)a - k; return 1;
+      case PI_CMD_AND: *r = a & k;           return 1;
+      case PI_CMD_OR:  *r = a | k;           return 1;
+      case PI_CMD_XOR: *r = a ^ k;           return 1;
+      case PI_CMD_MLT: *r = (unsigned)a * k; return 1;
+
+      case PI_CMD_RLA:
+         if ((k >= 0) && (k < 32)) {*r = (unsigned)a << k; return 1;}
+         break;
+
+      case PI_CMD_RRA:
+         if ((k >= 0) && (k < 32)) {*r = a >> k; return 1;}
+         break;
+   }
+
+   return 0;
+}
+
+static int optIdentity(uint32_t cmd, int k)
+{
+   /* A op k leaves A unchanged for any A */
+
+   switch (cmd)
+   {
+      case PI_CMD_ADD:
+      case PI_CMD_OR:
+      case PI_CMD_RLA:
+      case PI_CMD_RRA:
+      case PI_CMD_SUB:
+      case PI_CMD_XOR:
+         return (k == 0);
+
+      case PI_CMD_AND:
+         return (k == -1);
+
+      case PI_CMD_DIV:
+      case PI_CMD_MLT:
+         return (k == 1);
+   }
+
+   return 0;
+}
+
+static int optCombine(cmdInstr_t *i1, cmdInstr_t *i2)
+{
+   uint32_t c1, c2;
+   int k1, k2, r;
+
+   /* replace i1 by i1 followed by i2, both A op constant */
+
+   c1 = i1->p[0];
+   c2 = i2->p[0];
+   k1 = i1->p[1];
+   k2 = i2->p[1];
+
+   if (((c1 == PI_CMD_ADD) || (c1 == PI_CMD_SUB)) &&
+       ((c2 == PI_CMD_ADD) || (c2 == PI_CMD_SUB)))
+   {
+      if (c1 == PI_CMD_SUB) k1 = -(unsigned)k1;
+      if (c2 == PI_CMD_SUB) k2 = -(unsigned)k2;
+      i1->p[0] = PI_CMD_ADD;
+      i1->p[1] = (unsigned)k1 + k2;
+      return 1;
+   }
+
+   if (c1 != c2) return 0;
+
+   switch (c1)
+   {
+      case PI_CMD_AND:
+      case PI_CMD_OR:
+      case PI_CMD_XOR:
+      case PI_CMD_MLT:
+         if (!optEval(c1, k1, k2, &r)) break;
+         i1->p[1] = r;
+         return 1;
+
+      case PI_CMD_RLA:
+      case PI_CMD_RRA:
+         if ((k1 >= 0) && (k2 >= 0) && ((k1 + k2) < 32))
+         {
+            i1->p[1] = k1 + k2;
+            return 1;
+         }
+         break;
+   }
+
+   return 0;
+}
+
+static int optSame(cmdInstr_t *i1, cmdInstr_t *i2)
+{
+   /* both name the same var or param */
+
+   return ((i1->opt[1] == i2->opt[1]) && (i1->p[1] == i2->p[1]) &&
+           ((i1->opt[1] == CMD_VAR) || (i1->opt[1] == CMD_PAR)));
+}
+
+static int optFuse(cmdInstr_t *i1, cmdInstr_t *i2)
+{
+   uint32_t cmd;
+
+   /* compare or decrement followed by a conditional jump */
+
+   cmd = 0;
+
+   if (i1->p[0] == PI_CMD_CMP)
+   {
+      switch (i2->p[0])
+      {
+         case PI_CMD_JZ:  cmd = CMD_CMPJZ;  break;
+         case PI_CMD_JNZ: cmd = CMD_CMPJNZ; break;
+         case PI_CMD_JM:  cmd = CMD_CMPJM;  break;
+         case PI_CMD_JP:  cmd = CMD_CMPJP;  break;
+      }
+   }
+   else if ((i1->p[0] == PI_CMD_DCR) && (i2->p[0] == PI_CMD_JNZ))
+      cmd = CMD_DCRJNZ;
+
+   if (!cmd) return 0;
+
+   i1->p[0] = cmd;
+   i1->p[2] = i2->p[1];
+   i1->opt[2] = CMD_NUMERIC;
+
+   return 1;
+}
+
+static void optCompact(cmdScript_t *s, char *del, int *map)
+{
+   cmdInstr_t instr;
+   int i, j, t;
+
+   /* a removed step maps to the step which followed it */
+
+   j = 0;
+
+   for (i=0; i<s->instrs; i++)
+   {
+      map[i] = j;
+      if (!del[i]) j++;
+   }
+
+   map[s->instrs] = j;
+
+   j = 0;
+
+   for (i=0; i<s->instrs; i++)
+   {
+      if (!del[i])
+      {
+         instr = s->instr[i];
+         t = optTarget(instr.p[0]);
+         if (t) instr.p[t] = map[instr.p[t]];
+         s->instr[j++] = instr;
+      }
+   }
+
+   s->instrs = j;
+}
+
+static void optScript(cmdScript_t *s, int diags)
+{
+   cmdInstr_t *in;
+   uint32_t cmd, tcmd;
+   char *del, *target;
+   int *map, *work;
+   int i, j, n, t, tgt, steps, pass, changed, fuse, w, r;
+   int before, dead, folded, fused, threaded;
+
+   /*
+      Simplify the resolved script.  Jumps are threaded through
+      jumps, constant arithmetic on A is folded, redundant loads and
+      stores and unreachable steps are removed, and finally compares
+      and decrements feeding a conditional jump are fused.  Nothing
+      is changed which could alter A, F, a var, or a param as seen by
+      a later step.
+   */
+
+   n = s->instrs;
+
+   if (n == 0) return;
+
+   map = calloc(1, (sizeof(int) * 3 * (n + 1)) + (2 * (n + 1)));
+
+   if (map == NULL) return;
+
+   work = map + n + 1;             /* each step pushes at most 2 */
+   del = (char *)(work + (2 * (n + 1)));
+   target = del + n + 1;
+
+   before = n;
+   dead = folded = fused = threaded = 0;
+   fuse = 0;
+
+   for (pass=0; pass<16; pass++)
+   {
+      n = s->instrs;
+      in = s->instr;
+      changed = 0;
+
+      memset(target, 0, n + 1);
+
+      for (i=0; i<n; i++)
+      {
+         t = optTarget(in[i].p[0]);
+
+         if (t) target[in[i].p[t]] = 1;
+
+         if (in[i].p[0] == PI_CMD_CALL) target[i+1] = 1;
+      }
+
+      /* thread jumps through unconditional and same-condition jumps */
+
+      for (i=0; i<n; i++)
+      {
+         cmd = in[i].p[0];
+         t = optTarget(cmd);
+
+         if (!t) continue;
+
+         tgt = in[i].p[t];
+
+         for (steps=0; (tgt < n) && (steps < n); steps++)
+         {
+            tcmd = in[tgt].p[0];
+
+            if ((tcmd == PI_CMD_JMP) ||
+                (optCond(cmd) && (optCond(cmd) == tcmd)))
+               tgt = in[tgt].p[1];
+            else break;
+         }
+
+         if (tgt != in[i].p[t])
+         {
+            in[i].p[t] = tgt;
+            threaded++;
+            changed = 1;
+         }
+      }
+
+      /* unreachable steps */
+
+      memset(del, 1, n);
+
+      w = 0;
+      work[w++] = 0;
+
+      while (w)
+      {
+         i = work[--w];
+
+         if ((i >= n) || !del[i]) continue;
+
+         del[i] = 0;
+
+         cmd = in[i].p[0];
+         t = optTarget(cmd);
+
+         if (t) work[w++] = in[i].p[t];
+
+         if ((cmd != PI_CMD_JMP) && (cmd != PI_CMD_RET) &&
+             (cmd != PI_CMD_HALT)) work[w++] = i + 1;
+      }
+
+      for (i=0; i<n; i++) if (del[i]) {dead++; changed = 1;}
+
+      /* single steps which do nothing */
+
+      for (i=0; i<n; i++)
+      {
+         if (del[i]) continue;
+
+         cmd = in[i].p[0];
+
+         if ((cmd == PI_CMD_NOP) ||
+             ((optTarget(cmd) == 1) && (cmd != PI_CMD_CALL) &&
+              (in[i].p[1] == i+1)) ||
+             ((in[i].opt[1] == CMD_NUMERIC) &&
+              optIdentity(cmd, in[i].p[1]) && optDeadF(s, i+1)))
+         {
+            del[i] = 1;
+            folded++;
+            changed = 1;
+         }
+      }
+
+      /* pairs of steps, the second of which is never jumped to */
+
+      for (i=0; i<n-1; i++)
+      {
+         if (del[i]) continue;
+
+         /* a jump to a removed step lands on the step after it */
+
+         for (j=i+1; (j<n) && del[j] && !target[j]; j++);
+
+         if ((j >= n) || del[j] || target[j]) continue;
+
+         cmd  = in[i].p[0];
+         tcmd = in[j].p[0];
+
+         r = 0;
+
+         if ((in[i].opt[1] == CMD_NUMERIC) && (in[j].opt[1] == CMD_NUMERIC))
+         {
+            if (optCombine(&in[i], &in[j])) r = 1;
+
+            else if ((cmd == PI_CMD_LDA) && optDeadF(s, j+1) &&
+                     optEval(tcmd, in[i].p[1], in[j].p[1], &t))
+            {
+               in[i].p[1] = t;
+               r = 1;
+            }
+         }
+
+         if (((cmd == PI_CMD_STA)  && (tcmd == PI_CMD_LDA) &&
+              optSame(&in[i], &in[j])) ||
+             ((cmd == PI_CMD_LDA)  && (tcmd == PI_CMD_STA) &&
+              optSame(&in[i], &in[j])) ||
+             ((cmd == PI_CMD_STA)  && (tcmd == PI_CMD_STA) &&
+              (in[i].opt[1] == in[j].opt[1]) && (in[i].p[1] == in[j].p[1])))
+            r = 1;
+
+         if ((cmd == PI_CMD_LDA) && (tcmd == PI_CMD_LDA))
+         {
+            /* the first load is overwritten */
+            in[i] = in[j];
+            r = 1;
+         }
+
+         if (!r && fuse && optFuse(&in[i], &in[j]))
+         {
+            fused++;
+            r = 1;
+         }
+         else if (r) folded++;
+
+         if (r)
+         {
+            del[j] = 1;
+            changed = 1;
+            i = j;
+         }
+      }
+
+      if (changed) optCompact(s, del, map);
+      else if (!fuse) fuse = 1;
+      else break;
+   }
+
+   if (diags && (s->instrs != before))
+   {
+      fprintf(stderr,
+         "Optimised %d steps to %d (%d unreachable, %d folded, %d fused, "
+         "%d jumps threaded)\n",
+         before, s->instrs, dead, folded, fused, threaded);
+   }
+
+   free(map);
+}
+
 int cmdParseScript(char *script, cmdScript_t *s, int diags)
 {
    int idx, len, b, i, j, tags, resolved;
@@ -1200,6 +2030,9 @@ int cmdParseScript(char *script, cmdScript_t *s, int diags)
          }
       }
    }
+
+   if (!status && cmdOptimise) optScript(s, diags);
+
    return status;
 }
 
@@ -51,6 +51,14 @@ This version is for pigpio version 23+
 #define CMD_VAR     2
 #define CMD_PAR     3
 
+/* superinstructions made by the script optimiser, never parsed */
+
+#define CMD_CMPJZ  900 /* CMP x, JZ t  */
+#define CMD_CMPJNZ 901 /* CMP x, JNZ t */
+#define CMD_CMPJM  902 /* CMP x, JM t  */
+#define CMD_CMPJP  903 /* CMP x, JP t  */
+#define CMD_DCRJNZ 904 /* DCR v, JNZ t */
+
 typedef struct
 {
    uint32_t cmd;
@@ -108,6 +116,10 @@ typedef struct
 
 extern cmdInfo_t cmdInfo[];
 
+extern int cmdInfoEntries;
+
+extern int cmdOptimise;
+
 extern char *cmdUsage;
 
 int cmdParse(char *buf, uint32_t *p, unsigned ext_len, char *ext, cmdCtlParse_t *ctl);
@@ -118,5 +130,7 @@ char *cmdErrStr(int error);
 
 char *cmdStr(void);
 
+char *cmdName(int cmd);
+
 #endif
 
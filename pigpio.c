@@ -685,16 +685,45 @@ bit 0 READ_LAST_NOT_SET_ERROR
 #define NUM_WAVE_OOL (DMAO_PAGES * OOL_PER_OPAGE)
 #define NUM_WAVE_CBS (DMAO_PAGES * CBS_PER_OPAGE)
 
+/* waves are allocated above the pages used by chain counters */
+
+#define WAVE_BOT_CB  (PI_WAVE_COUNTERS * CBS_PER_OPAGE)
+#define WAVE_BOT_OOL (PI_WAVE_COUNTERS * OOL_PER_OPAGE)
+
+#define WAVE_FREE  0
+#define WAVE_LIVE  1
+#define WAVE_DYING 2 /* deleted while still being transmitted */
+
+/* repeated pulse runs are compiled to a DMA counter loop */
+
+#define WAVE_LOOP_BLKLEN      8
+#define WAVE_LOOP_MAX_BLOCKS  8
+#define WAVE_LOOP_MAX_PERIOD 64
+#define WAVE_LOOP_MIN_SAVED  16 /* cbs */
+
+/* a wave stream segment holds up to PI_WAVE_STREAM_SEG_PULSES pulses */
+
+#define STREAM_SEG_CBS  ((3 * PI_WAVE_STREAM_SEG_PULSES) + 2)
+#define STREAM_SEG_OOL  ((2 * PI_WAVE_STREAM_SEG_PULSES) + 2)
+
+#define STREAM_CBS (PI_WAVE_STREAM_SEGS * STREAM_SEG_CBS)
+#define STREAM_OOL (PI_WAVE_STREAM_SEGS * STREAM_SEG_OOL)
+
+#define STREAM_IDLE_MICROS 10
+
 #define TICKSLOTS 50
 
-#define PI_I2C_CLOSED 0
-#define PI_I2C_OPENED 1
+#define PI_I2C_CLOSED   0
+#define PI_I2C_OPENED   1
+#define PI_I2C_RESERVED 2
 
-#define PI_SPI_CLOSED 0
-#define PI_SPI_OPENED 1
+#define PI_SPI_CLOSED   0
+#define PI_SPI_OPENED   1
+#define PI_SPI_RESERVED 2
 
-#define PI_SER_CLOSED 0
-#define PI_SER_OPENED 1
+#define PI_SER_CLOSED   0
+#define PI_SER_OPENED   1
+#define PI_SER_RESERVED 2
 
 #define PI_NOTIFY_CLOSED  0
 #define PI_NOTIFY_CLOSING 1
@@ -702,6 +731,22 @@ bit 0 READ_LAST_NOT_SET_ERROR
 #define PI_NOTIFY_RUNNING 3
 #define PI_NOTIFY_PAUSED  4
 
+#define PI_FIFO_CLOSED   0
+#define PI_FIFO_OPENED   1
+#define PI_FIFO_RESERVED 2
+#define PI_FIFO_CLOSING  3
+
+/*
+   The longest fifo reply is an extension of bytes, each formatted as
+   up to 5 characters (" -128"), plus the result.  The stats and profile
+   replies format to less than 5 characters per byte and the help text
+   is much shorter.
+*/
+
+#define FIFO_REPLY_MAX ((CMD_MAX_EXTENSION * 5) + 32)
+
+#define FIFO_OUT_SIZE (FIFO_REPLY_MAX * 2)
+
 #define PI_WFRX_NONE    0
 #define PI_WFRX_SERIAL  1
 #define PI_WFRX_I2C     2
@@ -715,6 +760,8 @@ bit 0 READ_LAST_NOT_SET_ERROR
 
 #define MAX_EMITS (PIPE_BUF / sizeof(gpioReport_t))
 
+#define NTFY_EVENTS 64 /* queued script events per handle, power of 2 */
+
 #define SRX_BUF_SIZE 8192
 
 #define PI_I2C_RETRIES 0x0701
@@ -784,6 +831,40 @@ bit 0 READ_LAST_NOT_SET_ERROR
 
 #define PI_SCRIPT_STACK_SIZE 256
 
+#define SCR_THREADS      4
+#define SCR_MAX_THREADS  PI_MAX_SCRIPTS /* the pool grows to this */
+#define SCR_SLICE     1000 /* taken jumps before a script yields */
+#define SCR_SPIN_MICROS 100 /* shorter MICS delays don't yield */
+
+#define SCR_IDLE   0 /* halted */
+#define SCR_READY  1 /* on the run queue */
+#define SCR_ACTIVE 2 /* running on a worker */
+#define SCR_SLEEP  3 /* in MILS/MICS */
+#define SCR_WAIT   4 /* in WAIT */
+
+/* script op kinds, script pseudo commands map to cmd-PI_CMD_SCRIPT */
+
+#define SCR_OP_CMD  (PI_CMD_WLEV - PI_CMD_SCRIPT + 1)
+#define SCR_OP_W    (SCR_OP_CMD + 1)
+#define SCR_OP_R    (SCR_OP_CMD + 2)
+#define SCR_OP_BR1  (SCR_OP_CMD + 3)
+#define SCR_OP_BR2  (SCR_OP_CMD + 4)
+#define SCR_OP_TICK (SCR_OP_CMD + 5)
+#define SCR_OP_MICS (SCR_OP_CMD + 6)
+#define SCR_OP_MILS (SCR_OP_CMD + 7)
+#define SCR_OP_CMPJZ  (SCR_OP_CMD + 8)
+#define SCR_OP_CMPJNZ (SCR_OP_CMD + 9)
+#define SCR_OP_CMPJM  (SCR_OP_CMD + 10)
+#define SCR_OP_CMPJP  (SCR_OP_CMD + 11)
+#define SCR_OP_DCRJNZ (SCR_OP_CMD + 12)
+#define SCR_OP_END  (SCR_OP_CMD + 13)
+#define SCR_OPS     (SCR_OP_CMD + 14)
+
+#define SCRIPT_CACHE_MAGIC   0x53474950 /* "PIGS" */
+#define SCRIPT_CACHE_VERSION 2
+#define SCRIPT_CACHE_ENTRIES 128
+#define SCRIPT_CACHE_MAX_TEXT (1<<20)
+
 #define PI_SPI_FLAGS_CHANNEL(x)    ((x&7)<<29)
 
 #define PI_SPI_FLAGS_GET_CHANNEL(x) (((x)>>29)&7)
@@ -801,6 +882,18 @@ bit 0 READ_LAST_NOT_SET_ERROR
 #define PI_RUNNING  1
 #define PI_ENDING   2
 
+#define CMD_STATS_SLOTS 128
+
+#define CMD_LOCK_NONE   0
+#define CMD_LOCK_GPIO   1
+#define CMD_LOCK_WAVE   2
+#define CMD_LOCK_BB     3
+#define CMD_LOCK_I2C    4
+#define CMD_LOCK_SPI    5
+#define CMD_LOCK_SER    6
+#define CMD_LOCK_NOTIFY 7
+#define CMD_LOCKS       8
+
 /* typedef ------------------------------------------------------- */
 
 typedef void (*callbk_t) ();
@@ -873,7 +966,20 @@ typedef struct
    pthread_t       pthId;
 } gpioTimer_t;
 
-typedef struct
+typedef struct scrOp_s
+{
+   void       *code;  /* label dispatched to, run or the profiler */
+   void       *run;   /* label of the op in scrRun */
+   int        *a1;    /* operand 1, points to a var, a param, or i1 */
+   int        *a2;    /* operand 2, points to a var, a param, or i2 */
+   int         i1;
+   int         i2;
+   struct scrOp_s *jmp; /* resolved jump/call target */
+   cmdInstr_t *instr;
+   int         kind;
+} scrOp_t;
+
+typedef struct gpioScript_s
 {
    unsigned id;
    unsigned state;
@@ -881,12 +987,53 @@ typedef struct
    unsigned run_state;
    uint32_t waitBits;
    uint32_t changedBits;
-   pthread_t *pthIdp;
-   pthread_mutex_t pthMutex;
-   pthread_cond_t pthCond;
+   uint32_t waitTick;  /* tick and levels of the edge ending a WAIT */
+   uint32_t waitLevel;
    cmdScript_t script;
+   scrOp_t *op;
+   uint32_t trigBit;  /* gpio whose edge starts the script, 0 for none */
+   unsigned trigEdge;
+   /* scheduler state, protected by scrMutex unless SCR_ACTIVE */
+   int sched;
+   uint64_t wake;
+   struct gpioScript_s *next;
+   /* interpreter state saved while not on a worker */
+   scrOp_t *pc;
+   int A, F, SP;
+   int *stack;
+   char *buf;
+   /* profiling, prof is allocated on first use and kept until delete */
+   gpioScriptProf_t *prof;
+   volatile int profOn;
+   int profThreaded; /* ops dispatch through the profiler */
+   int blockStep;    /* step blocked in WAIT/MILS/MICS, or -1 */
+   uint32_t blockTick;
 } gpioScript_t;
 
+typedef struct
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t instrSize;
+   uint32_t cmds;
+} scriptCacheHdr_t;
+
+typedef struct
+{
+   uint64_t hash;
+   uint32_t textLen;
+   uint32_t instrs;
+   uint32_t strLen;
+} scriptCacheRec_t;
+
+typedef struct
+{
+   scriptCacheRec_t rec;
+   char *text;
+   cmdInstr_t *instr; /* p[4] of instructions with a string is an offset */
+   char *str;
+} scriptCache_t;
+
 
 typedef struct
 {
@@ -902,8 +1049,20 @@ typedef struct
    uint32_t lastReportTick;
    int      fd;
    int      pipe;
+   volatile uint32_t evtHead; /* written by scripts under eventMutex */
+   volatile uint32_t evtTail; /* written by the alert thread */
 } gpioNotify_t;
 
+typedef struct
+{
+   uint16_t  state;
+   uint16_t  binary;
+   FILE     *inp;
+   int       out;
+   pthread_t pthId;
+   volatile int closers; /* gpioFifoClose calls using inp */
+} fifoChannel_t;
+
 typedef struct
 {
    uint16_t state;
@@ -927,6 +1086,62 @@ typedef struct
    uint32_t flags;
 } spiInfo_t;
 
+typedef struct
+{
+   int      ool;       /* of the SET word, CLR follows, from botOOL */
+   uint32_t gpioOn;    /* levels of the gpios which aren't patched */
+   uint32_t gpioOff;
+} waveSlot_t;
+
+typedef struct
+{
+   uint64_t hash;
+   uint32_t refs;      /* shared creates of this content less deletes */
+   int      shared;    /* created by gpioWaveCreateShared */
+   int      numPulses;
+   int      maxPulses; /* size of pulses */
+   rawWave_t *pulses;
+   uint64_t micros;    /* the delays as wave2Cbs rounded them */
+   uint32_t patchBits; /* non-zero for a patchable wave */
+   int      numSlots;
+   int      maxSlots;  /* size of slot */
+   waveSlot_t *slot;
+} waveKey_t;
+
+typedef struct
+{
+   int      active;
+   int      botCB;
+   int      botOOL;
+   int      tail;   /* oldest queued segment, the DMA is in it or later */
+   int      last;   /* newest queued segment */
+   int      queued; /* segments queued */
+   int      idle;   /* the DMA has sent every queued pulse */
+   int      lastCB[PI_WAVE_STREAM_SEGS]; /* last pulse cb, -1 if none */
+   int      pulses[PI_WAVE_STREAM_SEGS];
+   uint32_t sent;
+   uint32_t underruns;
+} waveStream_t;
+
+typedef struct
+{
+   int      active;
+   int      botCB;
+   int      numCB;
+   int      botOOL;
+   int      numOOL;
+} waveChain_t;
+
+typedef struct
+{
+   uint32_t count;  /* 0 for a loop forever */
+   uint64_t micros; /* chain duration before the loop starts */
+   int      bodyCB; /* first cb of the loop body */
+   int      blocks;
+   int      ring[WAVE_LOOP_MAX_BLOCKS];
+   int      saved[WAVE_LOOP_MAX_BLOCKS];
+} waveChainLoop_t;
+
 typedef struct
 {
    uint32_t startTick;
@@ -940,6 +1155,8 @@ typedef struct
    uint32_t numSamples;
    uint32_t DMARestarts;
    uint32_t dmaInitCbsCount;
+   uint32_t waveCompactions;
+   uint32_t waveCacheHits;
 } gpioStats_t;
 
 typedef struct
@@ -1063,6 +1280,11 @@ static int waveClockInited = 0;
 
 static volatile gpioStats_t gpioStats;
 
+static gpioCmdStats_t cmdStats[CMD_STATS_SLOTS];
+
+static pthread_rwlock_t cmdLock[CMD_LOCKS] =
+   {[0 ... CMD_LOCKS-1] = PTHREAD_RWLOCK_INITIALIZER};
+
 static int gpioMaskSet = 0;
 
 /* initialise if not libInitialised */
@@ -1086,16 +1308,21 @@ static rawWaveInfo_t waveInfo[PI_MAX_WAVES];
 
 static wfRx_t wfRx[PI_MAX_USER_GPIO+1];
 
-static int waveOutBotCB  = PI_WAVE_COUNTERS*CBS_PER_OPAGE;
-static int waveOutTopCB  = NUM_WAVE_CBS;
-static int waveOutBotOOL = PI_WAVE_COUNTERS*OOL_PER_OPAGE;
-static int waveOutTopOOL = NUM_WAVE_OOL;
-static int waveOutCount = 0;
+static uint8_t waveState[PI_MAX_WAVES]; /* WAVE_FREE, LIVE, or DYING */
+static uint8_t waveTx[PI_MAX_WAVES];    /* in the last send or chain */
+static uint8_t waveFixed[PI_MAX_WAVES]; /* holds loops, can't be moved */
+static waveKey_t waveKey[PI_MAX_WAVES];  /* content of each live wave */
+
+static waveStream_t waveStream;
+
+static waveChain_t waveChain; /* memory of the last gpioWaveChainEx */
 
 static volatile uint32_t alertBits   = 0;
 static volatile uint32_t monitorBits = 0;
 static volatile uint32_t notifyBits  = 0;
 static volatile uint32_t scriptBits  = 0;
+static volatile uint32_t scriptWaitBits = 0;
+static volatile uint32_t scriptTrigBits = 0;
 
 static volatile int runState = PI_STARTING;
 
@@ -1111,12 +1338,31 @@ static gpioInfo_t       gpioInfo   [PI_MAX_GPIO+1];
 
 static gpioNotify_t     gpioNotify [PI_NOTIFY_SLOTS];
 
+static fifoChannel_t    fifoChannel[PI_FIFO_SLOTS];
+
 static i2cInfo_t        i2cInfo    [PI_I2C_SLOTS];
 static serInfo_t        serInfo    [PI_SER_SLOTS];
 static spiInfo_t        spiInfo    [PI_SPI_SLOTS];
 
 static gpioScript_t     gpioScript [PI_MAX_SCRIPTS];
 
+static pthread_mutex_t  scrMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  eventMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   scrCond;
+static gpioScript_t    *scrRunHead   = NULL;
+static gpioScript_t    *scrRunTail   = NULL;
+static gpioScript_t    *scrSleepHead = NULL;
+static pthread_t        scrThread[SCR_MAX_THREADS];
+static int              scrThreads = 0;
+static int              scrPoolMax = 0;
+static int              scrBlocked = 0;
+
+static scriptCache_t    scriptCache[SCRIPT_CACHE_ENTRIES];
+static int              scriptCacheCount = 0;
+static int              scriptCacheLoaded = 0;
+static char             scriptCachePath[256] = "";
+static pthread_mutex_t  scriptCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static gpioSignal_t     gpioSignal [PI_MAX_SIGNUM+1];
 
 static gpioTimer_t      gpioTimer  [PI_MAX_TIMER+1];
@@ -1188,7 +1434,8 @@ static pthread_t pthFifo;
 static pthread_t pthSocket;
 
 static gpioSample_t gpioSample[DATUMS];
-static gpioReport_t gpioReport[DATUMS];
+static gpioReport_t gpioReport[DATUMS+PI_MAX_USER_GPIO+1+NTFY_EVENTS];
+static gpioReport_t gpioEvent[PI_NOTIFY_SLOTS][NTFY_EVENTS];
 
 static uint32_t spi_dummy;
 
@@ -1312,6 +1559,17 @@ static void initHWClk
 
 static void initDMAgo(volatile uint32_t  *dmaAddr, uint32_t cbAddr);
 
+static void myScriptCacheLoad(void);
+
+static int  scrRun(gpioScript_t *s);
+
+static int  scrWake(uint32_t changes, uint32_t tick, uint32_t level);
+
+static void scrTrigger(uint32_t level, int numSamples);
+
+static int  waveLoadImage
+   (char *buf, unsigned bufSize, uint32_t mask, unsigned *wave_ids);
+
 /* ======================================================================= */
 
 static char * myTimeStamp()
@@ -1567,16 +1825,216 @@ static void spinWhileStarting(void)
 
 /* ----------------------------------------------------------------------- */
 
+static void myCmdStats(unsigned cmd, uint32_t micros, int res)
+{
+   gpioCmdStats_t *cs;
+   uint32_t max;
+   int b;
+
+   if (cmd >= CMD_STATS_SLOTS) return;
+
+   cs = &cmdStats[cmd];
+
+   /* commands run concurrently from socket, pipe, and script threads */
+
+   __sync_fetch_and_add(&cs->calls, 1);
+
+   if (res < 0) __sync_fetch_and_add(&cs->errors, 1);
+
+   __sync_fetch_and_add(&cs->totalMicros, micros);
+
+   /* another thread may raise the maximum between the test and set */
+
+   do
+   {
+      max = cs->maxMicros;
+      if (micros <= max) break;
+   }
+   while (!__sync_bool_compare_and_swap(&cs->maxMicros, max, micros));
+
+   if (micros) b = 32 - __builtin_clz(micros); else b = 0;
+
+   if (b >= PI_CMD_STATS_BUCKETS) b = PI_CMD_STATS_BUCKETS - 1;
+
+   __sync_fetch_and_add(&cs->execHist[b], 1);
+}
+
+/* ----------------------------------------------------------------------- */
+
+/*
+   Commands arrive concurrently from the socket threads, the pipe thread
+   and the script workers.  Each command which touches shared state is
+   serialised against the other commands of its own subsystem only, so
+   (for example) an I2C poller and a PWM controller never wait on each
+   other.
+
+   Commands which open or close a handle, or which rebuild subsystem
+   state, take their lock exclusively.  Transfers on an already open
+   I2C/serial handle take it shared as the kernel serialises the
+   underlying file operations.  SPI transfers drive the controller
+   registers directly and so are exclusive.  Register level reads and
+   writes (BR1, BS1, READ, TRIG, ...) are atomic at the hardware and take
+   no lock.  WRITE may end PWM or servo pulses on the gpio
+   (switchFunctionOff) and so takes the gpio lock exclusively, as do the
+   other mode changing commands.
+
+   Script commands take no lock.  Scripts are protected by scrMutex and
+   a script delete waits until no worker of the pool (pthScriptWorker)
+   is running the script, which may itself be executing a command.
+*/
+
+static int myCmdLockClass(unsigned cmd, int *exclusive)
+{
+   *exclusive = 1;
+
+   switch (cmd)
+   {
+      case PI_CMD_MODEG:
+      case PI_CMD_PRG:
+      case PI_CMD_PFG:
+      case PI_CMD_PRRG:
+      case PI_CMD_GDC:
+      case PI_CMD_GPW:
+         *exclusive = 0;
+         return CMD_LOCK_GPIO;
+
+      case PI_CMD_MODES:
+      case PI_CMD_PUD:
+      case PI_CMD_PWM:
+      case PI_CMD_PRS:
+      case PI_CMD_PFS:
+      case PI_CMD_SERVO:
+      case PI_CMD_HC:
+      case PI_CMD_HP:
+      case PI_CMD_WRITE:
+         return CMD_LOCK_GPIO;
+
+      case PI_CMD_WVBSY:
+      case PI_CMD_WVSM:
+      case PI_CMD_WVSP:
+      case PI_CMD_WVSC:
+         *exclusive = 0;
+         return CMD_LOCK_WAVE;
+
+      case PI_CMD_WVCLR:
+      case PI_CMD_WVNEW:
+      case PI_CMD_WVAG:
+      case PI_CMD_WVAGM:
+      case PI_CMD_WVAS:
+      case PI_CMD_WVCRE:
+      case PI_CMD_WVCRS:
+      case PI_CMD_WVCRP:
+      case PI_CMD_WVDEL:
+      case PI_CMD_WVGO:
+      case PI_CMD_WVGOR:
+      case PI_CMD_WVTX:
+      case PI_CMD_WVTXR:
+      case PI_CMD_WVCHA:
+      case PI_CMD_WVCHX:
+      case PI_CMD_WVLDI:
+      case PI_CMD_WVHLT:
+      case PI_CMD_WVSTR:
+      case PI_CMD_WVSTW:
+      case PI_CMD_WVSTI:
+      case PI_CMD_WVSTH:
+      case PI_CMD_WVPAT:
+      case PI_CMD_WVAST:
+      case PI_CMD_WVSTS:
+      case PI_CMD_WVASM:
+         return CMD_LOCK_WAVE;
+
+      case PI_CMD_SLRO:
+      case PI_CMD_SLR:
+      case PI_CMD_SLRC:
+      case PI_CMD_BI2CO:
+      case PI_CMD_BI2CC:
+      case PI_CMD_BI2CZ:
+         return CMD_LOCK_BB;
+
+      case PI_CMD_I2CO:
+      case PI_CMD_I2CC:
+         return CMD_LOCK_I2C;
+
+      case PI_CMD_I2CRD:
+      case PI_CMD_I2CWD:
+      case PI_CMD_I2CWQ:
+      case PI_CMD_I2CRS:
+      case PI_CMD_I2CWS:
+      case PI_CMD_I2CRB:
+      case PI_CMD_I2CWB:
+      case PI_CMD_I2CRW:
+      case PI_CMD_I2CWW:
+      case PI_CMD_I2CRK:
+      case PI_CMD_I2CWK:
+      case PI_CMD_I2CRI:
+      case PI_CMD_I2CWI:
+      case PI_CMD_I2CPC:
+      case PI_CMD_I2CPK:
+      case PI_CMD_I2CZ:
+         *exclusive = 0;
+         return CMD_LOCK_I2C;
+
+      case PI_CMD_SPIO:
+      case PI_CMD_SPIC:
+      case PI_CMD_SPIR:
+      case PI_CMD_SPIW:
+      case PI_CMD_SPIX:
+         return CMD_LOCK_SPI;
+
+      case PI_CMD_SERO:
+      case PI_CMD_SERC:
+         return CMD_LOCK_SER;
+
+      case PI_CMD_SERRB:
+      case PI_CMD_SERWB:
+      case PI_CMD_SERR:
+      case PI_CMD_SERW:
+      case PI_CMD_SERDA:
+         *exclusive = 0;
+         return CMD_LOCK_SER;
+
+      case PI_CMD_NO:
+      case PI_CMD_NB:
+      case PI_CMD_NP:
+      case PI_CMD_NC:
+         return CMD_LOCK_NOTIFY;
+   }
+
+   *exclusive = 0;
+   return CMD_LOCK_NONE;
+}
+
+/* ----------------------------------------------------------------------- */
+
 static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
 {
    int res, i, j;
    uint32_t mask;
    uint32_t tmp1, tmp2, tmp3;
    gpioPulse_t *pulse;
+   gpioStepAxis_t *axis;
+   gpioSerial_t serial[PI_WAVE_MAX_TRAINS];
+   gpioChainInfo_t chainInfo;
+   unsigned waveIds[PI_MAX_WAVES];
    int masked;
+   unsigned cmd;
+   uint32_t startTick;
+   int lock, exclusive;
 
    res = 0;
 
+   cmd = p[0];
+
+   lock = myCmdLockClass(cmd, &exclusive);
+
+   if (lock != CMD_LOCK_NONE)
+   {
+      if (exclusive) pthread_rwlock_wrlock(&cmdLock[lock]);
+      else           pthread_rwlock_rdlock(&cmdLock[lock]);
+   }
+
+   startTick = systReg[SYST_CLO];
+
    switch (p[0])
    {
       case PI_CMD_BC1:
@@ -1668,6 +2126,15 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          if (res > p[2]) res = p[2];
          break;
 
+      case PI_CMD_CSTAT:
+         /* return the number of bytes of statistics */
+         res = gpioCmdStats(
+            (gpioCmdStats_t *)buf, bufSize/sizeof(gpioCmdStats_t));
+         if (res > 0) res *= sizeof(gpioCmdStats_t);
+         break;
+
+      case PI_CMD_CSTATZ: res = gpioCmdStatsReset(); break;
+
       case PI_CMD_GDC: res = gpioGetPWMdutycycle(p[1]); break;
 
       case PI_CMD_GPW: res = gpioGetServoPulsewidth(p[1]); break;
@@ -1802,6 +2269,10 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
 
       case PI_CMD_NB: res = gpioNotifyBegin(p[1], p[2]); break;
 
+      case PI_CMD_FC: res = gpioFifoClose(p[1]); break;
+
+      case PI_CMD_FO: res = gpioFifoOpen(p[1]); break;
+
       case PI_CMD_NC: res = gpioNotifyClose(p[1]); break;
 
       case PI_CMD_NO: res = gpioNotifyOpen();  break;
@@ -1838,6 +2309,20 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          res = gpioRunScript(p[1], p[3]/4, (uint32_t *)buf);
          break;
 
+      case PI_CMD_PROCE:
+         memcpy(&p[4], buf, 4);
+         res = gpioScriptTrigger(p[1], p[2], p[4]);
+         break;
+
+      case PI_CMD_PROCF: res = gpioScriptProfile(p[1], p[2]); break;
+
+      case PI_CMD_PROCFG:
+         /* return the number of bytes of profile */
+         res = gpioScriptGetProfile(p[1],
+            (gpioScriptProf_t *)buf, bufSize/sizeof(gpioScriptProf_t));
+         if (res > 0) res *= sizeof(gpioScriptProf_t);
+         break;
+
       case PI_CMD_PROCS: res = gpioStopScript(p[1]); break;
 
       case PI_CMD_PRRG: res = gpioGetPWMrealRange(p[1]); break;
@@ -2003,6 +2488,49 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
 
          break;
 
+      case PI_CMD_WVAGM:
+
+         /* the train pulse counts precede the pulses */
+
+         if ((p[1] < 1) || (p[1] > PI_WAVE_MAX_TRAINS) || (p[3] < (p[1]*4)))
+         {
+            res = PI_BAD_TRAIN_CNT;
+            break;
+         }
+
+         mask = gpioMask;
+         pulse = (gpioPulse_t *)(buf + (p[1]*4));
+         j = (p[3] - (p[1]*4)) / sizeof(gpioPulse_t);
+         masked = 0;
+
+         for (i=0, tmp1=0; i<p[1]; i++)
+         {
+            memcpy(&tmp2, buf + (i*4), 4);
+            tmp1 += tmp2;
+         }
+
+         if (tmp1 != j)
+         {
+            res = PI_BAD_TRAIN_CNT;
+            break;
+         }
+
+         for (i=0; i<j; i++)
+         {
+            if ((pulse[i].gpioOn & mask) != pulse[i].gpioOn) masked = 1;
+            if ((pulse[i].gpioOff & mask) != pulse[i].gpioOff) masked = 1;
+
+            pulse[i].gpioOn  &= mask;
+            pulse[i].gpioOff &= mask;
+         }
+
+         res = gpioWaveAddMulti(p[1], (unsigned *)buf, pulse);
+
+         /* report permission error unless another error occurred */
+         if (masked && (res >= 0)) res = PI_SOME_PERMITTED;
+
+         break;
+
       case PI_CMD_WVAS:
          if (myPermit(p[1]))
          {
@@ -2021,6 +2549,74 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          }
          break;
 
+      case PI_CMD_WVASM:
+
+         /* six words then the data of each channel */
+
+         j = 0;
+         tmp1 = 0;
+         res = 0;
+
+         for (i=0; (i<p[1]) && (i<PI_WAVE_MAX_TRAINS); i++)
+         {
+            if ((tmp1 + 24) > p[3]) break;
+
+            memcpy(&serial[i], buf+tmp1, 24);
+            serial[i].bstr = buf + tmp1 + 24;
+
+            tmp1 += 24 + serial[i].numBytes;
+
+            if (tmp1 > p[3]) break;
+
+            if (!myPermit(serial[i].gpio))
+            {
+               DBG(DBG_USER,
+                  "gpioWaveAddSerialMulti: gpio %d, no permission to update",
+                  serial[i].gpio);
+               res = PI_NOT_PERMITTED;
+            }
+
+            j++;
+         }
+
+         if (!res)
+         {
+            if (j == p[1]) res = gpioWaveAddSerialMulti(j, serial);
+            else           res = PI_BAD_TRAIN_CNT;
+         }
+
+         break;
+
+      case PI_CMD_WVAST:
+      case PI_CMD_WVSTS:
+
+         /* a step profile then a triplet per axis */
+
+         j = 0;
+
+         if (p[3] >= sizeof(gpioStepProfile_t))
+            j = (p[3] - sizeof(gpioStepProfile_t)) / sizeof(gpioStepAxis_t);
+
+         axis = (gpioStepAxis_t *)(buf + sizeof(gpioStepProfile_t));
+
+         for (i=0; i<j; i++)
+         {
+            if (!myPermit(axis[i].stepGpio) || !myPermit(axis[i].dirGpio))
+               break;
+         }
+
+         if (i < j)
+         {
+            DBG(DBG_USER, "steps: axis %d, no permission to update", i);
+            res = PI_NOT_PERMITTED;
+         }
+         else if (cmd == PI_CMD_WVAST)
+            res = gpioWaveAddSteps(j, axis, (gpioStepProfile_t *)buf);
+         else
+            res = gpioWaveStreamSteps(j, axis, (gpioStepProfile_t *)buf);
+
+         break;
+
       case PI_CMD_WVBSY: res = gpioWaveTxBusy(); break;
 
       case PI_CMD_WVCHA:
@@ -2028,11 +2624,38 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          res = gpioWaveChain(buf, p[3]);
          break;
 
+      case PI_CMD_WVLDI:
+         /* mask off any non permitted gpios, return the ids as bytes
+            in place of the image
+         */
+         if (p[3] > bufSize) p[3] = bufSize;
+         res = waveLoadImage(buf, p[3], gpioMask, waveIds);
+         for (i=0; i<res; i++) buf[i] = waveIds[i];
+         break;
+
+      case PI_CMD_WVCHX:
+         /* return the chain's info in place of the chain */
+         if (p[3] > bufSize) p[3] = bufSize;
+         res = gpioWaveChainEx(buf, p[3], p[1], &chainInfo);
+         if (res >= 0)
+         {
+            memcpy(buf, &chainInfo, sizeof(gpioChainInfo_t));
+            res = sizeof(gpioChainInfo_t);
+         }
+         break;
+
 
       case PI_CMD_WVCLR: res = gpioWaveClear(); break;
 
       case PI_CMD_WVCRE: res = gpioWaveCreate(); break;
 
+      case PI_CMD_WVCRS: res = gpioWaveCreateShared(); break;
+
+      case PI_CMD_WVCRP:
+         /* a patch mustn't be able to drive non permitted gpios */
+         res = gpioWaveCreatePatchable(p[1] & gpioMask);
+         break;
+
       case PI_CMD_WVDEL: res = gpioWaveDelete(p[1]); break;
 
       case PI_CMD_WVGO:  res = gpioWaveTxStart(PI_WAVE_MODE_ONE_SHOT); break;
@@ -2049,6 +2672,8 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
             case 0: res = gpioWaveGetCbs();     break;
             case 1: res = gpioWaveGetHighCbs(); break;
             case 2: res = gpioWaveGetMaxCbs();  break;
+            case 3: res = gpioWaveGetFreeCbs(); break;
+            case 4: res = gpioWaveGetLargestFreeCbs(); break;
             default: res = PI_BAD_WVSC_COMMND;
          }
          break;
@@ -2073,6 +2698,36 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          }
          break;
 
+      case PI_CMD_WVPAT:
+         res = gpioWavePatch(p[1], p[2], p[3]/4, (uint32_t *)buf);
+         break;
+
+      case PI_CMD_WVSTH: res = gpioWaveStreamStop(); break;
+
+      case PI_CMD_WVSTI: res = gpioWaveStreamInfo(p[1]); break;
+
+      case PI_CMD_WVSTR: res = gpioWaveStreamStart(); break;
+
+      case PI_CMD_WVSTW:
+
+         /* need to mask off any non permitted gpios */
+
+         mask = gpioMask;
+         pulse = (gpioPulse_t *)buf;
+         j = p[3]/sizeof(gpioPulse_t);
+
+         for (i=0; i<j; i++)
+         {
+            pulse[i].gpioOn  &= mask;
+            pulse[i].gpioOff &= mask;
+         }
+
+         /* the count queued matters more than reporting the mask */
+
+         res = gpioWaveStreamWrite(j, pulse);
+
+         break;
+
       case PI_CMD_WVTX:
          res = gpioWaveTxSend(p[1], PI_WAVE_MODE_ONE_SHOT); break;
 
@@ -2084,6 +2739,10 @@ static int myDoCommand(uint32_t *p, unsigned bufSize, char *buf)
          break;
    }
 
+   myCmdStats(cmd, systReg[SYST_CLO] - startTick, res);
+
+   if (lock != CMD_LOCK_NONE) pthread_rwlock_unlock(&cmdLock[lock]);
+
    return res;
 }
 
@@ -2501,20 +3160,248 @@ static void waveBitDelay
 
 /* ----------------------------------------------------------------------- */
 
-static int errCBsOOL(int cb, int botOOL, int topOOL)
-{
-   if (cb >= waveOutTopCB) return PI_TOO_MANY_CBS;
-
-   if (botOOL >= topOOL) return PI_TOO_MANY_OOL;
-
-   return 0;
+static void waveCounter(
+   int botCB,
+   int *ring,
+   unsigned blklen,
+   unsigned blocks,
+   unsigned count,
+   uint32_t repeat,
+   uint32_t next)
+{
+   rawCbs_t *p=NULL;
+
+   int b, baseCB, dig;
+   uint32_t nxt;
+
+   /*
+      Each block is a ring of blklen OOL plus a scratch OOL, ring[b]
+      is the position of the first and the blklen+1 must be in the
+      same page.  The block's 3 cbs pop the bottom of the ring into
+      the next of the last cb and rotate the ring.  The cbs start at
+      botCB.
+   */
+
+   baseCB = botCB;
+
+   /* set up all the OOLs */
+   for (b=0; b<blocks; b++)
+   {
+      for (dig=0; dig<=blklen; dig++) waveSetOOL(ring[b]+dig, repeat);
+   }
+
+   for (b=0; b<blocks; b++)
+      waveSetOOL(ring[b]+blklen, waveCbPOadr(baseCB+((b*3)+3)));
+
+   for (b=0; b<blocks; b++)
+   {
+      /* copy BOTTOM to NEXT */
+
+      p = rawWaveCBAdr(botCB++);
+
+      p->info = NORMAL_DMA;
+
+      p->src = waveOOLPOadr(ring[b]);
+      p->dst = (waveCbPOadr(botCB+1) + 20);
+
+      p->length = 4;
+      p->next   = waveCbPOadr(botCB);
+
+      /* copy BOTTOM to TOP */
+
+      p = rawWaveCBAdr(botCB++);
+
+      p->info   = NORMAL_DMA;
+
+      p->src = waveOOLPOadr(ring[b]);
+      p->dst = waveOOLPOadr(ring[b]+blklen);
+
+      p->length = 4;
+      p->next   = waveCbPOadr(botCB);
+
+      /* shift all down one */
+
+      p = rawWaveCBAdr(botCB++);
+
+      p->info   = NORMAL_DMA|DMA_SRC_INC|DMA_DEST_INC;
+
+      p->src = waveOOLPOadr(ring[b]+1);
+      p->dst = waveOOLPOadr(ring[b]);
+
+      p->length = blklen*4;
+      p->next   = repeat;
+   }
+
+   b = 0;
+
+   while (count && (b<blocks))
+   {
+      dig = count % blklen;
+      count /= blklen;
+
+      if (count) nxt = rawWaveGetOut(ring[b]+blklen);
+      else       nxt = next;
+
+      waveSetOOL(ring[b]+dig, nxt);
+
+      b++;
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int errCBsOOL(int cb, int topCB, int botOOL, int topOOL)
+{
+   /* cb and botOOL are one past the last used, topOOL the last used */
+
+   if (cb > topCB) return PI_TOO_MANY_CBS;
+
+   if (botOOL > topOOL) return PI_TOO_MANY_OOL;
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int wavePulseCbs(rawWave_t *w)
+{
+   return (w->gpioOn != 0) + (w->gpioOff != 0) + (w->usDelay != 0) +
+          ((w->flags & WAVE_FLAG_READ) != 0) +
+          ((w->flags & WAVE_FLAG_TICK) != 0);
+}
+
+static int wavePulseOOL(rawWave_t *w)
+{
+   return (w->gpioOn != 0) + (w->gpioOff != 0) +
+          ((w->flags & WAVE_FLAG_READ) != 0) +
+          ((w->flags & WAVE_FLAG_TICK) != 0);
+}
+
+static int waveSlotFill(rawWave_t *w, uint32_t patchBits)
+{
+   /*
+      A pulse which touches a patched gpio is a slot.  It always
+      has a SET and a CLR word so either may be patched later.
+   */
+
+   if (!((w->gpioOn | w->gpioOff) & patchBits)) return 0;
+
+   return (w->gpioOn == 0) + (w->gpioOff == 0);
+}
+
+static int waveLoopBlocks(unsigned count)
+{
+   int blocks;
+
+   /* counter blocks needed to count to count */
+
+   blocks = 0;
+
+   do
+   {
+      blocks++;
+      count /= WAVE_LOOP_BLKLEN;
+   }
+   while (count);
+
+   return blocks;
+}
+
+static int waveLoopOOL(int blocks)
+{
+   /*
+      A ring and scratch and a saved copy of the ring per block, each
+      may have to skip to the next page to stay in one piece.
+   */
+
+   return blocks * (4 * WAVE_LOOP_BLKLEN);
+}
+
+static int waveLoopFind(
+   rawWave_t *waves, int numWaves, int pos, int *period, int *reps)
+{
+   int per, r, i, cbs, ool, blocks, saved, best;
+
+   /*
+      Looks for the period at pos which repeats to save the most cbs
+      as a counter loop.  Pulses which read the gpios or the clock
+      are never looped as each pass would overwrite the last.
+   */
+
+   best = WAVE_LOOP_MIN_SAVED - 1;
+
+   for (per=1; (per<=WAVE_LOOP_MAX_PERIOD) && ((pos+per+per)<=numWaves); per++)
+   {
+      if (waves[pos+per-1].flags) break;
+
+      r = 1;
+
+      while ((pos+((r+1)*per)) <= numWaves)
+      {
+         for (i=0; i<per; i++)
+         {
+            if ((waves[pos+i].gpioOn  != waves[pos+(r*per)+i].gpioOn)  ||
+                (waves[pos+i].gpioOff != waves[pos+(r*per)+i].gpioOff) ||
+                (waves[pos+i].usDelay != waves[pos+(r*per)+i].usDelay) ||
+                (waves[pos+(r*per)+i].flags)) break;
+         }
+
+         if (i < per) break;
+
+         r++;
+      }
+
+      if (r < 2) continue;
+
+      cbs = 0;
+      ool = 0;
+
+      for (i=0; i<per; i++)
+      {
+         cbs += wavePulseCbs(&waves[pos+i]);
+         ool += wavePulseOOL(&waves[pos+i]);
+      }
+
+      blocks = waveLoopBlocks(r-1);
+
+      saved = ((r-1) * cbs) - (4 * blocks);
+
+      /* never trade a cb saving for a shortage of OOL */
+
+      if ((saved > best) && (((r-1) * ool) >= waveLoopOOL(blocks)))
+      {
+         best = saved;
+         *period = per;
+         *reps = r;
+      }
+   }
+
+   return (best >= WAVE_LOOP_MIN_SAVED);
+}
+
+static int waveOOLRun(int *botOOL, int len)
+{
+   int pos;
+
+   /* len OOL in one page, a DMA copy can't cross pages */
+
+   if (((*botOOL % OOL_PER_OPAGE) + len) > OOL_PER_OPAGE)
+      *botOOL += OOL_PER_OPAGE - (*botOOL % OOL_PER_OPAGE);
+
+   pos = *botOOL;
+
+   *botOOL += len;
+
+   return pos;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static int wave2Cbs(unsigned wave_mode)
+static int wave2Cbs(
+   unsigned wave_mode, int botCB, int topCB, int botOOL, int topOOL,
+   uint32_t patchBits)
 {
-   int botCB=waveOutBotCB, botOOL=waveOutBotOOL, topOOL=waveOutTopOOL;
+   int firstCB=botCB;
 
    int status;
 
@@ -2526,12 +3413,22 @@ static int wave2Cbs(unsigned wave_mode)
 
    rawWave_t * waves;
 
+   int b, j, period, reps, blocks, loopCB, loopEnd, looped, slot;
+   int ring[WAVE_LOOP_MAX_BLOCKS], saved[WAVE_LOOP_MAX_BLOCKS];
+
    numWaves = wfc[wfcur];
    waves    = wf [wfcur];
 
+   period = 0;
+   reps = 0;
+   blocks = 0;
+   loopCB = 0;
+   loopEnd = -1;
+   looped = 0;
+
    half = PI_WF_MICROS/2;
 
-   if ((status = errCBsOOL(botCB+1, botOOL, topOOL))) return status;
+   if ((status = errCBsOOL(botCB+1, topCB, botOOL, topOOL))) return status;
 
    /* add delay cb at start of DMA */
 
@@ -2562,9 +3459,50 @@ static int wave2Cbs(unsigned wave_mode)
 
    for (i=0; i<numWaves; i++)
    {
-      if (waves[i].gpioOn)
+      /* a patchable wave isn't looped, its slots must stay distinct */
+
+      if (!patchBits && ((int)i > loopEnd) &&
+         waveLoopFind(waves, numWaves, i, &period, &reps))
+      {
+         /*
+            Emit the period once between cbs which reload the
+            counter and the counter which sends it round reps-1
+            more times.  Reloading on entry lets the wave be sent
+            again, or repeat, with the counter fresh.
+         */
+
+         blocks = waveLoopBlocks(reps-1);
+
+         status = errCBsOOL(botCB+blocks, topCB,
+            botOOL+waveLoopOOL(blocks), topOOL);
+         if (status) return status;
+
+         for (b=0; b<blocks; b++)
+         {
+            ring[b]  = waveOOLRun(&botOOL, WAVE_LOOP_BLKLEN+1);
+            saved[b] = waveOOLRun(&botOOL, WAVE_LOOP_BLKLEN);
+
+            p = rawWaveCBAdr(botCB++);
+
+            p->info   = NORMAL_DMA|DMA_SRC_INC|DMA_DEST_INC;
+            p->src    = waveOOLPOadr(saved[b]);
+            p->dst    = waveOOLPOadr(ring[b]);
+            p->length = WAVE_LOOP_BLKLEN*4;
+            p->next   = waveCbPOadr(botCB);
+         }
+
+         loopCB = botCB;
+         loopEnd = i + period - 1;
+      }
+
+      looped = 0;
+
+      slot = (waves[i].gpioOn | waves[i].gpioOff) & patchBits;
+
+      if (waves[i].gpioOn || slot)
       {
-         if ((status = errCBsOOL(botCB+1, botOOL+1, topOOL))) return status;
+         status = errCBsOOL(botCB+1, topCB, botOOL+1, topOOL);
+         if (status) return status;
 
          waveSetOOL(botOOL, waves[i].gpioOn);
 
@@ -2577,9 +3515,10 @@ static int wave2Cbs(unsigned wave_mode)
          p->next   = waveCbPOadr(botCB);
       }
 
-      if (waves[i].gpioOff)
+      if (waves[i].gpioOff || slot)
       {
-         if ((status = errCBsOOL(botCB+1, botOOL+1, topOOL))) return status;
+         status = errCBsOOL(botCB+1, topCB, botOOL+1, topOOL);
+         if (status) return status;
 
          waveSetOOL(botOOL, waves[i].gpioOff);
 
@@ -2594,7 +3533,8 @@ static int wave2Cbs(unsigned wave_mode)
 
       if (waves[i].flags & WAVE_FLAG_READ)
       {
-         if ((status = errCBsOOL(botCB+1, botOOL, topOOL-1))) return status;
+         status = errCBsOOL(botCB+1, topCB, botOOL, topOOL-1);
+         if (status) return status;
 
          p = rawWaveCBAdr(botCB++);
 
@@ -2607,7 +3547,8 @@ static int wave2Cbs(unsigned wave_mode)
 
       if (waves[i].flags & WAVE_FLAG_TICK)
       {
-         if ((status = errCBsOOL(botCB+1, botOOL, topOOL-1))) return status;
+         status = errCBsOOL(botCB+1, topCB, botOOL, topOOL-1);
+         if (status) return status;
 
          p = rawWaveCBAdr(botCB++);
 
@@ -2620,7 +3561,8 @@ static int wave2Cbs(unsigned wave_mode)
 
       if (waves[i].usDelay)
       {
-         if ((status = errCBsOOL(botCB+1, botOOL, topOOL))) return status;
+         status = errCBsOOL(botCB+1, topCB, botOOL, topOOL);
+         if (status) return status;
 
          p = rawWaveCBAdr(botCB++);
 
@@ -2647,6 +3589,43 @@ static int wave2Cbs(unsigned wave_mode)
          p->length = 4 * ((waves[i].usDelay+half)/PI_WF_MICROS);
          p->next   = waveCbPOadr(botCB);
       }
+
+      if ((int)i == loopEnd)
+      {
+         status = errCBsOOL(botCB+(3*blocks), topCB, botOOL, topOOL);
+         if (status) return status;
+
+         waveCounter(botCB, ring, WAVE_LOOP_BLKLEN, blocks, reps-1,
+            waveCbPOadr(loopCB), waveCbPOadr(botCB+(3*blocks)));
+
+         for (b=0; b<blocks; b++)
+         {
+            for (j=0; j<WAVE_LOOP_BLKLEN; j++)
+               waveSetOOL(saved[b]+j, rawWaveGetOut(ring[b]+j));
+         }
+
+         botCB += (3*blocks);
+
+         i = loopEnd + (period * (reps-1));
+
+         looped = 1;
+      }
+   }
+
+   if (looped)
+   {
+      /* the counter's next is dynamic, end on a cb which does nothing */
+
+      status = errCBsOOL(botCB+1, topCB, botOOL, topOOL);
+      if (status) return status;
+
+      p = rawWaveCBAdr(botCB++);
+
+      p->info   = NORMAL_DMA;
+      p->src    = waveOOLPOadr(ring[0]+WAVE_LOOP_BLKLEN);
+      p->dst    = waveOOLPOadr(ring[0]+WAVE_LOOP_BLKLEN);
+      p->length = 4;
+      p->next   = waveCbPOadr(botCB);
    }
 
    if (p != NULL)
@@ -2656,110 +3635,417 @@ static int wave2Cbs(unsigned wave_mode)
       else p->next = waveCbPOadr(repeatCB);
    }
 
-   status = botCB - waveOutBotCB;
-
-   waveOutBotCB  = botCB;
-   waveOutBotOOL = botOOL;
-   waveOutTopOOL = topOOL;
-
-   return status;
+   return botCB - firstCB;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static uint32_t waveGetIn(int page, int slot)
+static void waveNeeds(
+   uint32_t patchBits, int *numCB, int *numOOL, int *numLoops)
 {
-   return (dmaOVirt[page]->OOL[slot]);
-}
+   int i, j, cbs, ool, loops, period, reps, blocks, looped;
 
-static void waveSetIn(int page, int slot, uint32_t value)
-{
-   dmaOVirt[page]->OOL[slot] = value;
-}
+   /*
+      The cbs and OOL wave2Cbs will use for the current waveform.
+      The OOL for loops allows for skipping to the next page.
+   */
 
-static uint32_t myWaveOOLPOadr(int page, int slot)
-{
-   return (uint32_t) &dmaOBus[page]->OOL[slot];
-}
+   cbs = 1;
+   ool = 0;
+   loops = 0;
+   looped = 0;
 
-static void waveCount(
-   unsigned counter,
-   unsigned blklen,
-   unsigned blocks,
-   unsigned count,
-   uint32_t repeat,
-   uint32_t next)
-{
-   rawCbs_t *p=NULL;
+   i = 0;
 
-   int b, baseCB, dig;
-   uint32_t nxt;
+   while (i<wfc[wfcur])
+   {
+      if (!patchBits &&
+         waveLoopFind(wf[wfcur], wfc[wfcur], i, &period, &reps))
+      {
+         blocks = waveLoopBlocks(reps-1);
 
-   int botCB;
+         cbs += 4 * blocks;
+         ool += waveLoopOOL(blocks);
 
-   botCB  = counter * CBS_PER_OPAGE;
+         for (j=0; j<period; j++)
+         {
+            cbs += wavePulseCbs(&wf[wfcur][i+j]);
+            ool += wavePulseOOL(&wf[wfcur][i+j]);
+         }
 
-   baseCB = botCB;
+         i += period * reps;
 
-   /* set up all the OOLs */
-   for (b=0; b < (blocks*(blklen+1)); b++) waveSetIn(counter, b, repeat);
+         loops++;
+         looped = 1;
+      }
+      else
+      {
+         cbs += wavePulseCbs(&wf[wfcur][i]);
+         ool += wavePulseOOL(&wf[wfcur][i]);
 
-   for (b=0; b<blocks; b++)
-      waveSetIn(counter, ((b*(blklen+1))+blklen), waveCbPOadr(baseCB+((b*3)+3)));
+         cbs += waveSlotFill(&wf[wfcur][i], patchBits);
+         ool += waveSlotFill(&wf[wfcur][i], patchBits);
 
-   for (b=0; b<blocks; b++)
-   {
-      /* copy BOTTOM to NEXT */
+         i++;
 
-      p = rawWaveCBAdr(botCB++);
+         looped = 0;
+      }
+   }
 
-      p->info = NORMAL_DMA;
+   if (looped) cbs++;
 
-      p->src = myWaveOOLPOadr(counter, b*(blklen+1));
-      p->dst = (waveCbPOadr(botCB+1) + 20);
+   *numCB  = cbs;
+   *numOOL = ool;
+   *numLoops = loops;
+}
 
-      p->length = 4;
-      p->next   = waveCbPOadr(botCB);
+/* ----------------------------------------------------------------------- */
 
-      /* copy BOTTOM to TOP */
+static int waveInTx(int wave_id)
+{
+   return (waveTx[wave_id] && dmaOut[DMA_CONBLK_AD]);
+}
 
-      p = rawWaveCBAdr(botCB++);
+/* ----------------------------------------------------------------------- */
 
-      p->info   = NORMAL_DMA;
+static void waveRelease(int wid)
+{
+   /* a freed wave gives back its copy of the pulses and its slots */
 
-      p->src = myWaveOOLPOadr(counter, b*(blklen+1));
-      p->dst = myWaveOOLPOadr(counter, (b*(blklen+1))+blklen);
+   waveState[wid] = WAVE_FREE;
 
-      p->length = 4;
-      p->next   = waveCbPOadr(botCB);
+   if (waveKey[wid].pulses) free(waveKey[wid].pulses);
 
-      /* shift all down one */
+   waveKey[wid].pulses = NULL;
+   waveKey[wid].maxPulses = 0;
+   waveKey[wid].numPulses = 0;
 
-      p = rawWaveCBAdr(botCB++);
+   if (waveKey[wid].slot) free(waveKey[wid].slot);
 
-      p->info   = NORMAL_DMA|DMA_SRC_INC|DMA_DEST_INC;
+   waveKey[wid].slot = NULL;
+   waveKey[wid].maxSlots = 0;
+   waveKey[wid].numSlots = 0;
+}
 
-      p->src = myWaveOOLPOadr(counter, ((b*(blklen+1))+1));
-      p->dst = myWaveOOLPOadr(counter, ((b*(blklen+1))+0));
+static void waveReleaseAll(void)
+{
+   int i;
 
-      p->length = blklen*4;
-      p->next   = repeat;
-   }
+   for (i=0; i<PI_MAX_WAVES; i++) waveRelease(i);
+}
 
-   b = 0;
+static void waveReap(void)
+{
+   int i;
 
-   while (count && (b<blocks))
+   /* release deleted waves which are no longer being transmitted */
+
+   for (i=0; i<PI_MAX_WAVES; i++)
    {
-      dig = count % blklen;
-      count /= blklen;
+      if ((waveState[i] == WAVE_DYING) && !waveInTx(i))
+         waveRelease(i);
+   }
+}
 
-      if (count) nxt = waveGetIn(counter, (b*(blklen+1))+blklen);
-      else       nxt = next;
+/* ----------------------------------------------------------------------- */
 
-      waveSetIn(counter, b*(blklen+1)+dig, nxt);
+typedef struct
+{
+   int bot; /* first used */
+   int top; /* one past the last used */
+   int wave_id;
+} waveExtent_t;
 
-      b++;
+static int waveExtentCmp(const void *a, const void *b)
+{
+   return ((waveExtent_t *)a)->bot - ((waveExtent_t *)b)->bot;
+}
+
+static int waveExtents(int ool, waveExtent_t *ext)
+{
+   int i, n;
+
+   /*
+      The cbs (or OOL) held by waves, in address order.  The wave
+      stream, if any, has wave_id -1 and a compiled chain -2.
+   */
+
+   n = 0;
+
+   for (i=0; i<PI_MAX_WAVES; i++)
+   {
+      if (waveState[i] == WAVE_FREE) continue;
+
+      if (ool)
+      {
+         ext[n].bot = waveInfo[i].botOOL;
+         ext[n].top = waveInfo[i].topOOL;
+      }
+      else
+      {
+         ext[n].bot = waveInfo[i].botCB;
+         ext[n].top = waveInfo[i].topCB + 1;
+      }
+
+      ext[n].wave_id = i;
+
+      if (ext[n].top > ext[n].bot) n++;
+   }
+
+   if (waveStream.active)
+   {
+      if (ool)
+      {
+         ext[n].bot = waveStream.botOOL;
+         ext[n].top = waveStream.botOOL + STREAM_OOL;
+      }
+      else
+      {
+         ext[n].bot = waveStream.botCB;
+         ext[n].top = waveStream.botCB + STREAM_CBS;
+      }
+
+      ext[n].wave_id = -1;
+
+      n++;
+   }
+
+   if (waveChain.active)
+   {
+      if (ool)
+      {
+         ext[n].bot = waveChain.botOOL;
+         ext[n].top = waveChain.botOOL + waveChain.numOOL;
+      }
+      else
+      {
+         ext[n].bot = waveChain.botCB;
+         ext[n].top = waveChain.botCB + waveChain.numCB;
+      }
+
+      ext[n].wave_id = -2;
+
+      n++;
+   }
+
+   qsort(ext, n, sizeof(waveExtent_t), waveExtentCmp);
+
+   return n;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int waveFit(int ool, int need, int *numFree, int *numLargest)
+{
+   waveExtent_t ext[PI_MAX_WAVES+2];
+   int i, n, pos, end, gap, fit;
+
+   /*
+      First fit in the gaps between waves.  Also totals the free
+      space and finds the largest gap.  Returns the position of the
+      first gap of need or more, or -1.
+   */
+
+   n = waveExtents(ool, ext);
+
+   pos = ool ? WAVE_BOT_OOL : WAVE_BOT_CB;
+
+   fit = need ? -1 : pos;
+
+   *numFree = 0;
+   *numLargest = 0;
+
+   for (i=0; i<=n; i++)
+   {
+      if (i < n) end = ext[i].bot;
+      else       end = ool ? NUM_WAVE_OOL : NUM_WAVE_CBS;
+
+      gap = end - pos;
+
+      if (gap > 0)
+      {
+         *numFree += gap;
+
+         if (gap > *numLargest) *numLargest = gap;
+
+         if ((fit < 0) && (gap >= need)) fit = pos;
+      }
+
+      if (i < n) pos = ext[i].top;
+   }
+
+   return fit;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void waveMoveOOL(int wave_id, int bot)
+{
+   int i, len;
+
+   /* bot is at or below the wave's OOL, copy upwards */
+
+   len = waveInfo[wave_id].topOOL - waveInfo[wave_id].botOOL;
+
+   for (i=0; i<len; i++)
+      waveSetOOL(bot+i, rawWaveGetOut(waveInfo[wave_id].botOOL+i));
+
+   waveInfo[wave_id].botOOL = bot;
+   waveInfo[wave_id].topOOL = bot + len;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void waveMoveCBs(int wave_id, int bot)
+{
+   rawCbs_t cb;
+   int i, n, botOOL, topOOL;
+   uint32_t repeat, set, clr, lev, clo;
+
+   /*
+      bot is at or below the wave's cbs, copy upwards relinking the
+      cbs and pointing them at the wave's (possibly moved) OOL.  The
+      cbs are walked in the order wave2Cbs built them so the OOL are
+      met in the order they were allocated.
+   */
+
+   set = ((GPIO_BASE + (GPSET0*4)) & 0x00ffffff) | PI_PERI_BUS;
+   clr = ((GPIO_BASE + (GPCLR0*4)) & 0x00ffffff) | PI_PERI_BUS;
+   lev = ((GPIO_BASE + (GPLEV0*4)) & 0x00ffffff) | PI_PERI_BUS;
+   clo = ((SYST_BASE + (SYST_CLO*4)) & 0x00ffffff) | PI_PERI_BUS;
+
+   n = waveInfo[wave_id].topCB - waveInfo[wave_id].botCB + 1;
+
+   botOOL = waveInfo[wave_id].botOOL;
+   topOOL = waveInfo[wave_id].topOOL;
+
+   repeat = waveCbPOadr(waveInfo[wave_id].botCB + 1);
+
+   for (i=0; i<n; i++)
+   {
+      cb = *rawWaveCBAdr(waveInfo[wave_id].botCB + i);
+
+      if ((cb.dst == set) || (cb.dst == clr))
+         cb.src = waveOOLPOadr(botOOL++);
+      else if ((cb.src == lev) || (cb.src == clo))
+         cb.dst = waveOOLPOadr(--topOOL);
+
+      if (i < (n-1))          cb.next = waveCbPOadr(bot + i + 1);
+      else if (cb.next == repeat) cb.next = waveCbPOadr(bot + 1);
+      else                    cb.next = 0;
+
+      *rawWaveCBAdr(bot + i) = cb;
+   }
+
+   waveInfo[wave_id].botCB = bot;
+   waveInfo[wave_id].topCB = bot + n - 1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void waveCompact(void)
+{
+   waveExtent_t ext[PI_MAX_WAVES+2];
+   char oolMoved[PI_MAX_WAVES];
+   int i, n, w, pos;
+
+   /*
+      Slide waves down over the gaps, first their OOL then their cbs.
+      A wave being transmitted is never touched, the waves above it
+      close up against it.  Nor is a wave with loops, its counters
+      hold the addresses of its cbs, nor the wave stream or chain.
+   */
+
+   memset(oolMoved, 0, sizeof(oolMoved));
+
+   n = waveExtents(1, ext);
+
+   pos = WAVE_BOT_OOL;
+
+   for (i=0; i<n; i++)
+   {
+      w = ext[i].wave_id;
+
+      if (w < 0) {pos = ext[i].top; continue;}
+
+      if (!waveInTx(w) && !waveFixed[w] && (ext[i].bot > pos))
+      {
+         waveMoveOOL(w, pos);
+         oolMoved[w] = 1;
+      }
+
+      pos = waveInfo[w].topOOL;
+   }
+
+   n = waveExtents(0, ext);
+
+   pos = WAVE_BOT_CB;
+
+   for (i=0; i<n; i++)
+   {
+      w = ext[i].wave_id;
+
+      if (w < 0) {pos = ext[i].top; continue;}
+
+      if (!waveInTx(w) && !waveFixed[w] &&
+         ((ext[i].bot > pos) || oolMoved[w]))
+         waveMoveCBs(w, pos);
+
+      pos = waveInfo[w].topCB + 1;
+   }
+
+   gpioStats.waveCompactions++;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int waveAlloc(int numCB, int numOOL, int *botCB, int *botOOL)
+{
+   int freeCB, freeOOL, largest;
+
+   /* find room for numCB cbs and numOOL OOL, compacting if needed */
+
+   *botCB  = waveFit(0, numCB,  &freeCB,  &largest);
+   *botOOL = waveFit(1, numOOL, &freeOOL, &largest);
+
+   if ((*botCB < 0) || (*botOOL < 0))
+   {
+      if (freeCB  < numCB)  return PI_TOO_MANY_CBS;
+      if (freeOOL < numOOL) return PI_TOO_MANY_OOL;
+
+      /* there is room, but not in one piece */
+
+      waveCompact();
+
+      *botCB  = waveFit(0, numCB,  &freeCB,  &largest);
+      *botOOL = waveFit(1, numOOL, &freeOOL, &largest);
+
+      if (*botCB  < 0) return PI_TOO_MANY_CBS;
+      if (*botOOL < 0) return PI_TOO_MANY_OOL;
    }
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void waveCount(
+   unsigned counter,
+   unsigned blklen,
+   unsigned blocks,
+   unsigned count,
+   uint32_t repeat,
+   uint32_t next)
+{
+   int b, ring[WAVE_LOOP_MAX_BLOCKS];
+
+   /* a chain counter has a page to itself */
+
+   for (b=0; b<blocks; b++)
+      ring[b] = (counter * OOL_PER_OPAGE) + (b * (blklen+1));
+
+   waveCounter(
+      counter * CBS_PER_OPAGE, ring, blklen, blocks, count, repeat, next);
 }
 
 
@@ -2979,136 +4265,303 @@ int rawWaveAddGeneric(unsigned numIn1, rawWave_t *in1)
    else return PI_TOO_MANY_PULSES;
 }
 
-/* ======================================================================= */
+/* ----------------------------------------------------------------------- */
 
-int i2cWriteQuick(unsigned handle, unsigned bit)
+static void waveHeapDown(int *heap, int num, uint32_t *key, int i)
 {
-   int err;
+   int c, t;
 
-   DBG(DBG_USER, "handle=%d bit=%d", handle, bit);
+   /* restore the min-heap below i */
 
-   CHECK_INITED;
+   while ((c = (2*i) + 1) < num)
+   {
+      if (((c+1) < num) && (key[heap[c+1]] < key[heap[c]])) c++;
 
-   if (handle >= PI_I2C_SLOTS)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+      if (key[heap[i]] <= key[heap[c]]) break;
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+      t = heap[i]; heap[i] = heap[c]; heap[c] = t;
 
-   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_QUICK) == 0)
-      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+      i = c;
+   }
+}
 
-   if (bit > 1)
-      SOFT_ERROR(PI_BAD_PARAM, "bad bit (%d)", bit);
+static void waveHeapUp(int *heap, uint32_t *key, int i)
+{
+   int p, t;
 
-   err = my_smbus_access(
-      i2cInfo[handle].fd, bit, 0, PI_I2C_SMBUS_QUICK, NULL);
+   while (i > 0)
+   {
+      p = (i-1) / 2;
 
-   if (err < 0) return PI_I2C_WRITE_FAILED;
+      if (key[heap[p]] <= key[heap[i]]) break;
 
-   return err;
+      t = heap[i]; heap[i] = heap[p]; heap[p] = t;
+
+      i = p;
+   }
 }
 
-int i2cReadByte(unsigned handle)
+static int rawWaveAddMulti(unsigned numIn, unsigned *inLen, rawWave_t **in)
 {
-   union my_smbus_data data;
-
-   DBG(DBG_USER, "handle=%d", handle);
+   unsigned outPos=0, level = NUM_WAVE_OOL;
 
-   CHECK_INITED;
+   unsigned cbs=0;
 
-   if (handle >= PI_I2C_SLOTS)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   unsigned numOut, inPos[PI_WAVE_MAX_TRAINS+1];
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   uint32_t tNow, tEnd, tNext[PI_WAVE_MAX_TRAINS+1];
 
-   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_BYTE) == 0)
-      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+   int heap[PI_WAVE_MAX_TRAINS+1], due[PI_WAVE_MAX_TRAINS+1];
 
-   if (my_smbus_access(
-      i2cInfo[handle].fd, PI_I2C_SMBUS_READ, 0, PI_I2C_SMBUS_BYTE, &data))
-      return PI_I2C_READ_FAILED;
-   else
-      return 0xFF & data.byte;
-}
+   int numHeap, numDue, i, t;
 
+   rawWave_t *out, *w;
 
-int i2cWriteByte(unsigned handle, unsigned bVal)
-{
-   int err;
+   /*
+      A k-way version of rawWaveAddGeneric.  The trains are kept in
+      a min-heap on the time of their next pulse, so each pulse out
+      costs log(numIn) rather than a pass over the whole waveform
+      for each train added.
+   */
 
-   DBG(DBG_USER, "handle=%d bVal=%d", handle, bVal);
+   numOut = PI_WAVE_MAX_PULSES;
+   out    = wf[1-wfcur];
 
-   CHECK_INITED;
+   numHeap = 0;
 
-   if (handle >= PI_I2C_SLOTS)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   for (t=0; t<numIn; t++)
+   {
+      inPos[t] = 0;
+      tNext[t] = 0;
+      if (inLen[t]) heap[numHeap++] = t;
+   }
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   tNow = 0;
+   tEnd = 0;
 
-   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_BYTE) == 0)
-      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+   while (numHeap && (outPos < numOut))
+   {
+      if (tNow < tNext[heap[0]])
+      {
+         /* extend previous delay */
+         out[outPos-1].usDelay += (tNext[heap[0]] - tNow);
+         tNow = tNext[heap[0]];
+      }
 
-   if (bVal > 0xFF)
-      SOFT_ERROR(PI_BAD_PARAM, "bad bVal (%d)", bVal);
+      /* take one pulse from each train due now */
 
-   err = my_smbus_access(
-            i2cInfo[handle].fd,
-            PI_I2C_SMBUS_WRITE,
-            bVal,
-            PI_I2C_SMBUS_BYTE,
-            NULL);
+      numDue = 0;
 
-   if (err < 0) return PI_I2C_WRITE_FAILED;
+      out[outPos].gpioOn  = 0;
+      out[outPos].gpioOff = 0;
+      out[outPos].flags   = 0;
 
-   return err;
-}
+      while (numHeap && (tNext[heap[0]] == tNow))
+      {
+         t = heap[0];
 
+         w = &in[t][inPos[t]++];
 
-int i2cReadByteData(unsigned handle, unsigned reg)
-{
-   union my_smbus_data data;
+         out[outPos].gpioOn  |= w->gpioOn;
+         out[outPos].gpioOff |= w->gpioOff;
+         out[outPos].flags   |= w->flags;
 
-   DBG(DBG_USER, "handle=%d reg=%d", handle, reg);
+         tNext[t] = tNow + w->usDelay;
 
-   CHECK_INITED;
+         if (tNext[t] > tEnd) tEnd = tNext[t];
 
-   if (handle >= PI_I2C_SLOTS)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+         if (inPos[t] < inLen[t]) due[numDue++] = t;
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+         heap[0] = heap[--numHeap];
+         waveHeapDown(heap, numHeap, tNext, 0);
+      }
 
-   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_BYTE_DATA) == 0)
-      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+      for (i=0; i<numDue; i++)
+      {
+         heap[numHeap] = due[i];
+         waveHeapUp(heap, tNext, numHeap++);
+      }
 
-   if (reg > 0xFF)
-      SOFT_ERROR(PI_BAD_PARAM, "bad reg (%d)", reg);
+      /* the last pulse lasts until the longest train ends */
 
-   if (my_smbus_access(
-      i2cInfo[handle].fd, PI_I2C_SMBUS_READ, reg, PI_I2C_SMBUS_BYTE_DATA, &data))
-      return PI_I2C_READ_FAILED;
-   else
-      return 0xFF & data.byte;
-}
+      if (numHeap) out[outPos].usDelay = tNext[heap[0]] - tNow;
+      else         out[outPos].usDelay = tEnd - tNow;
 
+      tNow += out[outPos].usDelay;
 
-int i2cWriteByteData(unsigned handle, unsigned reg, unsigned bVal)
-{
-   union my_smbus_data data;
+      cbs++; /* one cb for delay */
 
-   int err;
+      if (out[outPos].gpioOn) cbs++; /* one cb if gpio on */
 
-   DBG(DBG_USER, "handle=%d reg=%d bVal=%d", handle, reg, bVal);
+      if (out[outPos].gpioOff) cbs++; /* one cb if gpio off */
+
+      if (out[outPos].flags & WAVE_FLAG_READ)
+      {
+         cbs++; /* one cb if read */
+         --level;
+      }
+
+      if (out[outPos].flags & WAVE_FLAG_TICK)
+      {
+         cbs++; /* one cb if tick */
+         --level;
+      }
+
+      outPos++;
+   }
+
+   if (!numHeap && (outPos < numOut) && (outPos < level))
+   {
+      wfStats.micros = tNow;
+
+      if (tNow > wfStats.highMicros) wfStats.highMicros = tNow;
+
+      wfStats.pulses = outPos;
+
+      if (outPos > wfStats.highPulses) wfStats.highPulses = outPos;
+
+      wfStats.cbs    = cbs;
+
+      if (cbs > wfStats.highCbs) wfStats.highCbs = cbs;
+
+      wfc[1-wfcur] = outPos;
+      wfcur = 1 - wfcur;
+
+      return outPos;
+   }
+   else return PI_TOO_MANY_PULSES;
+}
+
+/* ======================================================================= */
+
+int i2cWriteQuick(unsigned handle, unsigned bit)
+{
+   int err;
+
+   DBG(DBG_USER, "handle=%d bit=%d", handle, bit);
+
+   CHECK_INITED;
+
+   if (handle >= PI_I2C_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_QUICK) == 0)
+      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+
+   if (bit > 1)
+      SOFT_ERROR(PI_BAD_PARAM, "bad bit (%d)", bit);
+
+   err = my_smbus_access(
+      i2cInfo[handle].fd, bit, 0, PI_I2C_SMBUS_QUICK, NULL);
+
+   if (err < 0) return PI_I2C_WRITE_FAILED;
+
+   return err;
+}
+
+int i2cReadByte(unsigned handle)
+{
+   union my_smbus_data data;
+
+   DBG(DBG_USER, "handle=%d", handle);
+
+   CHECK_INITED;
+
+   if (handle >= PI_I2C_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_BYTE) == 0)
+      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+
+   if (my_smbus_access(
+      i2cInfo[handle].fd, PI_I2C_SMBUS_READ, 0, PI_I2C_SMBUS_BYTE, &data))
+      return PI_I2C_READ_FAILED;
+   else
+      return 0xFF & data.byte;
+}
+
+
+int i2cWriteByte(unsigned handle, unsigned bVal)
+{
+   int err;
+
+   DBG(DBG_USER, "handle=%d bVal=%d", handle, bVal);
+
+   CHECK_INITED;
+
+   if (handle >= PI_I2C_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_BYTE) == 0)
+      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+
+   if (bVal > 0xFF)
+      SOFT_ERROR(PI_BAD_PARAM, "bad bVal (%d)", bVal);
+
+   err = my_smbus_access(
+            i2cInfo[handle].fd,
+            PI_I2C_SMBUS_WRITE,
+            bVal,
+            PI_I2C_SMBUS_BYTE,
+            NULL);
+
+   if (err < 0) return PI_I2C_WRITE_FAILED;
+
+   return err;
+}
+
+
+int i2cReadByteData(unsigned handle, unsigned reg)
+{
+   union my_smbus_data data;
+
+   DBG(DBG_USER, "handle=%d reg=%d", handle, reg);
+
+   CHECK_INITED;
+
+   if (handle >= PI_I2C_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_BYTE_DATA) == 0)
+      SOFT_ERROR(PI_BAD_SMBUS_CMD, "SMBUS command not supported by driver");
+
+   if (reg > 0xFF)
+      SOFT_ERROR(PI_BAD_PARAM, "bad reg (%d)", reg);
+
+   if (my_smbus_access(
+      i2cInfo[handle].fd, PI_I2C_SMBUS_READ, reg, PI_I2C_SMBUS_BYTE_DATA, &data))
+      return PI_I2C_READ_FAILED;
+   else
+      return 0xFF & data.byte;
+}
+
+
+int i2cWriteByteData(unsigned handle, unsigned reg, unsigned bVal)
+{
+   union my_smbus_data data;
+
+   int err;
+
+   DBG(DBG_USER, "handle=%d reg=%d bVal=%d", handle, reg, bVal);
 
    CHECK_INITED;
 
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_BYTE_DATA) == 0)
@@ -3146,7 +4599,7 @@ int i2cReadWordData(unsigned handle, unsigned reg)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_WORD_DATA) == 0)
@@ -3180,7 +4633,7 @@ int i2cWriteWordData(unsigned handle, unsigned reg, unsigned wVal)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_WORD_DATA) == 0)
@@ -3218,7 +4671,7 @@ int i2cProcessCall(unsigned handle, unsigned reg, unsigned wVal)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_PROC_CALL) == 0)
@@ -3256,7 +4709,7 @@ int i2cReadBlockData(unsigned handle, unsigned reg, char *buf)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_BLOCK_DATA) == 0)
@@ -3299,7 +4752,7 @@ int i2cWriteBlockData(
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_BLOCK_DATA) == 0)
@@ -3342,7 +4795,7 @@ int i2cBlockProcessCall(
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_PROC_CALL) == 0)
@@ -3388,7 +4841,7 @@ int i2cReadI2CBlockData(
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_READ_I2C_BLOCK) == 0)
@@ -3436,7 +4889,7 @@ int i2cWriteI2CBlockData(
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((i2cInfo[handle].funcs & PI_I2C_FUNC_SMBUS_WRITE_I2C_BLOCK) == 0)
@@ -3476,7 +4929,7 @@ int i2cWriteDevice(unsigned handle, char *buf, unsigned count)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((count < 1) || (count > PI_MAX_I2C_DEVICE_COUNT))
@@ -3502,7 +4955,7 @@ int i2cReadDevice(unsigned handle, char *buf, unsigned count)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state == PI_I2C_CLOSED)
+   if (i2cInfo[handle].state != PI_I2C_OPENED)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if ((count < 1) || (count > PI_MAX_I2C_DEVICE_COUNT))
@@ -3540,9 +4993,9 @@ int i2cOpen(unsigned i2cBus, unsigned i2cAddr, unsigned i2cFlags)
 
    for (i=0; i<PI_I2C_SLOTS; i++)
    {
-      if (i2cInfo[i].state == PI_I2C_CLOSED)
+      if (__sync_bool_compare_and_swap(
+         &i2cInfo[i].state, PI_I2C_CLOSED, PI_I2C_RESERVED))
       {
-         i2cInfo[i].state = PI_I2C_OPENED;
          slot = i;
          break;
       }
@@ -3585,6 +5038,7 @@ int i2cOpen(unsigned i2cBus, unsigned i2cAddr, unsigned i2cFlags)
    i2cInfo[slot].addr = i2cAddr;
    i2cInfo[slot].flags = i2cFlags;
    i2cInfo[slot].funcs = funcs;
+   i2cInfo[slot].state = PI_I2C_OPENED;
 
    return slot;
 }
@@ -3598,7 +5052,8 @@ int i2cClose(unsigned handle)
    if (handle >= PI_I2C_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (i2cInfo[handle].state != PI_I2C_OPENED)
+   if (!__sync_bool_compare_and_swap(
+      &i2cInfo[handle].state, PI_I2C_OPENED, PI_I2C_RESERVED))
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if (i2cInfo[handle].fd >= 0) close(i2cInfo[handle].fd);
@@ -3862,7 +5317,9 @@ static void spiGoA(
    uint32_t flags,    /* flags           */
    char     *txBuf,   /* tx buffer       */
    char     *rxBuf,   /* rx buffer       */
-   unsigned count)    /* number of bytes */
+   unsigned count,    /* number of bytes */
+   unsigned pos,      /* bytes already transferred with CS asserted */
+   int      last)     /* deassert CS at end */
 {
    int cs;
    char bit_ir[4] = {1, 0, 0, 1}; /* read on rising edge */
@@ -3900,7 +5357,7 @@ static void spiGoA(
                  AUXSPI_CNTL0_MSB_FIRST(txmsbf)        |
                  AUXSPI_CNTL0_SHIFT_LEN(bitlen);
 
-   if (!count)
+   if (!count && !pos)
    {
       auxReg[AUX_SPI0_CNTL0_REG] =
          AUXSPI_CNTL0_ENABLE | AUXSPI_CNTL0_CLR_FIFOS;
@@ -3914,11 +5371,14 @@ static void spiGoA(
       return;
    }
 
-   auxReg[AUX_SPI0_CNTL0_REG] = AUXSPI_CNTL0_ENABLE  | spiDefaults;
+   if (!pos)
+   {
+      auxReg[AUX_SPI0_CNTL0_REG] = AUXSPI_CNTL0_ENABLE  | spiDefaults;
 
-   auxReg[AUX_SPI0_CNTL1_REG] = AUXSPI_CNTL1_MSB_FIRST(rxmsbf);
+      auxReg[AUX_SPI0_CNTL1_REG] = AUXSPI_CNTL1_MSB_FIRST(rxmsbf);
 
-   spiACS(channel, cs);
+      spiACS(channel, cs);
+   }
 
    while ((txCnt < count) || (rxCnt < count))
    {
@@ -3941,7 +5401,7 @@ static void spiGoA(
       {
          if (!txFull)
          {
-            if (txCnt != (count-1))
+            if ((txCnt != (count-1)) || !last)
             {
                auxReg[AUX_SPI0_TX_HOLD] =
                   _spiTXBits(txBuf, txCnt++, bitlen, txmsbf);
@@ -3957,7 +5417,7 @@ static void spiGoA(
 
    while ((auxReg[AUX_SPI0_STAT_REG] & AUXSPI_STAT_BUSY)) ;
 
-   spiACS(channel, !cs);
+   if (last) spiACS(channel, !cs);
 }
 
 static void spiGoS(
@@ -3965,7 +5425,9 @@ static void spiGoS(
    uint32_t flags,
    char     *txBuf,
    char     *rxBuf,
-   unsigned count)
+   unsigned count,
+   unsigned pos,
+   int      last)
 {
    unsigned txCnt=0;
    unsigned rxCnt=0;
@@ -3986,16 +5448,19 @@ static void spiGoS(
                  SPI_CS_CSPOL(cspol)   |
                  SPI_CS_CLEAR(3);
 
-   spiReg[SPI_CS] = spiDefaults; /* stop */
+   if (!pos)
+   {
+      spiReg[SPI_CS] = spiDefaults; /* stop */
 
-   if (!count) return;
+      if (!count) return;
+   }
 
    if (flag3w)
    {
-      if (ren3w < count)
+      if (ren3w < (pos + count))
       {
-         cnt4w = ren3w;
-         cnt3w = count - ren3w;
+         cnt4w = (ren3w > pos) ? ren3w - pos : 0;
+         cnt3w = count - cnt4w;
       }
       else
       {
@@ -4009,9 +5474,12 @@ static void spiGoS(
       cnt3w = 0;
    }
 
-   spiReg[SPI_CLK] = 250000000/speed;
+   if (!pos)
+   {
+      spiReg[SPI_CLK] = 250000000/speed;
 
-   spiReg[SPI_CS] = spiDefaults | SPI_CS_TA; /* start */
+      spiReg[SPI_CS] = spiDefaults | SPI_CS_TA; /* start */
+   }
 
    cnt = cnt4w;
 
@@ -4038,7 +5506,7 @@ static void spiGoS(
 
    cnt += cnt3w;
 
-   spiReg[SPI_CS] |= SPI_CS_REN;
+   if (cnt3w) spiReg[SPI_CS] |= SPI_CS_REN;
 
    while((txCnt < cnt) || (rxCnt < cnt))
    {
@@ -4059,26 +5527,38 @@ static void spiGoS(
 
    while (!(spiReg[SPI_CS] & SPI_CS_DONE)) ;
 
-   spiReg[SPI_CS] = spiDefaults; /* stop */
+   if (last) spiReg[SPI_CS] = spiDefaults; /* stop */
 }
 
-static void spiGo(
+static void spiGoPart(
    unsigned speed,
    uint32_t flags,
    char     *txBuf,
    char     *rxBuf,
-   unsigned count)
+   unsigned count,
+   unsigned pos,
+   int      last)
 {
    if (PI_SPI_FLAGS_GET_AUX_SPI(flags))
    {
-      spiGoA(speed, flags, txBuf, rxBuf, count);
+      spiGoA(speed, flags, txBuf, rxBuf, count, pos, last);
    }
    else
    {
-      spiGoS(speed, flags, txBuf, rxBuf, count);
+      spiGoS(speed, flags, txBuf, rxBuf, count, pos, last);
    }
 }
 
+static void spiGo(
+   unsigned speed,
+   uint32_t flags,
+   char     *txBuf,
+   char     *rxBuf,
+   unsigned count)
+{
+   spiGoPart(speed, flags, txBuf, rxBuf, count, 0, 1);
+}
+
 static int spiAnyOpen(uint32_t flags)
 {
    int i, aux;
@@ -4248,9 +5728,9 @@ int spiOpen(unsigned spiChan, unsigned baud, unsigned spiFlags)
 
    for (i=0; i<PI_SPI_SLOTS; i++)
    {
-      if (spiInfo[i].state == PI_SPI_CLOSED)
+      if (__sync_bool_compare_and_swap(
+         &spiInfo[i].state, PI_SPI_CLOSED, PI_SPI_RESERVED))
       {
-         spiInfo[i].state = PI_SPI_OPENED;
          slot = i;
          break;
       }
@@ -4261,6 +5741,7 @@ int spiOpen(unsigned spiChan, unsigned baud, unsigned spiFlags)
 
    spiInfo[slot].speed = baud;
    spiInfo[slot].flags = spiFlags | PI_SPI_FLAGS_CHANNEL(spiChan);
+   spiInfo[slot].state = PI_SPI_OPENED;
 
    return slot;
 }
@@ -4274,11 +5755,10 @@ int spiClose(unsigned handle)
    if (handle >= PI_SPI_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (spiInfo[handle].state != PI_SPI_OPENED)
+   if (!__sync_bool_compare_and_swap(
+      &spiInfo[handle].state, PI_SPI_OPENED, PI_SPI_CLOSED))
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   spiInfo[handle].state = PI_I2C_CLOSED;
-
    if (!spiAnyOpen(spiInfo[handle].flags))
       spiTerm(spiInfo[handle].flags); /* terminate on last close */
 
@@ -4397,9 +5877,9 @@ int serOpen(char *tty, unsigned serBaud, unsigned serFlags)
 
    for (i=0; i<PI_SER_SLOTS; i++)
    {
-      if (serInfo[i].state == PI_SER_CLOSED)
+      if (__sync_bool_compare_and_swap(
+         &serInfo[i].state, PI_SER_CLOSED, PI_SER_RESERVED))
       {
-         serInfo[i].state = PI_SER_OPENED;
          slot = i;
          break;
       }
@@ -4431,6 +5911,7 @@ int serOpen(char *tty, unsigned serBaud, unsigned serFlags)
 
    serInfo[slot].fd = fd;
    serInfo[slot].flags = serFlags;
+   serInfo[slot].state = PI_SER_OPENED;
 
    return slot;
 }
@@ -4444,7 +5925,8 @@ int serClose(unsigned handle)
    if (handle >= PI_SER_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (serInfo[handle].state != PI_SER_OPENED)
+   if (!__sync_bool_compare_and_swap(
+      &serInfo[handle].state, PI_SER_OPENED, PI_SER_RESERVED))
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
    if (serInfo[handle].fd >= 0) close(serInfo[handle].fd);
@@ -5041,10 +6523,11 @@ static void * pthAlertThread(void *x)
    int cycle, pulse;
    int emit, seqno, emitted;
    uint32_t changes, bits, changedBits, timeoutBits;
+   uint32_t evtHead, evtTail;
    int numSamples, d;
    int b, n, v;
    int err;
-   int stopped;
+   int stopped, woken;
    char fifo[32];
 
    req.tv_sec = 0;
@@ -5114,6 +6597,8 @@ static void * pthAlertThread(void *x)
 
       changedBits = 0;
 
+      woken = 0;
+
       oldLevel = reportedLevel & monitorBits;
 
       while ((oldSlot != newSlot) && (numSamples < DATUMS))
@@ -5129,6 +6614,11 @@ static void * pthAlertThread(void *x)
 
             changedBits |= (newLevel ^ oldLevel);
 
+            /* don't keep a WAITing script until the batch is done */
+
+            if ((newLevel ^ oldLevel) & scriptWaitBits)
+               woken += scrWake(newLevel ^ oldLevel, tick, level);
+
             oldLevel = newLevel;
 
             numSamples++;
@@ -5246,6 +6736,10 @@ static void * pthAlertThread(void *x)
          }
       }
 
+      /* start any scripts waiting for an edge */
+
+      if (changedBits & scriptTrigBits) scrTrigger(reportedLevel, numSamples);
+
       /* check for timeout watchdogs */
 
       timeoutBits = 0;
@@ -5366,6 +6860,32 @@ static void * pthAlertThread(void *x)
                }
             }
 
+            /* append any events queued by scripts */
+
+            evtTail = gpioNotify[n].evtTail;
+            evtHead = gpioNotify[n].evtHead;
+
+            if (evtTail != evtHead)
+            {
+               __sync_synchronize();
+
+               while (evtTail != evtHead)
+               {
+                  gpioReport[emit] =
+                     gpioEvent[n][evtTail & (NTFY_EVENTS-1)];
+
+                  gpioReport[emit].seqno = seqno;
+
+                  emit++;
+                  seqno++;
+                  evtTail++;
+               }
+
+               __sync_synchronize();
+
+               gpioNotify[n].evtTail = evtTail;
+            }
+
             if (!emit)
             {
                if ((tick - gpioNotify[n].lastReportTick) > 60000000)
@@ -5463,26 +6983,11 @@ static void * pthAlertThread(void *x)
          }
       }
 
-      if (changedBits & scriptBits)
+      if (woken)
       {
-         for (n=0; n<PI_MAX_SCRIPTS; n++)
-         {
-            if ((gpioScript[n].state     == PI_SCRIPT_IN_USE)  &&
-                (gpioScript[n].run_state == PI_SCRIPT_WAITING) &&
-                (gpioScript[n].waitBits & changedBits))
-            {
-               pthread_mutex_lock(&gpioScript[n].pthMutex);
-
-               if (gpioScript[n].run_state == PI_SCRIPT_WAITING)
-               {
-                  gpioScript[n].changedBits =
-                     gpioScript[n].waitBits & changedBits;
-                  pthread_cond_signal(&gpioScript[n].pthCond);
-               }
-
-               pthread_mutex_unlock(&gpioScript[n].pthMutex);
-            }
-         }
+         pthread_mutex_lock(&scrMutex);
+         intScriptBits();
+         pthread_mutex_unlock(&scrMutex);
       }
 
       /* once all outputs have been emitted set reported level */
@@ -5540,320 +7045,366 @@ static void scrSwap(int *v1, int *v2)
 
 /* ----------------------------------------------------------------------- */
 
-static int scrWait(gpioScript_t *s, uint32_t bits)
+static int scrEmit(
+   gpioScript_t *s, unsigned handle, int *val, int count, int avail)
 {
-   pthread_mutex_lock(&s->pthMutex);
+   gpioReport_t *r;
+   uint32_t head, tick;
+   int i;
 
-   if (s->request == PI_SCRIPT_RUN)
-   {
-      s->run_state = PI_SCRIPT_WAITING;
-      s->waitBits = bits;
-      intScriptBits();
+   /*
+      Queue a record of count values as event reports on a started
+      notification handle.  The alert thread sends them with the
+      handle's next batch of reports.  val holds avail values.
+   */
 
-      pthread_cond_wait(&s->pthCond, &s->pthMutex);
+   if ((handle >= PI_NOTIFY_SLOTS) ||
+       (gpioNotify[handle].state != PI_NOTIFY_RUNNING))
+      return PI_BAD_HANDLE;
 
-      s->waitBits = 0;
-      intScriptBits();
-      s->run_state = PI_SCRIPT_RUNNING;
+   if ((count < 1) || (count > PI_NTFY_MAX_RECORD) || (count > avail))
+      return PI_BAD_EVENT_CNT;
+
+   tick = gpioTick();
+
+   pthread_mutex_lock(&eventMutex);
+
+   head = gpioNotify[handle].evtHead;
+
+   if ((head - gpioNotify[handle].evtTail) > (NTFY_EVENTS - count))
+   {
+      pthread_mutex_unlock(&eventMutex);
+      return PI_NOTIFY_FULL;
    }
 
-   pthread_mutex_unlock(&s->pthMutex);
+   for (i=0; i<count; i++)
+   {
+      r = &gpioEvent[handle][(head + i) & (NTFY_EVENTS-1)];
 
-   return s->changedBits;
-}
+      r->flags = PI_NTFY_FLAGS_EVENT |
+                 PI_NTFY_FLAGS_SID(s->id) |
+                 PI_NTFY_FLAGS_IDX(i);
 
-/* ----------------------------------------------------------------------- */
+      if (i == (count-1)) r->flags |= PI_NTFY_FLAGS_LAST;
 
-static int scrSys(char *cmd, uint32_t p1, uint32_t p2)
-{
-   char buf[256];
-   char pars[40];
+      r->tick  = tick;
+      r->level = val[i];
+   }
 
-   sprintf(pars, " %u %u", p1, p2);
-   strcpy(buf, "/opt/pigpio/cgi/");
-   strncat(buf, cmd, 200);
-   strcat(buf, pars);
+   __sync_synchronize();
 
-   DBG(DBG_USER, "sys %s", buf);
+   gpioNotify[handle].evtHead = head + count;
 
-   return system(buf);
+   pthread_mutex_unlock(&eventMutex);
+
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void *pthScript(void *x)
+static int scrBufOk(int offset, int len)
 {
-   gpioScript_t *s;
-   cmdInstr_t instr;
-   int p1, p2, p1o, p2o, *t1, *t2;
-   int PC, A, F, SP;
-   int S[PI_SCRIPT_STACK_SIZE];
-   char buf[CMD_MAX_EXTENSION];
+   return ((offset >= 0) && (len >= 0) &&
+           (len <= (CMD_MAX_EXTENSION - offset)));
+}
 
+/* ----------------------------------------------------------------------- */
+
+static int scrCrc(uint8_t *b, int len, int width, uint32_t poly, uint32_t crc)
+{
+   uint32_t top, mask;
+   int i, j;
 
-   S[0] = 0; /* to prevent compiler warning */
+   /* MSB first, no reflection or final XOR */
 
-   s = x;
+   top  = 1 << (width - 1);
+   mask = (top << 1) - 1;
 
-   while ((volatile int)s->request != PI_SCRIPT_DELETE)
+   for (i=0; i<len; i++)
    {
-      pthread_mutex_lock(&s->pthMutex);
-      s->run_state = PI_SCRIPT_HALTED;
-      pthread_cond_wait(&s->pthCond, &s->pthMutex);
-      pthread_mutex_unlock(&s->pthMutex);
+      crc ^= b[i] << (width - 8);
 
-      s->run_state = PI_SCRIPT_RUNNING;
+      for (j=0; j<8; j++)
+      {
+         if (crc & top) crc = (crc << 1) ^ poly;
+         else           crc <<= 1;
+      }
+   }
 
-      A  = 0;
-      F  = 0;
-      PC = 0;
-      SP = 0;
+   return crc & mask;
+}
 
-      while (((volatile int)s->request   == PI_SCRIPT_RUN    ) &&
-                           (s->run_state == PI_SCRIPT_RUNNING))
-      {
-         instr = s->script.instr[PC];
+/* ----------------------------------------------------------------------- */
 
-         p1o = instr.p[1];
-         p2o = instr.p[2];
+static int scrSys(char *cmd, uint32_t p1, uint32_t p2)
+{
+   char buf[256];
+   char pars[40];
 
-         if      (instr.opt[1] == CMD_VAR) instr.p[1] = s->script.var[p1o];
-         else if (instr.opt[1] == CMD_PAR) instr.p[1] = s->script.par[p1o];
+   sprintf(pars, " %u %u", p1, p2);
+   strcpy(buf, "/opt/pigpio/cgi/");
+   strncat(buf, cmd, 200);
+   strcat(buf, pars);
 
-         if      (instr.opt[2] == CMD_VAR) instr.p[2] = s->script.var[p2o];
-         else if (instr.opt[2] == CMD_PAR) instr.p[2] = s->script.par[p2o];
-/*
-         fprintf(stderr, "PC=%d cmd=%d p1o=%d p1=%d p2o=%d p2=%d\n",
-            PC, instr.p[0], p1o, instr.p[1], p2o, instr.p[2]);
-         fflush(stderr);
-*/
-         if (instr.p[0] < 100)
-         {
-            if (instr.p[3])
-            {
-               memcpy(buf, (char *)instr.p[4], instr.p[3]);
-            }
+   DBG(DBG_USER, "sys %s", buf);
 
-            A = myDoCommand(instr.p, sizeof(buf)-1, buf);
+   return system(buf);
+}
 
-            F = A;
+/* ----------------------------------------------------------------------- */
 
-            PC++;
-         }
-         else
-         {
-            p1 = instr.p[1];
-            p2 = instr.p[2];
+static uint64_t scrNow(void)
+{
+   struct timespec ts;
 
-            switch (instr.p[0])
-            {
-               case PI_CMD_ADD:   A+=p1; F=A;                     PC++; break;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
 
-               case PI_CMD_AND:   A&=p1; F=A;                     PC++; break;
+   return ((uint64_t)ts.tv_sec * MILLION) + (ts.tv_nsec / THOUSAND);
+}
 
-               case PI_CMD_CALL:  scrPush(s, &SP, S, PC+1);    PC = p1; break;
+/* ----------------------------------------------------------------------- */
 
-               case PI_CMD_CMP:   F=A-p1;                         PC++; break;
+static void scrQueue(gpioScript_t *s)
+{
+   /* scrMutex must be held */
 
-               case PI_CMD_DCR:
-                  if (instr.opt[1] == CMD_PAR)
-                     {--s->script.par[p1o]; F=s->script.par[p1o];}
-                  else
-                     {--s->script.var[p1o]; F=s->script.var[p1o];}
-                  PC++;
-                  break;
+   s->sched = SCR_READY;
+   s->next = NULL;
 
-               case PI_CMD_DCRA:  --A; F=A;                       PC++; break;
+   if (scrRunTail) scrRunTail->next = s; else scrRunHead = s;
 
-               case PI_CMD_DIV:   A/=p1; F=A;                     PC++; break;
+   scrRunTail = s;
 
-               case PI_CMD_HALT: s->run_state = PI_SCRIPT_HALTED;       break;
+   pthread_cond_signal(&scrCond);
+}
 
-               case PI_CMD_INR:
-                  if (instr.opt[1] == CMD_PAR)
-                     {++s->script.par[p1o]; F=s->script.par[p1o];}
-                  else
-                     {++s->script.var[p1o]; F=s->script.var[p1o];}
-                  PC++;
-                  break;
+/* ----------------------------------------------------------------------- */
 
-               case PI_CMD_INRA:  ++A; F=A;                       PC++; break;
+static void scrSleep(gpioScript_t *s)
+{
+   gpioScript_t **pp;
 
-               case PI_CMD_JM:    if (F<0)  PC=p1; else PC++;           break;
+   /* scrMutex must be held, the sleep list is kept in wake order */
 
-               case PI_CMD_JMP:   PC=p1;                                break;
+   s->sched = SCR_SLEEP;
 
-               case PI_CMD_JNZ:   if (F)    PC=p1; else PC++;           break;
+   pp = &scrSleepHead;
 
-               case PI_CMD_JP:    if (F>=0) PC=p1; else PC++;           break;
+   while (*pp && ((*pp)->wake <= s->wake)) pp = &(*pp)->next;
 
-               case PI_CMD_JZ:    if (!F)   PC=p1; else PC++;           break;
+   s->next = *pp;
+   *pp = s;
 
-               case PI_CMD_LD:
-                  if (instr.opt[1] == CMD_PAR) s->script.par[p1o]=p2;
-                  else                         s->script.var[p1o]=p2;
-                  PC++;
-                  break;
+   /* a worker may be waiting for a later wake */
 
-               case PI_CMD_LDA:   A=p1;                           PC++; break;
+   pthread_cond_signal(&scrCond);
+}
 
-               case PI_CMD_LDAB:
-                  if ((p1 >= 0) && (p1 < sizeof(buf))) A = buf[p1];
-                  PC++;
-                  break;
+/* ----------------------------------------------------------------------- */
+
+static void scrUnsleep(gpioScript_t *s)
+{
+   gpioScript_t **pp;
 
-               case PI_CMD_MLT:   A*=p1; F=A;                     PC++; break;
+   /* scrMutex must be held */
 
-               case PI_CMD_MOD:   A%=p1; F=A;                     PC++; break;
+   for (pp=&scrSleepHead; *pp; pp=&(*pp)->next)
+   {
+      if (*pp == s)
+      {
+         *pp = s->next;
+         break;
+      }
+   }
+}
 
-               case PI_CMD_OR:    A|=p1; F=A;                     PC++; break;
+/* ----------------------------------------------------------------------- */
 
-               case PI_CMD_POP:
-                  if (instr.opt[1] == CMD_PAR)
-                     s->script.par[p1o]=scrPop(s, &SP, S);
-                  else
-                     s->script.var[p1o]=scrPop(s, &SP, S);
-                  PC++;
-                  break;
+static void scrHalt(gpioScript_t *s)
+{
+   /* scrMutex must be held, the script must not be on a worker */
 
-               case PI_CMD_POPA:  A=scrPop(s, &SP, S);            PC++; break;
+   switch (s->sched)
+   {
+      case SCR_SLEEP:
+         scrUnsleep(s);
+         break;
 
-               case PI_CMD_PUSH:
-                  if (instr.opt[1] == CMD_PAR)
-                     scrPush(s, &SP, S, s->script.par[p1o]);
-                  else
-                     scrPush(s, &SP, S, s->script.var[p1o]);
-                  PC++;
-                  break;
+      case SCR_WAIT:
+         s->waitBits = 0;
+         intScriptBits();
+         break;
 
-               case PI_CMD_PUSHA: scrPush(s, &SP, S, A);          PC++; break;
+      case SCR_READY:
+         /* a worker will halt it when it is dequeued */
+         return;
+   }
 
-               case PI_CMD_RET:   PC=scrPop(s, &SP, S);                 break;
+   s->sched = SCR_IDLE;
+   s->run_state = PI_SCRIPT_HALTED;
+}
 
-               case PI_CMD_RL:
-                  if (instr.opt[1] == CMD_PAR)
-                     {s->script.par[p1o]<<=p2; F=s->script.par[p1o];}
-                  else
-                     {s->script.var[p1o]<<=p2; F=s->script.var[p1o];}
-                  PC++;
-                  break;
+/* ----------------------------------------------------------------------- */
 
-               case PI_CMD_RLA:   A<<=p1; F=A;                    PC++; break;
+static void scrUnlock(void *x)
+{
+   pthread_mutex_unlock(&scrMutex);
+}
 
-               case PI_CMD_RR:
-                  if (instr.opt[1] == CMD_PAR)
-                     {s->script.par[p1o]>>=p2; F=s->script.par[p1o];}
-                  else
-                     {s->script.var[p1o]>>=p2; F=s->script.var[p1o];}
-                  PC++;
-                  break;
+/* ----------------------------------------------------------------------- */
 
-               case PI_CMD_RRA:   A>>=p1; F=A;                    PC++; break;
+static void *pthScriptWorker(void *x)
+{
+   gpioScript_t *s;
+   struct timespec ts;
+   uint64_t now;
+   int why;
 
-               case PI_CMD_STA:
-                  if (instr.opt[1] == CMD_PAR) s->script.par[p1o]=A;
-                  else                         s->script.var[p1o]=A;
-                  PC++;
-                  break;
+   /*
+      Scripts are multiplexed onto SCR_THREADS workers.  A script runs
+      until it halts, waits for gpio changes (WAIT), delays (MILS, or
+      MICS of SCR_SPIN_MICROS or more), or has taken SCR_SLICE jumps.
+      Waiting scripts are requeued by the alert thread, delaying
+      scripts when their wake time passes, and time-sliced scripts go
+      straight to the back of the run queue.  Other commands run on
+      the worker.  A worker issuing one which may block, or running
+      a shell command (SYS), is counted out of the pool, which grows
+      rather than leave no worker free (scrBlockStart).
+   */
 
-               case PI_CMD_STAB:
-                  if ((p1 >= 0) && (p1 < sizeof(buf))) buf[p1] = A;
-                  PC++;
-                  break;
+   pthread_mutex_lock(&scrMutex);
 
-               case PI_CMD_SUB:   A-=p1; F=A;                     PC++; break;
+   pthread_cleanup_push(scrUnlock, NULL);
 
-               case PI_CMD_SYS:
-                  A=scrSys((char*)instr.p[4], A, *(gpioReg + GPLEV0));
-                  F=A;
-                  PC++;
-                  break;
+   while (1)
+   {
+      now = scrNow();
 
-               case PI_CMD_WAIT:  A=scrWait(s, p1); F=A;          PC++; break;
+      while (scrSleepHead && (scrSleepHead->wake <= now))
+      {
+         s = scrSleepHead;
+         scrSleepHead = s->next;
+         scrQueue(s);
+      }
 
-               case PI_CMD_X:
-                  if (instr.opt[1] == CMD_PAR) t1 = &s->script.par[p1o];
-                  else                         t1 = &s->script.var[p1o];
+      s = scrRunHead;
 
-                  if (instr.opt[2] == CMD_PAR) t2 = &s->script.par[p2o];
-                  else                         t2 = &s->script.var[p2o];
+      if (s == NULL)
+      {
+         if (scrSleepHead)
+         {
+            ts.tv_sec  = scrSleepHead->wake / MILLION;
+            ts.tv_nsec = (scrSleepHead->wake % MILLION) * THOUSAND;
+            pthread_cond_timedwait(&scrCond, &scrMutex, &ts);
+         }
+         else pthread_cond_wait(&scrCond, &scrMutex);
 
-                  scrSwap(t1, t2);
-                  PC++;
-                  break;
+         continue;
+      }
 
-               case PI_CMD_XA:
-                  if (instr.opt[1] == CMD_PAR)
-                     scrSwap(&s->script.par[p1o], &A);
-                  else
-                     scrSwap(&s->script.var[p1o], &A);
-                  PC++;
-                  break;
+      scrRunHead = s->next;
+      if (scrRunHead == NULL) scrRunTail = NULL;
 
-               case PI_CMD_XOR:   A^=p1; F=A;                     PC++; break;
+      s->sched = SCR_ACTIVE;
 
-            }
-         }
+      pthread_mutex_unlock(&scrMutex);
 
-         if (PC >= s->script.instrs) s->run_state = PI_SCRIPT_HALTED;
+      why = scrRun(s);
 
-      }
+      pthread_mutex_lock(&scrMutex);
 
-      if ((volatile int)s->request == PI_SCRIPT_HALT)
-         s->run_state = PI_SCRIPT_HALTED;
+      if (s->request != PI_SCRIPT_RUN) why = SCR_IDLE;
 
+      switch (why)
+      {
+         case SCR_READY:
+            scrQueue(s);
+            break;
+
+         case SCR_SLEEP:
+            scrSleep(s);
+            break;
+
+         case SCR_WAIT:
+            s->sched = SCR_WAIT;
+            s->run_state = PI_SCRIPT_WAITING;
+            intScriptBits();
+            break;
+
+         default:
+            s->sched = SCR_IDLE;
+            s->run_state = PI_SCRIPT_HALTED;
+            break;
+      }
    }
 
-   return 0;
+   pthread_cleanup_pop(1);
+
+   return NULL;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void * pthTimerTick(void *x)
+static int scrWake(uint32_t changes, uint32_t tick, uint32_t level)
 {
-   gpioTimer_t *     tp;
-   struct timespec   req, rem, period;
-   char              buf[256];
+   gpioScript_t *s;
+   uint32_t bits;
+   int n, woken;
 
-   tp = x;
+   /*
+      Called by the alert thread for each sample which changes a
+      gpio being waited for.  monitorBits is left alone until the
+      scan is over, only scriptWaitBits is updated here.
+   */
 
-   clock_gettime(CLOCK_REALTIME, &tp->nextTick);
+   woken = 0;
+   bits = 0;
 
-   while (1)
+   pthread_mutex_lock(&scrMutex);
+
+   for (n=0; n<PI_MAX_SCRIPTS; n++)
    {
-      clock_gettime(CLOCK_REALTIME, &rem);
+      s = &gpioScript[n];
 
-      period.tv_sec  = tp->millis / THOUSAND;
-      period.tv_nsec = (tp->millis % THOUSAND) * THOUSAND * THOUSAND;
+      if ((s->state != PI_SCRIPT_IN_USE) || (s->sched != SCR_WAIT))
+         continue;
 
-      do
+      if (s->waitBits & changes)
       {
-         TIMER_ADD(&tp->nextTick, &period, &tp->nextTick);
-
-         TIMER_SUB(&tp->nextTick, &rem, &req);
+         s->changedBits = s->waitBits & changes;
+         s->A = s->changedBits;
+         s->F = s->changedBits;
+         s->waitTick  = tick;
+         s->waitLevel = level;
+         s->waitBits = 0;
+         s->run_state = PI_SCRIPT_RUNNING;
+         scrQueue(s);
+         woken++;
       }
-      while (req.tv_sec < 0);
+      else bits |= s->waitBits;
+   }
 
-      while (nanosleep(&req, &rem))
-      {
-         req.tv_sec  = rem.tv_sec;
-         req.tv_nsec = rem.tv_nsec;
-      }
+   scriptWaitBits = bits;
 
-      if (gpioCfg.dbgLevel >= DBG_SLOW_TICK)
-      {
-         if ((tp->millis > 50) || (gpioCfg.dbgLevel >= DBG_FAST_TICK))
-         {
-            sprintf(buf, "pigpio: TIMER=%d @ %u %u\n",
-               tp->id,
-              (unsigned)tp->nextTick.tv_sec,
-              (unsigned)tp->nextTick.tv_nsec);
-            fprintf(stderr, buf);
-         }
-      }
+   pthread_mutex_unlock(&scrMutex);
 
-      if (tp->ex) (tp->func)(tp->userdata);
-      else        (tp->func)();
+   return woken;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int scrAlloc(gpioScript_t *s)
+{
+   /* the stack and command buffer are only needed once run */
+
+   if (s->stack == NULL)
+   {
+      s->stack = malloc(
+         (sizeof(int) * PI_SCRIPT_STACK_SIZE) + CMD_MAX_EXTENSION);
+
+      if (s->stack == NULL) return PI_NO_MEMORY;
+
+      s->buf = (char *)(s->stack + PI_SCRIPT_STACK_SIZE);
    }
 
    return 0;
@@ -5861,2726 +7412,6018 @@ static void * pthTimerTick(void *x)
 
 /* ----------------------------------------------------------------------- */
 
-
-static void * pthFifoThread(void *x)
+static void scrStart(gpioScript_t *s)
 {
-   char buf[CMD_MAX_EXTENSION];
-   int idx, flags, len, res, i;
-   uint32_t p[CMD_P_ARR];
-   cmdCtlParse_t ctl;
-   uint32_t *param;
-   char v[CMD_MAX_EXTENSION];
+   /* scrMutex must be held, the script must be halted */
 
-   myCreatePipe(PI_INPFIFO, 0662);
-
-   if ((inpFifo = fopen(PI_INPFIFO, "r+")) == NULL)
-      SOFT_ERROR((void*)PI_INIT_FAILED, "fopen %s failed(%m)", PI_INPFIFO);
+   s->A  = 0;
+   s->F  = 0;
+   s->SP = 0;
+   s->pc = s->op;
 
-   myCreatePipe(PI_OUTFIFO, 0664);
+   s->request   = PI_SCRIPT_RUN;
+   s->run_state = PI_SCRIPT_RUNNING;
 
-   if ((outFifo = fopen(PI_OUTFIFO, "w+")) == NULL)
-      SOFT_ERROR((void*)PI_INIT_FAILED, "fopen %s failed (%m)", PI_OUTFIFO);
+   scrQueue(s);
+}
 
-   /* set outFifo non-blocking */
+/* ----------------------------------------------------------------------- */
 
-   flags = fcntl(fileno(outFifo), F_GETFL, 0);
-   fcntl(fileno(outFifo), F_SETFL, flags | O_NONBLOCK);
+static void scrTrigger(uint32_t level, int numSamples)
+{
+   gpioScript_t *s;
+   uint32_t changes;
+   int d, n, v;
 
-   /* don't start until DMA started */
+   /*
+      Called by the alert thread with the level before the samples.
+      Scripts which are still running when their edge recurs miss it.
+   */
 
-   spinWhileStarting();
+   pthread_mutex_lock(&scrMutex);
 
-   while (1)
+   for (d=0; d<numSamples; d++)
    {
-      if (fgets(buf, sizeof(buf), inpFifo) == NULL)
-         SOFT_ERROR((void*)PI_INIT_FAILED, "fifo fgets failed (%m)");
+      changes = (gpioSample[d].level ^ level) & scriptTrigBits;
 
-      len = strlen(buf);
+      level = gpioSample[d].level;
 
-      if (len)
+      if (!changes) continue;
+
+      for (n=0; n<PI_MAX_SCRIPTS; n++)
       {
-        --len;
-        buf[len] = 0; /* replace terminating */
-      }
+         s = &gpioScript[n];
 
-      ctl.eaten = 0;
-      idx = 0;
+         if ((s->state != PI_SCRIPT_IN_USE) || !(s->trigBit & changes))
+            continue;
 
-      while (((ctl.eaten)<len) && (idx >= 0))
-      {
-         if ((idx=cmdParse(buf, p, CMD_MAX_EXTENSION, v, &ctl)) >= 0)
-         {
-            /* make sure extensions are null terminated */
+         v = (level & s->trigBit) ? 1 : 0;
 
-            v[p[3]] = 0;
+         if (((s->trigEdge == RISING_EDGE)  && !v) ||
+             ((s->trigEdge == FALLING_EDGE) &&  v)) continue;
 
-            res = myDoCommand(p, sizeof(v)-1, v);
+         if ((s->sched != SCR_IDLE) || (s->run_state != PI_SCRIPT_HALTED))
+            continue;
 
-            switch (cmdInfo[idx].rv)
-            {
-               case 0:
-                  fprintf(outFifo, "%d\n", res);
-                  break;
+         s->script.par[0] = __builtin_ctz(s->trigBit);
+         s->script.par[1] = v;
+         s->script.par[2] = gpioSample[d].tick;
 
-               case 1:
-                  fprintf(outFifo, "%d\n", res);
-                  break;
+         scrStart(s);
+      }
+   }
 
-               case 2:
-                  fprintf(outFifo, "%d\n", res);
-                  break;
+   pthread_mutex_unlock(&scrMutex);
+}
 
-               case 3:
-                  fprintf(outFifo, "%08X\n", res);
-                  break;
+/* ----------------------------------------------------------------------- */
 
-               case 4:
-                  fprintf(outFifo, "%u\n", res);
-                  break;
+static int scrStartWorkers(void)
+{
+   pthread_condattr_t attr;
 
-               case 5:
-                  fprintf(outFifo, cmdUsage);
-                  break;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&scrCond, &attr);
+   pthread_condattr_destroy(&attr);
 
-               case 6:
-                  fprintf(outFifo, "%d", res);
-                  if (res > 0)
-                  {
-                     for (i=0; i<res; i++)
-                     {
-                        fprintf(outFifo, " %d", v[i]);
-                     }
-                  }
-                  fprintf(outFifo, "\n");
-                  break;
+   scrRunHead   = NULL;
+   scrRunTail   = NULL;
+   scrSleepHead = NULL;
 
-               case 7:
-                  if (res < 0) fprintf(outFifo, "%d\n", res);
-                  else
-                  {
-                     fprintf(outFifo, "%d", res);
-                     param = (uint32_t *)v;
-                     for (i=0; i<PI_MAX_SCRIPT_PARAMS; i++)
-                     {
-                        fprintf(outFifo, " %d", param[i]);
-                     }
-                     fprintf(outFifo, "\n");
-                  }
-                  break;
-            }
-         }
-         else fprintf(outFifo, "%d\n", PI_BAD_FIFO_COMMAND);
-      }
+   scrBlocked = 0;
+   scrPoolMax = SCR_MAX_THREADS;
 
-      fflush(outFifo);
+   pthread_mutex_lock(&scrMutex);
+
+   for (scrThreads=0; scrThreads<SCR_THREADS; scrThreads++)
+   {
+      if (pthread_create(
+         &scrThread[scrThreads], NULL, pthScriptWorker, NULL)) break;
    }
 
+   pthread_mutex_unlock(&scrMutex);
+
+   if (scrThreads < SCR_THREADS) return -1;
+
    return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void *pthSocketThreadHandler(void *fdC)
+static void scrStopWorkers(void)
 {
-   int sock = *(int*)fdC;
-   uint32_t p[10];
-   int opt;
-   char buf[CMD_MAX_EXTENSION];
+   int n;
 
-   free(fdC);
+   /* no worker may grow the pool while it is being stopped */
 
-   /* Disable the Nagle algorithm. */
-   opt = 1;
-   setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(int));
+   pthread_mutex_lock(&scrMutex);
+   scrPoolMax = 0;
+   pthread_mutex_unlock(&scrMutex);
 
-   while (1)
+   while (scrThreads)
    {
-      if (recv(sock, p, 16, MSG_WAITALL) != 16) break;
+      scrThreads--;
+      pthread_cancel(scrThread[scrThreads]);
+      pthread_join(scrThread[scrThreads], NULL);
+   }
 
-      if (p[3])
-      {
-         if (p[3] < sizeof(buf))
-         {
-            /* read extension into buf */
-            if (recv(sock, buf, p[3], MSG_WAITALL) != p[3])
-            {
-               /* Serious error.  No point continuing. */
-               DBG(DBG_ALWAYS, "recv failed for %d bytes", p[3]);
+   /* leave any stored scripts halted */
 
-               close(sock);
+   for (n=0; n<PI_MAX_SCRIPTS; n++)
+   {
+      gpioScript[n].request   = PI_SCRIPT_HALT;
+      gpioScript[n].run_state = PI_SCRIPT_HALTED;
+      gpioScript[n].sched     = SCR_IDLE;
+      gpioScript[n].waitBits  = 0;
+      gpioScript[n].trigBit   = 0;
+   }
 
-               return 0;
-            }
-         }
-         else
-         {
-            /* Serious error.  No point continuing. */
-            DBG(DBG_ALWAYS, "ext too large %d(%d)", p[3], sizeof(buf));
+   scrRunHead   = NULL;
+   scrRunTail   = NULL;
+   scrSleepHead = NULL;
 
-            close(sock);
+   scrBlocked = 0;
+}
 
-            return 0;
-         }
-      }
+/* ----------------------------------------------------------------------- */
 
-      /* add null terminator in case it's a string */
+static int scrBlocking(unsigned cmd)
+{
+   int exclusive;
 
-      buf[p[3]] = 0;
+   /* commands which wait on a bus or a slow bit banged transfer */
 
-      switch (p[0])
-      {
-         case PI_CMD_NOIB:
-            p[3] = gpioNotifyOpenInBand(sock);
+   switch (myCmdLockClass(cmd, &exclusive))
+   {
+      case CMD_LOCK_BB:
+      case CMD_LOCK_I2C:
+      case CMD_LOCK_SPI:
+      case CMD_LOCK_SER:
+         return 1;
+   }
 
-            /* Enable the Nagle algorithm. */
-            opt = 0;
-            setsockopt(
-               sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(int));
-            break;
+   return 0;
+}
 
-         case PI_CMD_PROCP:
-            p[3] = myDoCommand(p, sizeof(buf)-1, buf+sizeof(int));
-            if (((int)p[3]) >= 0)
-            {
-               memcpy(buf, &p[3], 4);
-               p[3] = 4 + (4*PI_MAX_SCRIPT_PARAMS);
-            }
-            break;
+static void scrBlockStart(void)
+{
+   /*
+      Counts the calling worker out of the pool for a blocking
+      command.  Were that to leave no worker free for the other
+      scripts another is started, up to SCR_MAX_THREADS.  Added
+      workers stay in the pool until the library terminates.
+   */
 
-         default:
-            p[3] = myDoCommand(p, sizeof(buf)-1, buf);
-      }
+   pthread_mutex_lock(&scrMutex);
 
-      write(sock, p, 16);
+   scrBlocked++;
 
-      switch (p[0])
+   if ((scrBlocked >= scrThreads) && (scrThreads < scrPoolMax))
+   {
+      if (pthread_create(
+         &scrThread[scrThreads], NULL, pthScriptWorker, NULL) == 0)
       {
-         /* extensions */
-
-         case PI_CMD_BI2CZ:
-         case PI_CMD_CF2:
-         case PI_CMD_I2CPK:
-         case PI_CMD_I2CRD:
-         case PI_CMD_I2CRI:
-         case PI_CMD_I2CRK:
-         case PI_CMD_I2CZ:
-         case PI_CMD_PROCP:
-         case PI_CMD_SERR:
-         case PI_CMD_SLR:
-         case PI_CMD_SPIX:
-         case PI_CMD_SPIR:
-
-            if (((int)p[3]) > 0)
-            {
-               write(sock, buf, p[3]);
-            }
-            break;
-
-         default:
-           break;
+         scrThreads++;
+         DBG(DBG_USER, "script workers %d", scrThreads);
       }
    }
 
-   close(sock);
-
-   return 0;
+   pthread_mutex_unlock(&scrMutex);
 }
 
-/* ----------------------------------------------------------------------- */
-
-static void * pthSocketThread(void *x)
+static void scrBlockEnd(void)
 {
-   int fdC, c, *sock;
-   struct sockaddr_in client;
-   pthread_attr_t attr;
-
-   if (pthread_attr_init(&attr))
-      SOFT_ERROR((void*)PI_INIT_FAILED,
-         "pthread_attr_init failed (%m)");
-
-   if (pthread_attr_setstacksize(&attr, STACK_SIZE))
-      SOFT_ERROR((void*)PI_INIT_FAILED,
-         "pthread_attr_setstacksize failed (%m)");
+   pthread_mutex_lock(&scrMutex);
+   scrBlocked--;
+   pthread_mutex_unlock(&scrMutex);
+}
 
-   if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))
-      SOFT_ERROR((void*)PI_INIT_FAILED,
-         "pthread_attr_setdetachstate failed (%m)");
+/* ----------------------------------------------------------------------- */
 
-   /* fdSock opened in gpioInitialise so that we can treat
-      failure to bind as fatal. */
+static int *scrOperand(gpioScript_t *s, int opt, uint32_t val, int *imm)
 
-   listen(fdSock, 100);
+{
+   if ((opt == CMD_VAR) && (val < PI_MAX_SCRIPT_VARS))
+      return &s->script.var[val];
 
-   c = sizeof(struct sockaddr_in);
+   if ((opt == CMD_PAR) && (val < PI_MAX_SCRIPT_PARAMS))
+      return &s->script.par[val];
 
-   /* don't start until DMA started */
+   return imm;
+}
 
-   spinWhileStarting();
+/* ----------------------------------------------------------------------- */
 
-   while ((fdC =
-      accept(fdSock, (struct sockaddr *)&client, (socklen_t*)&c)))
+static int *scrLvalue(gpioScript_t *s, int opt, uint32_t val)
+{
+   if (opt == CMD_PAR)
    {
-      pthread_t thr;
-
-      sock = malloc(sizeof(int));
-
-      *sock = fdC;
-
-      if (pthread_create
-         (&thr, &attr, pthSocketThreadHandler, (void*) sock) < 0)
-         SOFT_ERROR((void*)PI_INIT_FAILED,
-            "socket pthread_create failed (%m)");
+      if (val < PI_MAX_SCRIPT_PARAMS) return &s->script.par[val];
    }
+   else if (val < PI_MAX_SCRIPT_VARS) return &s->script.var[val];
 
-   if (fdC < 0)
-      SOFT_ERROR((void*)PI_INIT_FAILED, "accept failed (%m)");
-
-   return 0;
+   return &s->script.var[0];
 }
 
-/* ======================================================================= */
+/* ----------------------------------------------------------------------- */
 
-static void initCheckLockFile(void)
+static int scrTranslate(gpioScript_t *s)
 {
-   int fd;
-   int count;
-   int pid;
-   int err;
-   int delete;
-   char str[20];
+   scrOp_t *op;
+   cmdInstr_t *instr;
+   int i, n;
+   unsigned cmd;
 
-   fd = open(PI_LOCKFILE, O_RDONLY);
+   /*
+      Convert the compiled instructions into ops with their operands
+      resolved to pointers and their jump targets resolved to ops.
+      The labels are filled in by the first scrRun.  An extra END op
+      follows the last instruction.
+   */
 
-   if (fd != -1)
+   n = s->script.instrs;
+
+   s->op = calloc(n + 1, sizeof(scrOp_t));
+
+   if (s->op == NULL) return PI_NO_MEMORY;
+
+   for (i=0; i<n; i++)
    {
-      DBG(DBG_STARTUP, "lock file exists");
-      delete = 1;
+      op    = &s->op[i];
+      instr = &s->script.instr[i];
+      cmd   = instr->p[0];
 
-      count = read(fd, str, sizeof(str)-1);
+      op->instr = instr;
+      op->i1 = instr->p[1];
+      op->i2 = instr->p[2];
+      op->a1 = scrOperand(s, instr->opt[1], instr->p[1], &op->i1);
+      op->a2 = scrOperand(s, instr->opt[2], instr->p[2], &op->i2);
 
-      if (count)
+      if (cmd < PI_CMD_SCRIPT)
       {
-         pid = atoi(str);
-         err = kill(pid, 0);
-         if (!err) delete = 0; /* process still exists */
-         DBG(DBG_STARTUP, "lock file pid=%d err=%d", pid, err);
+         switch (cmd)
+         {
+            case PI_CMD_WRITE: op->kind = SCR_OP_W;    break;
+            case PI_CMD_READ:  op->kind = SCR_OP_R;    break;
+            case PI_CMD_BR1:   op->kind = SCR_OP_BR1;  break;
+            case PI_CMD_BR2:   op->kind = SCR_OP_BR2;  break;
+            case PI_CMD_TICK:  op->kind = SCR_OP_TICK; break;
+            case PI_CMD_MICS:  op->kind = SCR_OP_MICS; break;
+            case PI_CMD_MILS:  op->kind = SCR_OP_MILS; break;
+            default:           op->kind = SCR_OP_CMD;  break;
+         }
+         continue;
       }
 
-      close(fd);
-      DBG(DBG_STARTUP, "lock file delete=%d", delete);
-
-      if (delete) unlink(PI_LOCKFILE);
-   }
-}
+      if (cmd >= CMD_CMPJZ)
+      {
+         /* superinstructions from the script optimiser */
 
-static int initGrabLockFile(void)
-{
-   int fd;
-   int lockResult;
-   char pidStr[20];
+         switch (cmd)
+         {
+            case CMD_CMPJZ:  op->kind = SCR_OP_CMPJZ;  break;
+            case CMD_CMPJNZ: op->kind = SCR_OP_CMPJNZ; break;
+            case CMD_CMPJM:  op->kind = SCR_OP_CMPJM;  break;
+            case CMD_CMPJP:  op->kind = SCR_OP_CMPJP;  break;
+            case CMD_DCRJNZ: op->kind = SCR_OP_DCRJNZ; break;
+            default: op->kind = PI_CMD_NOP - PI_CMD_SCRIPT; continue;
+         }
 
-   initCheckLockFile();
+         if (cmd == CMD_DCRJNZ)
+            op->a1 = scrLvalue(s, instr->opt[1], instr->p[1]);
 
-   /* try to grab the lock file */
+         if (instr->p[2] < n) op->jmp = &s->op[instr->p[2]];
+         else                 op->jmp = &s->op[n];
 
-   fd = open(PI_LOCKFILE, O_WRONLY|O_CREAT|O_EXCL|O_TRUNC, 0644);
+         continue;
+      }
 
-   if (fd != -1)
-   {
-      lockResult = flock(fd, LOCK_EX|LOCK_NB);
+      if (cmd <= PI_CMD_WLEV) op->kind = cmd - PI_CMD_SCRIPT;
+      else                   op->kind = PI_CMD_NOP - PI_CMD_SCRIPT;
 
-      if(lockResult == 0)
+      switch (cmd)
       {
-         sprintf(pidStr, "%d\n", (int)getpid());
+         case PI_CMD_CALL:
+         case PI_CMD_JM:
+         case PI_CMD_JMP:
+         case PI_CMD_JNZ:
+         case PI_CMD_JP:
+         case PI_CMD_JZ:
+            if (instr->p[1] < n) op->jmp = &s->op[instr->p[1]];
+            else                 op->jmp = &s->op[n];
+            break;
 
-         write(fd, pidStr, strlen(pidStr));
-      }
-      else
-      {
-         close(fd);
-         return -1;
+         case PI_CMD_X:
+            op->a2 = scrLvalue(s, instr->opt[2], instr->p[2]);
+            /* fall through */
+
+         case PI_CMD_BLDB:
+         case PI_CMD_BLDL:
+         case PI_CMD_DCR:
+         case PI_CMD_INR:
+         case PI_CMD_LD:
+         case PI_CMD_POP:
+         case PI_CMD_PUSH:
+         case PI_CMD_RL:
+         case PI_CMD_RR:
+         case PI_CMD_STA:
+         case PI_CMD_XA:
+            op->a1 = scrLvalue(s, instr->opt[1], instr->p[1]);
+            break;
       }
    }
 
-   return fd;
+   s->op[n].kind = SCR_OP_END;
+
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static uint32_t * initMapMem(int fd, uint32_t addr, uint32_t len)
+#define SCR_YIELD(o, why)                                          \
+   do                                                              \
+   {                                                               \
+      if (prof) scrProfYield(s, prof, profStep, profTick, why);    \
+      s->pc = (o);                                                 \
+      s->A  = A;                                                   \
+      s->F  = F;                                                   \
+      s->SP = SP;                                                  \
+      return why;                                                  \
+   } while (0)
+
+#define SCR_NEXT(o)                                                \
+   do                                                              \
+   {                                                               \
+      op = (o);                                                    \
+      if ((*(volatile unsigned *)&s->request != PI_SCRIPT_RUN) ||  \
+          (*(volatile unsigned *)&s->run_state != PI_SCRIPT_RUNNING)) \
+         SCR_YIELD(op, SCR_IDLE);                                  \
+      goto *op->code;                                              \
+   } while (0)
+
+#define SCR_JUMP(o)                                                \
+   do                                                              \
+   {                                                               \
+      if (--slice <= 0) SCR_YIELD((o), SCR_READY);                 \
+      SCR_NEXT(o);                                                 \
+   } while (0)
+
+static void scrProfYield(
+   gpioScript_t *s, gpioScriptProf_t *prof, int step, uint32_t tick, int why)
 {
-    return (uint32_t *) mmap(0, len,
-       PROT_READ|PROT_WRITE|PROT_EXEC,
-       MAP_SHARED|MAP_LOCKED,
-       fd, addr);
-}
+   uint32_t now;
 
-/* ----------------------------------------------------------------------- */
+   /* charge the step being left, then time any block */
 
-static int initCheckPermitted(void)
-{
-   DBG(DBG_STARTUP, "");
+   now = systReg[SYST_CLO];
 
-   if ((fdMem = open("/dev/mem", O_RDWR | O_SYNC) ) < 0)
+   if (step >= 0) prof[step].micros += (now - tick);
+
+   if ((why == SCR_SLEEP) || (why == SCR_WAIT))
    {
-      DBG(DBG_ALWAYS,
-         "\n" \
-         "+---------------------------------------------------------+\n" \
-         "|Sorry, you don't have permission to run this program.    |\n" \
-         "|Try running as root, e.g. precede the command with sudo. |\n" \
-         "+---------------------------------------------------------+\n\n");
-      return -1;
+      s->blockStep = step;
+      s->blockTick = now;
    }
-   return 0;
 }
 
-/* ----------------------------------------------------------------------- */
-
-static int initPeripherals(void)
+static int scrRun(gpioScript_t *s)
 {
-   uint32_t dmaBase;
-
-   DBG(DBG_STARTUP, "");
+   scrOp_t *op;
+   uint32_t p[CMD_P_ARR];
+   uint32_t startTick, profTick;
+   int A, F, SP, i, pc, slice, profStep;
+   int *S;
+   char *buf;
+   gpioScriptProf_t *prof;
+
+   static void *label[SCR_OPS] =
+   {
+      [PI_CMD_ADD   - PI_CMD_SCRIPT] = &&op_add,
+      [PI_CMD_AND   - PI_CMD_SCRIPT] = &&op_and,
+      [PI_CMD_CALL  - PI_CMD_SCRIPT] = &&op_call,
+      [PI_CMD_CMP   - PI_CMD_SCRIPT] = &&op_cmp,
+      [PI_CMD_DCR   - PI_CMD_SCRIPT] = &&op_dcr,
+      [PI_CMD_DCRA  - PI_CMD_SCRIPT] = &&op_dcra,
+      [PI_CMD_DIV   - PI_CMD_SCRIPT] = &&op_div,
+      [PI_CMD_HALT  - PI_CMD_SCRIPT] = &&op_halt,
+      [PI_CMD_INR   - PI_CMD_SCRIPT] = &&op_inr,
+      [PI_CMD_INRA  - PI_CMD_SCRIPT] = &&op_inra,
+      [PI_CMD_JM    - PI_CMD_SCRIPT] = &&op_jm,
+      [PI_CMD_JMP   - PI_CMD_SCRIPT] = &&op_jmp,
+      [PI_CMD_JNZ   - PI_CMD_SCRIPT] = &&op_jnz,
+      [PI_CMD_JP    - PI_CMD_SCRIPT] = &&op_jp,
+      [PI_CMD_JZ    - PI_CMD_SCRIPT] = &&op_jz,
+      [PI_CMD_LD    - PI_CMD_SCRIPT] = &&op_ld,
+      [PI_CMD_LDA   - PI_CMD_SCRIPT] = &&op_lda,
+      [PI_CMD_LDAB  - PI_CMD_SCRIPT] = &&op_ldab,
+      [PI_CMD_MLT   - PI_CMD_SCRIPT] = &&op_mlt,
+      [PI_CMD_MOD   - PI_CMD_SCRIPT] = &&op_mod,
+      [PI_CMD_OR    - PI_CMD_SCRIPT] = &&op_or,
+      [PI_CMD_POP   - PI_CMD_SCRIPT] = &&op_pop,
+      [PI_CMD_POPA  - PI_CMD_SCRIPT] = &&op_popa,
+      [PI_CMD_PUSH  - PI_CMD_SCRIPT] = &&op_push,
+      [PI_CMD_PUSHA - PI_CMD_SCRIPT] = &&op_pusha,
+      [PI_CMD_RET   - PI_CMD_SCRIPT] = &&op_ret,
+      [PI_CMD_RL    - PI_CMD_SCRIPT] = &&op_rl,
+      [PI_CMD_RLA   - PI_CMD_SCRIPT] = &&op_rla,
+      [PI_CMD_RR    - PI_CMD_SCRIPT] = &&op_rr,
+      [PI_CMD_RRA   - PI_CMD_SCRIPT] = &&op_rra,
+      [PI_CMD_STA   - PI_CMD_SCRIPT] = &&op_sta,
+      [PI_CMD_STAB  - PI_CMD_SCRIPT] = &&op_stab,
+      [PI_CMD_SUB   - PI_CMD_SCRIPT] = &&op_sub,
+      [PI_CMD_SYS   - PI_CMD_SCRIPT] = &&op_sys,
+      [PI_CMD_WAIT  - PI_CMD_SCRIPT] = &&op_wait,
+      [PI_CMD_X     - PI_CMD_SCRIPT] = &&op_x,
+      [PI_CMD_XA    - PI_CMD_SCRIPT] = &&op_xa,
+      [PI_CMD_XOR   - PI_CMD_SCRIPT] = &&op_xor,
+      [PI_CMD_EMIT  - PI_CMD_SCRIPT] = &&op_emit,
+      [PI_CMD_EMITV - PI_CMD_SCRIPT] = &&op_emitv,
+      [PI_CMD_EMITP - PI_CMD_SCRIPT] = &&op_emitp,
+      [PI_CMD_BCMP  - PI_CMD_SCRIPT] = &&op_bcmp,
+      [PI_CMD_BCRC8 - PI_CMD_SCRIPT] = &&op_bcrc8,
+      [PI_CMD_BCRC16- PI_CMD_SCRIPT] = &&op_bcrc16,
+      [PI_CMD_BLDB  - PI_CMD_SCRIPT] = &&op_bldb,
+      [PI_CMD_BLDL  - PI_CMD_SCRIPT] = &&op_bldl,
+      [PI_CMD_BMOV  - PI_CMD_SCRIPT] = &&op_bmov,
+      [PI_CMD_BXOR  - PI_CMD_SCRIPT] = &&op_bxor,
+      [PI_CMD_WTICK - PI_CMD_SCRIPT] = &&op_wtick,
+      [PI_CMD_WLEV  - PI_CMD_SCRIPT] = &&op_wlev,
+      [SCR_OP_CMD]                   = &&op_cmd,
+      [SCR_OP_W]                     = &&op_w,
+      [SCR_OP_R]                     = &&op_r,
+      [SCR_OP_BR1]                   = &&op_br1,
+      [SCR_OP_BR2]                   = &&op_br2,
+      [SCR_OP_TICK]                  = &&op_tick,
+      [SCR_OP_MICS]                  = &&op_mics,
+      [SCR_OP_MILS]                  = &&op_mils,
+      [SCR_OP_CMPJZ]                 = &&op_cmpjz,
+      [SCR_OP_CMPJNZ]                = &&op_cmpjnz,
+      [SCR_OP_CMPJM]                 = &&op_cmpjm,
+      [SCR_OP_CMPJP]                 = &&op_cmpjp,
+      [SCR_OP_DCRJNZ]                = &&op_dcrjnz,
+      [SCR_OP_END]                   = &&op_end,
+   };
 
-   gpioReg = initMapMem(fdMem, GPIO_BASE, GPIO_LEN);
+   prof = s->profOn ? s->prof : NULL;
 
-   if (gpioReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap gpio failed (%m)");
+   profStep = -1;
+   profTick = 0;
 
-   /* dma channels 0-14 share one page, 15 has another */
+   /*
+      Direct thread the ops, anything without a label is a NOP.
+      While profiling every op but END first goes through op_prof.
+   */
 
-   if (gpioCfg.DMAprimaryChannel < 15)
+   if ((s->op[0].code == NULL) || ((prof != NULL) != s->profThreaded))
    {
-      dmaBase = DMA_BASE;
-   }
-   else dmaBase = DMA15_BASE;
+      for (i=0; i<=s->script.instrs; i++)
+      {
+         s->op[i].run = label[s->op[i].kind];
+         if (s->op[i].run == NULL) s->op[i].run = &&op_nop;
 
-   dmaReg = initMapMem(fdMem, dmaBase,  DMA_LEN);
+         if (prof && (i < s->script.instrs)) s->op[i].code = &&op_prof;
+         else                                s->op[i].code = s->op[i].run;
+      }
 
-   if (dmaReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap dma failed (%m)");
+      s->profThreaded = (prof != NULL);
+   }
 
-   if (gpioCfg.DMAprimaryChannel < 15)
+   if (prof)
    {
-      dmaIn =  dmaReg + (gpioCfg.DMAprimaryChannel   * 0x40);
-      dmaOut = dmaReg + (gpioCfg.DMAsecondaryChannel * 0x40);
+      profTick = systReg[SYST_CLO];
+
+      if (s->blockStep >= 0)
+         prof[s->blockStep].blockMicros += (profTick - s->blockTick);
    }
 
-   DBG(DBG_STARTUP, "DMA #%d @ %08X @ %08X",
-      gpioCfg.DMAprimaryChannel, dmaBase, (uint32_t)dmaIn);
+   s->blockStep = -1;
 
-   DBG(DBG_STARTUP, "debug reg is %08X", dmaIn[DMA_DEBUG]);
+   A  = s->A;
+   F  = s->F;
+   SP = s->SP;
+   S  = s->stack;
 
-   clkReg  = initMapMem(fdMem, CLK_BASE,  CLK_LEN);
+   buf = s->buf;
 
-   if (clkReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap clk failed (%m)");
+   slice = SCR_SLICE;
 
-   systReg  = initMapMem(fdMem, SYST_BASE,  SYST_LEN);
+   SCR_NEXT(s->pc);
 
-   if (systReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap syst failed (%m)");
+   op_prof:
+      startTick = systReg[SYST_CLO];
+      if (profStep >= 0) prof[profStep].micros += (startTick - profTick);
+      profStep = op - s->op;
+      profTick = startTick;
+      prof[profStep].count++;
+      goto *op->run;
 
-   spiReg  = initMapMem(fdMem, SPI_BASE,  SPI_LEN);
+   op_add:   A += *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   if (spiReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap spi failed (%m)");
+   op_and:   A &= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   pwmReg  = initMapMem(fdMem, PWM_BASE,  PWM_LEN);
+   op_call:
+      scrPush(s, &SP, S, (op - s->op) + 1);
+      SCR_JUMP(op->jmp);
 
-   if (pwmReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap pwm failed (%m)");
+   op_cmp:   F = A - *op->a1;                        SCR_NEXT(op+1);
 
-   pcmReg  = initMapMem(fdMem, PCM_BASE,  PCM_LEN);
+   op_dcr:   F = --(*op->a1);                        SCR_NEXT(op+1);
 
-   if (pcmReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap pcm failed (%m)");
+   op_dcra:  --A; F=A;                               SCR_NEXT(op+1);
 
-   auxReg  = initMapMem(fdMem, AUX_BASE,  AUX_LEN);
+   op_div:   A /= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   if (auxReg == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap aux failed (%m)");
+   op_halt:  s->run_state = PI_SCRIPT_HALTED;        SCR_NEXT(op);
 
-   return 0;
-}
+   op_inr:   F = ++(*op->a1);                        SCR_NEXT(op+1);
 
-/* ----------------------------------------------------------------------- */
+   op_inra:  ++A; F=A;                               SCR_NEXT(op+1);
 
-static int initZaps
-   (int  pmapFd, void *virtualBase, int  basePage, int  pages)
-{
-   int n;
-   long index;
-   off_t offset;
-   ssize_t t;
-   uint32_t physical;
-   int status;
-   uint32_t pageAdr;
-   unsigned long long pa;
+   op_jm:    if (F<0)  SCR_JUMP(op->jmp);            SCR_NEXT(op+1);
 
-   DBG(DBG_STARTUP, "");
+   op_jmp:             SCR_JUMP(op->jmp);
 
-   status = 0;
+   op_jnz:   if (F)    SCR_JUMP(op->jmp);            SCR_NEXT(op+1);
 
-   pageAdr = (uint32_t) dmaVirt[basePage];
+   op_jp:    if (F>=0) SCR_JUMP(op->jmp);            SCR_NEXT(op+1);
 
-   index  = ((uint32_t)virtualBase / PAGE_SIZE) * 8;
+   op_jz:    if (!F)   SCR_JUMP(op->jmp);            SCR_NEXT(op+1);
 
-   offset = lseek(pmapFd, index, SEEK_SET);
+   op_cmpjz:  F = A - *op->a1; if (!F)   SCR_JUMP(op->jmp); SCR_NEXT(op+1);
 
-   if (offset != index)
-      SOFT_ERROR(PI_INIT_FAILED, "lseek pagemap failed (%m)");
+   op_cmpjnz: F = A - *op->a1; if (F)    SCR_JUMP(op->jmp); SCR_NEXT(op+1);
 
-   for (n=0; n<pages; n++)
-   {
-      t = read(pmapFd, &pa, sizeof(pa));
+   op_cmpjm:  F = A - *op->a1; if (F<0)  SCR_JUMP(op->jmp); SCR_NEXT(op+1);
 
-      if (t != sizeof(pa))
-         SOFT_ERROR(PI_INIT_FAILED, "read pagemap failed (%m)");
+   op_cmpjp:  F = A - *op->a1; if (F>=0) SCR_JUMP(op->jmp); SCR_NEXT(op+1);
 
-      DBG(DBG_STARTUP, "pf%d=%016llX", n, pa);
+   op_dcrjnz: F = --(*op->a1); if (F)    SCR_JUMP(op->jmp); SCR_NEXT(op+1);
 
-      physical = 0x3FFFFFFF & (PAGE_SIZE * (pa & 0xFFFFFFFF));
+   op_ld:    *op->a1 = *op->a2;                      SCR_NEXT(op+1);
 
-      if (physical)
-      {
-         dmaBus[basePage+n] = (dmaPage_t *) (physical | pi_dram_bus);
+   op_lda:   A = *op->a1;                            SCR_NEXT(op+1);
 
-         dmaVirt[basePage+n] = mmap
-         (
-            (void *)pageAdr,
-            PAGE_SIZE,
-            PROT_READ|PROT_WRITE,
-            MAP_SHARED|MAP_FIXED|MAP_LOCKED|MAP_NORESERVE,
-            fdMem,
-            physical
-         );
-      }
-      else status = 1;
+   op_ldab:
+      if ((*op->a1 >= 0) && (*op->a1 < CMD_MAX_EXTENSION)) A = buf[*op->a1];
+      SCR_NEXT(op+1);
 
-      pageAdr += PAGE_SIZE;
-   }
+   op_mlt:   A *= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   return status;
-}
+   op_mod:   A %= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-/* ----------------------------------------------------------------------- */
+   op_nop:                                           SCR_NEXT(op+1);
 
-static int initPagemapBlock(int block)
-{
-   int trys, ok;
-   unsigned pageNum;
+   op_or:    A |= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   DBG(DBG_STARTUP, "block=%d", block);
+   op_pop:   *op->a1 = scrPop(s, &SP, S);            SCR_NEXT(op+1);
 
-   dmaPMapBlk[block] = mmap(
-       0, (PAGES_PER_BLOCK*PAGE_SIZE),
-       PROT_READ|PROT_WRITE,
-       MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE|MAP_LOCKED,
-       -1, 0);
+   op_popa:  A = scrPop(s, &SP, S);                  SCR_NEXT(op+1);
 
-   if (dmaPMapBlk[block] == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap dma block %d failed (%m)", block);
+   op_push:  scrPush(s, &SP, S, *op->a1);            SCR_NEXT(op+1);
 
-   /* force allocation of physical memory */
+   op_pusha: scrPush(s, &SP, S, A);                  SCR_NEXT(op+1);
 
-   memset((void *)dmaPMapBlk[block], 0xAA, (PAGES_PER_BLOCK*PAGE_SIZE));
+   op_ret:
+      pc = scrPop(s, &SP, S);
+      if ((pc < 0) || (pc > s->script.instrs)) pc = s->script.instrs;
+      SCR_JUMP(s->op + pc);
 
-   memset((void *)dmaPMapBlk[block], 0xFF, (PAGES_PER_BLOCK*PAGE_SIZE));
+   op_rl:    F = (*op->a1 <<= *op->a2);              SCR_NEXT(op+1);
 
-   memset((void *)dmaPMapBlk[block], 0, (PAGES_PER_BLOCK*PAGE_SIZE));
+   op_rla:   A <<= *op->a1; F=A;                     SCR_NEXT(op+1);
 
-   pageNum = block * PAGES_PER_BLOCK;
+   op_rr:    F = (*op->a1 >>= *op->a2);              SCR_NEXT(op+1);
 
-   dmaVirt[pageNum] = mmap(
-       0, (PAGES_PER_BLOCK*PAGE_SIZE),
-       PROT_READ|PROT_WRITE,
-       MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE|MAP_LOCKED,
-       -1, 0);
+   op_rra:   A >>= *op->a1; F=A;                     SCR_NEXT(op+1);
 
-   if (dmaVirt[pageNum] == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap dma block %d failed (%m)", block);
+   op_sta:   *op->a1 = A;                            SCR_NEXT(op+1);
 
-   munmap(dmaVirt[pageNum], PAGES_PER_BLOCK*PAGE_SIZE);
+   op_stab:
+      if ((*op->a1 >= 0) && (*op->a1 < CMD_MAX_EXTENSION)) buf[*op->a1] = A;
+      SCR_NEXT(op+1);
 
-   trys = 0;
-   ok = 0;
+   op_sub:   A -= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   while ((trys < 10) && !ok)
-   {
-      if (initZaps(fdPmap,
-                    dmaPMapBlk[block],
-                    pageNum,
-                    PAGES_PER_BLOCK) == 0) ok = 1;
-      else myGpioDelay(50000);
+   op_sys:
+      scrBlockStart(); /* the shell command may run for any time */
+      A = scrSys((char*)op->instr->p[4], A, *(gpioReg + GPLEV0));
+      scrBlockEnd();
+      F = A;
+      SCR_NEXT(op+1);
 
-      ++trys;
-   }
+   op_wait:
+      /* A and F are set to the changed bits by scrWake */
+      s->waitBits = *op->a1;
+      SCR_YIELD(op+1, SCR_WAIT);
 
-   if (!ok) SOFT_ERROR(PI_INIT_FAILED, "initZaps failed");
+   op_wtick: F = A = s->waitTick;                   SCR_NEXT(op+1);
 
-   return 0;
-}
+   op_wlev:  F = A = s->waitLevel;                  SCR_NEXT(op+1);
 
-static int initMboxBlock(int block)
-{
-   int n, ok;
-   unsigned page;
-   uintptr_t virtualAdr;
-   uintptr_t busAdr;
+   op_x:     scrSwap(op->a1, op->a2);                SCR_NEXT(op+1);
 
-   DBG(DBG_STARTUP, "block=%d", block);
+   op_xa:    scrSwap(op->a1, &A);                    SCR_NEXT(op+1);
 
-   ok = mbDMAAlloc
-      (&dmaMboxBlk[block], PAGES_PER_BLOCK * PAGE_SIZE, pi_mem_flag);
+   op_xor:   A ^= *op->a1; F=A;                      SCR_NEXT(op+1);
 
-   if (!ok) SOFT_ERROR(PI_INIT_FAILED, "init mbox zaps failed");
+   op_emit:
+      A = scrEmit(s, *op->a1, op->a2, 1, 1);
+      F = A;
+      SCR_NEXT(op+1);
 
-   page = block * PAGES_PER_BLOCK;
+   op_emitv:
+      A = scrEmit(s, *op->a1, s->script.var, *op->a2, PI_MAX_SCRIPT_VARS);
+      F = A;
+      SCR_NEXT(op+1);
 
-   virtualAdr = (uintptr_t) dmaMboxBlk[block].virtual_addr;
-   busAdr = dmaMboxBlk[block].bus_addr;
+   op_emitp:
+      A = scrEmit(s, *op->a1, s->script.par, *op->a2, PI_MAX_SCRIPT_PARAMS);
+      F = A;
+      SCR_NEXT(op+1);
 
-   for (n=0; n<PAGES_PER_BLOCK; n++)
-   {
-      dmaVirt[page+n] = (dmaPage_t *) virtualAdr;
-      dmaBus[page+n] = (dmaPage_t *) busAdr;
-      virtualAdr += PAGE_SIZE;
-      busAdr += PAGE_SIZE;
-   }
+   /* block commands work on A bytes of buf */
 
-   return 0;
-}
+   op_bcmp:
+      if (scrBufOk(*op->a1, A) && scrBufOk(*op->a2, A))
+      {
+         A = memcmp(buf + *op->a1, buf + *op->a2, A);
+         if (A) A = (A < 0) ? -1 : 1;
+      }
+      else A = PI_BAD_BUF_RANGE;
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_bcrc8:
+      if (scrBufOk(*op->a1, A))
+         A = scrCrc((uint8_t *)buf + *op->a1, A, 8,
+                    *op->a2 & 0xFF, (*op->a2 >> 8) & 0xFF);
+      else A = PI_BAD_BUF_RANGE;
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_bcrc16:
+      if (scrBufOk(*op->a1, A))
+         A = scrCrc((uint8_t *)buf + *op->a1, A, 16,
+                    *op->a2 & 0xFFFF, (*op->a2 >> 16) & 0xFFFF);
+      else A = PI_BAD_BUF_RANGE;
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_bldb:
+      if ((A >= 1) && (A <= 4) && scrBufOk(*op->a2, A))
+      {
+         F = 0;
+         for (i=0; i<A; i++) F = (F << 8) | (uint8_t)buf[*op->a2 + i];
+         *op->a1 = F;
+      }
+      else F = A = PI_BAD_BUF_RANGE;
+      SCR_NEXT(op+1);
 
-/* ----------------------------------------------------------------------- */
+   op_bldl:
+      if ((A >= 1) && (A <= 4) && scrBufOk(*op->a2, A))
+      {
+         F = 0;
+         for (i=A-1; i>=0; i--) F = (F << 8) | (uint8_t)buf[*op->a2 + i];
+         *op->a1 = F;
+      }
+      else F = A = PI_BAD_BUF_RANGE;
+      SCR_NEXT(op+1);
 
-static int initAllocDMAMem(void)
-{
-   int i, servoCycles, superCycles;
-   int status;
+   op_bmov:
+      if (scrBufOk(*op->a1, A) && scrBufOk(*op->a2, A))
+      {
+         memmove(buf + *op->a1, buf + *op->a2, A);
+         F = A;
+      }
+      else F = A = PI_BAD_BUF_RANGE;
+      SCR_NEXT(op+1);
 
-   DBG(DBG_STARTUP, "");
+   op_bxor:
+      if (scrBufOk(*op->a1, A))
+      {
+         F = 0;
+         for (i=0; i<A; i++) F ^= (uint8_t)buf[*op->a1 + i];
+         A = F;
+      }
+      else F = A = PI_BAD_BUF_RANGE;
+      SCR_NEXT(op+1);
 
-   /* Calculate the number of blocks needed for buffers.  The number
-      of blocks must be a multiple of the 20ms servo cycle.
+   op_cmd:
+      p[0] = op->instr->p[0];
+      p[1] = *op->a1;
+      p[2] = *op->a2;
+      p[3] = op->instr->p[3];
+      p[4] = op->instr->p[4];
+
+      if (p[3]) memcpy(buf, (char *)p[4], p[3]);
+
+      if (scrBlocking(p[0]))
+      {
+         scrBlockStart();
+         A = myDoCommand(p, CMD_MAX_EXTENSION-1, buf);
+         scrBlockEnd();
+      }
+      else A = myDoCommand(p, CMD_MAX_EXTENSION-1, buf);
+
+      F = A;
+      SCR_NEXT(op+1);
+
+   /*
+      Commands which bit-banging scripts issue in their inner
+      loops bypass the myDoCommand switch and are still counted in
+      the statistics.  Only a W which changes the gpio to output
+      (and may end PWM/servo on it) takes the gpio command lock.
    */
 
-   servoCycles = gpioCfg.bufferMilliseconds / 20;
-   if           (gpioCfg.bufferMilliseconds % 20) servoCycles++;
+   op_w:
+      startTick = systReg[SYST_CLO];
+      if (myPermit(*op->a1))
+      {
+         if ((*op->a1 <= PI_MAX_GPIO) &&
+             (gpioInfo[*op->a1].is == GPIO_WRITE))
+         {
+            A = gpioWrite(*op->a1, *op->a2);
+         }
+         else
+         {
+            pthread_rwlock_wrlock(&cmdLock[CMD_LOCK_GPIO]);
+            A = gpioWrite(*op->a1, *op->a2);
+            pthread_rwlock_unlock(&cmdLock[CMD_LOCK_GPIO]);
+         }
+      }
+      else
+      {
+         DBG(DBG_USER, "gpioWrite: gpio %d, no permission to update",
+            *op->a1);
+         A = PI_NOT_PERMITTED;
+      }
+      myCmdStats(PI_CMD_WRITE, systReg[SYST_CLO] - startTick, A);
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_r:
+      startTick = systReg[SYST_CLO];
+      A = gpioRead(*op->a1);
+      myCmdStats(PI_CMD_READ, systReg[SYST_CLO] - startTick, A);
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_br1:
+      startTick = systReg[SYST_CLO];
+      A = gpioRead_Bits_0_31();
+      myCmdStats(PI_CMD_BR1, systReg[SYST_CLO] - startTick, A);
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_br2:
+      startTick = systReg[SYST_CLO];
+      A = gpioRead_Bits_32_53();
+      myCmdStats(PI_CMD_BR2, systReg[SYST_CLO] - startTick, A);
+      F = A;
+      SCR_NEXT(op+1);
+
+   op_tick:
+      startTick = systReg[SYST_CLO];
+      A = gpioTick();
+      myCmdStats(PI_CMD_TICK, systReg[SYST_CLO] - startTick, A);
+      F = A;
+      SCR_NEXT(op+1);
+
+   /* delays give the worker to other scripts, very short ones spin */
+
+   op_mics:
+      if ((uint32_t)*op->a1 > PI_MAX_MICS_DELAY)
+      {
+         A = PI_BAD_MICS_DELAY;
+         myCmdStats(PI_CMD_MICS, 0, A);
+         F = A;
+         SCR_NEXT(op+1);
+      }
 
-   bufferCycles = (SUPERCYCLE * servoCycles) / gpioCfg.clockMicros;
+      A = 0;
+      F = 0;
 
-   superCycles = bufferCycles / SUPERCYCLE;
-   if           (bufferCycles % SUPERCYCLE) superCycles++;
+      myCmdStats(PI_CMD_MICS, *op->a1, A);
 
-   bufferCycles = SUPERCYCLE * superCycles;
+      if (*op->a1 < SCR_SPIN_MICROS)
+      {
+         myGpioDelay(*op->a1);
+         SCR_NEXT(op+1);
+      }
 
-   bufferBlocks = bufferCycles / CYCLES_PER_BLOCK;
+      s->wake = scrNow() + *op->a1;
+      SCR_YIELD(op+1, SCR_SLEEP);
 
-   DBG(DBG_STARTUP, "bmillis=%d mics=%d bblk=%d bcyc=%d",
-      gpioCfg.bufferMilliseconds, gpioCfg.clockMicros,
-      bufferBlocks, bufferCycles);
+   op_mils:
+      if ((uint32_t)*op->a1 > PI_MAX_MILS_DELAY)
+      {
+         A = PI_BAD_MILS_DELAY;
+         myCmdStats(PI_CMD_MILS, 0, A);
+         F = A;
+         SCR_NEXT(op+1);
+      }
 
-   /* allocate memory for pointers to virtual and bus memory pages */
+      A = 0;
+      F = 0;
 
-   dmaVirt = mmap(
-       0, PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
-       PROT_READ|PROT_WRITE,
-       MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
-       -1, 0);
+      myCmdStats(PI_CMD_MILS, *op->a1 * THOUSAND, A);
 
-   if (dmaVirt == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap dma virtual failed (%m)");
+      s->wake = scrNow() + ((uint64_t)*op->a1 * THOUSAND);
+      SCR_YIELD(op+1, SCR_SLEEP);
 
-   dmaBus = mmap(
-       0, PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
-       PROT_READ|PROT_WRITE,
-       MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
-       -1, 0);
+   op_end:
+      SCR_YIELD(op, SCR_IDLE);
+}
 
-   if (dmaBus == MAP_FAILED)
-      SOFT_ERROR(PI_INIT_FAILED, "mmap dma bus failed (%m)");
+/* ----------------------------------------------------------------------- */
 
-   dmaIVirt = (dmaIPage_t **) dmaVirt;
-   dmaIBus  = (dmaIPage_t **) dmaBus;
+static void * pthTimerTick(void *x)
+{
+   gpioTimer_t *     tp;
+   struct timespec   req, rem, period;
+   char              buf[256];
 
-   dmaOVirt = (dmaOPage_t **)(dmaVirt + (PAGES_PER_BLOCK*bufferBlocks));
-   dmaOBus  = (dmaOPage_t **)(dmaBus  + (PAGES_PER_BLOCK*bufferBlocks));
+   tp = x;
 
-   if ((gpioCfg.memAllocMode == PI_MEM_ALLOC_PAGEMAP) ||
-       ((gpioCfg.memAllocMode == PI_MEM_ALLOC_AUTO) &&
-        (gpioCfg.bufferMilliseconds > PI_DEFAULT_BUFFER_MILLIS)))
+   clock_gettime(CLOCK_REALTIME, &tp->nextTick);
+
+   while (1)
    {
-      /* pagemap allocation of DMA memory */
+      clock_gettime(CLOCK_REALTIME, &rem);
 
-      dmaPMapBlk = mmap(
-          0, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
-          PROT_READ|PROT_WRITE,
-          MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
-          -1, 0);
+      period.tv_sec  = tp->millis / THOUSAND;
+      period.tv_nsec = (tp->millis % THOUSAND) * THOUSAND * THOUSAND;
 
-      if (dmaPMapBlk == MAP_FAILED)
-         SOFT_ERROR(PI_INIT_FAILED, "pagemap mmap block failed (%m)");
+      do
+      {
+         TIMER_ADD(&tp->nextTick, &period, &tp->nextTick);
 
-      fdPmap = open("/proc/self/pagemap", O_RDONLY);
+         TIMER_SUB(&tp->nextTick, &rem, &req);
+      }
+      while (req.tv_sec < 0);
 
-      if (fdPmap < 0)
-         SOFT_ERROR(PI_INIT_FAILED, "pagemap open failed(%m)");
+      while (nanosleep(&req, &rem))
+      {
+         req.tv_sec  = rem.tv_sec;
+         req.tv_nsec = rem.tv_nsec;
+      }
 
-      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      if (gpioCfg.dbgLevel >= DBG_SLOW_TICK)
       {
-         status = initPagemapBlock(i);
-         if (status < 0)
+         if ((tp->millis > 50) || (gpioCfg.dbgLevel >= DBG_FAST_TICK))
          {
-            close(fdPmap);
-            return status;
+            sprintf(buf, "pigpio: TIMER=%d @ %u %u\n",
+               tp->id,
+              (unsigned)tp->nextTick.tv_sec,
+              (unsigned)tp->nextTick.tv_nsec);
+            fprintf(stderr, buf);
          }
       }
 
-      close(fdPmap);
-
-      DBG(DBG_STARTUP, "dmaPMapBlk=%08X dmaIn=%08X",
-         (uint32_t)dmaPMapBlk, (uint32_t)dmaIn);
+      if (tp->ex) (tp->func)(tp->userdata);
+      else        (tp->func)();
    }
-   else
-   {
-      /* mailbox allocation of DMA memory */
 
-      dmaMboxBlk = mmap(
-          0, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(DMAMem_t),
-          PROT_READ|PROT_WRITE,
-          MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
-          -1, 0);
+   return 0;
+}
 
-      if (dmaMboxBlk == MAP_FAILED)
-         SOFT_ERROR(PI_INIT_FAILED, "mmap mbox block failed (%m)");
+/* ----------------------------------------------------------------------- */
 
-      if (mbCreate() < 0)
-         SOFT_ERROR(PI_INIT_FAILED, "mbox create failed(%m)");
 
-      fdMbox = mbOpen();
+static char *myFmtInt(char *out, int val)
+{
+   char tmp[12];
+   unsigned u;
+   int n;
 
-      if (fdMbox < 0)
-         SOFT_ERROR(PI_INIT_FAILED, "mbox open failed(%m)");
+   if (val < 0)
+   {
+      *out++ = '-';
+      u = -(unsigned)val;
+   }
+   else u = val;
 
-      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
-      {
-         status = initMboxBlock(i);
-         if (status < 0)
-         {
-            mbClose(fdMbox);
-            return status;
-         }
-      }
+   n = 0;
 
-      mbClose(fdMbox);
+   do
+   {
+      tmp[n++] = '0' + (u % 10);
+      u /= 10;
+   } while (u);
 
-      DBG(DBG_STARTUP, "dmaMboxBlk=%08X dmaIn=%08X",
-         (uint32_t)dmaMboxBlk, (uint32_t)dmaIn);
-   }
+   while (n) *out++ = tmp[--n];
 
-   DBG(DBG_STARTUP,
-      "gpioReg=%08X pwmReg=%08X pcmReg=%08X clkReg=%08X auxReg=%08X",
-      (uint32_t)gpioReg, (uint32_t)pwmReg,
-      (uint32_t)pcmReg,  (uint32_t)clkReg, (uint32_t)auxReg);
+   return out;
+}
 
-   for (i=0; i<DMAI_PAGES; i++)
-      DBG(DBG_STARTUP, "dmaIBus[%d]=%08X", i, (uint32_t)dmaIBus[i]);
+/* ----------------------------------------------------------------------- */
 
-   if (gpioCfg.dbgLevel >= DBG_DMACBS)
+static char *myFmtFifoResult(
+   char *out, int rv, int res, char *v, int binary)
+{
+   int i, j;
+   uint32_t *param;
+   gpioCmdStats_t *cs;
+   gpioScriptProf_t *sp;
+   gpioChainInfo_t *ci;
+
+   if (binary)
    {
-      fprintf(stderr, "*** INPUT DMA CONTROL BLOCKS ***\n");
-      for (i=0; i<NUM_CBS; i++) dmaCbPrint(i);
-   }
+      memcpy(out, &res, 4);
+      out += 4;
 
-   return 0;
-}
+      switch (rv)
+      {
+         case 5:
+            i = strlen(cmdUsage);
+            memcpy(out, cmdUsage, i);
+            out += i;
+            break;
 
-/* ----------------------------------------------------------------------- */
+         case 6:
+         case 8:
+         case 9:
+         case 10:
+            if (res > 0)
+            {
+               memcpy(out, v, res);
+               out += res;
+            }
+            break;
 
-static void initPWM(unsigned bits)
-{
-   DBG(DBG_STARTUP, "bits=%d", bits);
+         case 7:
+            if (res >= 0)
+            {
+               memcpy(out, v, 4*PI_MAX_SCRIPT_PARAMS);
+               out += 4*PI_MAX_SCRIPT_PARAMS;
+            }
+            break;
+      }
 
-   /* reset PWM */
+      return out;
+   }
 
-   pwmReg[PWM_CTL] = 0;
+   switch (rv)
+   {
+      case 0:
+      case 1:
+      case 2:
+         out = myFmtInt(out, res);
+         *out++ = '\n';
+         break;
 
-   myGpioDelay(10);
+      case 3:
+         out += sprintf(out, "%08X\n", res);
+         break;
 
-   pwmReg[PWM_STA] = -1;
+      case 4:
+         out += sprintf(out, "%u\n", res);
+         break;
 
-   myGpioDelay(10);
+      case 5:
+         i = strlen(cmdUsage);
+         memcpy(out, cmdUsage, i);
+         out += i;
+         break;
 
-   /* set number of bits to transmit */
+      case 6:
+         out = myFmtInt(out, res);
+         if (res > 0)
+         {
+            for (i=0; i<res; i++)
+            {
+               *out++ = ' ';
+               out = myFmtInt(out, v[i]);
+            }
+         }
+         *out++ = '\n';
+         break;
 
-   pwmReg[PWM_RNG1] = bits;
+      case 7:
+         out = myFmtInt(out, res);
+         if (res >= 0)
+         {
+            param = (uint32_t *)v;
+            for (i=0; i<PI_MAX_SCRIPT_PARAMS; i++)
+            {
+               *out++ = ' ';
+               out = myFmtInt(out, param[i]);
+            }
+         }
+         *out++ = '\n';
+         break;
 
-   myGpioDelay(10);
+      case 8:
+         if (res < 0)
+         {
+            out = myFmtInt(out, res);
+            *out++ = '\n';
+         }
+         else
+         {
+            cs = (gpioCmdStats_t *)v;
+            for (i=0; i<(res/sizeof(gpioCmdStats_t)); i++)
+            {
+               out += sprintf(out, "%s %u %u %u %u",
+                  cmdName(cs[i].cmd), cs[i].calls, cs[i].errors,
+                  cs[i].calls ?
+                     (unsigned)(cs[i].totalMicros/cs[i].calls) : 0,
+                  cs[i].maxMicros);
+               for (j=0; j<PI_CMD_STATS_BUCKETS; j++)
+               {
+                  out += sprintf(out, " %u", cs[i].execHist[j]);
+               }
+               *out++ = '\n';
+            }
+         }
+         break;
 
-   dmaIVirt[0]->periphData = 1;
+      case 9:
+         if (res < 0)
+         {
+            out = myFmtInt(out, res);
+            *out++ = '\n';
+         }
+         else
+         {
+            sp = (gpioScriptProf_t *)v;
+            for (i=0; i<(res/sizeof(gpioScriptProf_t)); i++)
+            {
+               out += sprintf(out, "%u %s %u %llu %llu\n",
+                  sp[i].step, cmdName(sp[i].cmd), sp[i].count,
+                  (unsigned long long)sp[i].micros,
+                  (unsigned long long)sp[i].blockMicros);
+            }
+         }
+         break;
 
-   /* enable PWM DMA, raise panic and dreq thresholds to 15 */
+      case 10:
+         if (res != sizeof(gpioChainInfo_t))
+         {
+            out = myFmtInt(out, res);
+         }
+         else
+         {
+            ci = (gpioChainInfo_t *)v;
+            out += sprintf(out, "%u %u %u %u %llu", ci->cbs, ci->ool,
+               ci->loops, ci->forever, (unsigned long long)ci->micros);
+         }
+         *out++ = '\n';
+         break;
+   }
 
-   pwmReg[PWM_DMAC] = PWM_DMAC_ENAB      |
-                      PWM_DMAC_PANIC(15) |
-                      PWM_DMAC_DREQ(15);
+   return out;
+}
 
-   myGpioDelay(10);
+/* ----------------------------------------------------------------------- */
 
-   /* clear PWM fifo */
+static void myFifoWrite(int fd, char *buf, int len)
+{
+   struct pollfd pfd;
+   int n;
 
-   pwmReg[PWM_CTL] = PWM_CTL_CLRF1;
+   /* the pipe is non-blocking, give a slow reader a chance to drain it */
 
-   myGpioDelay(10);
+   while (len > 0)
+   {
+      n = write(fd, buf, len);
 
-   /* enable PWM channel 1 and use fifo */
+      if (n > 0)
+      {
+         buf += n;
+         len -= n;
+      }
+      else if ((n < 0) && (errno == EAGAIN))
+      {
+         pfd.fd = fd;
+         pfd.events = POLLOUT;
 
-   pwmReg[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_MODE1 | PWM_CTL_PWEN1;
+         if (poll(&pfd, 1, 100) <= 0) break;
+      }
+      else break;
+   }
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void initPCM(unsigned bits)
+static void myFifoServe(FILE *inp, int outFd, fifoChannel_t *ch)
 {
-   DBG(DBG_STARTUP, "bits=%d", bits);
+   char buf[CMD_MAX_EXTENSION];
+   char v[CMD_MAX_EXTENSION];
+   char *out, *pos;
+   int idx, len, res, binary;
+   uint32_t p[CMD_P_ARR];
+   cmdCtlParse_t ctl;
 
-   /* disable PCM so we can modify the regs */
+   out = malloc(FIFO_OUT_SIZE);
 
-   pcmReg[PCM_CS] = 0;
+   if (out == NULL)
+   {
+      DBG(DBG_ALWAYS, "fifo buffer malloc failed (%m)");
+      return;
+   }
 
-   myGpioDelay(1000);
+   pthread_cleanup_push(free, out);
 
-   pcmReg[PCM_FIFO]   = 0;
-   pcmReg[PCM_MODE]   = 0;
-   pcmReg[PCM_RXC]    = 0;
-   pcmReg[PCM_TXC]    = 0;
-   pcmReg[PCM_DREQ]   = 0;
-   pcmReg[PCM_INTEN]  = 0;
-   pcmReg[PCM_INTSTC] = 0;
-   pcmReg[PCM_GRAY]   = 0;
+   binary = ch ? ch->binary : 0;
 
-   myGpioDelay(1000);
+   while (1)
+   {
+      if (fgets(buf, sizeof(buf), inp) == NULL)
+      {
+         DBG(DBG_ALWAYS, "fifo fgets failed (%m)");
+         break;
+      }
 
-   pcmReg[PCM_MODE] = PCM_MODE_FLEN(bits-1); /* # bits in frame */
+      if (ch && (ch->state == PI_FIFO_CLOSING)) break;
 
-   /* enable channel 1 with # bits width */
+      len = strlen(buf);
 
-   pcmReg[PCM_TXC] = PCM_TXC_CH1EN | PCM_TXC_CH1WID(bits-8);
+      if (len)
+      {
+        --len;
+        buf[len] = 0; /* replace terminating */
+      }
 
-   pcmReg[PCM_CS] |= PCM_CS_STBY; /* clear standby */
+      ctl.eaten = 0;
+      idx = 0;
 
-   myGpioDelay(1000);
+      pos = out;
 
-   pcmReg[PCM_CS] |= PCM_CS_TXCLR; /* clear TX FIFO */
+      /* all the replies to a line are written in one go */
 
-   pcmReg[PCM_CS] |= PCM_CS_DMAEN; /* enable DREQ */
+      while (((ctl.eaten)<len) && (idx >= 0))
+      {
+         if ((FIFO_OUT_SIZE - (pos - out)) < FIFO_REPLY_MAX)
+         {
+            myFifoWrite(outFd, out, pos - out);
+            pos = out;
+         }
 
-   pcmReg[PCM_DREQ] = PCM_DREQ_TX_PANIC(16) | PCM_DREQ_TX_REQ_L(30);
+         if ((idx=cmdParse(buf, p, CMD_MAX_EXTENSION, v, &ctl)) >= 0)
+         {
+            /* make sure extensions are null terminated */
 
-   pcmReg[PCM_INTSTC] = 0b1111; /* clear status bits */
+            v[p[3]] = 0;
 
-   /* enable PCM */
+            res = myDoCommand(p, sizeof(v)-1, v);
 
-   pcmReg[PCM_CS] |= PCM_CS_EN;
+            pos = myFmtFifoResult(pos, cmdInfo[idx].rv, res, v, binary);
+         }
+         else pos = myFmtFifoResult(pos, 0, PI_BAD_FIFO_COMMAND, v, binary);
+      }
 
-   /* enable tx */
+      if (pos != out) myFifoWrite(outFd, out, pos - out);
 
-   pcmReg[PCM_CS] |= PCM_CS_TXON;
+      if (ch && (ch->state == PI_FIFO_CLOSING)) break;
+   }
 
-   dmaIVirt[0]->periphData = 0x0F;
+   pthread_cleanup_pop(1);
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void initHWClk
-   (int clkCtl, int clkDiv, int clkSrc, int divI, int divF, int MASH)
+static void * pthFifoThread(void *x)
 {
-   DBG(DBG_INTERNAL, "ctl=%d div=%d src=%d /I=%d /f=%d M=%d",
-      clkCtl, clkDiv, clkSrc, divI, divF, MASH);
+   int flags;
 
-   /* kill the clock if busy, anything else isn't reliable */
+   myCreatePipe(PI_INPFIFO, 0662);
 
-   if (clkReg[clkCtl] & CLK_CTL_BUSY)
-   {
-      do
-      {
-         clkReg[clkCtl] = CLK_PASSWD | CLK_CTL_KILL;
-      }
-      while (clkReg[clkCtl] & CLK_CTL_BUSY);
-   }
+   if ((inpFifo = fopen(PI_INPFIFO, "r+")) == NULL)
+      SOFT_ERROR((void*)PI_INIT_FAILED, "fopen %s failed(%m)", PI_INPFIFO);
 
-   clkReg[clkDiv] = (CLK_PASSWD | CLK_DIV_DIVI(divI) | CLK_DIV_DIVF(divF));
+   myCreatePipe(PI_OUTFIFO, 0664);
 
-   usleep(10);
+   if ((outFifo = fopen(PI_OUTFIFO, "w+")) == NULL)
+      SOFT_ERROR((void*)PI_INIT_FAILED, "fopen %s failed (%m)", PI_OUTFIFO);
 
-   clkReg[clkCtl] = (CLK_PASSWD | CLK_CTL_MASH(MASH) | CLK_CTL_SRC(clkSrc));
+   /* set outFifo non-blocking */
 
-   usleep(10);
+   flags = fcntl(fileno(outFifo), F_GETFL, 0);
+   fcntl(fileno(outFifo), F_SETFL, flags | O_NONBLOCK);
 
-   clkReg[clkCtl] |= (CLK_PASSWD | CLK_CTL_ENAB);
-}
+   /* don't start until DMA started */
 
-static void initClock(int mainClock)
-{
-   const unsigned BITS=10;
-   int clockPWM;
-   unsigned clkCtl, clkDiv, clkSrc, clkDivI, clkDivF, clkMash, clkBits;
-   char *per;
-   unsigned micros;
+   spinWhileStarting();
 
-   DBG(DBG_STARTUP, "mainClock=%d", mainClock);
+   myFifoServe(inpFifo, fileno(outFifo), NULL);
 
-   if (mainClock) micros = gpioCfg.clockMicros;
-   else           micros = PI_WF_MICROS;
+   return 0;
+}
 
-   clockPWM = mainClock ^ (gpioCfg.clockPeriph == PI_CLOCK_PCM);
+/* ----------------------------------------------------------------------- */
 
-   if (clockPWM)
-   {
-      clkCtl = CLK_PWMCTL;
-      clkDiv = CLK_PWMDIV;
-      per = "PWM";
-   }
-   else
-   {
-      clkCtl = CLK_PCMCTL;
-      clkDiv = CLK_PCMDIV;
-      per = "PCM";
-   }
+static void myFifoRelease(fifoChannel_t *ch)
+{
+   char name[32];
+   int handle;
 
-   clkSrc  = CLK_CTL_SRC_PLLD;
-   clkDivI = 50 * micros; /* 10      MHz - 1      MHz */
-   clkBits = BITS;        /* 10/BITS MHz - 1/BITS MHz */
-   clkDivF = 0;
-   clkMash = 0;
+   handle = ch - fifoChannel;
 
-   DBG(DBG_STARTUP, "%s PLLD divi=%d divf=%d mash=%d bits=%d",
-      per, clkDivI, clkDivF, clkMash, clkBits);
+   if (ch->inp) fclose(ch->inp);
+   if (ch->out >= 0) close(ch->out);
 
-   initHWClk(clkCtl, clkDiv, clkSrc, clkDivI, clkDivF, clkMash);
+   ch->inp = NULL;
+   ch->out = -1;
 
-   if (clockPWM) initPWM(BITS);
-   else          initPCM(BITS);
+   sprintf(name, PI_INPFIFO_CH, handle);
+   unlink(name);
 
-   myGpioDelay(2000);
+   sprintf(name, PI_OUTFIFO_CH, handle);
+   unlink(name);
+
+   ch->state = PI_FIFO_CLOSED;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void initDMAgo(volatile uint32_t  *dmaAddr, uint32_t cbAddr)
+static void * pthFifoChannelThread(void *x)
 {
-   DBG(DBG_STARTUP, "");
+   fifoChannel_t *ch = x;
 
-   dmaAddr[DMA_CS] = DMA_CHANNEL_RESET;
+   myFifoServe(ch->inp, ch->out, ch);
 
-   dmaAddr[DMA_CS] = DMA_INTERRUPT_STATUS | DMA_END_FLAG;
+   /* closed by gpioFifoClose, nobody will join this thread */
 
-   dmaAddr[DMA_CONBLK_AD] = cbAddr;
+   pthread_detach(pthread_self());
 
-   /* clear READ/FIFO/READ_LAST_NOT_SET error bits */
+   /*
+      No later close may start, and one which has started may still
+      be writing to inp to wake this thread.
+   */
 
-   dmaAddr[DMA_DEBUG] = DMA_DEBUG_READ_ERR            |
-                        DMA_DEBUG_FIFO_ERR            |
-                        DMA_DEBUG_RD_LST_NOT_SET_ERR;
+   __sync_bool_compare_and_swap(&ch->state, PI_FIFO_OPENED, PI_FIFO_CLOSING);
 
+   while (ch->closers) myGpioSleep(0, 1000);
 
-   dmaAddr[DMA_CS] = DMA_WAIT_ON_WRITES    |
-                     DMA_PANIC_PRIORITY(8) |
-                     DMA_PRIORITY(8)       |
-                     DMA_ACTIVATE;
+   myFifoRelease(ch);
+
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-static void initClearGlobals(void)
+static int myStreamSerRead(unsigned handle, char *buf, unsigned count,
+   unsigned timeout)
 {
-   int i;
+   fd_set fds;
+   struct timeval tv;
+   int got, res;
 
-   DBG(DBG_STARTUP, "");
+   got = 0;
 
-   alertBits   = 0;
-   monitorBits = 0;
-   notifyBits  = 0;
-   scriptBits  = 0;
+   while (got < count)
+   {
+      res = serRead(handle, buf+got, count-got);
 
-   pthAlertRunning  = 0;
-   pthFifoRunning   = 0;
-   pthSocketRunning = 0;
+      if (res < 0) return res;
 
-   wfc[0] = 0;
-   wfc[1] = 0;
-   wfc[2] = 0;
+      if (res > 0) {got += res; continue;}
 
-   wfcur=0;
+      /* nothing pending, wait for more or give up when idle */
 
-   wfStats.micros     = 0;
-   wfStats.highMicros = 0;
-   wfStats.maxMicros  = PI_WAVE_MAX_MICROS;
+      FD_ZERO(&fds);
+      FD_SET(serInfo[handle].fd, &fds);
 
-   wfStats.pulses     = 0;
-   wfStats.highPulses = 0;
-   wfStats.maxPulses  = PI_WAVE_MAX_PULSES;
+      tv.tv_sec  = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
 
-   wfStats.cbs        = 0;
-   wfStats.highCbs    = 0;
-   wfStats.maxCbs     = (PI_WAVE_BLOCKS * PAGES_PER_BLOCK * CBS_PER_OPAGE);
+      if (select(serInfo[handle].fd+1, &fds, NULL, NULL, &tv) <= 0) break;
+   }
 
-   gpioGetSamples.func     = NULL;
-   gpioGetSamples.ex       = 0;
-   gpioGetSamples.userdata = NULL;
-   gpioGetSamples.bits     = 0;
+   return got;
+}
 
-   for (i=0; i<=PI_MAX_USER_GPIO; i++)
-   {
-      wfRx[i].mode         = PI_WFRX_NONE;
+/* ----------------------------------------------------------------------- */
 
-      gpioAlert[i].func    = NULL;
-   }
+static int myDoStream(int sock, uint32_t *p, char *buf)
+{
+   uint32_t h[4], q[5];
+   uint32_t arg, total, pos, elapsed, gap, held;
+   unsigned n, out;
+   char *inBuf, *outBuf;
+   gpioPulse_t *pulse;
+   int res, err, lock, i, ok, timed;
+   struct timeval tv, rcvTv, sndTv;
+   socklen_t len;
 
-   for (i=0; i<=PI_MAX_GPIO; i++)
-   {
-      gpioInfo [i].is      = GPIO_UNDEFINED;
-      gpioInfo [i].width   = 0;
-      gpioInfo [i].range   = PI_DEFAULT_DUTYCYCLE_RANGE;
-      gpioInfo [i].freqIdx = DEFAULT_PWM_IDX;
-   }
+   /*
+      buf holds room for the gap pulse which time shifts WVAGS
+      chunks, then the chunk being streamed in, then the chunk
+      being streamed out.
+   */
 
-   for (i=0; i<PI_NOTIFY_SLOTS; i++)
-   {
-      gpioNotify[i].seqno = 0;
-      gpioNotify[i].state = PI_NOTIFY_CLOSED;
-   }
+   pulse  = (gpioPulse_t *)buf;
+   inBuf  = buf + sizeof(gpioPulse_t);
+   outBuf = inBuf + PI_STREAM_CHUNK;
 
-   for (i=0; i<=PI_MAX_SIGNUM; i++)
+   arg = 0;
+   if (p[3] >= 4) memcpy(&arg, buf, 4);
+
+   total = p[2];
+   res = PI_STREAM_CHUNK;
+
+   switch (p[0])
    {
-      gpioSignal[i].func     = NULL;
-      gpioSignal[i].ex       = 0;
-      gpioSignal[i].userdata = NULL;
+      case PI_CMD_SPIXS:
+         lock = CMD_LOCK_SPI;
+         pthread_rwlock_wrlock(&cmdLock[lock]);
+
+         if ((p[1] >= PI_SPI_SLOTS) || (spiInfo[p[1]].state != PI_SPI_OPENED))
+            res = PI_BAD_HANDLE;
+         else if (!total || (arg & ~(PI_STREAM_TX|PI_STREAM_RX)))
+            res = PI_BAD_STREAM;
+         break;
+
+      case PI_CMD_SERRS: /* each chunk is locked below */
+         lock = CMD_LOCK_NONE;
+         pthread_rwlock_rdlock(&cmdLock[CMD_LOCK_SER]);
+
+         if ((p[1] >= PI_SER_SLOTS) || (serInfo[p[1]].state != PI_SER_OPENED))
+            res = PI_BAD_HANDLE;
+
+         pthread_rwlock_unlock(&cmdLock[CMD_LOCK_SER]);
+         break;
+
+      default: /* PI_CMD_WVAGS, each chunk is locked by myDoCommand */
+         lock = CMD_LOCK_NONE;
+
+         if (total % sizeof(gpioPulse_t)) res = PI_BAD_STREAM;
    }
 
-   for (i=0; i<=PI_MAX_TIMER; i++)
+   DBG(DBG_USER, "cmd=%d p1=%d total=%d arg=%d res=%d",
+      p[0], p[1], total, arg, res);
+
+   h[0] = p[0];
+   h[1] = p[1];
+   h[2] = total;
+   h[3] = res;
+
+   ok = (write(sock, h, 16) == 16);
+
+   if (res < 0) total = 0; /* refused, the stream is over */
+
+   /*
+      SPIXS holds the SPI lock, and chip select, for the whole
+      transfer.  Don't let a stalled client hold them for ever.
+   */
+
+   timed = 0;
+
+   if (ok && (lock == CMD_LOCK_SPI) && (res >= 0))
    {
-      gpioTimer[i].running = 0;
-      gpioTimer[i].func    = NULL;
+      len = sizeof(rcvTv);
+      getsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcvTv, &len);
+      len = sizeof(sndTv);
+      getsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &sndTv, &len);
+
+      tv.tv_sec  = PI_STREAM_TIMEOUT / 1000;
+      tv.tv_usec = (PI_STREAM_TIMEOUT % 1000) * 1000;
+
+      setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+      timed = 1;
    }
 
-   /* calculate the usable PWM frequencies */
+   pos = 0;
+   elapsed = 0;
+   held = 0;
+   err = 0;
 
-   for (i=0; i<PWM_FREQS; i++)
+   /*
+      Once a chunk fails every remaining chunk is still consumed
+      and acknowledged with the error so that the client, which
+      may have sent chunks ahead, stays in step.
+   */
+
+   while (ok && (pos < total))
    {
-      pwmFreq[i]=
-         (1000000.0/
-            ((float)PULSE_PER_CYCLE*gpioCfg.clockMicros*pwmCycles[i]))+0.5;
+      n = total - pos;
+      if (n > PI_STREAM_CHUNK) n = PI_STREAM_CHUNK;
 
-      DBG(DBG_STARTUP, "f%d is %d", i, pwmFreq[i]);
-   }
+      out = 0;
 
-   inpFifo = NULL;
-   outFifo = NULL;
+      if ((p[0] == PI_CMD_WVAGS) ||
+         ((p[0] == PI_CMD_SPIXS) && (arg & PI_STREAM_TX)))
+      {
+         if (recv(sock, inBuf, n, MSG_WAITALL) != n) {ok = 0; break;}
+      }
 
-   fdLock = -1;
-   fdMem  = -1;
-   fdSock = -1;
+      if (err) res = err;
 
-   dmaMboxBlk = MAP_FAILED;
-   dmaPMapBlk = MAP_FAILED;
-   dmaVirt = MAP_FAILED;
-   dmaBus  = MAP_FAILED;
+      else switch (p[0])
+      {
+         case PI_CMD_SPIXS:
+            spiGoPart(spiInfo[p[1]].speed, spiInfo[p[1]].flags,
+               (arg & PI_STREAM_TX) ? inBuf  : NULL,
+               (arg & PI_STREAM_RX) ? outBuf : NULL,
+               n, pos, (pos + n) == total);
 
-   auxReg  = MAP_FAILED;
-   clkReg  = MAP_FAILED;
-   dmaReg  = MAP_FAILED;
-   gpioReg = MAP_FAILED;
-   pcmReg  = MAP_FAILED;
-   pwmReg  = MAP_FAILED;
-   systReg = MAP_FAILED;
-   spiReg  = MAP_FAILED;
-}
+            held = ((pos + n) < total) ? pos + n : 0;
 
-/* ----------------------------------------------------------------------- */
+            res = n;
+            if (arg & PI_STREAM_RX) out = n;
+            break;
 
-static void initReleaseResources(void)
-{
-   int i;
+         case PI_CMD_SERRS:
+            pthread_rwlock_rdlock(&cmdLock[CMD_LOCK_SER]);
 
-   DBG(DBG_STARTUP, "");
+            if (serInfo[p[1]].state != PI_SER_OPENED) res = PI_BAD_HANDLE;
+            else res = myStreamSerRead(p[1], outBuf, n, arg);
 
-   /* shut down running threads */
+            pthread_rwlock_unlock(&cmdLock[CMD_LOCK_SER]);
 
-   for (i=0; i<=PI_MAX_TIMER; i++)
-   {
-      if (gpioTimer[i].running)
-      {
-         /* destroy thread */
+            if (res > 0) out = res;
+            break;
 
-         pthread_cancel(gpioTimer[i].pthId);
-         pthread_join(gpioTimer[i].pthId, NULL);
-         gpioTimer[i].running = 0;
+         case PI_CMD_WVAGS:
+            /* start this chunk after the pulses already streamed */
+
+            gap = elapsed;
+
+            for (i=0; i<(n/sizeof(gpioPulse_t)); i++)
+               elapsed += pulse[i+1].usDelay;
+
+            q[0] = PI_CMD_WVAG;
+            q[1] = 0;
+            q[2] = 0;
+
+            if (pos)
+            {
+               pulse[0].gpioOn  = 0;
+               pulse[0].gpioOff = 0;
+               pulse[0].usDelay = gap;
+
+               q[3] = n + sizeof(gpioPulse_t);
+               res = myDoCommand(q, q[3], buf);
+            }
+            else
+            {
+               q[3] = n;
+               res = myDoCommand(q, q[3], inBuf);
+            }
+
+            /* masked gpios are reported but don't end the stream */
+
+            if (res == PI_SOME_PERMITTED) res = wfc[wfcur];
+            break;
       }
-   }
 
-   if (pthAlertRunning)
-   {
-      pthread_cancel(pthAlert);
-      pthread_join(pthAlert, NULL);
-      pthAlertRunning = 0;
-   }
+      if (res < 0) err = res;
 
-   if (pthFifoRunning)
-   {
-      pthread_cancel(pthFifo);
-      pthread_join(pthFifo, NULL);
-      pthFifoRunning = 0;
-   }
+      h[2] = pos;
+      h[3] = res;
 
-   if (pthSocketRunning)
-   {
-      pthread_cancel(pthSocket);
-      pthread_join(pthSocket, NULL);
-      pthSocketRunning = 0;
+      if (write(sock, h, 16) != 16) {ok = 0; break;}
+
+      if (out && (write(sock, outBuf, out) != out)) {ok = 0; break;}
+
+      pos += n;
+
+      if ((p[0] == PI_CMD_SERRS) && (res < (int)n)) break;
    }
 
-   /* release mmap'd memory */
+   /*
+      Don't leave CS asserted if the client went away, or stalled
+      past PI_STREAM_TIMEOUT, mid transfer.
+   */
 
-   if (auxReg  != MAP_FAILED) munmap((void *)auxReg,  AUX_LEN);
-   if (clkReg  != MAP_FAILED) munmap((void *)clkReg,  CLK_LEN);
-   if (dmaReg  != MAP_FAILED) munmap((void *)dmaReg,  DMA_LEN);
-   if (gpioReg != MAP_FAILED) munmap((void *)gpioReg, GPIO_LEN);
-   if (pcmReg  != MAP_FAILED) munmap((void *)pcmReg,  PCM_LEN);
-   if (pwmReg  != MAP_FAILED) munmap((void *)pwmReg,  PWM_LEN);
-   if (systReg != MAP_FAILED) munmap((void *)systReg, SYST_LEN);
-   if (spiReg  != MAP_FAILED) munmap((void *)spiReg,  SPI_LEN);
+   if (held)
+      spiGoPart(spiInfo[p[1]].speed, spiInfo[p[1]].flags,
+         NULL, NULL, 0, held, 1);
 
-   auxReg  = MAP_FAILED;
-   clkReg  = MAP_FAILED;
-   dmaReg  = MAP_FAILED;
-   gpioReg = MAP_FAILED;
-   pcmReg  = MAP_FAILED;
-   pwmReg  = MAP_FAILED;
-   systReg = MAP_FAILED;
-   spiReg  = MAP_FAILED;
+   if (lock != CMD_LOCK_NONE) pthread_rwlock_unlock(&cmdLock[lock]);
 
-   if (dmaBus != MAP_FAILED)
+   if (timed && ok)
    {
-      munmap(dmaBus,
-         PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
+      setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcvTv, sizeof(rcvTv));
+      setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &sndTv, sizeof(sndTv));
    }
 
-   dmaBus = MAP_FAILED;
+   return ok ? 0 : -1;
+}
 
-   if (dmaVirt != MAP_FAILED)
+/* ----------------------------------------------------------------------- */
+
+static void *pthSocketThreadHandler(void *fdC)
+{
+   int sock = *(int*)fdC;
+   uint32_t p[10];
+   int opt;
+   char buf[CMD_MAX_EXTENSION];
+
+   free(fdC);
+
+   /* Disable the Nagle algorithm. */
+   opt = 1;
+   setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(int));
+
+   while (1)
    {
-      for (i=0; i<PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      if (recv(sock, p, 16, MSG_WAITALL) != 16) break;
+
+      if (p[3])
       {
-         munmap(dmaVirt[i], PAGE_SIZE);
+         if (p[3] < sizeof(buf))
+         {
+            /* read extension into buf */
+            if (recv(sock, buf, p[3], MSG_WAITALL) != p[3])
+            {
+               /* Serious error.  No point continuing. */
+               DBG(DBG_ALWAYS, "recv failed for %d bytes", p[3]);
+
+               close(sock);
+
+               return 0;
+            }
+         }
+         else
+         {
+            /* Serious error.  No point continuing. */
+            DBG(DBG_ALWAYS, "ext too large %d(%d)", p[3], sizeof(buf));
+
+            close(sock);
+
+            return 0;
+         }
       }
 
-      munmap(dmaVirt,
-         PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
-   }
+      /* add null terminator in case it's a string */
 
-   dmaVirt = MAP_FAILED;
+      buf[p[3]] = 0;
 
-   if (dmaPMapBlk != MAP_FAILED)
-   {
-      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      switch (p[0])
       {
-         munmap(dmaPMapBlk[i], PAGES_PER_BLOCK*PAGE_SIZE);
-      }
+         case PI_CMD_NOIB:
+            p[3] = gpioNotifyOpenInBand(sock);
 
-      munmap(dmaPMapBlk, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
-   }
+            /* Enable the Nagle algorithm. */
+            opt = 0;
+            setsockopt(
+               sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(int));
+            break;
+
+         case PI_CMD_SPIXS:
+         case PI_CMD_SERRS:
+         case PI_CMD_WVAGS:
+            if (myDoStream(sock, p, buf) < 0)
+            {
+               close(sock);
+
+               return 0;
+            }
+            continue;
+
+         case PI_CMD_PROCP:
+            p[3] = myDoCommand(p, sizeof(buf)-1, buf+sizeof(int));
+            if (((int)p[3]) >= 0)
+            {
+               memcpy(buf, &p[3], 4);
+               p[3] = 4 + (4*PI_MAX_SCRIPT_PARAMS);
+            }
+            break;
+
+         default:
+            p[3] = myDoCommand(p, sizeof(buf)-1, buf);
+      }
+
+      write(sock, p, 16);
+
+      switch (p[0])
+      {
+         /* extensions */
+
+         case PI_CMD_BI2CZ:
+         case PI_CMD_CF2:
+         case PI_CMD_CSTAT:
+         case PI_CMD_I2CPK:
+         case PI_CMD_I2CRD:
+         case PI_CMD_I2CRI:
+         case PI_CMD_I2CRK:
+         case PI_CMD_I2CZ:
+         case PI_CMD_PROCFG:
+         case PI_CMD_PROCP:
+         case PI_CMD_SERR:
+         case PI_CMD_SLR:
+         case PI_CMD_SPIX:
+         case PI_CMD_SPIR:
+         case PI_CMD_WVCHX:
+         case PI_CMD_WVLDI:
+
+            if (((int)p[3]) > 0)
+            {
+               write(sock, buf, p[3]);
+            }
+            break;
+
+         default:
+           break;
+      }
+   }
+
+   close(sock);
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void * pthSocketThread(void *x)
+{
+   int fdC, c, *sock;
+   struct sockaddr_in client;
+   pthread_attr_t attr;
+
+   if (pthread_attr_init(&attr))
+      SOFT_ERROR((void*)PI_INIT_FAILED,
+         "pthread_attr_init failed (%m)");
+
+   if (pthread_attr_setstacksize(&attr, STACK_SIZE))
+      SOFT_ERROR((void*)PI_INIT_FAILED,
+         "pthread_attr_setstacksize failed (%m)");
+
+   if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))
+      SOFT_ERROR((void*)PI_INIT_FAILED,
+         "pthread_attr_setdetachstate failed (%m)");
+
+   /* fdSock opened in gpioInitialise so that we can treat
+      failure to bind as fatal. */
+
+   listen(fdSock, 100);
+
+   c = sizeof(struct sockaddr_in);
+
+   /* don't start until DMA started */
+
+   spinWhileStarting();
+
+   while ((fdC =
+      accept(fdSock, (struct sockaddr *)&client, (socklen_t*)&c)))
+   {
+      pthread_t thr;
+
+      sock = malloc(sizeof(int));
+
+      *sock = fdC;
+
+      if (pthread_create
+         (&thr, &attr, pthSocketThreadHandler, (void*) sock) < 0)
+         SOFT_ERROR((void*)PI_INIT_FAILED,
+            "socket pthread_create failed (%m)");
+   }
+
+   if (fdC < 0)
+      SOFT_ERROR((void*)PI_INIT_FAILED, "accept failed (%m)");
+
+   return 0;
+}
+
+/* ======================================================================= */
+
+static void initCheckLockFile(void)
+{
+   int fd;
+   int count;
+   int pid;
+   int err;
+   int delete;
+   char str[20];
+
+   fd = open(PI_LOCKFILE, O_RDONLY);
+
+   if (fd != -1)
+   {
+      DBG(DBG_STARTUP, "lock file exists");
+      delete = 1;
+
+      count = read(fd, str, sizeof(str)-1);
+
+      if (count)
+      {
+         pid = atoi(str);
+         err = kill(pid, 0);
+         if (!err) delete = 0; /* process still exists */
+         DBG(DBG_STARTUP, "lock file pid=%d err=%d", pid, err);
+      }
+
+      close(fd);
+      DBG(DBG_STARTUP, "lock file delete=%d", delete);
+
+      if (delete) unlink(PI_LOCKFILE);
+   }
+}
+
+static int initGrabLockFile(void)
+{
+   int fd;
+   int lockResult;
+   char pidStr[20];
+
+   initCheckLockFile();
+
+   /* try to grab the lock file */
+
+   fd = open(PI_LOCKFILE, O_WRONLY|O_CREAT|O_EXCL|O_TRUNC, 0644);
+
+   if (fd != -1)
+   {
+      lockResult = flock(fd, LOCK_EX|LOCK_NB);
+
+      if(lockResult == 0)
+      {
+         sprintf(pidStr, "%d\n", (int)getpid());
+
+         write(fd, pidStr, strlen(pidStr));
+      }
+      else
+      {
+         close(fd);
+         return -1;
+      }
+   }
+
+   return fd;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static uint32_t * initMapMem(int fd, uint32_t addr, uint32_t len)
+{
+    return (uint32_t *) mmap(0, len,
+       PROT_READ|PROT_WRITE|PROT_EXEC,
+       MAP_SHARED|MAP_LOCKED,
+       fd, addr);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int initCheckPermitted(void)
+{
+   DBG(DBG_STARTUP, "");
+
+   if ((fdMem = open("/dev/mem", O_RDWR | O_SYNC) ) < 0)
+   {
+      DBG(DBG_ALWAYS,
+         "\n" \
+         "+---------------------------------------------------------+\n" \
+         "|Sorry, you don't have permission to run this program.    |\n" \
+         "|Try running as root, e.g. precede the command with sudo. |\n" \
+         "+---------------------------------------------------------+\n\n");
+      return -1;
+   }
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int initPeripherals(void)
+{
+   uint32_t dmaBase;
+
+   DBG(DBG_STARTUP, "");
+
+   gpioReg = initMapMem(fdMem, GPIO_BASE, GPIO_LEN);
+
+   if (gpioReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap gpio failed (%m)");
+
+   /* dma channels 0-14 share one page, 15 has another */
+
+   if (gpioCfg.DMAprimaryChannel < 15)
+   {
+      dmaBase = DMA_BASE;
+   }
+   else dmaBase = DMA15_BASE;
+
+   dmaReg = initMapMem(fdMem, dmaBase,  DMA_LEN);
+
+   if (dmaReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap dma failed (%m)");
+
+   if (gpioCfg.DMAprimaryChannel < 15)
+   {
+      dmaIn =  dmaReg + (gpioCfg.DMAprimaryChannel   * 0x40);
+      dmaOut = dmaReg + (gpioCfg.DMAsecondaryChannel * 0x40);
+   }
+
+   DBG(DBG_STARTUP, "DMA #%d @ %08X @ %08X",
+      gpioCfg.DMAprimaryChannel, dmaBase, (uint32_t)dmaIn);
+
+   DBG(DBG_STARTUP, "debug reg is %08X", dmaIn[DMA_DEBUG]);
+
+   clkReg  = initMapMem(fdMem, CLK_BASE,  CLK_LEN);
+
+   if (clkReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap clk failed (%m)");
+
+   systReg  = initMapMem(fdMem, SYST_BASE,  SYST_LEN);
+
+   if (systReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap syst failed (%m)");
+
+   spiReg  = initMapMem(fdMem, SPI_BASE,  SPI_LEN);
+
+   if (spiReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap spi failed (%m)");
+
+   pwmReg  = initMapMem(fdMem, PWM_BASE,  PWM_LEN);
+
+   if (pwmReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap pwm failed (%m)");
+
+   pcmReg  = initMapMem(fdMem, PCM_BASE,  PCM_LEN);
+
+   if (pcmReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap pcm failed (%m)");
+
+   auxReg  = initMapMem(fdMem, AUX_BASE,  AUX_LEN);
+
+   if (auxReg == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap aux failed (%m)");
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int initZaps
+   (int  pmapFd, void *virtualBase, int  basePage, int  pages)
+{
+   int n;
+   long index;
+   off_t offset;
+   ssize_t t;
+   uint32_t physical;
+   int status;
+   uint32_t pageAdr;
+   unsigned long long pa;
+
+   DBG(DBG_STARTUP, "");
+
+   status = 0;
+
+   pageAdr = (uint32_t) dmaVirt[basePage];
+
+   index  = ((uint32_t)virtualBase / PAGE_SIZE) * 8;
+
+   offset = lseek(pmapFd, index, SEEK_SET);
+
+   if (offset != index)
+      SOFT_ERROR(PI_INIT_FAILED, "lseek pagemap failed (%m)");
+
+   for (n=0; n<pages; n++)
+   {
+      t = read(pmapFd, &pa, sizeof(pa));
+
+      if (t != sizeof(pa))
+         SOFT_ERROR(PI_INIT_FAILED, "read pagemap failed (%m)");
+
+      DBG(DBG_STARTUP, "pf%d=%016llX", n, pa);
+
+      physical = 0x3FFFFFFF & (PAGE_SIZE * (pa & 0xFFFFFFFF));
+
+      if (physical)
+      {
+         dmaBus[basePage+n] = (dmaPage_t *) (physical | pi_dram_bus);
+
+         dmaVirt[basePage+n] = mmap
+         (
+            (void *)pageAdr,
+            PAGE_SIZE,
+            PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_FIXED|MAP_LOCKED|MAP_NORESERVE,
+            fdMem,
+            physical
+         );
+      }
+      else status = 1;
+
+      pageAdr += PAGE_SIZE;
+   }
+
+   return status;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int initPagemapBlock(int block)
+{
+   int trys, ok;
+   unsigned pageNum;
+
+   DBG(DBG_STARTUP, "block=%d", block);
+
+   dmaPMapBlk[block] = mmap(
+       0, (PAGES_PER_BLOCK*PAGE_SIZE),
+       PROT_READ|PROT_WRITE,
+       MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE|MAP_LOCKED,
+       -1, 0);
+
+   if (dmaPMapBlk[block] == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap dma block %d failed (%m)", block);
+
+   /* force allocation of physical memory */
+
+   memset((void *)dmaPMapBlk[block], 0xAA, (PAGES_PER_BLOCK*PAGE_SIZE));
+
+   memset((void *)dmaPMapBlk[block], 0xFF, (PAGES_PER_BLOCK*PAGE_SIZE));
+
+   memset((void *)dmaPMapBlk[block], 0, (PAGES_PER_BLOCK*PAGE_SIZE));
+
+   pageNum = block * PAGES_PER_BLOCK;
+
+   dmaVirt[pageNum] = mmap(
+       0, (PAGES_PER_BLOCK*PAGE_SIZE),
+       PROT_READ|PROT_WRITE,
+       MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE|MAP_LOCKED,
+       -1, 0);
+
+   if (dmaVirt[pageNum] == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap dma block %d failed (%m)", block);
+
+   munmap(dmaVirt[pageNum], PAGES_PER_BLOCK*PAGE_SIZE);
+
+   trys = 0;
+   ok = 0;
+
+   while ((trys < 10) && !ok)
+   {
+      if (initZaps(fdPmap,
+                    dmaPMapBlk[block],
+                    pageNum,
+                    PAGES_PER_BLOCK) == 0) ok = 1;
+      else myGpioDelay(50000);
+
+      ++trys;
+   }
+
+   if (!ok) SOFT_ERROR(PI_INIT_FAILED, "initZaps failed");
+
+   return 0;
+}
+
+static int initMboxBlock(int block)
+{
+   int n, ok;
+   unsigned page;
+   uintptr_t virtualAdr;
+   uintptr_t busAdr;
+
+   DBG(DBG_STARTUP, "block=%d", block);
+
+   ok = mbDMAAlloc
+      (&dmaMboxBlk[block], PAGES_PER_BLOCK * PAGE_SIZE, pi_mem_flag);
+
+   if (!ok) SOFT_ERROR(PI_INIT_FAILED, "init mbox zaps failed");
+
+   page = block * PAGES_PER_BLOCK;
+
+   virtualAdr = (uintptr_t) dmaMboxBlk[block].virtual_addr;
+   busAdr = dmaMboxBlk[block].bus_addr;
+
+   for (n=0; n<PAGES_PER_BLOCK; n++)
+   {
+      dmaVirt[page+n] = (dmaPage_t *) virtualAdr;
+      dmaBus[page+n] = (dmaPage_t *) busAdr;
+      virtualAdr += PAGE_SIZE;
+      busAdr += PAGE_SIZE;
+   }
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int initAllocDMAMem(void)
+{
+   int i, servoCycles, superCycles;
+   int status;
+
+   DBG(DBG_STARTUP, "");
+
+   /* Calculate the number of blocks needed for buffers.  The number
+      of blocks must be a multiple of the 20ms servo cycle.
+   */
+
+   servoCycles = gpioCfg.bufferMilliseconds / 20;
+   if           (gpioCfg.bufferMilliseconds % 20) servoCycles++;
+
+   bufferCycles = (SUPERCYCLE * servoCycles) / gpioCfg.clockMicros;
+
+   superCycles = bufferCycles / SUPERCYCLE;
+   if           (bufferCycles % SUPERCYCLE) superCycles++;
+
+   bufferCycles = SUPERCYCLE * superCycles;
+
+   bufferBlocks = bufferCycles / CYCLES_PER_BLOCK;
+
+   DBG(DBG_STARTUP, "bmillis=%d mics=%d bblk=%d bcyc=%d",
+      gpioCfg.bufferMilliseconds, gpioCfg.clockMicros,
+      bufferBlocks, bufferCycles);
+
+   /* allocate memory for pointers to virtual and bus memory pages */
+
+   dmaVirt = mmap(
+       0, PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
+       PROT_READ|PROT_WRITE,
+       MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
+       -1, 0);
+
+   if (dmaVirt == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap dma virtual failed (%m)");
+
+   dmaBus = mmap(
+       0, PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
+       PROT_READ|PROT_WRITE,
+       MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
+       -1, 0);
+
+   if (dmaBus == MAP_FAILED)
+      SOFT_ERROR(PI_INIT_FAILED, "mmap dma bus failed (%m)");
+
+   dmaIVirt = (dmaIPage_t **) dmaVirt;
+   dmaIBus  = (dmaIPage_t **) dmaBus;
+
+   dmaOVirt = (dmaOPage_t **)(dmaVirt + (PAGES_PER_BLOCK*bufferBlocks));
+   dmaOBus  = (dmaOPage_t **)(dmaBus  + (PAGES_PER_BLOCK*bufferBlocks));
+
+   if ((gpioCfg.memAllocMode == PI_MEM_ALLOC_PAGEMAP) ||
+       ((gpioCfg.memAllocMode == PI_MEM_ALLOC_AUTO) &&
+        (gpioCfg.bufferMilliseconds > PI_DEFAULT_BUFFER_MILLIS)))
+   {
+      /* pagemap allocation of DMA memory */
+
+      dmaPMapBlk = mmap(
+          0, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *),
+          PROT_READ|PROT_WRITE,
+          MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
+          -1, 0);
+
+      if (dmaPMapBlk == MAP_FAILED)
+         SOFT_ERROR(PI_INIT_FAILED, "pagemap mmap block failed (%m)");
+
+      fdPmap = open("/proc/self/pagemap", O_RDONLY);
+
+      if (fdPmap < 0)
+         SOFT_ERROR(PI_INIT_FAILED, "pagemap open failed(%m)");
+
+      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      {
+         status = initPagemapBlock(i);
+         if (status < 0)
+         {
+            close(fdPmap);
+            return status;
+         }
+      }
+
+      close(fdPmap);
+
+      DBG(DBG_STARTUP, "dmaPMapBlk=%08X dmaIn=%08X",
+         (uint32_t)dmaPMapBlk, (uint32_t)dmaIn);
+   }
+   else
+   {
+      /* mailbox allocation of DMA memory */
+
+      dmaMboxBlk = mmap(
+          0, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(DMAMem_t),
+          PROT_READ|PROT_WRITE,
+          MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED,
+          -1, 0);
+
+      if (dmaMboxBlk == MAP_FAILED)
+         SOFT_ERROR(PI_INIT_FAILED, "mmap mbox block failed (%m)");
+
+      if (mbCreate() < 0)
+         SOFT_ERROR(PI_INIT_FAILED, "mbox create failed(%m)");
+
+      fdMbox = mbOpen();
+
+      if (fdMbox < 0)
+         SOFT_ERROR(PI_INIT_FAILED, "mbox open failed(%m)");
+
+      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      {
+         status = initMboxBlock(i);
+         if (status < 0)
+         {
+            mbClose(fdMbox);
+            return status;
+         }
+      }
+
+      mbClose(fdMbox);
+
+      DBG(DBG_STARTUP, "dmaMboxBlk=%08X dmaIn=%08X",
+         (uint32_t)dmaMboxBlk, (uint32_t)dmaIn);
+   }
+
+   DBG(DBG_STARTUP,
+      "gpioReg=%08X pwmReg=%08X pcmReg=%08X clkReg=%08X auxReg=%08X",
+      (uint32_t)gpioReg, (uint32_t)pwmReg,
+      (uint32_t)pcmReg,  (uint32_t)clkReg, (uint32_t)auxReg);
+
+   for (i=0; i<DMAI_PAGES; i++)
+      DBG(DBG_STARTUP, "dmaIBus[%d]=%08X", i, (uint32_t)dmaIBus[i]);
+
+   if (gpioCfg.dbgLevel >= DBG_DMACBS)
+   {
+      fprintf(stderr, "*** INPUT DMA CONTROL BLOCKS ***\n");
+      for (i=0; i<NUM_CBS; i++) dmaCbPrint(i);
+   }
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initPWM(unsigned bits)
+{
+   DBG(DBG_STARTUP, "bits=%d", bits);
+
+   /* reset PWM */
+
+   pwmReg[PWM_CTL] = 0;
+
+   myGpioDelay(10);
+
+   pwmReg[PWM_STA] = -1;
+
+   myGpioDelay(10);
+
+   /* set number of bits to transmit */
+
+   pwmReg[PWM_RNG1] = bits;
+
+   myGpioDelay(10);
+
+   dmaIVirt[0]->periphData = 1;
+
+   /* enable PWM DMA, raise panic and dreq thresholds to 15 */
+
+   pwmReg[PWM_DMAC] = PWM_DMAC_ENAB      |
+                      PWM_DMAC_PANIC(15) |
+                      PWM_DMAC_DREQ(15);
+
+   myGpioDelay(10);
+
+   /* clear PWM fifo */
+
+   pwmReg[PWM_CTL] = PWM_CTL_CLRF1;
+
+   myGpioDelay(10);
+
+   /* enable PWM channel 1 and use fifo */
+
+   pwmReg[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_MODE1 | PWM_CTL_PWEN1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initPCM(unsigned bits)
+{
+   DBG(DBG_STARTUP, "bits=%d", bits);
+
+   /* disable PCM so we can modify the regs */
+
+   pcmReg[PCM_CS] = 0;
+
+   myGpioDelay(1000);
+
+   pcmReg[PCM_FIFO]   = 0;
+   pcmReg[PCM_MODE]   = 0;
+   pcmReg[PCM_RXC]    = 0;
+   pcmReg[PCM_TXC]    = 0;
+   pcmReg[PCM_DREQ]   = 0;
+   pcmReg[PCM_INTEN]  = 0;
+   pcmReg[PCM_INTSTC] = 0;
+   pcmReg[PCM_GRAY]   = 0;
+
+   myGpioDelay(1000);
+
+   pcmReg[PCM_MODE] = PCM_MODE_FLEN(bits-1); /* # bits in frame */
+
+   /* enable channel 1 with # bits width */
+
+   pcmReg[PCM_TXC] = PCM_TXC_CH1EN | PCM_TXC_CH1WID(bits-8);
+
+   pcmReg[PCM_CS] |= PCM_CS_STBY; /* clear standby */
+
+   myGpioDelay(1000);
+
+   pcmReg[PCM_CS] |= PCM_CS_TXCLR; /* clear TX FIFO */
+
+   pcmReg[PCM_CS] |= PCM_CS_DMAEN; /* enable DREQ */
+
+   pcmReg[PCM_DREQ] = PCM_DREQ_TX_PANIC(16) | PCM_DREQ_TX_REQ_L(30);
+
+   pcmReg[PCM_INTSTC] = 0b1111; /* clear status bits */
+
+   /* enable PCM */
+
+   pcmReg[PCM_CS] |= PCM_CS_EN;
+
+   /* enable tx */
+
+   pcmReg[PCM_CS] |= PCM_CS_TXON;
+
+   dmaIVirt[0]->periphData = 0x0F;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initHWClk
+   (int clkCtl, int clkDiv, int clkSrc, int divI, int divF, int MASH)
+{
+   DBG(DBG_INTERNAL, "ctl=%d div=%d src=%d /I=%d /f=%d M=%d",
+      clkCtl, clkDiv, clkSrc, divI, divF, MASH);
+
+   /* kill the clock if busy, anything else isn't reliable */
+
+   if (clkReg[clkCtl] & CLK_CTL_BUSY)
+   {
+      do
+      {
+         clkReg[clkCtl] = CLK_PASSWD | CLK_CTL_KILL;
+      }
+      while (clkReg[clkCtl] & CLK_CTL_BUSY);
+   }
+
+   clkReg[clkDiv] = (CLK_PASSWD | CLK_DIV_DIVI(divI) | CLK_DIV_DIVF(divF));
+
+   usleep(10);
+
+   clkReg[clkCtl] = (CLK_PASSWD | CLK_CTL_MASH(MASH) | CLK_CTL_SRC(clkSrc));
+
+   usleep(10);
+
+   clkReg[clkCtl] |= (CLK_PASSWD | CLK_CTL_ENAB);
+}
+
+static void initClock(int mainClock)
+{
+   const unsigned BITS=10;
+   int clockPWM;
+   unsigned clkCtl, clkDiv, clkSrc, clkDivI, clkDivF, clkMash, clkBits;
+   char *per;
+   unsigned micros;
+
+   DBG(DBG_STARTUP, "mainClock=%d", mainClock);
+
+   if (mainClock) micros = gpioCfg.clockMicros;
+   else           micros = PI_WF_MICROS;
+
+   clockPWM = mainClock ^ (gpioCfg.clockPeriph == PI_CLOCK_PCM);
+
+   if (clockPWM)
+   {
+      clkCtl = CLK_PWMCTL;
+      clkDiv = CLK_PWMDIV;
+      per = "PWM";
+   }
+   else
+   {
+      clkCtl = CLK_PCMCTL;
+      clkDiv = CLK_PCMDIV;
+      per = "PCM";
+   }
+
+   clkSrc  = CLK_CTL_SRC_PLLD;
+   clkDivI = 50 * micros; /* 10      MHz - 1      MHz */
+   clkBits = BITS;        /* 10/BITS MHz - 1/BITS MHz */
+   clkDivF = 0;
+   clkMash = 0;
+
+   DBG(DBG_STARTUP, "%s PLLD divi=%d divf=%d mash=%d bits=%d",
+      per, clkDivI, clkDivF, clkMash, clkBits);
+
+   initHWClk(clkCtl, clkDiv, clkSrc, clkDivI, clkDivF, clkMash);
+
+   if (clockPWM) initPWM(BITS);
+   else          initPCM(BITS);
+
+   myGpioDelay(2000);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initDMAgo(volatile uint32_t  *dmaAddr, uint32_t cbAddr)
+{
+   DBG(DBG_STARTUP, "");
+
+   dmaAddr[DMA_CS] = DMA_CHANNEL_RESET;
+
+   dmaAddr[DMA_CS] = DMA_INTERRUPT_STATUS | DMA_END_FLAG;
+
+   dmaAddr[DMA_CONBLK_AD] = cbAddr;
+
+   /* clear READ/FIFO/READ_LAST_NOT_SET error bits */
+
+   dmaAddr[DMA_DEBUG] = DMA_DEBUG_READ_ERR            |
+                        DMA_DEBUG_FIFO_ERR            |
+                        DMA_DEBUG_RD_LST_NOT_SET_ERR;
+
+
+   dmaAddr[DMA_CS] = DMA_WAIT_ON_WRITES    |
+                     DMA_PANIC_PRIORITY(8) |
+                     DMA_PRIORITY(8)       |
+                     DMA_ACTIVATE;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initClearGlobals(void)
+{
+   int i;
+
+   DBG(DBG_STARTUP, "");
+
+   alertBits   = 0;
+   monitorBits = 0;
+   notifyBits  = 0;
+   scriptBits  = 0;
+   scriptTrigBits = 0;
+   scriptWaitBits = 0;
+
+   pthAlertRunning  = 0;
+   pthFifoRunning   = 0;
+   pthSocketRunning = 0;
+
+   wfc[0] = 0;
+   wfc[1] = 0;
+   wfc[2] = 0;
+
+   wfcur=0;
+
+   wfStats.micros     = 0;
+   wfStats.highMicros = 0;
+   wfStats.maxMicros  = PI_WAVE_MAX_MICROS;
+
+   wfStats.pulses     = 0;
+   wfStats.highPulses = 0;
+   wfStats.maxPulses  = PI_WAVE_MAX_PULSES;
+
+   wfStats.cbs        = 0;
+   wfStats.highCbs    = 0;
+   wfStats.maxCbs     = (PI_WAVE_BLOCKS * PAGES_PER_BLOCK * CBS_PER_OPAGE);
+
+   waveReleaseAll();
+   memset(waveTx, 0, sizeof(waveTx));
+
+   memset(cmdStats, 0, sizeof(cmdStats));
+
+   gpioGetSamples.func     = NULL;
+   gpioGetSamples.ex       = 0;
+   gpioGetSamples.userdata = NULL;
+   gpioGetSamples.bits     = 0;
+
+   for (i=0; i<=PI_MAX_USER_GPIO; i++)
+   {
+      wfRx[i].mode         = PI_WFRX_NONE;
+
+      gpioAlert[i].func    = NULL;
+   }
+
+   for (i=0; i<=PI_MAX_GPIO; i++)
+   {
+      gpioInfo [i].is      = GPIO_UNDEFINED;
+      gpioInfo [i].width   = 0;
+      gpioInfo [i].range   = PI_DEFAULT_DUTYCYCLE_RANGE;
+      gpioInfo [i].freqIdx = DEFAULT_PWM_IDX;
+   }
+
+   for (i=0; i<PI_NOTIFY_SLOTS; i++)
+   {
+      gpioNotify[i].seqno = 0;
+      gpioNotify[i].state = PI_NOTIFY_CLOSED;
+   }
+
+   for (i=0; i<=PI_MAX_SIGNUM; i++)
+   {
+      gpioSignal[i].func     = NULL;
+      gpioSignal[i].ex       = 0;
+      gpioSignal[i].userdata = NULL;
+   }
+
+   for (i=0; i<=PI_MAX_TIMER; i++)
+   {
+      gpioTimer[i].running = 0;
+      gpioTimer[i].func    = NULL;
+   }
+
+   /* calculate the usable PWM frequencies */
+
+   for (i=0; i<PWM_FREQS; i++)
+   {
+      pwmFreq[i]=
+         (1000000.0/
+            ((float)PULSE_PER_CYCLE*gpioCfg.clockMicros*pwmCycles[i]))+0.5;
+
+      DBG(DBG_STARTUP, "f%d is %d", i, pwmFreq[i]);
+   }
+
+   inpFifo = NULL;
+   outFifo = NULL;
+
+   fdLock = -1;
+   fdMem  = -1;
+   fdSock = -1;
+
+   dmaMboxBlk = MAP_FAILED;
+   dmaPMapBlk = MAP_FAILED;
+   dmaVirt = MAP_FAILED;
+   dmaBus  = MAP_FAILED;
+
+   auxReg  = MAP_FAILED;
+   clkReg  = MAP_FAILED;
+   dmaReg  = MAP_FAILED;
+   gpioReg = MAP_FAILED;
+   pcmReg  = MAP_FAILED;
+   pwmReg  = MAP_FAILED;
+   systReg = MAP_FAILED;
+   spiReg  = MAP_FAILED;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void initReleaseResources(void)
+{
+   int i;
+
+   DBG(DBG_STARTUP, "");
+
+   /* shut down running threads */
+
+   for (i=0; i<=PI_MAX_TIMER; i++)
+   {
+      if (gpioTimer[i].running)
+      {
+         /* destroy thread */
+
+         pthread_cancel(gpioTimer[i].pthId);
+         pthread_join(gpioTimer[i].pthId, NULL);
+         gpioTimer[i].running = 0;
+      }
+   }
+
+   if (pthAlertRunning)
+   {
+      pthread_cancel(pthAlert);
+      pthread_join(pthAlert, NULL);
+      pthAlertRunning = 0;
+   }
+
+   scrStopWorkers();
+
+   if (pthFifoRunning)
+   {
+      pthread_cancel(pthFifo);
+      pthread_join(pthFifo, NULL);
+      pthFifoRunning = 0;
+   }
+
+   for (i=0; i<PI_FIFO_SLOTS; i++)
+   {
+      if (fifoChannel[i].state == PI_FIFO_OPENED)
+      {
+         pthread_cancel(fifoChannel[i].pthId);
+         pthread_join(fifoChannel[i].pthId, NULL);
+         myFifoRelease(&fifoChannel[i]);
+      }
+   }
+
+   if (pthSocketRunning)
+   {
+      pthread_cancel(pthSocket);
+      pthread_join(pthSocket, NULL);
+      pthSocketRunning = 0;
+   }
+
+   /* release mmap'd memory */
+
+   if (auxReg  != MAP_FAILED) munmap((void *)auxReg,  AUX_LEN);
+   if (clkReg  != MAP_FAILED) munmap((void *)clkReg,  CLK_LEN);
+   if (dmaReg  != MAP_FAILED) munmap((void *)dmaReg,  DMA_LEN);
+   if (gpioReg != MAP_FAILED) munmap((void *)gpioReg, GPIO_LEN);
+   if (pcmReg  != MAP_FAILED) munmap((void *)pcmReg,  PCM_LEN);
+   if (pwmReg  != MAP_FAILED) munmap((void *)pwmReg,  PWM_LEN);
+   if (systReg != MAP_FAILED) munmap((void *)systReg, SYST_LEN);
+   if (spiReg  != MAP_FAILED) munmap((void *)spiReg,  SPI_LEN);
+
+   auxReg  = MAP_FAILED;
+   clkReg  = MAP_FAILED;
+   dmaReg  = MAP_FAILED;
+   gpioReg = MAP_FAILED;
+   pcmReg  = MAP_FAILED;
+   pwmReg  = MAP_FAILED;
+   systReg = MAP_FAILED;
+   spiReg  = MAP_FAILED;
+
+   if (dmaBus != MAP_FAILED)
+   {
+      munmap(dmaBus,
+         PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
+   }
+
+   dmaBus = MAP_FAILED;
+
+   if (dmaVirt != MAP_FAILED)
+   {
+      for (i=0; i<PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      {
+         munmap(dmaVirt[i], PAGE_SIZE);
+      }
+
+      munmap(dmaVirt,
+         PAGES_PER_BLOCK*(bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
+   }
+
+   dmaVirt = MAP_FAILED;
+
+   if (dmaPMapBlk != MAP_FAILED)
+   {
+      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      {
+         munmap(dmaPMapBlk[i], PAGES_PER_BLOCK*PAGE_SIZE);
+      }
+
+      munmap(dmaPMapBlk, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(dmaPage_t *));
+   }
+
+   dmaPMapBlk = MAP_FAILED;
+
+   if (dmaMboxBlk != MAP_FAILED)
+   {
+      fdMbox = mbOpen();
+
+      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
+      {
+         mbDMAFree(&dmaMboxBlk[bufferBlocks+PI_WAVE_BLOCKS-i-1]);
+      }
+
+      mbClose(fdMbox);
+
+      munmap(dmaMboxBlk, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(DMAMem_t));
+   }
+
+   dmaMboxBlk = MAP_FAILED;
+
+   if (inpFifo != NULL)
+   {
+      fclose(inpFifo);
+      unlink(PI_INPFIFO);
+      inpFifo = NULL;
+   }
+
+   if (outFifo != NULL)
+   {
+      fclose(outFifo);
+      unlink(PI_OUTFIFO);
+      outFifo = NULL;
+   }
+
+   if (fdMem != -1)
+   {
+      close(fdMem);
+      fdMem = -1;
+   }
+
+   if (fdLock != -1)
+   {
+      close(fdLock);
+      unlink(PI_LOCKFILE);
+      fdLock = -1;
+   }
+
+   if (fdSock != -1)
+   {
+      close(fdSock);
+      fdSock = -1;
+   }
+
+   if (fdPmap != -1)
+   {
+      close(fdPmap);
+      fdPmap = -1;
+   }
+
+   if (fdMbox != -1)
+   {
+      close(fdMbox);
+      fdMbox = -1;
+   }
+
+   gpioStats.DMARestarts = 0;
+   gpioStats.dmaInitCbsCount = 0;
+}
+
+int initInitialise(void)
+{
+   int rev, i;
+   struct sockaddr_in server;
+   char * portStr;
+   unsigned port;
+   struct sched_param param;
+   pthread_attr_t pthAttr;
+
+   DBG(DBG_STARTUP, "");
+
+   waveClockInited = 0;
+
+   clock_gettime(CLOCK_REALTIME, &libStarted);
+
+   rev = gpioHardwareRevision();
+
+   initClearGlobals();
+
+   if (initCheckPermitted() < 0) return PI_INIT_FAILED;
+
+   myScriptCacheLoad();
+
+   fdLock = initGrabLockFile();
+
+   if (fdLock < 0)
+      SOFT_ERROR(PI_INIT_FAILED, "Can't lock %s", PI_LOCKFILE);
+
+   if (!gpioMaskSet)
+   {
+      if      (rev ==  0) gpioMask = PI_DEFAULT_UPDATE_MASK_R0;
+      else if (rev == 17) gpioMask = PI_DEFAULT_UPDATE_MASK_COMPUTE;
+      else if (rev <   4) gpioMask = PI_DEFAULT_UPDATE_MASK_R1;
+      else if (rev <  16) gpioMask = PI_DEFAULT_UPDATE_MASK_R2;
+      else                gpioMask = PI_DEFAULT_UPDATE_MASK_R3;
+
+      gpioMaskSet = 1;
+   }
+
+#ifndef EMBEDDED_IN_VM
+   sigSetHandler();
+#endif
+
+   if (initPeripherals() < 0) return PI_INIT_FAILED;
+
+   if (initAllocDMAMem() < 0) return PI_INIT_FAILED;
+
+   /* done with /dev/mem */
+
+   if (fdMem != -1)
+   {
+      close(fdMem);
+      fdMem = -1;
+   }
+
+   param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+
+   sched_setscheduler(0, SCHED_FIFO, &param);
+
+   initClock(1); /* initialise main clock */
+
+   atexit(gpioTerminate);
+
+   if (pthread_attr_init(&pthAttr))
+      SOFT_ERROR(PI_INIT_FAILED, "pthread_attr_init failed (%m)");
+
+   if (pthread_attr_setstacksize(&pthAttr, STACK_SIZE))
+      SOFT_ERROR(PI_INIT_FAILED, "pthread_attr_setstacksize failed (%m)");
+
+   if (pthread_create(&pthAlert, &pthAttr, pthAlertThread, &i))
+      SOFT_ERROR(PI_INIT_FAILED, "pthread_create alert failed (%m)");
+
+   pthAlertRunning = 1;
+
+   if (scrStartWorkers())
+      SOFT_ERROR(PI_INIT_FAILED, "pthread_create script failed (%m)");
+
+   if (!(gpioCfg.ifFlags & PI_DISABLE_FIFO_IF))
+   {
+      if (pthread_create(&pthFifo, &pthAttr, pthFifoThread, &i))
+         SOFT_ERROR(PI_INIT_FAILED, "pthread_create fifo failed (%m)");
+
+      pthFifoRunning = 1;
+   }
+
+   if (!(gpioCfg.ifFlags & PI_DISABLE_SOCK_IF))
+   {
+      fdSock = socket(AF_INET , SOCK_STREAM , 0);
+
+      if (fdSock == -1)
+         SOFT_ERROR(PI_INIT_FAILED, "socket failed (%m)");
+
+      portStr = getenv(PI_ENVPORT);
+
+      if (portStr) port = atoi(portStr); else port = gpioCfg.socketPort;
+
+      server.sin_family = AF_INET;
+      server.sin_addr.s_addr = INADDR_ANY;
+      server.sin_port = htons(port);
+
+      if (bind(fdSock,(struct sockaddr *)&server , sizeof(server)) < 0)
+         SOFT_ERROR(PI_INIT_FAILED, "bind to port %d failed (%m)", port);
+
+      if (pthread_create(&pthSocket, &pthAttr, pthSocketThread, &i))
+         SOFT_ERROR(PI_INIT_FAILED, "pthread_create socket failed (%m)");
+
+      pthSocketRunning = 1;
+   }
+
+   myGpioDelay(10000);
+
+   dmaInitCbs();
+
+   flushMemory();
+
+   initDMAgo((uint32_t *)dmaIn, (uint32_t)dmaIBus[0]);
+
+   myGpioDelay(20000);
+
+   return PIGPIO_VERSION;
+}
+
+
+/* ======================================================================= */
+
+int getBitInBytes(int bitPos, char *buf, int numBits)
+{
+   int bitp, bufp;
+
+   if (bitPos < numBits)
+   {
+      bufp =      bitPos / 8;
+      bitp = 7 - (bitPos % 8);
+      if (buf[bufp] & (1<<bitp)) return 1;
+   }
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+void putBitInBytes(int bitPos, char *buf, int bit)
+{
+   int bitp, bufp;
+
+   bufp =      bitPos / 8;
+   bitp = 7 - (bitPos % 8);
+
+   if (bit) buf[bufp] |=   (1<<bitp);
+   else     buf[bufp] &= (~(1<<bitp));
+}
+
+/* ----------------------------------------------------------------------- */
+
+uint32_t rawWaveGetOut(int pos)
+{
+   int page, slot;
+
+   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
+   {
+      waveOOLPageSlot(pos, &page, &slot);
+      return (dmaOVirt[page]->OOL[slot]);
+   }
+
+   return -1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+void rawWaveSetOut(int pos, uint32_t value)
+{
+   int page, slot;
+
+   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
+   {
+      waveOOLPageSlot(pos, &page, &slot);
+      dmaOVirt[page]->OOL[slot] = value;
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+uint32_t rawWaveGetIn(int pos)
+{
+   int page, slot;
+
+   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
+   {
+      waveOOLPageSlot((NUM_WAVE_OOL-1)-pos, &page, &slot);
+      return (dmaOVirt[page]->OOL[slot]);
+   }
+
+   return -1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+void rawWaveSetIn(int pos, uint32_t value)
+{
+   int page, slot;
+
+   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
+   {
+      waveOOLPageSlot((NUM_WAVE_OOL-1)-pos, &page, &slot);
+      dmaOVirt[page]->OOL[slot] = value;
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+rawWaveInfo_t rawWaveInfo(int wave_id)
+{
+   rawWaveInfo_t dummy = {-1, -1, -1, -1};
+
+   if ((wave_id >=0) && (wave_id < PI_MAX_WAVES)) return waveInfo[wave_id];
+   else                                           return dummy;
+}
+
+/* ----------------------------------------------------------------------- */
+
+double time_time(void)
+{
+   struct timeval tv;
+   double t;
+
+   gettimeofday(&tv, 0);
+
+   t = (double)tv.tv_sec + ((double)tv.tv_usec / 1E6);
+
+   return t;
+}
+
+/* ----------------------------------------------------------------------- */
+
+void time_sleep(double seconds)
+{
+   struct timespec ts, rem;
+
+   if (seconds > 0.0)
+   {
+      ts.tv_sec = seconds;
+      ts.tv_nsec = (seconds-(double)ts.tv_sec) * 1E9;
+
+      while (clock_nanosleep(CLOCK_REALTIME, 0, &ts, &rem))
+      {
+         /* copy remaining time to ts */
+         ts.tv_sec  = rem.tv_sec;
+         ts.tv_nsec = rem.tv_nsec;
+      }
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+void rawDumpWave(void)
+{
+   int i;
+
+   unsigned numWaves, t;
+
+   rawWave_t *waves;
+
+   numWaves = wfc[wfcur];
+   waves    = wf [wfcur];
+
+   t = 0;
+
+   for (i=0; i<numWaves; i++)
+   {
+      fprintf(stderr, "%10u %08X %08X %08X %10u\n",
+         t, waves[i].gpioOn, waves[i].gpioOff,
+         waves[i].flags, waves[i].usDelay);
+      t += waves[i].usDelay;
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+void rawDumpScript(unsigned script_id)
+{
+   int i;
+
+   if (script_id >= PI_MAX_SCRIPTS) return;
+
+   if (gpioScript[script_id].state == PI_SCRIPT_IN_USE)
+   {
+
+      for (i=0; i<PI_MAX_SCRIPT_PARAMS; i++)
+      {
+         fprintf(stderr, "p%d=%d ", i, gpioScript[script_id].script.par[i]);
+      }
+
+      fprintf(stderr, "\n");
+
+      for (i=0; i<PI_MAX_SCRIPT_VARS; i++)
+      {
+         fprintf(stderr, "v%d=%d ", i, gpioScript[script_id].script.var[i]);
+      }
+
+      fprintf(stderr, "\n");
+
+      for (i=0; i<gpioScript[script_id].script.instrs; i++)
+      {
+         fprintf(stderr,
+            "c%d=[%d, %d(%d), %d(%d), %d, %d]\n",
+            i,
+            gpioScript[script_id].script.instr[i].p[0],
+            gpioScript[script_id].script.instr[i].p[1],
+            gpioScript[script_id].script.instr[i].opt[1],
+            gpioScript[script_id].script.instr[i].p[2],
+            gpioScript[script_id].script.instr[i].opt[2],
+            gpioScript[script_id].script.instr[i].p[3],
+            gpioScript[script_id].script.instr[i].p[4]);
+      }
+   }
+}
+
+/* ======================================================================= */
+
+int gpioInitialise(void)
+{
+   int status;
+
+   if (libInitialised) return PIGPIO_VERSION;
+
+   DBG(DBG_STARTUP, "not initialised, initialising");
+
+   runState = PI_STARTING;
+
+   status = initInitialise();
+
+   if (status < 0)
+   {
+      runState = PI_ENDING;
+      initReleaseResources();
+   }
+   else
+   {
+      libInitialised = 1;
+      runState = PI_RUNNING;
+   }
+
+   return status;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+void gpioTerminate(void)
+{
+   int i;
+
+   DBG(DBG_USER, "");
+
+   if (!libInitialised) return;
+
+   DBG(DBG_STARTUP, "initialised, terminating");
+
+   runState = PI_ENDING;
+
+   gpioMaskSet = 0;
+
+   /* reset DMA */
+
+   if (dmaReg != MAP_FAILED) dmaIn[DMA_CS] = DMA_CHANNEL_RESET;
+   if (dmaReg != MAP_FAILED) dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+
+#ifndef EMBEDDED_IN_VM
+   if (gpioCfg.showStats)
+   {
+      fprintf(stderr,
+         "If you didn't request stats please cut & paste the\n"
+         "following and e-mail to pigpio@abyz.co.uk\n");
+
+      fprintf(stderr,
+         "micros=%d allocMode=%d dmaInitCbs=%d DMARestarts=%d\n",
+         gpioCfg.clockMicros, gpioCfg.memAllocMode,
+         gpioStats.dmaInitCbsCount, gpioStats.DMARestarts);
+
+      fprintf(stderr,
+         "samples %u maxSamples %u maxEmit %u emitFrags %u\n",
+         gpioStats.numSamples, gpioStats.maxSamples,
+         gpioStats.maxEmit, gpioStats.emitFrags);
+
+      fprintf(stderr, "cbTicks %d, cbCalls %u alertTicks %u\n",
+         gpioStats.cbTicks, gpioStats.cbCalls, gpioStats.alertTicks);
+
+      fprintf(stderr, "waveCompactions %u waveCacheHits %u\n",
+         gpioStats.waveCompactions, gpioStats.waveCacheHits);
+
+      for (i=0; i< TICKSLOTS; i++)
+         fprintf(stderr, "%9u ", gpioStats.diffTick[i]);
+
+      fprintf(stderr, "\n");
+
+      fprintf(stderr, "\n");
+
+      fprintf(stderr,
+         "#####################################################\n");
+   }
+#endif
+
+   initReleaseResources();
+
+   fflush(NULL);
+
+   libInitialised = 0;
+}
+
+static void switchFunctionOff(unsigned gpio)
+{
+   unsigned clock, pwm;
+   int cctl[] = {CLK_GP0_CTL, CLK_GP1_CTL, CLK_GP2_CTL};
+
+   switch (gpioInfo[gpio].is)
+   {
+      case GPIO_SERVO:
+         /* switch servo off */
+         myGpioSetServo(gpio, gpioInfo[gpio].width, 0);
+         gpioInfo[gpio].width = 0;
+         break;
+
+      case GPIO_PWM:
+         /* switch pwm off */
+         myGpioSetPwm(gpio, gpioInfo[gpio].width, 0);
+         gpioInfo[gpio].width = 0;
+         break;
+
+      case GPIO_HW_CLK:
+         /* switch hardware clock off */
+         clock = (clkDef[gpio] >> 4) & 3;
+         clkReg[cctl[clock]] = CLK_PASSWD | CLK_CTL_KILL;
+         gpioInfo[gpio].width = 0;
+         break;
+
+      case GPIO_HW_PWM:
+         /* switch hardware PWM off */
+         pwm = (PWMDef[gpio] >> 4) & 3;
+         if (pwm == 0) pwmReg[PWM_CTL] &= (~PWM_CTL_PWEN1);
+         else          pwmReg[PWM_CTL] &= (~PWM_CTL_PWEN2);
+         gpioInfo[gpio].width = 0;
+         break;
+   }
+}
+
+static void stopHardwarePWM(void)
+{
+   int i;
+
+   for (i=0; i<= PI_MAX_GPIO; i++)
+   {
+      if (gpioInfo[i].is == GPIO_HW_PWM)
+      {
+         switchFunctionOff(i);
+
+         gpioInfo[i].is = GPIO_UNDEFINED;
+      }
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetMode(unsigned gpio, unsigned mode)
+{
+   int reg, shift, old_mode;
+
+   DBG(DBG_USER, "gpio=%d mode=%d", gpio, mode);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_GPIO)
+      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+
+   if (mode > PI_ALT3)
+      SOFT_ERROR(PI_BAD_MODE, "gpio %d, bad mode (%d)", gpio, mode);
+
+   reg   =  gpio/10;
+   shift = (gpio%10) * 3;
+
+   old_mode = (gpioReg[reg] >> shift) & 7;
+
+   if (mode != old_mode)
+   {
+      switchFunctionOff(gpio);
+
+      gpioInfo[gpio].is = GPIO_UNDEFINED;
+
+      gpioReg[reg] = (gpioReg[reg] & ~(7<<shift)) | (mode<<shift);
+   }
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetMode(unsigned gpio)
+{
+   int reg, shift;
+
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_GPIO)
+      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+
+   reg   =  gpio/10;
+   shift = (gpio%10) * 3;
+
+   return (gpioReg[reg] >> shift) & 7;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetPullUpDown(unsigned gpio, unsigned pud)
+{
+   DBG(DBG_USER, "gpio=%d pud=%d", gpio, pud);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_GPIO)
+      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+
+   if (pud > PI_PUD_UP)
+      SOFT_ERROR(PI_BAD_PUD, "gpio %d, bad pud (%d)", gpio, pud);
+
+   *(gpioReg + GPPUD) = pud;
+
+   myGpioDelay(20);
+
+   *(gpioReg + GPPUDCLK0 + BANK) = BIT;
+
+   myGpioDelay(20);
+
+   *(gpioReg + GPPUD) = 0;
+
+   *(gpioReg + GPPUDCLK0 + BANK) = 0;
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioRead(unsigned gpio)
+{
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_GPIO)
+      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+
+   if ((*(gpioReg + GPLEV0 + BANK) & BIT) != 0) return PI_ON;
+   else                                         return PI_OFF;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWrite(unsigned gpio, unsigned level)
+{
+   DBG(DBG_USER, "gpio=%d level=%d", gpio, level);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_GPIO)
+      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+
+   if (level > PI_ON)
+      SOFT_ERROR(PI_BAD_LEVEL, "gpio %d, bad level (%d)", gpio, level);
+
+   if (gpio <= PI_MAX_GPIO)
+   {
+      if (gpioInfo[gpio].is != GPIO_WRITE)
+      {
+         /* stop a glitch between setting mode then level */
+         if (level == PI_OFF) *(gpioReg + GPCLR0 + BANK) = BIT;
+         else                 *(gpioReg + GPSET0 + BANK) = BIT;
+
+         switchFunctionOff(gpio);
+
+         gpioSetMode(gpio, PI_OUTPUT);
+
+         gpioInfo[gpio].is = GPIO_WRITE;
+      }
+   }
+
+   if (level == PI_OFF) *(gpioReg + GPCLR0 + BANK) = BIT;
+   else                 *(gpioReg + GPSET0 + BANK) = BIT;
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioPWM(unsigned gpio, unsigned val)
+{
+   DBG(DBG_USER, "gpio=%d dutycycle=%d", gpio, val);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if (val > gpioInfo[gpio].range)
+      SOFT_ERROR(PI_BAD_DUTYCYCLE, "gpio %d, bad dutycycle (%d)", gpio, val);
+
+   if (gpioInfo[gpio].is != GPIO_PWM)
+   {
+      switchFunctionOff(gpio);
+
+      gpioSetMode(gpio, PI_OUTPUT);
+
+      gpioInfo[gpio].is = GPIO_PWM;
+   }
+
+   myGpioSetPwm(gpio, gpioInfo[gpio].width, val);
+
+   gpioInfo[gpio].width=val;
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetPWMdutycycle(unsigned gpio)
+{
+   unsigned pwm;
+
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   switch (gpioInfo[gpio].is)
+   {
+      case GPIO_PWM:
+         return gpioInfo[gpio].width;
+
+      case GPIO_HW_PWM:
+         pwm = (PWMDef[gpio] >> 4) & 3;
+         return hw_pwm_duty[pwm];
+
+      case GPIO_HW_CLK:
+         return PI_HW_PWM_RANGE/2;
+
+      default:
+         SOFT_ERROR(PI_NOT_PWM_GPIO, "not a PWM gpio (%d)", gpio);
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetPWMrange(unsigned gpio, unsigned range)
+{
+   int oldWidth, newWidth;
+
+   DBG(DBG_USER, "gpio=%d range=%d", gpio, range);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if ((range < PI_MIN_DUTYCYCLE_RANGE)  || (range > PI_MAX_DUTYCYCLE_RANGE))
+      SOFT_ERROR(PI_BAD_DUTYRANGE, "gpio %d, bad range (%d)", gpio, range);
+
+   oldWidth = gpioInfo[gpio].width;
+
+   if (oldWidth)
+   {
+      if (gpioInfo[gpio].is == GPIO_PWM)
+      {
+         newWidth = (range * oldWidth) / gpioInfo[gpio].range;
+
+         myGpioSetPwm(gpio, oldWidth, 0);
+         gpioInfo[gpio].range = range;
+         gpioInfo[gpio].width = newWidth;
+         myGpioSetPwm(gpio, 0, newWidth);
+      }
+   }
+
+   gpioInfo[gpio].range = range;
+
+   /* return the actual range for the current gpio frequency */
+
+   return pwmRealRange[gpioInfo[gpio].freqIdx];
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetPWMrange(unsigned gpio)
+{
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   switch (gpioInfo[gpio].is)
+   {
+      case GPIO_HW_PWM:
+      case GPIO_HW_CLK:
+         return PI_HW_PWM_RANGE;
+
+      default:
+         return gpioInfo[gpio].range;
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetPWMrealRange(unsigned gpio)
+{
+   unsigned pwm;
+
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   switch (gpioInfo[gpio].is)
+   {
+      case GPIO_HW_PWM:
+         pwm = (PWMDef[gpio] >> 4) & 3;
+         return hw_pwm_real_range[pwm];
+
+      case GPIO_HW_CLK:
+         return PI_HW_PWM_RANGE;
+
+      default:
+         return pwmRealRange[gpioInfo[gpio].freqIdx];
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetPWMfrequency(unsigned gpio, unsigned frequency)
+{
+   int i, width;
+   unsigned diff, best, idx;
+
+   DBG(DBG_USER, "gpio=%d frequency=%d", gpio, frequency);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if      (frequency > pwmFreq[0])           idx = 0;
+   else if (frequency < pwmFreq[PWM_FREQS-1]) idx = PWM_FREQS-1;
+   else
+   {
+      best = 100000; /* impossibly high frequency difference */
+      idx = 0;
+
+      for (i=0; i<PWM_FREQS; i++)
+      {
+         if (frequency > pwmFreq[i]) diff = frequency - pwmFreq[i];
+         else                        diff = pwmFreq[i] - frequency;
+
+         if (diff < best)
+         {
+            best = diff;
+            idx = i;
+         }
+      }
+   }
+
+   width = gpioInfo[gpio].width;
+
+   if (width)
+   {
+      if (gpioInfo[gpio].is == GPIO_PWM)
+      {
+         myGpioSetPwm(gpio, width, 0);
+         gpioInfo[gpio].freqIdx = idx;
+         myGpioSetPwm(gpio, 0, width);
+      }
+   }
+
+   gpioInfo[gpio].freqIdx = idx;
+
+   return pwmFreq[idx];
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetPWMfrequency(unsigned gpio)
+{
+   unsigned pwm, clock;
+
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   switch (gpioInfo[gpio].is)
+   {
+      case GPIO_HW_PWM:
+         pwm = (PWMDef[gpio] >> 4) & 3;
+         return hw_pwm_freq[pwm];
+
+      case GPIO_HW_CLK:
+         clock = (clkDef[gpio] >> 4) & 3;
+         return hw_clk_freq[clock];
+
+      default:
+         return pwmFreq[gpioInfo[gpio].freqIdx];
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioServo(unsigned gpio, unsigned val)
+{
+   DBG(DBG_USER, "gpio=%d pulsewidth=%d", gpio, val);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if ((val!=PI_SERVO_OFF) && (val<PI_MIN_SERVO_PULSEWIDTH))
+      SOFT_ERROR(PI_BAD_PULSEWIDTH,
+         "gpio %d, bad pulsewidth (%d)", gpio, val);
+
+   if (val>PI_MAX_SERVO_PULSEWIDTH)
+      SOFT_ERROR(PI_BAD_PULSEWIDTH,
+         "gpio %d, bad pulsewidth (%d)", gpio, val);
+
+   if (gpioInfo[gpio].is != GPIO_SERVO)
+   {
+      switchFunctionOff(gpio);
+
+      gpioSetMode(gpio, PI_OUTPUT);
+
+      gpioInfo[gpio].is = GPIO_SERVO;
+   }
+
+   myGpioSetServo(gpio, gpioInfo[gpio].width, val);
+
+   gpioInfo[gpio].width=val;
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioGetServoPulsewidth(unsigned gpio)
+{
+   DBG(DBG_USER, "gpio=%d", gpio);
+
+   CHECK_INITED;
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if (gpioInfo[gpio].is != GPIO_SERVO)
+      SOFT_ERROR(PI_NOT_SERVO_GPIO, "not a servo gpio (%d)", gpio);
+
+   return gpioInfo[gpio].width;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveClear(void)
+{
+   DBG(DBG_USER, "");
+
+   CHECK_INITED;
+
+   wfc[0] = 0;
+   wfc[1] = 0;
+   wfc[2] = 0;
+
+   wfcur = 0;
+
+   wfStats.micros = 0;
+   wfStats.pulses = 0;
+   wfStats.cbs    = 0;
+
+   waveReleaseAll();
+   memset(waveTx, 0, sizeof(waveTx));
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddNew(void)
+{
+   DBG(DBG_USER, "");
+
+   CHECK_INITED;
+
+   wfc[0] = 0;
+   wfc[1] = 0;
+   wfc[2] = 0;
+
+   wfcur = 0;
+
+   wfStats.micros = 0;
+   wfStats.pulses = 0;
+   wfStats.cbs    = 0;
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddGeneric(unsigned numPulses, gpioPulse_t *pulses)
+{
+   int p;
+
+   DBG(DBG_USER, "numPulses=%u pulses=%08X", numPulses, (uint32_t)pulses);
+
+   CHECK_INITED;
+
+   if (numPulses > PI_WAVE_MAX_PULSES)
+      SOFT_ERROR(PI_TOO_MANY_PULSES, "bad number of pulses (%d)", numPulses);
+
+   if (!pulses) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) pulses pointer");
+
+   for (p=0; p<numPulses; p++)
+   {
+      wf[2][p].gpioOff = pulses[p].gpioOff;
+      wf[2][p].gpioOn  = pulses[p].gpioOn;
+      wf[2][p].usDelay = pulses[p].usDelay;
+      wf[2][p].flags   = 0;
+   }
+
+   return rawWaveAddGeneric(numPulses, wf[2]);
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddMulti(
+   unsigned numTrains, unsigned *trainPulses, gpioPulse_t *pulses)
+{
+   unsigned inLen[PI_WAVE_MAX_TRAINS+1];
+   rawWave_t *in[PI_WAVE_MAX_TRAINS+1];
+   int p, t, total;
+
+   DBG(DBG_USER, "numTrains=%u trainPulses=%08X pulses=%08X",
+      numTrains, (uint32_t)trainPulses, (uint32_t)pulses);
+
+   CHECK_INITED;
+
+   if ((numTrains < 1) || (numTrains > PI_WAVE_MAX_TRAINS))
+      SOFT_ERROR(PI_BAD_TRAIN_CNT, "bad number of trains (%d)", numTrains);
+
+   if (!trainPulses)
+      SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) trainPulses pointer");
+
+   if (!pulses) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) pulses pointer");
+
+   /* the existing waveform is merged as the first train */
+
+   inLen[0] = wfc[wfcur];
+   in[0]    = wf[wfcur];
+
+   total = 0;
+
+   for (t=0; t<numTrains; t++)
+   {
+      if (trainPulses[t] > (PI_WAVE_MAX_PULSES - total))
+         SOFT_ERROR(PI_TOO_MANY_PULSES, "too many pulses");
+
+      inLen[t+1] = trainPulses[t];
+      in[t+1]    = wf[2] + total;
+
+      total += trainPulses[t];
+   }
+
+   for (p=0; p<total; p++)
+   {
+      wf[2][p].gpioOff = pulses[p].gpioOff;
+      wf[2][p].gpioOn  = pulses[p].gpioOn;
+      wf[2][p].usDelay = pulses[p].usDelay;
+      wf[2][p].flags   = 0;
+   }
+
+   return rawWaveAddMulti(numTrains+1, inLen, in);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int waveSerialCheck
+   (unsigned gpio,
+    unsigned baud,
+    unsigned data_bits,
+    unsigned stop_bits,
+    unsigned offset,
+    unsigned numBytes)
+{
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if ((baud < PI_WAVE_MIN_BAUD) || (baud > PI_WAVE_MAX_BAUD))
+      SOFT_ERROR(PI_BAD_WAVE_BAUD, "bad baud rate (%d)", baud);
+
+   if ((data_bits < PI_MIN_WAVE_DATABITS) || (data_bits > PI_MAX_WAVE_DATABITS))
+      SOFT_ERROR(PI_BAD_DATABITS, "bad number of databits (%d)", data_bits);
+
+   if ((stop_bits < PI_MIN_WAVE_HALFSTOPBITS) ||
+       (stop_bits > PI_MAX_WAVE_HALFSTOPBITS))
+      SOFT_ERROR(PI_BAD_STOPBITS,
+         "bad number of (half) stop bits (%d)", stop_bits);
+
+   if (numBytes > PI_WAVE_MAX_CHARS)
+      SOFT_ERROR(PI_TOO_MANY_CHARS, "too many chars (%d)", numBytes);
+
+   if (offset > PI_WAVE_MAX_MICROS)
+      SOFT_ERROR(PI_BAD_SER_OFFSET, "offset too large (%d)", offset);
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int waveSerialTrain
+   (unsigned gpio,
+    unsigned baud,
+    unsigned data_bits,
+    unsigned stop_bits,
+    unsigned offset,
+    unsigned numBytes,
+    char     *bstr,
+    rawWave_t *out,
+    unsigned maxPulses)
+{
+   unsigned i, b, n, chars, next, width;
+   uint32_t bit;
+   uint64_t c, frame, edges;
+   unsigned bitDelay[PI_MAX_WAVE_DATABITS+2];
+   unsigned at[PI_MAX_WAVE_DATABITS+3];
+   uint16_t w16;
+   uint32_t w32;
+
+   /*
+      Encodes the characters as pulses at their level changes.  A
+      frame is the start bit, the data bits, and the stop bits as
+      one word, so the changes are the set bits of the word xor'd
+      with itself shifted by one.  Each is found with a count of
+      trailing zeros and its delay looked up in a table of bit start
+      times, rather than stepping through the bits one at a time.
+   */
+
+   chars = numBytes;
+
+   if (data_bits > 8) chars /= 2;
+   if (data_bits > 16) chars /= 2;
+
+   if (!chars) return 0;
+
+   waveBitDelay(baud, data_bits, stop_bits, bitDelay);
+
+   width = data_bits + 2;
+
+   at[0] = 0;
+
+   for (b=0; b<width; b++) at[b+1] = at[b] + bitDelay[b];
+
+   bit = 1<<gpio;
+
+   /* earlier channels may have filled the pulse buffer */
+
+   if (maxPulses < 1)
+      SOFT_ERROR(PI_TOO_MANY_PULSES, "too many pulses");
+
+   n = 0;
+
+   out[n].gpioOn  = bit;
+   out[n].gpioOff = 0;
+   out[n].flags   = 0;
+
+   if (offset > bitDelay[0]) out[n].usDelay = offset;
+   else                      out[n].usDelay = bitDelay[0];
+
+   n++;
+
+   for (i=0; i<chars; i++)
+   {
+      if ((n + width) > maxPulses)
+         SOFT_ERROR(PI_TOO_MANY_PULSES, "too many pulses");
+
+      if (data_bits < 9) c = (uint8_t)bstr[i];
+      else if (data_bits < 17)
+      {
+         memcpy(&w16, bstr + (i * 2), 2);
+         c = w16;
+      }
+      else
+      {
+         memcpy(&w32, bstr + (i * 4), 4);
+         c = w32;
+      }
+
+      c &= ((uint64_t)1 << data_bits) - 1;
+
+      /* start bit 0, data bits, stop bit 1, after a high line */
+
+      frame = (c << 1) | ((uint64_t)1 << (data_bits + 1));
+
+      edges = (frame ^ ((frame << 1) | 1)) & (((uint64_t)1 << width) - 1);
+
+      while (edges)
+      {
+         b = __builtin_ctzll(edges);
+
+         edges &= edges - 1;
+
+         next = edges ? __builtin_ctzll(edges) : width;
+
+         if ((frame >> b) & 1)
+         {
+            out[n].gpioOn  = bit;
+            out[n].gpioOff = 0;
+         }
+         else
+         {
+            out[n].gpioOn  = 0;
+            out[n].gpioOff = bit;
+         }
+
+         out[n].usDelay = at[next] - at[b];
+         out[n].flags   = 0;
+
+         n++;
+      }
+   }
+
+   return n;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddSerial
+   (unsigned gpio,
+    unsigned baud,
+    unsigned data_bits,
+    unsigned stop_bits,
+    unsigned offset,
+    unsigned numBytes,
+    char     *bstr)
+{
+   int n;
+
+   DBG(DBG_USER,
+      "gpio=%d baud=%d bits=%d stops=%d offset=%d numBytes=%d str=[%s]",
+      gpio, baud, data_bits, stop_bits, offset,
+      numBytes, myBuf2Str(numBytes, (char *)bstr));
+
+   CHECK_INITED;
+
+   n = waveSerialCheck(gpio, baud, data_bits, stop_bits, offset, numBytes);
+
+   if (n) return n;
+
+   n = waveSerialTrain(gpio, baud, data_bits, stop_bits, offset,
+      numBytes, bstr, wf[2], PI_WAVE_MAX_PULSES);
+
+   if (n <= 0) return n;
+
+   return rawWaveAddGeneric(n, wf[2]);
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddSerialMulti(unsigned numChannels, gpioSerial_t *channels)
+{
+   unsigned inLen[PI_WAVE_MAX_TRAINS+1];
+   rawWave_t *in[PI_WAVE_MAX_TRAINS+1];
+   gpioSerial_t *ch;
+   int c, n, total, status;
+
+   DBG(DBG_USER, "numChannels=%u channels=%08X",
+      numChannels, (uint32_t)channels);
+
+   CHECK_INITED;
+
+   if ((numChannels < 1) || (numChannels > PI_WAVE_MAX_TRAINS))
+      SOFT_ERROR(PI_BAD_TRAIN_CNT, "bad number of channels (%d)", numChannels);
+
+   if (!channels) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) channels pointer");
+
+   for (c=0; c<numChannels; c++)
+   {
+      ch = &channels[c];
+
+      status = waveSerialCheck(ch->gpio, ch->baud, ch->dataBits,
+         ch->stopBits, ch->offset, ch->numBytes);
+
+      if (status) return status;
+
+      if (ch->numBytes && !ch->bstr)
+         SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) channel %d data pointer", c);
+   }
+
+   /*
+      Each channel is encoded as a separate train, then all of them
+      and the existing waveform are merged in one pass.
+   */
+
+   inLen[0] = wfc[wfcur];
+   in[0]    = wf[wfcur];
+
+   total = 0;
+
+   for (c=0; c<numChannels; c++)
+   {
+      ch = &channels[c];
+
+      n = waveSerialTrain(ch->gpio, ch->baud, ch->dataBits, ch->stopBits,
+         ch->offset, ch->numBytes, ch->bstr,
+         wf[2] + total, PI_WAVE_MAX_PULSES - total);
+
+      if (n < 0) return n;
+
+      inLen[c+1] = n;
+      in[c+1]    = wf[2] + total;
+
+      total += n;
+   }
+
+   return rawWaveAddMulti(numChannels+1, inLen, in);
+}
+
+/* ----------------------------------------------------------------------- */
+
+typedef struct
+{
+   int    scurve;
+   double v0, vp, ve; /* start, peak, and end speed, steps/s */
+   double Ta, Tc, Td; /* accelerate, cruise, and decelerate time, s */
+   double Da, Dc;     /* accelerate and cruise distance, steps */
+} stepPlan_t;
+
+static gpioPulse_t stepPulse[PI_WAVE_MAX_PULSES];
+
+static double stepSqrt(double x)
+{
+   double r;
+   int i;
+
+   /* avoids needing libm for one square root per move */
+
+   if (x <= 0.0) return 0.0;
+
+   r = (x > 1.0) ? x : 1.0;
+
+   for (i=0; i<64; i++) r = (r + (x / r)) / 2.0;
+
+   return r;
+}
+
+static double stepRamp(stepPlan_t *pl, double u)
+{
+   /* fraction of the speed change made after fraction u of a ramp */
+
+   if (pl->scurve) return u * u * (3.0 - (2.0 * u));
+
+   return u;
+}
+
+static double stepRampDist(stepPlan_t *pl, double u)
+{
+   /* the integral of stepRamp, 1/2 at the end of the ramp */
+
+   if (pl->scurve) return (u * u * u) - ((u * u * u * u) / 2.0);
+
+   return (u * u) / 2.0;
+}
+
+static void stepPos(stepPlan_t *pl, double t, double *x, double *v)
+{
+   double u;
+
+   if (t < pl->Ta)
+   {
+      u = t / pl->Ta;
+      *v = pl->v0 + ((pl->vp - pl->v0) * stepRamp(pl, u));
+      *x = (pl->v0 * t) + ((pl->vp - pl->v0) * pl->Ta * stepRampDist(pl, u));
+   }
+   else if (t < (pl->Ta + pl->Tc))
+   {
+      *v = pl->vp;
+      *x = pl->Da + (pl->vp * (t - pl->Ta));
+   }
+   else
+   {
+      t -= (pl->Ta + pl->Tc);
+      if (t > pl->Td) t = pl->Td;
+      u = (pl->Td > 0.0) ? (t / pl->Td) : 1.0;
+      *v = pl->vp - ((pl->vp - pl->ve) * stepRamp(pl, u));
+      *x = pl->Da + pl->Dc + (pl->vp * t) -
+         ((pl->vp - pl->ve) * pl->Td * stepRampDist(pl, u));
+   }
+}
+
+static double stepTime(stepPlan_t *pl, double x, double lo, double hi)
+{
+   double t, tn, px, pv;
+   int i;
+
+   /* Newton's method, kept inside [lo, hi] by bisection */
+
+   t = lo;
+
+   for (i=0; i<64; i++)
+   {
+      stepPos(pl, t, &px, &pv);
+
+      px -= x;
+
+      if ((px > -1E-9) && (px < 1E-9)) break;
+
+      if (px < 0.0) lo = t; else hi = t;
+
+      if (pv > 0.0) tn = t - (px / pv); else tn = lo;
+
+      if ((tn <= lo) || (tn >= hi)) tn = (lo + hi) / 2.0;
+
+      t = tn;
+   }
+
+   return t;
+}
+
+static int waveSteps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
+{
+   stepPlan_t pl;
+   unsigned a, n, k, steps, width;
+   uint32_t dirOn, dirOff, mask;
+   double am, vp2, t, end;
+   uint32_t at, prev;
+   int p;
+
+   if ((numAxes < 1) || (numAxes > PI_MAX_STEP_AXES))
+      SOFT_ERROR(PI_BAD_STEP_AXES, "bad number of axes (%d)", numAxes);
+
+   if ((!axes) || (!stepProfile))
+      SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) axes or stepProfile pointer");
+
+   width = stepProfile->stepMicros;
+
+   /* a step and its gap, 2 * width, must fit the period at maxSpeed */
+
+   if ((stepProfile->maxSpeed < 1) ||
+       (stepProfile->startSpeed > stepProfile->maxSpeed) ||
+       (stepProfile->endSpeed > stepProfile->maxSpeed) ||
+       (width < 1) ||
+       (stepProfile->maxSpeed > (500000 / width)) ||
+       (stepProfile->flags & ~PI_STEP_SCURVE))
+      SOFT_ERROR(PI_BAD_STEP_PROFILE,
+         "bad profile start=%d max=%d end=%d accel=%d micros=%d flags=%X",
+         stepProfile->startSpeed, stepProfile->maxSpeed, stepProfile->endSpeed,
+         stepProfile->accel, width, stepProfile->flags);
+
+   /* the axis with most steps sets the pace, the others follow it */
+
+   n = 0;
+   dirOn = 0;
+   dirOff = 0;
+
+   for (a=0; a<numAxes; a++)
+   {
+      if ((axes[a].stepGpio > PI_MAX_USER_GPIO) ||
+          (axes[a].dirGpio  > PI_MAX_USER_GPIO))
+         SOFT_ERROR(PI_BAD_USER_GPIO, "bad axis %d gpios (%d, %d)",
+            a, axes[a].stepGpio, axes[a].dirGpio);
+
+      steps = (axes[a].steps < 0) ? -axes[a].steps : axes[a].steps;
+
+      if (steps > n) n = steps;
+
+      if (axes[a].steps > 0) dirOn  |= (1<<axes[a].dirGpio);
+      if (axes[a].steps < 0) dirOff |= (1<<axes[a].dirGpio);
+   }
+
+   if (n > ((PI_WAVE_MAX_PULSES - 1) / 2))
+      SOFT_ERROR(PI_BAD_STEP_AXES, "too many steps (%d)", n);
+
+   if (n == 0) return 0;
+
+   /*
+      Plan a speed profile for n steps.  The peak speed is reduced
+      if there isn't room to reach it, then the start or end speed
+      if they can't be met.  The average acceleration of an S-curve
+      ramp is lowered so its steepest point is the given accel.
+   */
+
+   memset(&pl, 0, sizeof(pl));
+
+   pl.scurve = (stepProfile->flags & PI_STEP_SCURVE) != 0;
+   pl.v0 = stepProfile->startSpeed;
+   pl.ve = stepProfile->endSpeed;
+
+   if (stepProfile->accel)
+   {
+      am = pl.scurve ? (stepProfile->accel * 2.0 / 3.0) : stepProfile->accel;
+
+      vp2 = (am * n) + (((pl.v0 * pl.v0) + (pl.ve * pl.ve)) / 2.0);
+
+      pl.vp = stepSqrt(vp2);
+
+      if (pl.vp > stepProfile->maxSpeed) pl.vp = stepProfile->maxSpeed;
+      if (pl.vp < pl.v0) pl.vp = pl.v0;
+      if (pl.vp < pl.ve) pl.vp = pl.ve;
+
+      pl.Ta = (pl.vp - pl.v0) / am;
+      pl.Td = (pl.vp - pl.ve) / am;
+   }
+   else
+   {
+      pl.v0 = stepProfile->maxSpeed;
+      pl.vp = stepProfile->maxSpeed;
+      pl.ve = stepProfile->maxSpeed;
+   }
+
+   pl.Da = (pl.v0 + pl.vp) * pl.Ta / 2.0;
+   pl.Dc = n - pl.Da - ((pl.vp + pl.ve) * pl.Td / 2.0);
+
+   if (pl.Dc < 0.0) pl.Dc = 0.0;
+
+   pl.Tc = pl.Dc / pl.vp;
+
+   end = pl.Ta + pl.Tc + pl.Td;
+
+   /*
+      Set the directions then wait one step pulse width before the
+      first step.  Step k of the leading axis is made as the move
+      passes k-1/2 steps, the others step when their share of the
+      move rounds up.
+   */
+
+   stepPulse[0].gpioOn  = dirOn;
+   stepPulse[0].gpioOff = dirOff;
+
+   p = 0;
+   prev = 0;
+   t = 0.0;
+
+   for (k=1; k<=n; k++)
+   {
+      t = stepTime(&pl, k - 0.5, t, end);
+
+      at = width + (uint32_t)((t * 1000000.0) + 0.5);
+
+      if (at < (prev + width)) at = prev + width;
+
+      mask = 0;
+
+      for (a=0; a<numAxes; a++)
+      {
+         steps = (axes[a].steps < 0) ? -axes[a].steps : axes[a].steps;
+
+         if (((k * steps) / n) != (((k - 1) * steps) / n))
+            mask |= (1<<axes[a].stepGpio);
+      }
+
+      stepPulse[p].usDelay = at - prev;
+
+      p++;
+
+      stepPulse[p].gpioOn  = mask;
+      stepPulse[p].gpioOff = 0;
+      stepPulse[p].usDelay = width;
+
+      p++;
+
+      stepPulse[p].gpioOn  = 0;
+      stepPulse[p].gpioOff = mask;
+
+      prev = at + width;
+   }
+
+   stepPulse[p].usDelay = 0;
+
+   return p + 1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveAddSteps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
+{
+   int n;
+
+   DBG(DBG_USER, "numAxes=%u axes=%08X stepProfile=%08X",
+      numAxes, (uint32_t)axes, (uint32_t)stepProfile);
+
+   CHECK_INITED;
+
+   n = waveSteps(numAxes, axes, stepProfile);
+
+   if (n <= 0) return n;
+
+   return gpioWaveAddGeneric(n, stepPulse);
+}
+
+/* ----------------------------------------------------------------------- */
+
+int rawWaveAddSPI(
+   rawSPI_t *spi,
+   unsigned offset,
+   unsigned spiSS,
+   char *buf,
+   unsigned spiTxBits,
+   unsigned spiBitFirst,
+   unsigned spiBitLast,
+   unsigned spiBits)
+{
+   int p, dbv, bit, halfbit;
+   int rising_edge[2], read_cycle[2];
+   uint32_t on_bits, off_bits;
+   int tx_bit_pos;
+
+   DBG(DBG_USER,
+      "spi=%08X off=%d spiSS=%d tx=%08X, num=%d fb=%d lb=%d spiBits=%d",
+      (uint32_t)spi, offset, spiSS, (uint32_t)buf, spiTxBits,
+      spiBitFirst, spiBitLast, spiBits);
+
+   CHECK_INITED;
+
+   if (spiSS > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", spiSS);
+
+   /*
+   CPOL CPHA
+    0    0   read rising/write falling
+    0    1   read falling/write rising
+    1    0   read falling/write rising
+    1    1   read rising/write falling
+   */
+
+   if (spi->clk_pol) {rising_edge[0] = 0; rising_edge[1] = 1;}
+   else              {rising_edge[0] = 1; rising_edge[1] = 0;}
+
+   if (spi->clk_pha) {read_cycle[0] = 0; read_cycle[1] = 1;}
+   else              {read_cycle[0] = 1; read_cycle[1] = 0;}
+
+   p = 0;
+
+   if (offset)
+   {
+      wf[2][p].gpioOn  = 0;
+      wf[2][p].gpioOff = 0;
+      wf[2][p].flags   = 0;
+      wf[2][p].usDelay = offset;
+      p++;
+   }
+
+   /* preset initial mosi bit in case it's read at leading clock bit */
+
+   on_bits = 0;
+   off_bits = 0;
+
+   tx_bit_pos = 0;
+
+   if (getBitInBytes(tx_bit_pos, buf, spiTxBits))
+   {
+      dbv = 1;
+      on_bits  |= (1<<(spi->mosi));
+   }
+   else
+   {
+      dbv = 0;
+      off_bits  |= (1<<(spi->mosi));
+   }
+
+   if (spi->ss_pol) off_bits |= (1<<spiSS);
+   else             on_bits  |= (1<<spiSS);
+
+   wf[2][p].gpioOn  = on_bits;
+   wf[2][p].gpioOff = off_bits;
+   wf[2][p].flags   = 0;
+
+   if (spi->clk_us > spi->ss_us) wf[2][p].usDelay = spi->clk_us;
+   else                          wf[2][p].usDelay = spi->ss_us;
+
+   p++;
+
+   for (bit=1; bit<=spiBits; bit++)
+   {
+      for (halfbit=0; halfbit<2; halfbit++)
+      {
+         wf[2][p].usDelay = spi->clk_us;
+         wf[2][p].flags = 0;
+
+         on_bits = 0;
+         off_bits = 0;
+
+         if (read_cycle[halfbit])
+         {
+            if ((bit>=spiBitFirst) && (bit<=spiBitLast))
+               wf[2][p].flags = WAVE_FLAG_READ;
+         }
+         else
+         {
+            if (getBitInBytes(tx_bit_pos, buf, spiTxBits))
+            {
+               if (!dbv) on_bits |= (1<<(spi->mosi));
+               dbv = 1;
+            }
+            else
+            {
+               if (dbv) off_bits |= (1<<(spi->mosi));
+               dbv = 0;
+            }
+
+            ++tx_bit_pos;
+         }
 
-   dmaPMapBlk = MAP_FAILED;
+         if (rising_edge[halfbit]) on_bits  |= (1<<(spi->clk));
+         else                      off_bits |= (1<<(spi->clk));
 
-   if (dmaMboxBlk != MAP_FAILED)
-   {
-      fdMbox = mbOpen();
+         wf[2][p].gpioOn = on_bits;
+         wf[2][p].gpioOff = off_bits;
 
-      for (i=0; i<(bufferBlocks+PI_WAVE_BLOCKS); i++)
-      {
-         mbDMAFree(&dmaMboxBlk[bufferBlocks+PI_WAVE_BLOCKS-i-1]);
+         p++;
       }
+   }
 
-      mbClose(fdMbox);
+   on_bits = 0;
+   off_bits = 0;
 
-      munmap(dmaMboxBlk, (bufferBlocks+PI_WAVE_BLOCKS)*sizeof(DMAMem_t));
-   }
+   if (spi->ss_pol) on_bits  |= (1<<spiSS);
+   else             off_bits |= (1<<spiSS);
 
-   dmaMboxBlk = MAP_FAILED;
+   wf[2][p].gpioOn  = on_bits;
+   wf[2][p].gpioOff = off_bits;
+   wf[2][p].flags   = 0;
+   wf[2][p].usDelay = 0;
 
-   if (inpFifo != NULL)
-   {
-      fclose(inpFifo);
-      unlink(PI_INPFIFO);
-      inpFifo = NULL;
-   }
+   p++;
 
-   if (outFifo != NULL)
-   {
-      fclose(outFifo);
-      unlink(PI_OUTFIFO);
-      outFifo = NULL;
-   }
+   return rawWaveAddGeneric(p, wf[2]);
+}
 
-   if (fdMem != -1)
-   {
-      close(fdMem);
-      fdMem = -1;
-   }
+/* ----------------------------------------------------------------------- */
 
-   if (fdLock != -1)
-   {
-      close(fdLock);
-      unlink(PI_LOCKFILE);
-      fdLock = -1;
-   }
+static uint64_t waveHash(int numPulses, rawWave_t *pulses)
+{
+   uint64_t hash;
+   uint32_t *w;
+   int i;
 
-   if (fdSock != -1)
-   {
-      close(fdSock);
-      fdSock = -1;
-   }
+   /* FNV-1a a word at a time */
 
-   if (fdPmap != -1)
-   {
-      close(fdPmap);
-      fdPmap = -1;
-   }
+   hash = 0xcbf29ce484222325ULL;
 
-   if (fdMbox != -1)
+   w = (uint32_t *)pulses;
+
+   for (i=0; i<(numPulses * (sizeof(rawWave_t)/4)); i++)
    {
-      close(fdMbox);
-      fdMbox = -1;
+      hash ^= w[i];
+      hash *= 0x100000001b3ULL;
    }
 
-   gpioStats.DMARestarts = 0;
-   gpioStats.dmaInitCbsCount = 0;
+   return hash;
 }
 
-int initInitialise(void)
+static uint64_t waveMicros(int numPulses, rawWave_t *pulses)
 {
-   int rev, i;
-   struct sockaddr_in server;
-   char * portStr;
-   unsigned port;
-   struct sched_param param;
-   pthread_attr_t pthAttr;
+   uint64_t micros;
+   unsigned half;
+   int i;
 
-   DBG(DBG_STARTUP, "");
+   /* the delays as wave2Cbs rounded them */
 
-   waveClockInited = 0;
+   half = PI_WF_MICROS/2;
 
-   clock_gettime(CLOCK_REALTIME, &libStarted);
+   micros = 0;
 
-   rev = gpioHardwareRevision();
+   for (i=0; i<numPulses; i++)
+      micros += PI_WF_MICROS * ((pulses[i].usDelay + half) / PI_WF_MICROS);
 
-   initClearGlobals();
+   return micros;
+}
 
-   if (initCheckPermitted() < 0) return PI_INIT_FAILED;
+static int waveFind(uint64_t hash, int numPulses, rawWave_t *pulses)
+{
+   int i;
 
-   fdLock = initGrabLockFile();
+   for (i=0; i<PI_MAX_WAVES; i++)
+   {
+      if ((waveState[i]           == WAVE_LIVE) &&
+          (waveKey[i].shared)                   &&
+          (waveKey[i].hash        == hash)      &&
+          (waveKey[i].numPulses   == numPulses) &&
+          (memcmp(waveKey[i].pulses, pulses,
+             numPulses * sizeof(rawWave_t)) == 0))
+         return i;
+   }
 
-   if (fdLock < 0)
-      SOFT_ERROR(PI_INIT_FAILED, "Can't lock %s", PI_LOCKFILE);
+   return -1;
+}
 
-   if (!gpioMaskSet)
-   {
-      if      (rev ==  0) gpioMask = PI_DEFAULT_UPDATE_MASK_R0;
-      else if (rev == 17) gpioMask = PI_DEFAULT_UPDATE_MASK_COMPUTE;
-      else if (rev <   4) gpioMask = PI_DEFAULT_UPDATE_MASK_R1;
-      else if (rev <  16) gpioMask = PI_DEFAULT_UPDATE_MASK_R2;
-      else                gpioMask = PI_DEFAULT_UPDATE_MASK_R3;
+/* ----------------------------------------------------------------------- */
 
-      gpioMaskSet = 1;
+static int waveSlots(int wid, uint32_t patchBits)
+{
+   int i, ool, n;
+   rawWave_t *w;
+   waveSlot_t *slot;
+
+   /* where wave2Cbs put the SET and CLR word of each slot */
+
+   n = 0;
+
+   for (i=0; i<wfc[wfcur]; i++)
+   {
+      w = &wf[wfcur][i];
+      if ((w->gpioOn | w->gpioOff) & patchBits) n++;
    }
 
-#ifndef EMBEDDED_IN_VM
-   sigSetHandler();
-#endif
+   if (waveKey[wid].maxSlots < n)
+   {
+      slot = realloc(waveKey[wid].slot, n * sizeof(waveSlot_t));
 
-   if (initPeripherals() < 0) return PI_INIT_FAILED;
+      if (slot == NULL) return PI_NO_MEMORY;
 
-   if (initAllocDMAMem() < 0) return PI_INIT_FAILED;
+      waveKey[wid].slot = slot;
+      waveKey[wid].maxSlots = n;
+   }
 
-   /* done with /dev/mem */
+   ool = 0;
+   n = 0;
 
-   if (fdMem != -1)
+   for (i=0; i<wfc[wfcur]; i++)
    {
-      close(fdMem);
-      fdMem = -1;
-   }
+      w = &wf[wfcur][i];
 
-   param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+      if ((w->gpioOn | w->gpioOff) & patchBits)
+      {
+         waveKey[wid].slot[n].ool     = ool;
+         waveKey[wid].slot[n].gpioOn  = w->gpioOn  & ~patchBits;
+         waveKey[wid].slot[n].gpioOff = w->gpioOff & ~patchBits;
+         n++;
 
-   sched_setscheduler(0, SCHED_FIFO, &param);
+         ool += 2;
+      }
+      else ool += (w->gpioOn != 0) + (w->gpioOff != 0);
+   }
 
-   initClock(1); /* initialise main clock */
+   waveKey[wid].numSlots = n;
 
-   atexit(gpioTerminate);
+   return 0;
+}
 
-   if (pthread_attr_init(&pthAttr))
-      SOFT_ERROR(PI_INIT_FAILED, "pthread_attr_init failed (%m)");
+/* ----------------------------------------------------------------------- */
 
-   if (pthread_attr_setstacksize(&pthAttr, STACK_SIZE))
-      SOFT_ERROR(PI_INIT_FAILED, "pthread_attr_setstacksize failed (%m)");
+static int waveCreate(uint32_t patchBits, int shared)
+{
+   int wid, cb, numCB, numOOL, numLoops, botCB, botOOL, status;
+   uint32_t len;
+   uint64_t hash;
+   rawWave_t *pulses;
 
-   if (pthread_create(&pthAlert, &pthAttr, pthAlertThread, &i))
-      SOFT_ERROR(PI_INIT_FAILED, "pthread_create alert failed (%m)");
+   if (wfc[wfcur] == 0) return PI_EMPTY_WAVEFORM;
 
-   pthAlertRunning = 1;
+   waveReap();
 
-   if (!(gpioCfg.ifFlags & PI_DISABLE_FIFO_IF))
-   {
-      if (pthread_create(&pthFifo, &pthAttr, pthFifoThread, &i))
-         SOFT_ERROR(PI_INIT_FAILED, "pthread_create fifo failed (%m)");
+   /*
+      Identical content already created shared is shared again.
+      Other creates always build a wave of their own.
+   */
 
-      pthFifoRunning = 1;
-   }
+   len = wfc[wfcur] * sizeof(rawWave_t);
 
-   if (!(gpioCfg.ifFlags & PI_DISABLE_SOCK_IF))
+   hash = 0;
+
+   if (shared)
    {
-      fdSock = socket(AF_INET , SOCK_STREAM , 0);
+      hash = waveHash(wfc[wfcur], wf[wfcur]);
 
-      if (fdSock == -1)
-         SOFT_ERROR(PI_INIT_FAILED, "socket failed (%m)");
+      wid = waveFind(hash, wfc[wfcur], wf[wfcur]);
 
-      portStr = getenv(PI_ENVPORT);
+      if (wid >= 0)
+      {
+         waveKey[wid].refs++;
 
-      if (portStr) port = atoi(portStr); else port = gpioCfg.socketPort;
+         gpioStats.waveCacheHits++;
 
-      server.sin_family = AF_INET;
-      server.sin_addr.s_addr = INADDR_ANY;
-      server.sin_port = htons(port);
+         gpioWaveAddNew();
 
-      if (bind(fdSock,(struct sockaddr *)&server , sizeof(server)) < 0)
-         SOFT_ERROR(PI_INIT_FAILED, "bind to port %d failed (%m)", port);
+         return wid;
+      }
+   }
 
-      if (pthread_create(&pthSocket, &pthAttr, pthSocketThread, &i))
-         SOFT_ERROR(PI_INIT_FAILED, "pthread_create socket failed (%m)");
+   /* the lowest free id */
 
-      pthSocketRunning = 1;
+   for (wid=0; wid<PI_MAX_WAVES; wid++)
+   {
+      if (waveState[wid] == WAVE_FREE) break;
    }
 
-   myGpioDelay(10000);
+   if (wid >= PI_MAX_WAVES) return PI_NO_WAVEFORM_ID;
 
-   dmaInitCbs();
+   if (patchBits)
+   {
+      status = waveSlots(wid, patchBits);
 
-   flushMemory();
+      if (status) return status;
+   }
 
-   initDMAgo((uint32_t *)dmaIn, (uint32_t)dmaIBus[0]);
+   waveNeeds(patchBits, &numCB, &numOOL, &numLoops);
 
-   myGpioDelay(20000);
+   status = waveAlloc(numCB, numOOL, &botCB, &botOOL);
 
-   return PIGPIO_VERSION;
-}
+   if (status) return status;
 
+   cb = wave2Cbs(PI_WAVE_MODE_ONE_SHOT,
+      botCB, botCB+numCB, botOOL, botOOL+numOOL, patchBits);
 
-/* ======================================================================= */
+   if (cb < 0) return cb;
 
-int getBitInBytes(int bitPos, char *buf, int numBits)
-{
-   int bitp, bufp;
+   /* a shared wave keeps its content to check later matches against */
 
-   if (bitPos < numBits)
+   if (shared)
    {
-      bufp =      bitPos / 8;
-      bitp = 7 - (bitPos % 8);
-      if (buf[bufp] & (1<<bitp)) return 1;
-   }
+      if (waveKey[wid].maxPulses < wfc[wfcur])
+      {
+         pulses = realloc(waveKey[wid].pulses, len);
 
-   return 0;
-}
+         if (pulses == NULL) return PI_NO_MEMORY;
 
-/* ----------------------------------------------------------------------- */
+         waveKey[wid].pulses = pulses;
+         waveKey[wid].maxPulses = wfc[wfcur];
+      }
 
-void putBitInBytes(int bitPos, char *buf, int bit)
-{
-   int bitp, bufp;
+      memcpy(waveKey[wid].pulses, wf[wfcur], len);
 
-   bufp =      bitPos / 8;
-   bitp = 7 - (bitPos % 8);
+      waveKey[wid].numPulses = wfc[wfcur];
+   }
+   else waveKey[wid].numPulses = 0;
 
-   if (bit) buf[bufp] |=   (1<<bitp);
-   else     buf[bufp] &= (~(1<<bitp));
-}
+   waveKey[wid].hash = hash;
+   waveKey[wid].shared = shared;
+   waveKey[wid].micros = waveMicros(wfc[wfcur], wf[wfcur]);
+   waveKey[wid].refs = 1;
+   waveKey[wid].patchBits = patchBits;
 
-/* ----------------------------------------------------------------------- */
+   waveInfo[wid].botCB  = botCB;
+   waveInfo[wid].topCB  = botCB + cb - 1;
+   waveInfo[wid].botOOL = botOOL;
+   waveInfo[wid].topOOL = botOOL + numOOL;
 
-uint32_t rawWaveGetOut(int pos)
-{
-   int page, slot;
+   waveState[wid] = WAVE_LIVE;
+   waveTx[wid] = 0;
+   waveFixed[wid] = (numLoops != 0);
 
-   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
-   {
-      waveOOLPageSlot(pos, &page, &slot);
-      return (dmaOVirt[page]->OOL[slot]);
-   }
+   gpioWaveAddNew();
 
-   return -1;
+   return wid;
 }
 
 /* ----------------------------------------------------------------------- */
 
-void rawWaveSetOut(int pos, uint32_t value)
+int gpioWaveCreate(void)
 {
-   int page, slot;
+   DBG(DBG_USER, "");
 
-   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
-   {
-      waveOOLPageSlot(pos, &page, &slot);
-      dmaOVirt[page]->OOL[slot] = value;
-   }
-}
+   CHECK_INITED;
 
+   return waveCreate(0, 0);
+}
 
 /* ----------------------------------------------------------------------- */
 
-uint32_t rawWaveGetIn(int pos)
+int gpioWaveCreateShared(void)
 {
-   int page, slot;
+   DBG(DBG_USER, "");
 
-   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
-   {
-      waveOOLPageSlot((NUM_WAVE_OOL-1)-pos, &page, &slot);
-      return (dmaOVirt[page]->OOL[slot]);
-   }
+   CHECK_INITED;
 
-   return -1;
+   return waveCreate(0, 1);
 }
 
 /* ----------------------------------------------------------------------- */
 
-void rawWaveSetIn(int pos, uint32_t value)
+int gpioWaveCreatePatchable(uint32_t bits)
 {
-   int page, slot;
-
-   if ((pos >= 0) && (pos < NUM_WAVE_OOL))
-   {
-      waveOOLPageSlot((NUM_WAVE_OOL-1)-pos, &page, &slot);
-      dmaOVirt[page]->OOL[slot] = value;
-   }
-}
+   DBG(DBG_USER, "bits=%08X", bits);
 
-/* ----------------------------------------------------------------------- */
+   CHECK_INITED;
 
-rawWaveInfo_t rawWaveInfo(int wave_id)
-{
-   rawWaveInfo_t dummy = {-1, -1, -1, -1};
+   if (!bits)
+      SOFT_ERROR(PI_BAD_PATCH, "no bits to patch");
 
-   if ((wave_id >=0) && (wave_id < PI_MAX_WAVES)) return waveInfo[wave_id];
-   else                                           return dummy;
+   return waveCreate(bits, 0);
 }
 
 /* ----------------------------------------------------------------------- */
 
-double time_time(void)
+int gpioWavePatch(
+   unsigned wave_id, unsigned slot, unsigned numSlots, uint32_t *levels)
 {
-   struct timeval tv;
-   double t;
+   int i, ool;
+   uint32_t bits;
+   waveSlot_t *s;
 
-   gettimeofday(&tv, 0);
+   DBG(DBG_USER, "wave id=%d slot=%d numSlots=%d levels=%08X",
+      wave_id, slot, numSlots, (uint32_t)levels);
+
+   CHECK_INITED;
 
-   t = (double)tv.tv_sec + ((double)tv.tv_usec / 1E6);
+   if ((wave_id >= PI_MAX_WAVES) || (waveState[wave_id] != WAVE_LIVE))
+      SOFT_ERROR(PI_BAD_WAVE_ID, "bad wave id (%d)", wave_id);
 
-   return t;
-}
+   bits = waveKey[wave_id].patchBits;
 
-/* ----------------------------------------------------------------------- */
+   if ((!bits) ||
+       (slot > waveKey[wave_id].numSlots) ||
+       (numSlots > (waveKey[wave_id].numSlots - slot)))
+      SOFT_ERROR(PI_BAD_PATCH, "bad patch, wave id=%d slot=%d numSlots=%d",
+         wave_id, slot, numSlots);
 
-void time_sleep(double seconds)
-{
-   struct timespec ts, rem;
+   /* the OOL moves with the wave, the slots are relative to it */
 
-   if (seconds > 0.0)
+   for (i=0; i<numSlots; i++)
    {
-      ts.tv_sec = seconds;
-      ts.tv_nsec = (seconds-(double)ts.tv_sec) * 1E9;
+      s = &waveKey[wave_id].slot[slot+i];
 
-      while (clock_nanosleep(CLOCK_REALTIME, 0, &ts, &rem))
-      {
-         /* copy remaining time to ts */
-         ts.tv_sec  = rem.tv_sec;
-         ts.tv_nsec = rem.tv_nsec;
-      }
+      ool = waveInfo[wave_id].botOOL + s->ool;
+
+      waveSetOOL(ool,   s->gpioOn  | ( levels[i] & bits));
+      waveSetOOL(ool+1, s->gpioOff | (~levels[i] & bits));
    }
+
+   return waveKey[wave_id].numSlots;
 }
 
 /* ----------------------------------------------------------------------- */
 
-void rawDumpWave(void)
+int gpioWaveDelete(unsigned wave_id)
 {
-   int i;
-
-   unsigned numWaves, t;
+   DBG(DBG_USER, "wave id=%d", wave_id);
 
-   rawWave_t *waves;
+   CHECK_INITED;
 
-   numWaves = wfc[wfcur];
-   waves    = wf [wfcur];
+   if ((wave_id >= PI_MAX_WAVES) || (waveState[wave_id] != WAVE_LIVE))
+      SOFT_ERROR(PI_BAD_WAVE_ID, "bad wave id (%d)", wave_id);
 
-   t = 0;
+   /* a wave created more than once lives until its last delete */
 
-   for (i=0; i<numWaves; i++)
+   if (waveKey[wave_id].refs > 1)
    {
-      fprintf(stderr, "%10u %08X %08X %08X %10u\n",
-         t, waves[i].gpioOn, waves[i].gpioOff,
-         waves[i].flags, waves[i].usDelay);
-      t += waves[i].usDelay;
+      waveKey[wave_id].refs--;
+      return 0;
    }
+
+   /* a wave being transmitted keeps its memory until it stops */
+
+   if (waveInTx(wave_id)) waveState[wave_id] = WAVE_DYING;
+   else                   waveRelease(wave_id);
+
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-void rawDumpScript(unsigned script_id)
+static int waveImageCB(uint32_t ref, gpioWaveImageWave_t *w, unsigned offset)
 {
-   int i;
+   unsigned pos;
 
-   if (script_id >= PI_MAX_SCRIPTS) return;
+   /* a word of one of the wave's cbs */
 
-   if (gpioScript[script_id].state == PI_SCRIPT_IN_USE)
-   {
+   if ((ref & ~PI_WI_REF_MASK) != PI_WI_REF_CB) return 0;
 
-      for (i=0; i<PI_MAX_SCRIPT_PARAMS; i++)
-      {
-         fprintf(stderr, "p%d=%d ", i, gpioScript[script_id].script.par[i]);
-      }
+   pos = ref & PI_WI_REF_MASK;
 
-      fprintf(stderr, "\n");
+   return ((pos/32) >= w->botCB) && ((pos/32) <= w->topCB) &&
+          ((pos%32) == offset);
+}
 
-      for (i=0; i<PI_MAX_SCRIPT_VARS; i++)
-      {
-         fprintf(stderr, "v%d=%d ", i, gpioScript[script_id].script.var[i]);
-      }
+static int waveImageOOL(uint32_t ref, gpioWaveImageWave_t *w, unsigned len)
+{
+   unsigned pos;
 
-      fprintf(stderr, "\n");
+   /* len of the wave's OOL, in one page as the image is page aligned */
 
-      for (i=0; i<gpioScript[script_id].script.instrs; i++)
-      {
-         fprintf(stderr,
-            "c%d=[%d, %d(%d), %d(%d), %d, %d]\n",
-            i,
-            gpioScript[script_id].script.instr[i].p[0],
-            gpioScript[script_id].script.instr[i].p[1],
-            gpioScript[script_id].script.instr[i].opt[1],
-            gpioScript[script_id].script.instr[i].p[2],
-            gpioScript[script_id].script.instr[i].opt[2],
-            gpioScript[script_id].script.instr[i].p[3],
-            gpioScript[script_id].script.instr[i].p[4]);
-      }
-   }
-}
+   if ((ref & ~PI_WI_REF_MASK) != PI_WI_REF_OOL) return 0;
 
-/* ======================================================================= */
+   pos = ref & PI_WI_REF_MASK;
 
-int gpioInitialise(void)
+   return (len > 0) && (pos >= w->botOOL) && ((pos+len) <= w->topOOL) &&
+          (((pos % OOL_PER_OPAGE) + len) <= OOL_PER_OPAGE);
+}
+
+static int waveImageCheck(
+   gpioWaveImage_t *img, gpioWaveImageWave_t *wave, gpioWaveImageCb_t *cbs,
+   uint32_t *ool, uint32_t *reloc, uint8_t *use)
 {
-   int status;
+   gpioWaveImageWave_t *w;
+   gpioWaveImageCb_t *cb;
+   uint32_t i, j, k, r, len, src, dst, nextCB, nextOOL;
 
-   if (libInitialised) return PIGPIO_VERSION;
+   /*
+      The waves must tile the image and a wave's cbs may only refer
+      to the wave.  use marks each OOL which holds a cb address (4),
+      is written by a cb (2), or is sent to the gpios (1).  A cb may
+      only change the next of a cb, and then only to a cb address,
+      and the levels sent to the gpios must be fixed.  A wave's last
+      cb must end it as a send or a chain repoints its next.
+   */
 
-   DBG(DBG_STARTUP, "not initialised, initialising");
+   nextCB = 0;
+   nextOOL = 0;
+   r = 0;
 
-   runState = PI_STARTING;
+   for (i=0; i<img->numWaves; i++)
+   {
+      w = &wave[i];
 
-   status = initInitialise();
+      if ((w->botCB != nextCB) || (w->topCB < w->botCB) ||
+          (w->topCB >= img->numCB) || (w->botOOL != nextOOL) ||
+          (w->topOOL < w->botOOL) || (w->topOOL > img->numOOL))
+         SOFT_ERROR(PI_BAD_WAVE_IMAGE, "bad extent for image wave %d", i);
 
-   if (status < 0)
-   {
-      runState = PI_ENDING;
-      initReleaseResources();
-   }
-   else
-   {
-      libInitialised = 1;
-      runState = PI_RUNNING;
-   }
+      if (cbs[w->topCB].next)
+         SOFT_ERROR(PI_BAD_WAVE_IMAGE, "image wave %d doesn't end", i);
 
-   return status;
-}
+      nextCB  = w->topCB + 1;
+      nextOOL = w->topOOL;
 
+      for (; (r < img->numRelocs) && (reloc[r] < w->topOOL); r++)
+      {
+         if ((reloc[r] < w->botOOL) || (r && (reloc[r] <= reloc[r-1])) ||
+             !waveImageCB(ool[reloc[r]], w, 0))
+            SOFT_ERROR(PI_BAD_WAVE_IMAGE, "bad image reloc %d", r);
 
-/* ----------------------------------------------------------------------- */
+         use[reloc[r]] |= 4;
+      }
 
-void gpioTerminate(void)
-{
-   int i;
+      for (j=w->botCB; j<=w->topCB; j++)
+      {
+         cb = &cbs[j];
 
-   DBG(DBG_USER, "");
+         src = cb->src & PI_WI_REF_MASK;
+         dst = cb->dst & PI_WI_REF_MASK;
 
-   if (!libInitialised) return;
+         if (cb->next && !waveImageCB(cb->next, w, 0))
+            SOFT_ERROR(PI_BAD_WAVE_IMAGE, "bad next for image cb %d", j);
 
-   DBG(DBG_STARTUP, "initialised, terminating");
+         switch (cb->info)
+         {
+            case PI_WI_CB_COPY:
 
-   runState = PI_ENDING;
+               if (cb->length != 4) break;
 
-   gpioMaskSet = 0;
+               if ((cb->dst == (PI_WI_REF_PERI|PI_WI_PERI_SET)) ||
+                   (cb->dst == (PI_WI_REF_PERI|PI_WI_PERI_CLR)))
+               {
+                  if (!waveImageOOL(cb->src, w, 1)) break;
+                  use[src] |= 1;
+                  continue;
+               }
 
-   /* reset DMA */
+               if (waveImageCB(cb->dst, w, 20))
+               {
+                  if (!waveImageOOL(cb->src, w, 1) || !(use[src] & 4))
+                     break;
+                  continue;
+               }
 
-   if (dmaReg != MAP_FAILED) dmaIn[DMA_CS] = DMA_CHANNEL_RESET;
-   if (dmaReg != MAP_FAILED) dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+               if (!waveImageOOL(cb->dst, w, 1)) break;
 
-#ifndef EMBEDDED_IN_VM
-   if (gpioCfg.showStats)
-   {
-      fprintf(stderr,
-         "If you didn't request stats please cut & paste the\n"
-         "following and e-mail to pigpio@abyz.co.uk\n");
+               if (use[dst] & 4)
+               {
+                  if (!waveImageOOL(cb->src, w, 1) || !(use[src] & 4))
+                     break;
+               }
+               else if (!waveImageOOL(cb->src, w, 1) &&
+                        (cb->src != (PI_WI_REF_PERI|PI_WI_PERI_LEV)) &&
+                        (cb->src != (PI_WI_REF_PERI|PI_WI_PERI_CLO)))
+                  break;
 
-      fprintf(stderr,
-         "micros=%d allocMode=%d dmaInitCbs=%d DMARestarts=%d\n",
-         gpioCfg.clockMicros, gpioCfg.memAllocMode,
-         gpioStats.dmaInitCbsCount, gpioStats.DMARestarts);
+               use[dst] |= 2;
+               continue;
 
-      fprintf(stderr,
-         "samples %u maxSamples %u maxEmit %u emitFrags %u\n",
-         gpioStats.numSamples, gpioStats.maxSamples,
-         gpioStats.maxEmit, gpioStats.emitFrags);
+            case PI_WI_CB_BLOCK:
 
-      fprintf(stderr, "cbTicks %d, cbCalls %u alertTicks %u\n",
-         gpioStats.cbTicks, gpioStats.cbCalls, gpioStats.alertTicks);
+               len = cb->length / 4;
 
-      for (i=0; i< TICKSLOTS; i++)
-         fprintf(stderr, "%9u ", gpioStats.diffTick[i]);
+               if ((cb->length % 4) ||
+                   !waveImageOOL(cb->src, w, len) ||
+                   !waveImageOOL(cb->dst, w, len)) break;
 
-      fprintf(stderr, "\n");
+               for (k=0; k<len; k++)
+               {
+                  if ((use[dst+k] & 4) && !(use[src+k] & 4)) break;
+                  use[dst+k] |= 2;
+               }
 
-      fprintf(stderr, "\n");
+               if (k < len) break;
+               continue;
 
-      fprintf(stderr,
-         "#####################################################\n");
+            case PI_WI_CB_PACED:
+
+               if ((cb->length < 4) || (cb->length % 4) ||
+                   (cb->src != (PI_WI_REF_PERI|PI_WI_PERI_DATA)) ||
+                   (cb->dst != (PI_WI_REF_PERI|PI_WI_PERI_PACE))) break;
+               continue;
+         }
+
+         SOFT_ERROR(PI_BAD_WAVE_IMAGE, "bad image cb %d", j);
+      }
    }
-#endif
 
-   initReleaseResources();
+   if ((nextCB != img->numCB) || (nextOOL != img->numOOL) ||
+       (r != img->numRelocs))
+      SOFT_ERROR(PI_BAD_WAVE_IMAGE, "image waves don't cover the image");
 
-   fflush(NULL);
+   for (i=0; i<img->numOOL; i++)
+   {
+      if ((use[i] & 1) && (use[i] & 6))
+         SOFT_ERROR(PI_BAD_WAVE_IMAGE, "image gpio levels not fixed (%d)", i);
+   }
 
-   libInitialised = 0;
+   return 0;
 }
 
-static void switchFunctionOff(unsigned gpio)
+static uint32_t waveImageAdr(uint32_t ref, int botCB, int botOOL)
 {
-   unsigned clock, pwm;
-   int cctl[] = {CLK_GP0_CTL, CLK_GP1_CTL, CLK_GP2_CTL};
+   uint32_t pos;
 
-   switch (gpioInfo[gpio].is)
+   pos = ref & PI_WI_REF_MASK;
+
+   switch (ref & ~PI_WI_REF_MASK)
    {
-      case GPIO_SERVO:
-         /* switch servo off */
-         myGpioSetServo(gpio, gpioInfo[gpio].width, 0);
-         gpioInfo[gpio].width = 0;
-         break;
+      case PI_WI_REF_CB:
+         return waveCbPOadr(botCB + (pos/32)) + (pos%32);
 
-      case GPIO_PWM:
-         /* switch pwm off */
-         myGpioSetPwm(gpio, gpioInfo[gpio].width, 0);
-         gpioInfo[gpio].width = 0;
-         break;
+      case PI_WI_REF_OOL:
+         return waveOOLPOadr(botOOL + pos);
 
-      case GPIO_HW_CLK:
-         /* switch hardware clock off */
-         clock = (clkDef[gpio] >> 4) & 3;
-         clkReg[cctl[clock]] = CLK_PASSWD | CLK_CTL_KILL;
-         gpioInfo[gpio].width = 0;
-         break;
+      case PI_WI_REF_PERI:
+         switch (pos)
+         {
+            case PI_WI_PERI_SET:
+               return ((GPIO_BASE + (GPSET0*4)) & 0x00ffffff) | PI_PERI_BUS;
 
-      case GPIO_HW_PWM:
-         /* switch hardware PWM off */
-         pwm = (PWMDef[gpio] >> 4) & 3;
-         if (pwm == 0) pwmReg[PWM_CTL] &= (~PWM_CTL_PWEN1);
-         else          pwmReg[PWM_CTL] &= (~PWM_CTL_PWEN2);
-         gpioInfo[gpio].width = 0;
-         break;
+            case PI_WI_PERI_CLR:
+               return ((GPIO_BASE + (GPCLR0*4)) & 0x00ffffff) | PI_PERI_BUS;
+
+            case PI_WI_PERI_LEV:
+               return ((GPIO_BASE + (GPLEV0*4)) & 0x00ffffff) | PI_PERI_BUS;
+
+            case PI_WI_PERI_CLO:
+               return ((SYST_BASE + (SYST_CLO*4)) & 0x00ffffff) | PI_PERI_BUS;
+
+            case PI_WI_PERI_PACE:
+               /* use the secondary clock */
+               if (gpioCfg.clockPeriph != PI_CLOCK_PCM)
+                  return ((PCM_BASE + PCM_FIFO*4) & 0x00ffffff) | PI_PERI_BUS;
+               else
+                  return ((PWM_BASE + PWM_FIFO*4) & 0x00ffffff) | PI_PERI_BUS;
+
+            case PI_WI_PERI_DATA:
+               return (uint32_t) (&dmaOBus[0]->periphData);
+         }
    }
+
+   return 0;
 }
 
-static void stopHardwarePWM(void)
+static int waveLoadImage(
+   char *buf, unsigned bufSize, uint32_t mask, unsigned *wave_ids)
 {
-   int i;
+   gpioWaveImage_t img;
+   gpioWaveImageWave_t *wave;
+   gpioWaveImageCb_t *cbs, *c;
+   rawCbs_t *p;
+   uint32_t *ool, *reloc, v;
+   uint8_t *use;
+   char *copy;
+   unsigned half;
+   int i, wid, numFree, status, botCB, botOOL;
 
-   for (i=0; i<= PI_MAX_GPIO; i++)
-   {
-      if (gpioInfo[i].is == GPIO_HW_PWM)
-      {
-         switchFunctionOff(i);
+   if (bufSize < sizeof(img))
+      SOFT_ERROR(PI_BAD_WAVE_IMAGE, "wave image too short (%d)", bufSize);
 
-         gpioInfo[i].is = GPIO_UNDEFINED;
-      }
-   }
-}
+   memcpy(&img, buf, sizeof(img));
 
-/* ----------------------------------------------------------------------- */
+   if ((img.magic != PI_WAVE_IMAGE_MAGIC) ||
+       (img.oolPage != OOL_PER_OPAGE) ||
+       (img.numWaves < 1) || (img.numWaves > PI_MAX_WAVES) ||
+       (img.numCB > NUM_WAVE_CBS) || (img.numOOL > NUM_WAVE_OOL) ||
+       (img.numRelocs > img.numOOL) ||
+       (bufSize != (sizeof(img) +
+          (img.numWaves * sizeof(gpioWaveImageWave_t)) +
+          (img.numCB * sizeof(gpioWaveImageCb_t)) +
+          ((img.numOOL + img.numRelocs) * 4))))
+      SOFT_ERROR(PI_BAD_WAVE_IMAGE, "bad wave image header");
 
-int gpioSetMode(unsigned gpio, unsigned mode)
-{
-   int reg, shift, old_mode;
+   waveReap();
 
-   DBG(DBG_USER, "gpio=%d mode=%d", gpio, mode);
+   numFree = 0;
 
-   CHECK_INITED;
+   for (wid=0; wid<PI_MAX_WAVES; wid++)
+   {
+      if (waveState[wid] == WAVE_FREE) numFree++;
+   }
 
-   if (gpio > PI_MAX_GPIO)
-      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+   if (numFree < img.numWaves) return PI_NO_WAVEFORM_ID;
 
-   if (mode > PI_ALT3)
-      SOFT_ERROR(PI_BAD_MODE, "gpio %d, bad mode (%d)", gpio, mode);
+   /* an aligned copy to check, with room to mark the OOL's use */
 
-   reg   =  gpio/10;
-   shift = (gpio%10) * 3;
+   copy = malloc(bufSize + img.numOOL);
 
-   old_mode = (gpioReg[reg] >> shift) & 7;
+   if (copy == NULL)
+      SOFT_ERROR(PI_NO_MEMORY, "no memory for wave image");
 
-   if (mode != old_mode)
-   {
-      switchFunctionOff(gpio);
+   memcpy(copy, buf, bufSize);
 
-      gpioInfo[gpio].is = GPIO_UNDEFINED;
+   wave  = (gpioWaveImageWave_t *)(copy + sizeof(img));
+   cbs   = (gpioWaveImageCb_t *)(wave + img.numWaves);
+   ool   = (uint32_t *)(cbs + img.numCB);
+   reloc = ool + img.numOOL;
+   use   = (uint8_t *)(reloc + img.numRelocs);
 
-      gpioReg[reg] = (gpioReg[reg] & ~(7<<shift)) | (mode<<shift);
-   }
+   memset(use, 0, img.numOOL);
 
-   return 0;
-}
+   status = waveImageCheck(&img, wave, cbs, ool, reloc, use);
 
+   /* the image's OOL pages must line up with the DMA pages */
 
-/* ----------------------------------------------------------------------- */
+   if (status == 0)
+      status = waveAlloc(img.numCB,
+         img.numOOL ? (img.numOOL + OOL_PER_OPAGE - 1) : 0, &botCB, &botOOL);
 
-int gpioGetMode(unsigned gpio)
-{
-   int reg, shift;
+   if (status)
+   {
+      free(copy);
+      return status;
+   }
 
-   DBG(DBG_USER, "gpio=%d", gpio);
+   botOOL += (OOL_PER_OPAGE - (botOOL % OOL_PER_OPAGE)) % OOL_PER_OPAGE;
 
-   CHECK_INITED;
+   half = PI_WF_MICROS/2;
 
-   if (gpio > PI_MAX_GPIO)
-      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+   for (i=0; i<img.numCB; i++)
+   {
+      c = &cbs[i];
 
-   reg   =  gpio/10;
-   shift = (gpio%10) * 3;
+      p = rawWaveCBAdr(botCB+i);
 
-   return (gpioReg[reg] >> shift) & 7;
-}
+      switch (c->info)
+      {
+         case PI_WI_CB_COPY:
+            p->info   = NORMAL_DMA;
+            p->length = 4;
+            break;
 
+         case PI_WI_CB_BLOCK:
+            p->info   = NORMAL_DMA|DMA_SRC_INC|DMA_DEST_INC;
+            p->length = c->length;
+            break;
 
-/* ----------------------------------------------------------------------- */
+         case PI_WI_CB_PACED:
+            if (gpioCfg.clockPeriph != PI_CLOCK_PCM)
+               p->info = NORMAL_DMA|DMA_DEST_DREQ|DMA_PERIPHERAL_MAPPING(2);
+            else
+               p->info = NORMAL_DMA|DMA_DEST_DREQ|DMA_PERIPHERAL_MAPPING(5);
+            p->length = 4 * (((c->length/4) + half) / PI_WF_MICROS);
+            break;
+      }
 
-int gpioSetPullUpDown(unsigned gpio, unsigned pud)
-{
-   DBG(DBG_USER, "gpio=%d pud=%d", gpio, pud);
+      p->src  = waveImageAdr(c->src, botCB, botOOL);
+      p->dst  = waveImageAdr(c->dst, botCB, botOOL);
+      p->next = waveImageAdr(c->next, botCB, botOOL);
+   }
+
+   for (i=0; i<img.numOOL; i++)
+   {
+      v = ool[i];
 
-   CHECK_INITED;
+      /* mask off any non permitted gpios */
 
-   if (gpio > PI_MAX_GPIO)
-      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+      if (use[i] & 4)      v = waveImageAdr(v, botCB, botOOL);
+      else if (use[i] & 1) v &= mask;
 
-   if (pud > PI_PUD_UP)
-      SOFT_ERROR(PI_BAD_PUD, "gpio %d, bad pud (%d)", gpio, pud);
+      waveSetOOL(botOOL+i, v);
+   }
 
-   *(gpioReg + GPPUD) = pud;
+   wid = 0;
 
-   myGpioDelay(20);
+   for (i=0; i<img.numWaves; i++)
+   {
+      while (waveState[wid] != WAVE_FREE) wid++;
 
-   *(gpioReg + GPPUDCLK0 + BANK) = BIT;
+      waveInfo[wid].botCB  = botCB  + wave[i].botCB;
+      waveInfo[wid].topCB  = botCB  + wave[i].topCB;
+      waveInfo[wid].botOOL = botOOL + wave[i].botOOL;
+      waveInfo[wid].topOOL = botOOL + wave[i].topOOL;
 
-   myGpioDelay(20);
+      /* no pulses, so never matched by a create */
 
-   *(gpioReg + GPPUD) = 0;
+      waveKey[wid].hash = 0;
+      waveKey[wid].shared = 0;
+      waveKey[wid].numPulses = 0;
+      waveKey[wid].micros = wave[i].micros;
+      waveKey[wid].refs = 1;
+      waveKey[wid].patchBits = 0;
+      waveKey[wid].numSlots = 0;
 
-   *(gpioReg + GPPUDCLK0 + BANK) = 0;
+      waveState[wid] = WAVE_LIVE;
+      waveTx[wid] = 0;
+      waveFixed[wid] = 1;
 
-   return 0;
-}
+      if (wave_ids != NULL) wave_ids[i] = wid;
+   }
 
+   free(copy);
+
+   return img.numWaves;
+}
 
 /* ----------------------------------------------------------------------- */
 
-int gpioRead(unsigned gpio)
+int gpioWaveLoadImage(char *buf, unsigned bufSize, unsigned *wave_ids)
 {
-   DBG(DBG_USER, "gpio=%d", gpio);
+   DBG(DBG_USER, "bufSize=%d wave_ids=%08X", bufSize, (uint32_t)wave_ids);
 
    CHECK_INITED;
 
-   if (gpio > PI_MAX_GPIO)
-      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
-
-   if ((*(gpioReg + GPLEV0 + BANK) & BIT) != 0) return PI_ON;
-   else                                         return PI_OFF;
+   return waveLoadImage(buf, bufSize, -1, wave_ids);
 }
 
-
 /* ----------------------------------------------------------------------- */
 
-int gpioWrite(unsigned gpio, unsigned level)
+int gpioWaveTxStart(unsigned wave_mode)
 {
-   DBG(DBG_USER, "gpio=%d level=%d", gpio, level);
-
-   CHECK_INITED;
+   /* This function is deprecated and will be removed. */
 
-   if (gpio > PI_MAX_GPIO)
-      SOFT_ERROR(PI_BAD_GPIO, "bad gpio (%d)", gpio);
+   int firstCB=WAVE_BOT_CB;
+   int numCBs, i;
 
-   if (level > PI_ON)
-      SOFT_ERROR(PI_BAD_LEVEL, "gpio %d, bad level (%d)", gpio, level);
+   DBG(DBG_USER, "wave_mode=%d", wave_mode);
 
-   if (gpio <= PI_MAX_GPIO)
-   {
-      if (gpioInfo[gpio].is != GPIO_WRITE)
-      {
-         /* stop a glitch between setting mode then level */
-         if (level == PI_OFF) *(gpioReg + GPCLR0 + BANK) = BIT;
-         else                 *(gpioReg + GPSET0 + BANK) = BIT;
+   CHECK_INITED;
 
-         switchFunctionOff(gpio);
+   if (wave_mode > PI_WAVE_MODE_REPEAT)
+      SOFT_ERROR(PI_BAD_WAVE_MODE, "bad wave mode (%d)", wave_mode);
 
-         gpioSetMode(gpio, PI_OUTPUT);
+   if (wfc[wfcur] == 0) return 0;
 
-         gpioInfo[gpio].is = GPIO_WRITE;
-      }
+   if (!waveClockInited)
+   {
+      stopHardwarePWM();
+      initClock(0); /* initialise secondary clock */
+      waveClockInited = 1;
    }
 
-   if (level == PI_OFF) *(gpioReg + GPCLR0 + BANK) = BIT;
-   else                 *(gpioReg + GPSET0 + BANK) = BIT;
-
-   return 0;
-}
-
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
 
-/* ----------------------------------------------------------------------- */
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-int gpioPWM(unsigned gpio, unsigned val)
-{
-   DBG(DBG_USER, "gpio=%d dutycycle=%d", gpio, val);
+   /* the waveform is built over any created waves and the stream */
 
-   CHECK_INITED;
+   waveReleaseAll();
+   memset(waveTx, 0, sizeof(waveTx));
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+   waveStream.active = 0;
+   waveChain.active = 0;
 
-   if (val > gpioInfo[gpio].range)
-      SOFT_ERROR(PI_BAD_DUTYCYCLE, "gpio %d, bad dutycycle (%d)", gpio, val);
+   numCBs = wave2Cbs(wave_mode, firstCB, NUM_WAVE_CBS,
+      WAVE_BOT_OOL, NUM_WAVE_OOL, 0);
 
-   if (gpioInfo[gpio].is != GPIO_PWM)
+   if (numCBs > 0)
    {
-      switchFunctionOff(gpio);
-
-      gpioSetMode(gpio, PI_OUTPUT);
+      if (gpioCfg.dbgLevel >= DBG_SLOW_TICK)
+      {
+         fprintf(stderr, "*** OUTPUT DMA CONTROL BLOCKS ***\n");
+         for (i=0; i<numCBs; i++) waveCbOPrint(firstCB+i);
+      }
 
-      gpioInfo[gpio].is = GPIO_PWM;
+      initDMAgo((uint32_t *)dmaOut, waveCbPOadr(firstCB));
    }
 
-   myGpioSetPwm(gpio, gpioInfo[gpio].width, val);
-
-   gpioInfo[gpio].width=val;
+   return numCBs;
 
-   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-int gpioGetPWMdutycycle(unsigned gpio)
+int gpioWaveTxSend(unsigned wave_id, unsigned wave_mode)
 {
-   unsigned pwm;
+   rawCbs_t *p=NULL;
 
-   DBG(DBG_USER, "gpio=%d", gpio);
+   DBG(DBG_USER, "wave_id=%d wave_mode=%d", wave_id, wave_mode);
 
    CHECK_INITED;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
-
-   switch (gpioInfo[gpio].is)
-   {
-      case GPIO_PWM:
-         return gpioInfo[gpio].width;
-
-      case GPIO_HW_PWM:
-         pwm = (PWMDef[gpio] >> 4) & 3;
-         return hw_pwm_duty[pwm];
+   if ((wave_id >= PI_MAX_WAVES) || (waveState[wave_id] != WAVE_LIVE))
+      SOFT_ERROR(PI_BAD_WAVE_ID, "bad wave id (%d)", wave_id);
 
-      case GPIO_HW_CLK:
-         return PI_HW_PWM_RANGE/2;
+   if (wave_mode > PI_WAVE_MODE_REPEAT)
+      SOFT_ERROR(PI_BAD_WAVE_MODE, "bad wave mode (%d)", wave_mode);
 
-      default:
-         SOFT_ERROR(PI_NOT_PWM_GPIO, "not a PWM gpio (%d)", gpio);
+   if (!waveClockInited)
+   {
+      stopHardwarePWM();
+      initClock(0); /* initialise secondary clock */
+      waveClockInited = 1;
    }
-}
-
-
-/* ----------------------------------------------------------------------- */
-
-int gpioSetPWMrange(unsigned gpio, unsigned range)
-{
-   int oldWidth, newWidth;
 
-   DBG(DBG_USER, "gpio=%d range=%d", gpio, range);
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
 
-   CHECK_INITED;
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+   waveStream.active = 0;
+   waveChain.active = 0;
 
-   if ((range < PI_MIN_DUTYCYCLE_RANGE)  || (range > PI_MAX_DUTYCYCLE_RANGE))
-      SOFT_ERROR(PI_BAD_DUTYRANGE, "gpio %d, bad range (%d)", gpio, range);
+   waveReap();
 
-   oldWidth = gpioInfo[gpio].width;
+   memset(waveTx, 0, sizeof(waveTx));
 
-   if (oldWidth)
-   {
-      if (gpioInfo[gpio].is == GPIO_PWM)
-      {
-         newWidth = (range * oldWidth) / gpioInfo[gpio].range;
+   waveTx[wave_id] = 1;
 
-         myGpioSetPwm(gpio, oldWidth, 0);
-         gpioInfo[gpio].range = range;
-         gpioInfo[gpio].width = newWidth;
-         myGpioSetPwm(gpio, 0, newWidth);
-      }
-   }
+   p = rawWaveCBAdr(waveInfo[wave_id].topCB);
 
-   gpioInfo[gpio].range = range;
+   if (wave_mode == PI_WAVE_MODE_ONE_SHOT) p->next = 0;
+   else p->next = waveCbPOadr(waveInfo[wave_id].botCB+1);
 
-   /* return the actual range for the current gpio frequency */
+   initDMAgo((uint32_t *)dmaOut, waveCbPOadr(waveInfo[wave_id].botCB));
 
-   return pwmRealRange[gpioInfo[gpio].freqIdx];
+   /* for compatability with the deprecated gpioWaveTxStart return the
+      number of cbs
+   */
+   return (waveInfo[wave_id].topCB - waveInfo[wave_id].botCB) + 1;
 }
 
-
 /* ----------------------------------------------------------------------- */
 
-int gpioGetPWMrange(unsigned gpio)
+int gpioWaveChain(char *buf, unsigned bufSize)
 {
-   DBG(DBG_USER, "gpio=%d", gpio);
+   unsigned blklen=8, blocks=8;
+   int i, wid, rwid, nwid, firstCB, lastCB, counters, cycles;
+   uint32_t repeat, next;
+   uint8_t used[256];
 
-   CHECK_INITED;
+   rawCbs_t *p=NULL;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+   DBG(DBG_USER, "bufSize=%d [%s]", bufSize, myBuf2Str(bufSize, buf));
 
-   switch (gpioInfo[gpio].is)
-   {
-      case GPIO_HW_PWM:
-      case GPIO_HW_CLK:
-         return PI_HW_PWM_RANGE;
+   CHECK_INITED;
 
-      default:
-         return gpioInfo[gpio].range;
+   if (!waveClockInited)
+   {
+      stopHardwarePWM();
+      initClock(0); /* initialise secondary clock */
+      waveClockInited = 1;
    }
-}
 
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
 
-/* ----------------------------------------------------------------------- */
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-int gpioGetPWMrealRange(unsigned gpio)
-{
-   unsigned pwm;
+   for (i=0; i<256; i++) used[i] = 255;
 
-   DBG(DBG_USER, "gpio=%d", gpio);
+   waveStream.active = 0;
+   waveChain.active = 0;
 
-   CHECK_INITED;
+   waveReap();
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+   memset(waveTx, 0, sizeof(waveTx));
 
-   switch (gpioInfo[gpio].is)
+   counters = 0;
+   wid = -1;
+   lastCB = -1;
+   firstCB = -1;
+
+   i = 0;
+
+   while (i<bufSize)
    {
-      case GPIO_HW_PWM:
-         pwm = (PWMDef[gpio] >> 4) & 3;
-         return hw_pwm_real_range[pwm];
+      wid = (uint8_t)buf[i];
 
-      case GPIO_HW_CLK:
-         return PI_HW_PWM_RANGE;
+      if (wid == 255) /* repeat wave command */
+      {
+         if (counters < PI_WAVE_COUNTERS)
+         {
+            if ((i+4) < bufSize)
+            {
+               rwid = (uint8_t)buf[i+1];
+               if ((i+5) < bufSize)
+               {
+                  nwid = (uint8_t)buf[i+5];
+                  if ((nwid < PI_MAX_WAVES) && (waveState[nwid] == WAVE_LIVE))
+                     next = waveCbPOadr(1+waveInfo[nwid].botCB);
+                  else next = 0; /* error, will be picked up later */
+               }
+               else next = 0;
+               if (used[rwid] == counters)
+               {
+                  repeat = waveCbPOadr(1+waveInfo[rwid].botCB);
 
-      default:
-         return pwmRealRange[gpioInfo[gpio].freqIdx];
-   }
-}
+                  cycles = (uint8_t)buf[i+2] +
+                           ((uint8_t)buf[i+3]<<8) +
+                           ((uint8_t)buf[i+4]<<16);
 
+                  i+=4;
 
-/* ----------------------------------------------------------------------- */
+                  if ((cycles > 1) && (cycles < PI_MAX_WAVE_CYCLES))
+                  {
+                     --cycles;
 
-int gpioSetPWMfrequency(unsigned gpio, unsigned frequency)
-{
-   int i, width;
-   unsigned diff, best, idx;
+                     waveCount(counters, blklen, blocks, cycles, repeat, next);
 
-   DBG(DBG_USER, "gpio=%d frequency=%d", gpio, frequency);
+                     p = rawWaveCBAdr(lastCB);
 
-   CHECK_INITED;
+                     lastCB = -1;
+
+                     p->next = waveCbPOadr(counters * CBS_PER_OPAGE);
+
+                     counters++;
+                  }
+                  else SOFT_ERROR(PI_BAD_REPEAT_CNT,
+                          "bad chain repeat count (%d)", cycles);
+               }
+               else SOFT_ERROR(PI_BAD_REPEAT_WID,
+                       "bad chain repeat wave (%d)", rwid);
+            }
+            else SOFT_ERROR(PI_BAD_CHAIN_CMD,
+                    "bad chain command (at char %d)", i);
+         }
+         else SOFT_ERROR(PI_TOO_MANY_COUNTS,
+                 "too many chain counters (at char %d)", i);
+      }
+      else if ((wid >= PI_MAX_WAVES) || (waveState[wid] != WAVE_LIVE))
+         SOFT_ERROR(PI_BAD_WAVE_ID, "undefined wave (%d)", wid);
+      else
+      {
+         if (used[wid] == 255)
+         {
+            used[wid] = counters;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+            waveTx[wid] = 1;
 
-   if      (frequency > pwmFreq[0])           idx = 0;
-   else if (frequency < pwmFreq[PWM_FREQS-1]) idx = PWM_FREQS-1;
-   else
-   {
-      best = 100000; /* impossibly high frequency difference */
-      idx = 0;
+            if (firstCB < 0) firstCB = waveInfo[wid].botCB;
 
-      for (i=0; i<PWM_FREQS; i++)
-      {
-         if (frequency > pwmFreq[i]) diff = frequency - pwmFreq[i];
-         else                        diff = pwmFreq[i] - frequency;
+            if (lastCB >= 0)
+            {
+               p = rawWaveCBAdr(lastCB);
 
-         if (diff < best)
-         {
-            best = diff;
-            idx = i;
+               p->next = waveCbPOadr(1+waveInfo[wid].botCB);
+            }
+            lastCB = waveInfo[wid].topCB;
          }
+         else SOFT_ERROR(PI_REUSED_WID,
+                 "wave already used in chain (%d)", wid);
       }
+      i++;
    }
 
-   width = gpioInfo[gpio].width;
-
-   if (width)
+   if (firstCB >= 0)
    {
-      if (gpioInfo[gpio].is == GPIO_PWM)
+      if (lastCB >= 0)
       {
-         myGpioSetPwm(gpio, width, 0);
-         gpioInfo[gpio].freqIdx = idx;
-         myGpioSetPwm(gpio, 0, width);
+         p = rawWaveCBAdr(lastCB);
+
+         p->next = 0;
       }
-   }
 
-   gpioInfo[gpio].freqIdx = idx;
+      initDMAgo((uint32_t *)dmaOut, waveCbPOadr(firstCB));
+   }
 
-   return pwmFreq[idx];
+   return 0;
 }
 
+/*-------------------------------------------------------------------------*/
 
-/* ----------------------------------------------------------------------- */
-
-int gpioGetPWMfrequency(unsigned gpio)
+int gpioWaveTxBusy(void)
 {
-   unsigned pwm, clock;
-
-   DBG(DBG_USER, "gpio=%d", gpio);
+   DBG(DBG_USER, "");
 
    CHECK_INITED;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
-
-   switch (gpioInfo[gpio].is)
-   {
-      case GPIO_HW_PWM:
-         pwm = (PWMDef[gpio] >> 4) & 3;
-         return hw_pwm_freq[pwm];
-
-      case GPIO_HW_CLK:
-         clock = (clkDef[gpio] >> 4) & 3;
-         return hw_clk_freq[clock];
-
-      default:
-         return pwmFreq[gpioInfo[gpio].freqIdx];
-   }
+   if (dmaOut[DMA_CONBLK_AD])
+      return 1;
+   else
+      return 0;
 }
 
-
 /* ----------------------------------------------------------------------- */
 
-int gpioServo(unsigned gpio, unsigned val)
+int gpioWaveTxStop(void)
 {
-   DBG(DBG_USER, "gpio=%d pulsewidth=%d", gpio, val);
+   DBG(DBG_USER, "");
 
    CHECK_INITED;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
-
-   if ((val!=PI_SERVO_OFF) && (val<PI_MIN_SERVO_PULSEWIDTH))
-      SOFT_ERROR(PI_BAD_PULSEWIDTH,
-         "gpio %d, bad pulsewidth (%d)", gpio, val);
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
 
-   if (val>PI_MAX_SERVO_PULSEWIDTH)
-      SOFT_ERROR(PI_BAD_PULSEWIDTH,
-         "gpio %d, bad pulsewidth (%d)", gpio, val);
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-   if (gpioInfo[gpio].is != GPIO_SERVO)
-   {
-      switchFunctionOff(gpio);
+   /* a stopped stream no longer holds its cbs and OOL */
 
-      gpioSetMode(gpio, PI_OUTPUT);
+   waveStream.active = 0;
 
-      gpioInfo[gpio].is = GPIO_SERVO;
-   }
+   return 0;
+}
 
-   myGpioSetServo(gpio, gpioInfo[gpio].width, val);
+/* ----------------------------------------------------------------------- */
 
-   gpioInfo[gpio].width=val;
+static int waveStreamSegCB(int seg)
+{
+   return waveStream.botCB + (seg * STREAM_SEG_CBS);
+}
 
-   return 0;
+static int waveStreamSegOOL(int seg)
+{
+   return waveStream.botOOL + (seg * STREAM_SEG_OOL);
 }
 
+static uint32_t waveStreamFirst(int seg)
+{
+   /* a segment without pulse cbs starts at its idle cbs */
 
-/* ----------------------------------------------------------------------- */
+   if (waveStream.lastCB[seg] < 0)
+      return waveCbPOadr(waveStreamSegCB(seg) + STREAM_SEG_CBS - 2);
+   else
+      return waveCbPOadr(waveStreamSegCB(seg));
+}
 
-int gpioGetServoPulsewidth(unsigned gpio)
+static void waveStreamDelayCb(rawCbs_t *p, uint32_t length)
 {
-   DBG(DBG_USER, "gpio=%d", gpio);
+   /* use the secondary clock */
 
-   CHECK_INITED;
+   if (gpioCfg.clockPeriph != PI_CLOCK_PCM)
+   {
+      p->info   = NORMAL_DMA |
+                  DMA_DEST_DREQ |
+                  DMA_PERIPHERAL_MAPPING(2);
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+      p->dst    = ((PCM_BASE + PCM_FIFO*4) & 0x00ffffff) | PI_PERI_BUS;
+   }
+   else
+   {
+      p->info   = NORMAL_DMA |
+                  DMA_DEST_DREQ |
+                  DMA_PERIPHERAL_MAPPING(5);
 
-   if (gpioInfo[gpio].is != GPIO_SERVO)
-      SOFT_ERROR(PI_NOT_SERVO_GPIO, "not a servo gpio (%d)", gpio);
+      p->dst    = ((PWM_BASE + PWM_FIFO*4) & 0x00ffffff) | PI_PERI_BUS;
+   }
 
-   return gpioInfo[gpio].width;
+   p->src    = (uint32_t) (&dmaOBus[0]->periphData);
+   p->length = length;
 }
 
+static void waveStreamFill(int seg, unsigned numPulses, gpioPulse_t *pulses)
+{
+   rawCbs_t *p;
+   int i, cb, ool, idleCB, idleOOL;
+   unsigned half;
 
-/* ----------------------------------------------------------------------- */
+   /*
+      The pulses are followed by an idle loop of two cbs.  The first
+      flags that the DMA ran out of pulses, the second waits and
+      loops back.  Queuing the next segment points both the last
+      pulse cb and the idle loop at it.
+   */
 
-int gpioWaveClear(void)
-{
-   DBG(DBG_USER, "");
+   half = PI_WF_MICROS/2;
 
-   CHECK_INITED;
+   cb  = waveStreamSegCB(seg);
+   ool = waveStreamSegOOL(seg);
 
-   wfc[0] = 0;
-   wfc[1] = 0;
-   wfc[2] = 0;
+   idleCB  = cb  + STREAM_SEG_CBS - 2;
+   idleOOL = ool + STREAM_SEG_OOL - 2;
 
-   wfcur = 0;
+   waveStream.lastCB[seg] = -1;
 
-   wfStats.micros = 0;
-   wfStats.pulses = 0;
-   wfStats.cbs    = 0;
+   for (i=0; i<numPulses; i++)
+   {
+      if (pulses[i].gpioOn)
+      {
+         waveSetOOL(ool, pulses[i].gpioOn);
 
-   waveOutBotCB  = PI_WAVE_COUNTERS*CBS_PER_OPAGE;
-   waveOutTopCB  = NUM_WAVE_CBS;
-   waveOutBotOOL = PI_WAVE_COUNTERS*OOL_PER_OPAGE;
-   waveOutTopOOL = NUM_WAVE_OOL;
+         p = rawWaveCBAdr(cb);
 
-   waveOutCount = 0;
+         p->info   = NORMAL_DMA;
+         p->src    = waveOOLPOadr(ool++);
+         p->dst    = ((GPIO_BASE + (GPSET0*4)) & 0x00ffffff) | PI_PERI_BUS;
+         p->length = 4;
 
-   return 0;
-}
+         waveStream.lastCB[seg] = cb++;
+         p->next   = waveCbPOadr(cb);
+      }
 
-/* ----------------------------------------------------------------------- */
+      if (pulses[i].gpioOff)
+      {
+         waveSetOOL(ool, pulses[i].gpioOff);
 
-int gpioWaveAddNew(void)
-{
-   DBG(DBG_USER, "");
+         p = rawWaveCBAdr(cb);
 
-   CHECK_INITED;
+         p->info   = NORMAL_DMA;
+         p->src    = waveOOLPOadr(ool++);
+         p->dst    = ((GPIO_BASE + (GPCLR0*4)) & 0x00ffffff) | PI_PERI_BUS;
+         p->length = 4;
 
-   wfc[0] = 0;
-   wfc[1] = 0;
-   wfc[2] = 0;
+         waveStream.lastCB[seg] = cb++;
+         p->next   = waveCbPOadr(cb);
+      }
 
-   wfcur = 0;
+      if (pulses[i].usDelay)
+      {
+         p = rawWaveCBAdr(cb);
 
-   wfStats.micros = 0;
-   wfStats.pulses = 0;
-   wfStats.cbs    = 0;
+         waveStreamDelayCb(p,
+            4 * ((pulses[i].usDelay+half)/PI_WF_MICROS));
 
-   return 0;
-}
+         waveStream.lastCB[seg] = cb++;
+         p->next   = waveCbPOadr(cb);
+      }
+   }
 
-/* ----------------------------------------------------------------------- */
+   if (waveStream.lastCB[seg] >= 0)
+      rawWaveCBAdr(waveStream.lastCB[seg])->next = waveCbPOadr(idleCB);
 
-int gpioWaveAddGeneric(unsigned numPulses, gpioPulse_t *pulses)
-{
-   int p;
+   waveSetOOL(idleOOL,   0); /* underrun flag */
+   waveSetOOL(idleOOL+1, 1);
 
-   DBG(DBG_USER, "numPulses=%u pulses=%08X", numPulses, (uint32_t)pulses);
+   p = rawWaveCBAdr(idleCB);
 
-   CHECK_INITED;
+   p->info   = NORMAL_DMA;
+   p->src    = waveOOLPOadr(idleOOL+1);
+   p->dst    = waveOOLPOadr(idleOOL);
+   p->length = 4;
+   p->next   = waveCbPOadr(idleCB+1);
 
-   if (numPulses > PI_WAVE_MAX_PULSES)
-      SOFT_ERROR(PI_TOO_MANY_PULSES, "bad number of pulses (%d)", numPulses);
+   p = rawWaveCBAdr(idleCB+1);
 
-   if (!pulses) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) pulses pointer");
+   waveStreamDelayCb(p, 4 * STREAM_IDLE_MICROS / PI_WF_MICROS);
 
-   for (p=0; p<numPulses; p++)
-   {
-      wf[2][p].gpioOff = pulses[p].gpioOff;
-      wf[2][p].gpioOn  = pulses[p].gpioOn;
-      wf[2][p].usDelay = pulses[p].usDelay;
-      wf[2][p].flags   = 0;
-   }
+   p->next   = waveCbPOadr(idleCB);
 
-   return rawWaveAddGeneric(numPulses, wf[2]);
+   waveStream.pulses[seg] = numPulses;
 }
 
-/* ----------------------------------------------------------------------- */
-
-int gpioWaveAddSerial
-   (unsigned gpio,
-    unsigned baud,
-    unsigned data_bits,
-    unsigned stop_bits,
-    unsigned offset,
-    unsigned numBytes,
-    char     *bstr)
+static int waveStreamRetire(void)
 {
-   int i, b, p, lev, c, v;
+   int cb, seg, flag;
 
-   uint16_t *wstr = (uint16_t *)bstr;
-   uint32_t *lstr = (uint32_t *)bstr;
+   /*
+      Retires the segments the DMA has finished with.  Returns -1
+      if the DMA is no longer in the stream (a wave was sent or the
+      output stopped).
+   */
 
-   unsigned bitDelay[32];
+   cb = rawWaveCB();
 
-   DBG(DBG_USER,
-      "gpio=%d baud=%d bits=%d stops=%d offset=%d numBytes=%d str=[%s]",
-      gpio, baud, data_bits, stop_bits, offset,
-      numBytes, myBuf2Str(numBytes, (char *)bstr));
+   if ((cb < waveStream.botCB) || (cb >= (waveStream.botCB + STREAM_CBS)))
+      return -1;
 
-   CHECK_INITED;
+   seg = (cb - waveStream.botCB) / STREAM_SEG_CBS;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+   waveStream.idle = ((seg == waveStream.last) &&
+      (((cb - waveStream.botCB) % STREAM_SEG_CBS) >= (STREAM_SEG_CBS - 2)));
 
-   if ((baud < PI_WAVE_MIN_BAUD) || (baud > PI_WAVE_MAX_BAUD))
-      SOFT_ERROR(PI_BAD_WAVE_BAUD, "bad baud rate (%d)", baud);
+   while ((waveStream.tail != seg) && (waveStream.queued > 1))
+   {
+      waveStream.sent += waveStream.pulses[waveStream.tail];
 
-   if ((data_bits < PI_MIN_WAVE_DATABITS) || (data_bits > PI_MAX_WAVE_DATABITS))
-      SOFT_ERROR(PI_BAD_DATABITS, "bad number of databits (%d)", data_bits);
+      /* the DMA waited in the idle loop for this segment's successor */
 
-   if ((stop_bits < PI_MIN_WAVE_HALFSTOPBITS) ||
-       (stop_bits > PI_MAX_WAVE_HALFSTOPBITS))
-      SOFT_ERROR(PI_BAD_STOPBITS,
-         "bad number of (half) stop bits (%d)", stop_bits);
+      flag = waveStreamSegOOL(waveStream.tail) + STREAM_SEG_OOL - 2;
 
-   if (gpio > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+      if (waveStream.pulses[waveStream.tail] && rawWaveGetOut(flag))
+         waveStream.underruns++;
 
-   if (numBytes > PI_WAVE_MAX_CHARS)
-      SOFT_ERROR(PI_TOO_MANY_CHARS, "too many chars (%d)", numBytes);
+      waveStream.tail = (waveStream.tail + 1) % PI_WAVE_STREAM_SEGS;
+      waveStream.queued--;
+   }
 
-   if (offset > PI_WAVE_MAX_MICROS)
-      SOFT_ERROR(PI_BAD_SER_OFFSET, "offset too large (%d)", offset);
+   return 0;
+}
 
-   if (data_bits > 8) numBytes /= 2;
-   if (data_bits > 16) numBytes /= 2;
+static int waveStreamCheck(void)
+{
+   if (!waveStream.active) return PI_NO_WAVE_STREAM;
 
-   if (!numBytes) return 0;
+   if (waveStreamRetire() < 0)
+   {
+      /* the stream's memory is no longer needed */
 
-   waveBitDelay(baud, data_bits, stop_bits, bitDelay);
+      waveStream.active = 0;
+      return PI_NO_WAVE_STREAM;
+   }
 
-   p = 0;
+   return 0;
+}
 
-   wf[2][p].gpioOn  = (1<<gpio);
-   wf[2][p].gpioOff = 0;
-   wf[2][p].flags   = 0;
+/* ----------------------------------------------------------------------- */
 
-   if (offset > bitDelay[0]) wf[2][p].usDelay = offset;
-   else                      wf[2][p].usDelay = bitDelay[0];
+int gpioWaveStreamStart(void)
+{
+   int status, botCB, botOOL;
 
-   for (i=0; i<numBytes; i++)
-   {
-      p++;
+   DBG(DBG_USER, "");
 
-      /* start bit */
+   CHECK_INITED;
 
-      wf[2][p].gpioOn = 0;
-      wf[2][p].gpioOff = (1<<gpio);
-      wf[2][p].usDelay = bitDelay[0];
-      wf[2][p].flags   = 0;
+   if (!waveClockInited)
+   {
+      stopHardwarePWM();
+      initClock(0); /* initialise secondary clock */
+      waveClockInited = 1;
+   }
 
-      lev = 0;
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
 
-      if      (data_bits <  9) c = bstr[i];
-      else if (data_bits < 17) c = wstr[i];
-      else                  c = lstr[i];
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-      for (b=0; b<data_bits; b++)
-      {
-         if (c & (1<<b)) v=1; else v=0;
+   waveStream.active = 0;
+   waveChain.active = 0;
 
-         if (v == lev) wf[2][p].usDelay += bitDelay[b+1];
-         else
-         {
-            p++;
+   waveReap();
 
-            lev = v;
+   memset(waveTx, 0, sizeof(waveTx));
 
-            if (lev)
-            {
-               wf[2][p].gpioOn  = (1<<gpio);
-               wf[2][p].gpioOff = 0;
-               wf[2][p].flags   = 0;
-            }
-            else
-            {
-               wf[2][p].gpioOn  = 0;
-               wf[2][p].gpioOff = (1<<gpio);
-               wf[2][p].flags   = 0;
-            }
+   status = waveAlloc(STREAM_CBS, STREAM_OOL, &botCB, &botOOL);
 
-            wf[2][p].usDelay = bitDelay[b+1];
-         }
-      }
+   if (status) return status;
 
-      /* stop bit */
+   waveStream.active = 1;
+   waveStream.botCB  = botCB;
+   waveStream.botOOL = botOOL;
 
-      if (lev) wf[2][p].usDelay += bitDelay[data_bits+1];
-      else
-      {
-         p++;
+   /* the DMA idles in an empty first segment until pulses are queued */
 
-         wf[2][p].gpioOn  = (1<<gpio);
-         wf[2][p].gpioOff = 0;
-         wf[2][p].usDelay = bitDelay[data_bits+1];
-         wf[2][p].flags   = 0;
-      }
-   }
+   waveStreamFill(0, 0, NULL);
 
-   p++;
+   waveStream.tail = 0;
+   waveStream.last = 0;
+   waveStream.queued = 1;
+   waveStream.idle = 1;
+   waveStream.sent = 0;
+   waveStream.underruns = 0;
 
-   wf[2][p].gpioOn  = (1<<gpio);
-   wf[2][p].gpioOff = 0;
-   wf[2][p].usDelay = bitDelay[0];
-   wf[2][p].flags   = 0;
+   initDMAgo((uint32_t *)dmaOut, waveStreamFirst(0));
 
-   return rawWaveAddGeneric(p, wf[2]);
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-int rawWaveAddSPI(
-   rawSPI_t *spi,
-   unsigned offset,
-   unsigned spiSS,
-   char *buf,
-   unsigned spiTxBits,
-   unsigned spiBitFirst,
-   unsigned spiBitLast,
-   unsigned spiBits)
+int gpioWaveStreamWrite(unsigned numPulses, gpioPulse_t *pulses)
 {
-   int p, dbv, bit, halfbit;
-   int rising_edge[2], read_cycle[2];
-   uint32_t on_bits, off_bits;
-   int tx_bit_pos;
+   int status, seg, last;
+   unsigned done, n;
 
-   DBG(DBG_USER,
-      "spi=%08X off=%d spiSS=%d tx=%08X, num=%d fb=%d lb=%d spiBits=%d",
-      (uint32_t)spi, offset, spiSS, (uint32_t)buf, spiTxBits,
-      spiBitFirst, spiBitLast, spiBits);
+   DBG(DBG_USER, "numPulses=%u pulses=%08X", numPulses, (uint32_t)pulses);
 
    CHECK_INITED;
 
-   if (spiSS > PI_MAX_USER_GPIO)
-      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", spiSS);
+   if ((status = waveStreamCheck())) return status;
 
-   /*
-   CPOL CPHA
-    0    0   read rising/write falling
-    0    1   read falling/write rising
-    1    0   read falling/write rising
-    1    1   read rising/write falling
-   */
+   done = 0;
 
-   if (spi->clk_pol) {rising_edge[0] = 0; rising_edge[1] = 1;}
-   else              {rising_edge[0] = 1; rising_edge[1] = 0;}
+   while ((done < numPulses) && (waveStream.queued < PI_WAVE_STREAM_SEGS))
+   {
+      n = numPulses - done;
+      if (n > PI_WAVE_STREAM_SEG_PULSES) n = PI_WAVE_STREAM_SEG_PULSES;
 
-   if (spi->clk_pha) {read_cycle[0] = 0; read_cycle[1] = 1;}
-   else              {read_cycle[0] = 1; read_cycle[1] = 0;}
+      last = waveStream.last;
+      seg  = (last + 1) % PI_WAVE_STREAM_SEGS;
 
-   p = 0;
+      waveStreamFill(seg, n, pulses + done);
 
-   if (offset)
-   {
-      wf[2][p].gpioOn  = 0;
-      wf[2][p].gpioOff = 0;
-      wf[2][p].flags   = 0;
-      wf[2][p].usDelay = offset;
-      p++;
-   }
+      /* the segment must be complete before the DMA can reach it */
 
-   /* preset initial mosi bit in case it's read at leading clock bit */
+      __sync_synchronize();
 
-   on_bits = 0;
-   off_bits = 0;
+      rawWaveCBAdr(waveStreamSegCB(last) + STREAM_SEG_CBS - 1)->next =
+         waveStreamFirst(seg);
 
-   tx_bit_pos = 0;
+      if (waveStream.lastCB[last] >= 0)
+         rawWaveCBAdr(waveStream.lastCB[last])->next = waveStreamFirst(seg);
 
-   if (getBitInBytes(tx_bit_pos, buf, spiTxBits))
-   {
-      dbv = 1;
-      on_bits  |= (1<<(spi->mosi));
-   }
-   else
-   {
-      dbv = 0;
-      off_bits  |= (1<<(spi->mosi));
+      waveStream.last = seg;
+      waveStream.queued++;
+
+      done += n;
    }
 
-   if (spi->ss_pol) off_bits |= (1<<spiSS);
-   else             on_bits  |= (1<<spiSS);
+   return done;
+}
 
-   wf[2][p].gpioOn  = on_bits;
-   wf[2][p].gpioOff = off_bits;
-   wf[2][p].flags   = 0;
+/* ----------------------------------------------------------------------- */
 
-   if (spi->clk_us > spi->ss_us) wf[2][p].usDelay = spi->clk_us;
-   else                          wf[2][p].usDelay = spi->ss_us;
+int gpioWaveStreamInfo(unsigned item)
+{
+   int status, i, seg, queued;
 
-   p++;
+   DBG(DBG_USER, "item=%d", item);
 
-   for (bit=1; bit<=spiBits; bit++)
-   {
-      for (halfbit=0; halfbit<2; halfbit++)
-      {
-         wf[2][p].usDelay = spi->clk_us;
-         wf[2][p].flags = 0;
+   CHECK_INITED;
 
-         on_bits = 0;
-         off_bits = 0;
+   if ((status = waveStreamCheck())) return status;
 
-         if (read_cycle[halfbit])
-         {
-            if ((bit>=spiBitFirst) && (bit<=spiBitLast))
-               wf[2][p].flags = WAVE_FLAG_READ;
-         }
-         else
-         {
-            if (getBitInBytes(tx_bit_pos, buf, spiTxBits))
-            {
-               if (!dbv) on_bits |= (1<<(spi->mosi));
-               dbv = 1;
-            }
-            else
-            {
-               if (dbv) off_bits |= (1<<(spi->mosi));
-               dbv = 0;
-            }
+   switch (item)
+   {
+      case PI_WAVE_STREAM_SPACE:
+         return (PI_WAVE_STREAM_SEGS - waveStream.queued) *
+            PI_WAVE_STREAM_SEG_PULSES;
 
-            ++tx_bit_pos;
-         }
+      case PI_WAVE_STREAM_QUEUED:
+         if (waveStream.idle) return 0;
 
-         if (rising_edge[halfbit]) on_bits  |= (1<<(spi->clk));
-         else                      off_bits |= (1<<(spi->clk));
+         queued = 0;
+         seg = waveStream.tail;
 
-         wf[2][p].gpioOn = on_bits;
-         wf[2][p].gpioOff = off_bits;
+         for (i=0; i<waveStream.queued; i++)
+         {
+            queued += waveStream.pulses[seg];
+            seg = (seg + 1) % PI_WAVE_STREAM_SEGS;
+         }
 
-         p++;
-      }
-   }
+         return queued;
 
-   on_bits = 0;
-   off_bits = 0;
+      case PI_WAVE_STREAM_SENT:
+         /* the newest segment is only retired when another follows */
 
-   if (spi->ss_pol) on_bits  |= (1<<spiSS);
-   else             off_bits |= (1<<spiSS);
+         if (waveStream.idle)
+            return (waveStream.sent +
+               waveStream.pulses[waveStream.last]) & 0x7FFFFFFF;
 
-   wf[2][p].gpioOn  = on_bits;
-   wf[2][p].gpioOff = off_bits;
-   wf[2][p].flags   = 0;
-   wf[2][p].usDelay = 0;
+         return waveStream.sent & 0x7FFFFFFF;
 
-   p++;
+      case PI_WAVE_STREAM_UNDERRUNS:
+         return waveStream.underruns & 0x7FFFFFFF;
 
-   return rawWaveAddGeneric(p, wf[2]);
+      default:
+         SOFT_ERROR(PI_BAD_STREAM_INFO, "bad stream info item (%d)", item);
+   }
 }
 
 /* ----------------------------------------------------------------------- */
 
-int gpioWaveCreate(void)
+int gpioWaveStreamSteps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
 {
-   int cb;
+   int status, n;
 
-   DBG(DBG_USER, "");
+   DBG(DBG_USER, "numAxes=%u axes=%08X stepProfile=%08X",
+      numAxes, (uint32_t)axes, (uint32_t)stepProfile);
 
    CHECK_INITED;
 
-   if (wfc[wfcur] == 0) return PI_EMPTY_WAVEFORM;
-
-   if (waveOutCount < PI_MAX_WAVES)
-   {
-      waveInfo[waveOutCount].botCB  = waveOutBotCB;
-      waveInfo[waveOutCount].botOOL = waveOutBotOOL;
-      waveInfo[waveOutCount].topOOL = waveOutTopOOL;
+   if ((status = waveStreamCheck())) return status;
 
-      if ((cb = wave2Cbs(PI_WAVE_MODE_ONE_SHOT)) < 0) return cb;
+   n = waveSteps(numAxes, axes, stepProfile);
 
-      waveInfo[waveOutCount].topCB  = waveOutBotCB-1;
+   if (n <= 0) return n;
 
-      gpioWaveAddNew();
+   /* a move is queued whole or not at all so no steps are lost */
 
-      return waveOutCount++;
-   }
+   if (n > ((PI_WAVE_STREAM_SEGS - waveStream.queued) *
+            PI_WAVE_STREAM_SEG_PULSES))
+      SOFT_ERROR(PI_STREAM_FULL, "no stream space for %d pulses", n);
 
-   return PI_NO_WAVEFORM_ID;
+   return gpioWaveStreamWrite(n, stepPulse);
 }
 
 /* ----------------------------------------------------------------------- */
 
-int gpioWaveDelete(unsigned wave_id)
+int gpioWaveStreamStop(void)
 {
-   DBG(DBG_USER, "wave id=%d", wave_id);
+   int status;
+
+   DBG(DBG_USER, "");
 
    CHECK_INITED;
 
-   if (wave_id >= waveOutCount)
-      SOFT_ERROR(PI_BAD_WAVE_ID, "bad wave id (%d)", wave_id);
+   if ((status = waveStreamCheck())) return status;
 
-   waveOutBotCB  = waveInfo[wave_id].botCB;
-   waveOutBotOOL = waveInfo[wave_id].botOOL;
-   waveOutTopOOL = waveInfo[wave_id].topOOL;
+   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+
+   dmaOut[DMA_CONBLK_AD] = 0;
 
-   waveOutCount = wave_id;
+   waveStream.active = 0;
 
    return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
-int gpioWaveTxStart(unsigned wave_mode)
+static int waveChainParse(
+   char *buf, unsigned bufSize, waveChainLoop_t *loop, int *stack,
+   gpioChainInfo_t *info)
 {
-   /* This function is deprecated and will be removed. */
+   waveChainLoop_t *l;
+   unsigned i, half, n;
+   int wid, cmd, depth, blocks;
+   uint64_t micros;
 
-   int firstCB=PI_WAVE_COUNTERS*CBS_PER_OPAGE;
-   int numCBs, i;
+   /*
+      Checks the whole chain and totals the cbs, OOL, and time it
+      needs without touching DMA memory.  loop gets the count of
+      each loop in the order the loops start, stack holds the loops
+      open at each point.
+   */
 
-   DBG(DBG_USER, "wave_mode=%d", wave_mode);
+   half = PI_WF_MICROS/2;
 
-   CHECK_INITED;
+   memset(info, 0, sizeof(gpioChainInfo_t));
 
-   if (wave_mode > PI_WAVE_MODE_REPEAT)
-      SOFT_ERROR(PI_BAD_WAVE_MODE, "bad wave mode (%d)", wave_mode);
+   info->ool = 1; /* for the cbs which do nothing */
 
-   if (wfc[wfcur] == 0) return 0;
+   micros = 0;
+   depth = 0;
+   n = 0;
 
-   if (!waveClockInited)
+   i = 0;
+
+   while (i < bufSize)
    {
-      stopHardwarePWM();
-      initClock(0); /* initialise secondary clock */
-      waveClockInited = 1;
-   }
+      wid = (uint8_t)buf[i];
 
-   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+      if (wid != 255)
+      {
+         if ((wid >= PI_MAX_WAVES) || (waveState[wid] != WAVE_LIVE))
+            SOFT_ERROR(PI_BAD_WAVE_ID, "undefined wave (%d)", wid);
 
-   dmaOut[DMA_CONBLK_AD] = 0;
+         /* a wave without pulses is just its leading delay */
 
-   waveOutBotCB  = firstCB;
-   waveOutTopCB  = NUM_WAVE_CBS;
-   waveOutBotOOL = PI_WAVE_COUNTERS*OOL_PER_OPAGE;
-   waveOutTopOOL = NUM_WAVE_OOL;
+         if (waveInfo[wid].topCB > waveInfo[wid].botCB)
+         {
+            info->cbs++;
+            info->ool++;
+            micros += waveKey[wid].micros;
+         }
 
-   waveOutCount = 0;
+         i++;
+         continue;
+      }
 
-   numCBs = wave2Cbs(wave_mode);
+      if ((i+1) >= bufSize)
+         SOFT_ERROR(PI_BAD_CHAIN_CMD, "bad chain command (at char %d)", i);
 
-   if (numCBs > 0)
-   {
-      if (gpioCfg.dbgLevel >= DBG_SLOW_TICK)
+      cmd = buf[i+1];
+
+      if ((cmd == 1) || (cmd == 2))
       {
-         fprintf(stderr, "*** OUTPUT DMA CONTROL BLOCKS ***\n");
-         for (i=0; i<numCBs; i++) waveCbOPrint(firstCB+i);
+         if ((i+3) >= bufSize)
+            SOFT_ERROR(PI_BAD_CHAIN_CMD,
+               "bad chain command (at char %d)", i);
+
+         n = (uint8_t)buf[i+2] + ((uint8_t)buf[i+3]<<8);
       }
 
-      initDMAgo((uint32_t *)dmaOut, waveCbPOadr(firstCB));
-   }
+      switch (cmd)
+      {
+         case 0: /* loop start */
 
-   return numCBs;
+            loop[info->loops].micros = micros;
 
-}
+            stack[depth++] = info->loops++;
 
-/* ----------------------------------------------------------------------- */
+            micros = 0;
 
-int gpioWaveTxSend(unsigned wave_id, unsigned wave_mode)
-{
-   rawCbs_t *p=NULL;
+            i += 2;
+            break;
 
-   DBG(DBG_USER, "wave_id=%d wave_mode=%d", wave_id, wave_mode);
+         case 1: /* loop repeat */
 
-   CHECK_INITED;
+            if (!depth)
+               SOFT_ERROR(PI_BAD_CHAIN_LOOP,
+                  "repeat without loop start (at char %d)", i);
 
-   if (wave_id >= waveOutCount)
-      SOFT_ERROR(PI_BAD_WAVE_ID, "bad wave id (%d)", wave_id);
+            if (!n)
+               SOFT_ERROR(PI_BAD_REPEAT_CNT,
+                  "bad chain repeat count (%d)", n);
 
-   if (wave_mode > PI_WAVE_MODE_REPEAT)
-      SOFT_ERROR(PI_BAD_WAVE_MODE, "bad wave mode (%d)", wave_mode);
+            l = &loop[stack[--depth]];
 
-   if (!waveClockInited)
-   {
-      stopHardwarePWM();
-      initClock(0); /* initialise secondary clock */
-      waveClockInited = 1;
+            l->count = n;
+
+            /* a counter and the cbs which reload it */
+
+            if (n > 1)
+            {
+               blocks = waveLoopBlocks(n-1);
+
+               info->cbs += 4 * blocks;
+               info->ool += waveLoopOOL(blocks);
+            }
+
+            micros = l->micros + (micros * n);
+
+            i += 4;
+            break;
+
+         case 2: /* delay */
+
+            if ((n + half) / PI_WF_MICROS) info->cbs++;
+
+            micros += PI_WF_MICROS * ((n + half) / PI_WF_MICROS);
+
+            i += 4;
+            break;
+
+         case 3: /* loop forever */
+
+            if (depth != 1)
+               SOFT_ERROR(PI_BAD_CHAIN_LOOP,
+                  "loop forever not outermost (at char %d)", i);
+
+            if ((i+2) != bufSize)
+               SOFT_ERROR(PI_BAD_CHAIN_CMD,
+                  "loop forever not last (at char %d)", i);
+
+            l = &loop[stack[--depth]];
+
+            l->count = 0;
+
+            info->cbs++;
+            info->forever = 1;
+
+            micros += l->micros;
+
+            i += 2;
+            break;
+
+         default:
+            SOFT_ERROR(PI_BAD_CHAIN_CMD,
+               "bad chain command (at char %d)", i);
+      }
    }
 
-   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+   if (depth)
+      SOFT_ERROR(PI_BAD_CHAIN_LOOP, "%d chain loops not closed", depth);
 
-   dmaOut[DMA_CONBLK_AD] = 0;
+   /* the counters' next is dynamic, end on a cb which does nothing */
 
-   p = rawWaveCBAdr(waveInfo[wave_id].topCB);
+   if (!info->forever) info->cbs++;
 
-   if (wave_mode == PI_WAVE_MODE_ONE_SHOT) p->next = 0;
-   else p->next = waveCbPOadr(waveInfo[wave_id].botCB+1);
+   info->micros = micros;
 
-   initDMAgo((uint32_t *)dmaOut, waveCbPOadr(waveInfo[wave_id].botCB));
+   return 0;
+}
+
+static void waveChainNop(int cb, int scratch, uint32_t next)
+{
+   rawCbs_t *p;
+
+   p = rawWaveCBAdr(cb);
+
+   p->info   = NORMAL_DMA;
+   p->src    = waveOOLPOadr(scratch);
+   p->dst    = waveOOLPOadr(scratch);
+   p->length = 4;
+   p->next   = next;
+}
+
+static void waveChainEmit(
+   char *buf, unsigned bufSize, waveChainLoop_t *loop, int *stack,
+   int forever, int botCB, int botOOL)
+{
+   rawCbs_t *p;
+   waveChainLoop_t *l;
+   unsigned i, half, ticks;
+   int wid, cb, ool, scratch, link, depth, numLoops, b, j;
 
-   /* for compatability with the deprecated gpioWaveTxStart return the
-      number of cbs
+   /*
+      The chain was checked by waveChainParse.  Each cb runs on to
+      the next unless it says otherwise.  A wave is entered past its
+      leading delay by a cb which first points the wave's last cb
+      back at the chain, so a wave may be used any number of times.
+      Each loop has its own counter which is reloaded from a saved
+      copy as the loop starts, so an inner loop counts afresh on
+      each pass of the outer.
    */
-   return (waveInfo[wave_id].topCB - waveInfo[wave_id].botCB) + 1;
-}
 
-/* ----------------------------------------------------------------------- */
+   half = PI_WF_MICROS/2;
 
-int gpioWaveChain(char *buf, unsigned bufSize)
-{
-   unsigned blklen=8, blocks=8;
-   int i, wid, rwid, nwid, firstCB, lastCB, counters, cycles;
-   uint32_t repeat, next;
-   char used[256];
+   cb  = botCB;
+   ool = botOOL;
 
-   rawCbs_t *p=NULL;
+   scratch = ool++;
 
-   DBG(DBG_USER, "bufSize=%d [%s]", bufSize, myBuf2Str(bufSize, buf));
+   waveSetOOL(scratch, 0);
 
-   CHECK_INITED;
+   depth = 0;
+   numLoops = 0;
 
-   if (!waveClockInited)
+   i = 0;
+
+   while (i < bufSize)
    {
-      stopHardwarePWM();
-      initClock(0); /* initialise secondary clock */
-      waveClockInited = 1;
-   }
+      wid = (uint8_t)buf[i];
 
-   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+      if (wid != 255)
+      {
+         if (waveInfo[wid].topCB > waveInfo[wid].botCB)
+         {
+            link = ool++;
 
-   dmaOut[DMA_CONBLK_AD] = 0;
+            waveSetOOL(link, waveCbPOadr(cb+1));
 
-   for (i=0; i<256; i++) used[i] = 255;
+            p = rawWaveCBAdr(cb++);
 
-   counters = 0;
-   wid = -1;
-   lastCB = -1;
-   firstCB = -1;
+            p->info   = NORMAL_DMA;
+            p->src    = waveOOLPOadr(link);
+            p->dst    = waveCbPOadr(waveInfo[wid].topCB) + 20;
+            p->length = 4;
+            p->next   = waveCbPOadr(waveInfo[wid].botCB+1);
 
-   i = 0;
+            waveTx[wid] = 1;
+         }
 
-   while (i<bufSize)
-   {
-      wid = (unsigned)buf[i];
+         i++;
+         continue;
+      }
 
-      if (wid == 255) /* repeat wave command */
+      switch (buf[i+1])
       {
-         if (counters < PI_WAVE_COUNTERS)
-         {
-            if ((i+4) < bufSize)
+         case 0: /* loop start */
+
+            l = &loop[numLoops];
+
+            stack[depth++] = numLoops++;
+
+            l->blocks = 0;
+
+            if (l->count > 1)
             {
-               rwid = buf[i+1];
-               if ((i+5) < bufSize)
-               {
-                  nwid = buf[i+5];
-                  if (nwid < waveOutCount)
-                     next = waveCbPOadr(1+waveInfo[nwid].botCB);
-                  else next = 0; /* error, will be picked up later */
-               }
-               else next = 0;
-               if (used[rwid] == counters)
+               l->blocks = waveLoopBlocks(l->count-1);
+
+               for (b=0; b<l->blocks; b++)
                {
-                  repeat = waveCbPOadr(1+waveInfo[rwid].botCB);
+                  l->ring[b]  = waveOOLRun(&ool, WAVE_LOOP_BLKLEN+1);
+                  l->saved[b] = waveOOLRun(&ool, WAVE_LOOP_BLKLEN);
 
-                  cycles = (unsigned)buf[i+2] +
-                           ((unsigned)buf[i+3]<<8) +
-                           ((unsigned)buf[i+4]<<16);
+                  p = rawWaveCBAdr(cb++);
 
-                  i+=4;
+                  p->info   = NORMAL_DMA|DMA_SRC_INC|DMA_DEST_INC;
+                  p->src    = waveOOLPOadr(l->saved[b]);
+                  p->dst    = waveOOLPOadr(l->ring[b]);
+                  p->length = WAVE_LOOP_BLKLEN*4;
+                  p->next   = waveCbPOadr(cb);
+               }
+            }
 
-                  if ((cycles > 1) && (cycles < PI_MAX_WAVE_CYCLES))
-                  {
-                     --cycles;
+            l->bodyCB = cb;
 
-                     waveCount(counters, blklen, blocks, cycles, repeat, next);
+            i += 2;
+            break;
 
-                     p = rawWaveCBAdr(lastCB);
+         case 1: /* loop repeat */
 
-                     lastCB = -1;
+            l = &loop[stack[--depth]];
 
-                     p->next = waveCbPOadr(counters * CBS_PER_OPAGE);
+            if (l->blocks)
+            {
+               waveCounter(cb, l->ring, WAVE_LOOP_BLKLEN, l->blocks,
+                  l->count-1, waveCbPOadr(l->bodyCB),
+                  waveCbPOadr(cb+(3*l->blocks)));
 
-                     counters++;
-                  }
-                  else SOFT_ERROR(PI_BAD_REPEAT_CNT,
-                          "bad chain repeat count (%d)", cycles);
+               for (b=0; b<l->blocks; b++)
+               {
+                  for (j=0; j<WAVE_LOOP_BLKLEN; j++)
+                     waveSetOOL(l->saved[b]+j, rawWaveGetOut(l->ring[b]+j));
                }
-               else SOFT_ERROR(PI_BAD_REPEAT_WID,
-                       "bad chain repeat wave (%d)", rwid);
+
+               cb += 3 * l->blocks;
             }
-            else SOFT_ERROR(PI_BAD_CHAIN_CMD,
-                    "bad chain command (at char %d)", i);
-         }
-         else SOFT_ERROR(PI_TOO_MANY_COUNTS,
-                 "too many chain counters (at char %d)", i);
-      }
-      else if (wid >= waveOutCount)
-         SOFT_ERROR(PI_BAD_WAVE_ID, "undefined wave (%d)", wid);
-      else
-      {
-         if (used[wid] == 255)
-         {
-            used[wid] = counters;
 
-            if (firstCB < 0) firstCB = waveInfo[wid].botCB;
+            i += 4;
+            break;
 
-            if (lastCB >= 0)
+         case 2: /* delay */
+
+            ticks = ((uint8_t)buf[i+2] + ((uint8_t)buf[i+3]<<8) + half) /
+               PI_WF_MICROS;
+
+            if (ticks)
             {
-               p = rawWaveCBAdr(lastCB);
+               p = rawWaveCBAdr(cb++);
 
-               p->next = waveCbPOadr(1+waveInfo[wid].botCB);
+               waveStreamDelayCb(p, 4 * ticks);
+
+               p->next = waveCbPOadr(cb);
             }
-            lastCB = waveInfo[wid].topCB;
-         }
-         else SOFT_ERROR(PI_REUSED_WID,
-                 "wave already used in chain (%d)", wid);
-      }
-      i++;
-   }
 
-   if (firstCB >= 0)
-   {
-      if (lastCB >= 0)
-      {
-         p = rawWaveCBAdr(lastCB);
+            i += 4;
+            break;
 
-         p->next = 0;
-      }
+         case 3: /* loop forever */
 
-      initDMAgo((uint32_t *)dmaOut, waveCbPOadr(firstCB));
+            l = &loop[stack[--depth]];
+
+            waveChainNop(cb++, scratch, waveCbPOadr(l->bodyCB));
+
+            i += 2;
+            break;
+      }
    }
 
-   return 0;
+   if (!forever) waveChainNop(cb, scratch, 0);
 }
 
-/*-------------------------------------------------------------------------*/
+/* ----------------------------------------------------------------------- */
 
-int gpioWaveTxBusy(void)
+int gpioWaveChainEx(
+   char *buf, unsigned bufSize, unsigned chainFlags, gpioChainInfo_t *info)
 {
-   DBG(DBG_USER, "");
+   gpioChainInfo_t ci;
+   waveChainLoop_t *loop;
+   int *stack;
+   int n, status, botCB, botOOL;
+
+   DBG(DBG_USER, "bufSize=%d chainFlags=%d [%s]",
+      bufSize, chainFlags, myBuf2Str(bufSize, buf));
 
    CHECK_INITED;
 
-   if (dmaOut[DMA_CONBLK_AD])
-      return 1;
-   else
-      return 0;
-}
+   if (chainFlags > PI_CHAIN_DRY_RUN)
+      SOFT_ERROR(PI_BAD_FLAGS, "bad chain flags (0x%X)", chainFlags);
 
-/* ----------------------------------------------------------------------- */
+   /* each loop takes at least two bytes */
 
-int gpioWaveTxStop(void)
-{
-   DBG(DBG_USER, "");
+   n = (bufSize / 2) + 1;
 
-   CHECK_INITED;
+   loop  = malloc(n * sizeof(waveChainLoop_t));
+   stack = malloc(n * sizeof(int));
 
-   dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+   if ((loop == NULL) || (stack == NULL))
+   {
+      free(loop);
+      free(stack);
+      SOFT_ERROR(PI_NO_MEMORY, "no memory for chain of %d bytes", bufSize);
+   }
 
-   dmaOut[DMA_CONBLK_AD] = 0;
+   status = waveChainParse(buf, bufSize, loop, stack, &ci);
 
-   return 0;
+   if ((status == 0) && !(chainFlags & PI_CHAIN_DRY_RUN))
+   {
+      if (!waveClockInited)
+      {
+         stopHardwarePWM();
+         initClock(0); /* initialise secondary clock */
+         waveClockInited = 1;
+      }
+
+      dmaOut[DMA_CS] = DMA_CHANNEL_RESET;
+
+      dmaOut[DMA_CONBLK_AD] = 0;
+
+      waveStream.active = 0;
+      waveChain.active = 0;
+
+      waveReap();
+
+      memset(waveTx, 0, sizeof(waveTx));
+
+      status = waveAlloc(ci.cbs, ci.ool, &botCB, &botOOL);
+
+      if (status == 0)
+      {
+         waveChain.active = 1;
+         waveChain.botCB  = botCB;
+         waveChain.numCB  = ci.cbs;
+         waveChain.botOOL = botOOL;
+         waveChain.numOOL = ci.ool;
+
+         waveChainEmit(buf, bufSize, loop, stack, ci.forever, botCB, botOOL);
+
+         initDMAgo((uint32_t *)dmaOut, waveCbPOadr(botCB));
+      }
+   }
+
+   free(loop);
+   free(stack);
+
+   if ((status == 0) && (info != NULL)) *info = ci;
+
+   return status;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -8682,6 +13525,40 @@ int gpioWaveGetMaxCbs(void)
    return wfStats.maxCbs;
 }
 
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveGetFreeCbs(void)
+{
+   int numFree, numLargest;
+
+   DBG(DBG_USER, "");
+
+   CHECK_INITED;
+
+   waveReap();
+
+   waveFit(0, 0, &numFree, &numLargest);
+
+   return numFree;
+}
+
+/* ----------------------------------------------------------------------- */
+
+int gpioWaveGetLargestFreeCbs(void)
+{
+   int numFree, numLargest;
+
+   DBG(DBG_USER, "");
+
+   CHECK_INITED;
+
+   waveReap();
+
+   waveFit(0, 0, &numFree, &numLargest);
+
+   return numLargest;
+}
+
 static int read_SDA(wfRx_t *w)
 {
    myGpioSetMode(w->I.SDA, PI_INPUT);
@@ -9237,9 +14114,9 @@ int gpioNotifyOpen(void)
 
    for (i=0; i<PI_NOTIFY_SLOTS; i++)
    {
-      if (gpioNotify[i].state == PI_NOTIFY_CLOSED)
+      if (__sync_bool_compare_and_swap(
+         &gpioNotify[i].state, PI_NOTIFY_CLOSED, PI_NOTIFY_OPENED))
       {
-         gpioNotify[i].state = PI_NOTIFY_OPENED;
          slot = i;
          break;
       }
@@ -9266,6 +14143,11 @@ int gpioNotifyOpen(void)
    gpioNotify[slot].pipe  = 1;
    gpioNotify[slot].lastReportTick = gpioTick();
 
+   pthread_mutex_lock(&eventMutex);
+   gpioNotify[slot].evtHead = 0;
+   gpioNotify[slot].evtTail = 0;
+   pthread_mutex_unlock(&eventMutex);
+
    return slot;
 }
 
@@ -9284,7 +14166,8 @@ static int gpioNotifyOpenInBand(int fd)
 
    for (i=0; i<PI_NOTIFY_SLOTS; i++)
    {
-      if (gpioNotify[i].state == PI_NOTIFY_CLOSED)
+      if (__sync_bool_compare_and_swap(
+         &gpioNotify[i].state, PI_NOTIFY_CLOSED, PI_NOTIFY_OPENED))
       {
          slot = i;
          break;
@@ -9293,13 +14176,17 @@ static int gpioNotifyOpenInBand(int fd)
 
    if (slot < 0) SOFT_ERROR(PI_NO_HANDLE, "no handle");
 
-   gpioNotify[slot].state = PI_NOTIFY_OPENED;
    gpioNotify[slot].seqno = 0;
    gpioNotify[slot].bits  = 0;
    gpioNotify[slot].fd    = fd;
    gpioNotify[slot].pipe  = 0;
    gpioNotify[slot].lastReportTick = gpioTick();
 
+   pthread_mutex_lock(&eventMutex);
+   gpioNotify[slot].evtHead = 0;
+   gpioNotify[slot].evtTail = 0;
+   pthread_mutex_unlock(&eventMutex);
+
    return slot;
 }
 
@@ -9309,19 +14196,25 @@ static int gpioNotifyOpenInBand(int fd)
 static void intScriptBits(void)
 {
    int i;
-   uint32_t bits;
+   uint32_t bits, trigBits;
 
    bits = 0;
+   trigBits = 0;
 
    for (i=0; i<PI_MAX_SCRIPTS; i++)
    {
       if (gpioScript[i].state == PI_SCRIPT_IN_USE)
       {
          bits |= gpioScript[i].waitBits;
+         trigBits |= gpioScript[i].trigBit;
       }
    }
 
-   scriptBits = bits;
+   scriptTrigBits = trigBits;
+
+   scriptWaitBits = bits;
+
+   scriptBits = bits | trigBits;
 
    monitorBits = alertBits | notifyBits | scriptBits | gpioGetSamples.bits;
 }
@@ -9378,45 +14271,152 @@ int gpioNotifyPause (unsigned handle)
 {
    DBG(DBG_USER, "handle=%d", handle);
 
-   CHECK_INITED;
+   CHECK_INITED;
+
+   if (handle >= PI_NOTIFY_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (gpioNotify[handle].state <= PI_NOTIFY_CLOSING)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   gpioNotify[handle].bits  = 0;
+
+   gpioNotify[handle].state = PI_NOTIFY_PAUSED;
+
+   intNotifyBits();
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioNotifyClose(unsigned handle)
+{
+   DBG(DBG_USER, "handle=%d", handle);
+
+   CHECK_INITED;
+
+   if (handle >= PI_NOTIFY_SLOTS)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   if (gpioNotify[handle].state <= PI_NOTIFY_CLOSING)
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+
+   gpioNotify[handle].bits  = 0;
+
+   gpioNotify[handle].state = PI_NOTIFY_CLOSING;
+
+   intNotifyBits();
+
+   /* actual close done in alert thread */
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioFifoOpen(unsigned flags)
+{
+   int i, slot, fd;
+   char name[32];
+   fifoChannel_t *ch;
+   pthread_attr_t pthAttr;
+
+   DBG(DBG_USER, "flags=0x%X", flags);
+
+   CHECK_INITED;
+
+   if (flags & ~PI_FIFO_FLAGS_BINARY)
+      SOFT_ERROR(PI_BAD_FLAGS, "bad flags (0x%X)", flags);
+
+   slot = -1;
+
+   for (i=0; i<PI_FIFO_SLOTS; i++)
+   {
+      if (__sync_bool_compare_and_swap(
+         &fifoChannel[i].state, PI_FIFO_CLOSED, PI_FIFO_RESERVED))
+      {
+         slot = i;
+         break;
+      }
+   }
+
+   if (slot < 0)
+      SOFT_ERROR(PI_NO_HANDLE, "no handle");
+
+   ch = &fifoChannel[slot];
+
+   ch->binary = flags & PI_FIFO_FLAGS_BINARY;
+   ch->inp = NULL;
+   ch->out = -1;
+
+   sprintf(name, PI_INPFIFO_CH, slot);
+
+   myCreatePipe(name, 0662);
+
+   ch->inp = fopen(name, "r+");
+
+   sprintf(name, PI_OUTFIFO_CH, slot);
+
+   myCreatePipe(name, 0664);
+
+   fd = open(name, O_RDWR|O_NONBLOCK);
 
-   if (handle >= PI_NOTIFY_SLOTS)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   ch->out = fd;
 
-   if (gpioNotify[handle].state <= PI_NOTIFY_CLOSING)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   if ((ch->inp == NULL) || (fd < 0))
+   {
+      myFifoRelease(ch);
+      SOFT_ERROR(PI_BAD_PATHNAME, "open %s failed (%m)", name);
+   }
 
-   gpioNotify[handle].bits  = 0;
+   ch->state = PI_FIFO_OPENED;
 
-   gpioNotify[handle].state = PI_NOTIFY_PAUSED;
+   pthread_attr_init(&pthAttr);
+   pthread_attr_setstacksize(&pthAttr, STACK_SIZE);
 
-   intNotifyBits();
+   if (pthread_create(&ch->pthId, &pthAttr, pthFifoChannelThread, ch))
+   {
+      myFifoRelease(ch);
+      SOFT_ERROR(PI_NO_HANDLE, "pthread_create failed (%m)");
+   }
 
-   return 0;
+   return slot;
 }
 
-
 /* ----------------------------------------------------------------------- */
 
-int gpioNotifyClose(unsigned handle)
+int gpioFifoClose(unsigned handle)
 {
+   fifoChannel_t *ch;
+
    DBG(DBG_USER, "handle=%d", handle);
 
    CHECK_INITED;
 
-   if (handle >= PI_NOTIFY_SLOTS)
+   if (handle >= PI_FIFO_SLOTS)
       SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
 
-   if (gpioNotify[handle].state <= PI_NOTIFY_CLOSING)
-      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   ch = &fifoChannel[handle];
 
-   gpioNotify[handle].bits  = 0;
+   /* the channel thread doesn't release inp while a close uses it */
 
-   gpioNotify[handle].state = PI_NOTIFY_CLOSING;
+   __sync_fetch_and_add(&ch->closers, 1);
 
-   intNotifyBits();
+   if (!__sync_bool_compare_and_swap(
+      &ch->state, PI_FIFO_OPENED, PI_FIFO_CLOSING))
+   {
+      __sync_fetch_and_sub(&ch->closers, 1);
+      SOFT_ERROR(PI_BAD_HANDLE, "bad handle (%d)", handle);
+   }
 
-   /* actual close done in alert thread */
+   /* wake the channel thread, it releases the channel itself */
+
+   write(fileno(ch->inp), "\n", 1);
+
+   __sync_fetch_and_sub(&ch->closers, 1);
 
    return 0;
 }
@@ -9573,100 +14573,449 @@ static int intGpioSetTimerFunc(unsigned id,
       }
    }
 
-   return 0;
-}
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetTimerFunc(unsigned id, unsigned millis, gpioTimerFunc_t f)
+{
+   DBG(DBG_USER, "id=%d millis=%d function=%08X", id, millis, (uint32_t)f);
+
+   CHECK_INITED;
+
+   if (id > PI_MAX_TIMER)
+      SOFT_ERROR(PI_BAD_TIMER, "bad timer id (%d)", id);
+
+   if ((millis < PI_MIN_MS) || (millis > PI_MAX_MS))
+      SOFT_ERROR(PI_BAD_MS, "timer %d, bad millis (%d)", id, millis);
+
+   intGpioSetTimerFunc(id, millis, f, 0, NULL);
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioSetTimerFuncEx(unsigned id, unsigned millis, gpioTimerFuncEx_t f,
+                       void * userdata)
+{
+   DBG(DBG_USER, "id=%d millis=%d function=%08X, userdata=%08X",
+      id, millis, (uint32_t)f, (uint32_t)userdata);
+
+   CHECK_INITED;
+
+   if (id > PI_MAX_TIMER)
+      SOFT_ERROR(PI_BAD_TIMER, "bad timer id (%d)", id);
+
+   if ((millis < PI_MIN_MS) || (millis > PI_MAX_MS))
+      SOFT_ERROR(PI_BAD_MS, "timer %d, bad millis (%d)", id, millis);
+
+   intGpioSetTimerFunc(id, millis, f, 1, userdata);
+
+   return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+pthread_t *gpioStartThread(gpioThreadFunc_t f, void *arg)
+{
+   pthread_t *pth;
+   pthread_attr_t pthAttr;
+
+   DBG(DBG_USER, "f=%08X, arg=%08X", (uint32_t)f, (uint32_t)arg);
+
+   CHECK_INITED_RET_NULL_PTR;
+
+   pth = malloc(sizeof(pthread_t));
+
+   if (pth)
+   {
+      if (pthread_attr_init(&pthAttr))
+      {
+         free(pth);
+         SOFT_ERROR(NULL, "pthread_attr_init failed");
+      }
+
+      if (pthread_attr_setstacksize(&pthAttr, STACK_SIZE))
+      {
+         free(pth);
+         SOFT_ERROR(NULL, "pthread_attr_setstacksize failed");
+      }
+
+      if (pthread_create(pth, &pthAttr, f, arg))
+      {
+         free(pth);
+         SOFT_ERROR(NULL, "pthread_create failed");
+      }
+   }
+   return pth;
+}
+
+/* ----------------------------------------------------------------------- */
+
+void gpioStopThread(pthread_t *pth)
+{
+   DBG(DBG_USER, "pth=%08X", (uint32_t)pth);
+
+   CHECK_INITED_RET_NIL;
+
+   if (pth)
+   {
+      pthread_cancel(*pth);
+      pthread_join(*pth, NULL);
+   }
+}
+
+/* ----------------------------------------------------------------------- */
+
+static uint64_t myScriptHash(char *text, uint32_t len)
+{
+   uint64_t hash;
+   uint32_t i;
+
+   /* FNV-1a */
+
+   hash = 0xcbf29ce484222325ULL;
+
+   for (i=0; i<len; i++)
+   {
+      hash ^= (uint8_t)text[i];
+      hash *= 0x100000001b3ULL;
+   }
+
+   return hash;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int myScriptCacheFind(char *text, uint32_t len, uint64_t hash)
+{
+   int i;
+
+   for (i=0; i<scriptCacheCount; i++)
+   {
+      if ((scriptCache[i].rec.hash    == hash) &&
+          (scriptCache[i].rec.textLen == len)  &&
+          (memcmp(scriptCache[i].text, text, len) == 0))
+         return i;
+   }
+
+   return -1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int myScriptCacheAdd(
+   scriptCacheRec_t *rec, char *text, cmdInstr_t *instr, char *str)
+{
+   scriptCache_t *c;
+   char *buf;
+   int isize;
+
+   if (scriptCacheCount >= SCRIPT_CACHE_ENTRIES) return -1;
+
+   isize = rec->instrs * sizeof(cmdInstr_t);
+
+   buf = malloc(isize + rec->strLen + rec->textLen + 1);
+
+   if (buf == NULL) return -1;
+
+   c = &scriptCache[scriptCacheCount];
+
+   c->rec   = *rec;
+   c->instr = (cmdInstr_t *)buf;
+   c->str   = buf + isize;
+   c->text  = c->str + rec->strLen;
+
+   memcpy(c->instr, instr, isize);
+   memcpy(c->str, str, rec->strLen);
+   memcpy(c->text, text, rec->textLen);
+   c->text[rec->textLen] = 0;
+
+   return scriptCacheCount++;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void myScriptCacheAppend(int idx)
+{
+   FILE *f;
+   scriptCacheHdr_t hdr;
+   scriptCache_t *c;
+
+   if (!scriptCachePath[0]) return;
+
+   f = fopen(scriptCachePath, "ab");
+
+   if (f == NULL)
+   {
+      DBG(DBG_ALWAYS, "can't open script cache %s (%m)", scriptCachePath);
+      return;
+   }
+
+   if (ftell(f) == 0)
+   {
+      hdr.magic     = SCRIPT_CACHE_MAGIC;
+      hdr.version   = SCRIPT_CACHE_VERSION;
+      hdr.instrSize = sizeof(cmdInstr_t);
+      hdr.cmds      = cmdInfoEntries;
+
+      fwrite(&hdr, sizeof(hdr), 1, f);
+   }
+
+   c = &scriptCache[idx];
+
+   fwrite(&c->rec, sizeof(c->rec), 1, f);
+   fwrite(c->text, 1, c->rec.textLen, f);
+   fwrite(c->instr, sizeof(cmdInstr_t), c->rec.instrs, f);
+   fwrite(c->str, 1, c->rec.strLen, f);
+
+   fclose(f);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int myScriptCacheValid(scriptCacheRec_t *rec, cmdInstr_t *instr)
+{
+   int i, j, jmp;
+   uint32_t cmd;
+
+   /*
+      A record is only trusted as far as cmdParseScript would have
+      produced it.  Each command must be known (tags are resolved
+      away) or one of the optimiser's fused jumps, each jump must
+      land on a step or just past the last, and each var or param
+      must exist.
+   */
+
+   for (i=0; i<rec->instrs; i++)
+   {
+      cmd = instr[i].p[0];
+      jmp = 0;
+
+      if (cmd >= CMD_CMPJZ)
+      {
+         if (cmd > CMD_DCRJNZ) return 0;
+         jmp = 2;
+      }
+      else
+      {
+         if (cmd == PI_CMD_TAG) return 0;
+
+         for (j=0; j<cmdInfoEntries; j++)
+         {
+            if (cmdInfo[j].cmd == cmd) break;
+         }
+
+         if (j >= cmdInfoEntries) return 0;
+
+         switch (cmd)
+         {
+            case PI_CMD_CALL:
+            case PI_CMD_JM:
+            case PI_CMD_JMP:
+            case PI_CMD_JNZ:
+            case PI_CMD_JP:
+            case PI_CMD_JZ:
+               jmp = 1;
+               break;
+         }
+      }
+
+      if (jmp && (instr[i].p[jmp] > rec->instrs)) return 0;
+
+      for (j=1; j<3; j++)
+      {
+         switch (instr[i].opt[j])
+         {
+            case 0:
+            case CMD_NUMERIC:
+               break;
+
+            case CMD_VAR:
+               if (instr[i].p[j] >= PI_MAX_SCRIPT_VARS) return 0;
+               break;
+
+            case CMD_PAR:
+               if (instr[i].p[j] >= PI_MAX_SCRIPT_PARAMS) return 0;
+               break;
+
+            default:
+               return 0;
+         }
+      }
+
+      if (instr[i].p[3])
+      {
+         if (((uint64_t)instr[i].p[4] + instr[i].p[3]) >= rec->strLen)
+            return 0;
+      }
+   }
+
+   return 1;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void myScriptCacheLoad(void)
+{
+   FILE *f;
+   scriptCacheHdr_t hdr;
+   scriptCacheRec_t rec;
+   char *buf;
+   long good;
+   int isize, loaded;
+
+   if (scriptCacheLoaded || !scriptCachePath[0]) return;
+
+   scriptCacheLoaded = 1;
+
+   f = fopen(scriptCachePath, "rb");
+
+   if (f == NULL) return;
+
+   loaded = 0;
+   good = 0;
+
+   if ((fread(&hdr, sizeof(hdr), 1, f) == 1)  &&
+       (hdr.magic     == SCRIPT_CACHE_MAGIC)   &&
+       (hdr.version   == SCRIPT_CACHE_VERSION) &&
+       (hdr.instrSize == sizeof(cmdInstr_t))   &&
+       (hdr.cmds      == cmdInfoEntries))
+   {
+      good = sizeof(hdr);
+
+      while (fread(&rec, sizeof(rec), 1, f) == 1)
+      {
+         if ((rec.textLen > SCRIPT_CACHE_MAX_TEXT) ||
+             (rec.instrs  > rec.textLen)        ||
+             (rec.strLen  > rec.textLen)) break;
+
+         isize = rec.instrs * sizeof(cmdInstr_t);
+
+         buf = malloc(rec.textLen + isize + rec.strLen);
+
+         if (buf == NULL) break;
+
+         if (fread(buf, 1, rec.textLen + isize + rec.strLen, f) !=
+            (rec.textLen + isize + rec.strLen))
+         {
+            free(buf);
+            break;
+         }
+
+         if (myScriptHash(buf, rec.textLen) != rec.hash ||
+            !myScriptCacheValid(&rec, (cmdInstr_t *)(buf + rec.textLen)))
+         {
+            free(buf);
+            break;
+         }
+
+         good = ftell(f);
+
+         if (myScriptCacheFind(buf, rec.textLen, rec.hash) < 0)
+         {
+            if (myScriptCacheAdd(&rec, buf,
+               (cmdInstr_t *)(buf + rec.textLen),
+               buf + rec.textLen + isize) >= 0) loaded++;
+         }
+
+         free(buf);
+      }
+   }
+
+   fclose(f);
 
+   /* drop anything unusable so later appends stay readable */
 
-/* ----------------------------------------------------------------------- */
-
-int gpioSetTimerFunc(unsigned id, unsigned millis, gpioTimerFunc_t f)
-{
-   DBG(DBG_USER, "id=%d millis=%d function=%08X", id, millis, (uint32_t)f);
+   if (truncate(scriptCachePath, good) < 0)
+      DBG(DBG_ALWAYS, "can't truncate script cache %s (%m)", scriptCachePath);
 
-   CHECK_INITED;
+   DBG(DBG_STARTUP, "%d scripts loaded from %s", loaded, scriptCachePath);
+}
 
-   if (id > PI_MAX_TIMER)
-      SOFT_ERROR(PI_BAD_TIMER, "bad timer id (%d)", id);
+/* ----------------------------------------------------------------------- */
 
-   if ((millis < PI_MIN_MS) || (millis > PI_MAX_MS))
-      SOFT_ERROR(PI_BAD_MS, "timer %d, bad millis (%d)", id, millis);
+static int myScriptCacheStore(char *text, uint32_t len, uint64_t hash,
+   cmdScript_t *s)
+{
+   scriptCacheRec_t rec;
+   cmdInstr_t *instr;
+   uint32_t base;
+   int i, idx;
 
-   intGpioSetTimerFunc(id, millis, f, 0, NULL);
+   instr = malloc((s->instrs + 1) * sizeof(cmdInstr_t));
 
-   return 0;
-}
+   if (instr == NULL) return -1;
 
+   /* make string pointers relative to the string area */
 
-/* ----------------------------------------------------------------------- */
+   base = (uintptr_t)s->str_area;
 
-int gpioSetTimerFuncEx(unsigned id, unsigned millis, gpioTimerFuncEx_t f,
-                       void * userdata)
-{
-   DBG(DBG_USER, "id=%d millis=%d function=%08X, userdata=%08X",
-      id, millis, (uint32_t)f, (uint32_t)userdata);
+   for (i=0; i<s->instrs; i++)
+   {
+      instr[i] = s->instr[i];
+      if (instr[i].p[3]) instr[i].p[4] -= base;
+   }
 
-   CHECK_INITED;
+   rec.hash    = hash;
+   rec.textLen = len;
+   rec.instrs  = s->instrs;
+   rec.strLen  = s->str_area_pos;
 
-   if (id > PI_MAX_TIMER)
-      SOFT_ERROR(PI_BAD_TIMER, "bad timer id (%d)", id);
+   idx = myScriptCacheAdd(&rec, text, instr, s->str_area);
 
-   if ((millis < PI_MIN_MS) || (millis > PI_MAX_MS))
-      SOFT_ERROR(PI_BAD_MS, "timer %d, bad millis (%d)", id, millis);
+   free(instr);
 
-   intGpioSetTimerFunc(id, millis, f, 1, userdata);
+   if (idx >= 0) myScriptCacheAppend(idx);
 
-   return 0;
+   return idx;
 }
 
 /* ----------------------------------------------------------------------- */
 
-pthread_t *gpioStartThread(gpioThreadFunc_t f, void *arg)
+static int myScriptFromCache(int idx, cmdScript_t *s)
 {
-   pthread_t *pth;
-   pthread_attr_t pthAttr;
+   scriptCache_t *c;
+   uint32_t base;
+   int b, i;
 
-   DBG(DBG_USER, "f=%08X, arg=%08X", (uint32_t)f, (uint32_t)arg);
+   c = &scriptCache[idx];
 
-   CHECK_INITED_RET_NULL_PTR;
+   /* same layout as cmdParseScript, sized to fit */
 
-   pth = malloc(sizeof(pthread_t));
+   b = (sizeof(int) * (PI_MAX_SCRIPT_PARAMS + PI_MAX_SCRIPT_VARS)) +
+       (sizeof(cmdInstr_t) * c->rec.instrs) + c->rec.strLen;
 
-   if (pth)
-   {
-      if (pthread_attr_init(&pthAttr))
-      {
-         free(pth);
-         SOFT_ERROR(NULL, "pthread_attr_init failed");
-      }
+   s->par = calloc(1, b);
 
-      if (pthread_attr_setstacksize(&pthAttr, STACK_SIZE))
-      {
-         free(pth);
-         SOFT_ERROR(NULL, "pthread_attr_setstacksize failed");
-      }
+   if (s->par == NULL) return -1;
 
-      if (pthread_create(pth, &pthAttr, f, arg))
-      {
-         free(pth);
-         SOFT_ERROR(NULL, "pthread_create failed");
-      }
-   }
-   return pth;
-}
+   s->var = s->par + PI_MAX_SCRIPT_PARAMS;
 
-/* ----------------------------------------------------------------------- */
+   s->instr = (cmdInstr_t *)(s->var + PI_MAX_SCRIPT_VARS);
 
-void gpioStopThread(pthread_t *pth)
-{
-   DBG(DBG_USER, "pth=%08X", (uint32_t)pth);
+   s->str_area = (char *)(s->instr + c->rec.instrs);
 
-   CHECK_INITED_RET_NIL;
+   s->str_area_len = c->rec.strLen;
+   s->str_area_pos = c->rec.strLen;
 
-   if (pth)
+   s->instrs = c->rec.instrs;
+
+   memcpy(s->instr, c->instr, sizeof(cmdInstr_t) * c->rec.instrs);
+   memcpy(s->str_area, c->str, c->rec.strLen);
+
+   base = (uintptr_t)s->str_area;
+
+   for (i=0; i<s->instrs; i++)
    {
-      pthread_cancel(*pth);
-      pthread_join(*pth, NULL);
+      if (s->instr[i].p[3]) s->instr[i].p[4] += base;
    }
+
+   return 0;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -9674,52 +15023,87 @@ void gpioStopThread(pthread_t *pth)
 int gpioStoreScript(char *script)
 {
    gpioScript_t *s;
-   int status, slot, i;
+   int status, slot, i, idx;
+   uint32_t len;
+   uint64_t hash;
 
    DBG(DBG_USER, "script=[%s]", script);
 
    CHECK_INITED;
 
+   len  = strlen(script);
+   hash = myScriptHash(script, len);
+
+   pthread_mutex_lock(&scriptCacheMutex);
+
+   idx = myScriptCacheFind(script, len, hash);
+
+   /*
+      Every store gets its own slot, parameters, and run state even
+      when the compiled code comes from the cache.
+   */
+
    slot = -1;
 
    for (i=0; i<PI_MAX_SCRIPTS; i++)
    {
-      if (gpioScript[i].state == PI_SCRIPT_FREE)
+      if (__sync_bool_compare_and_swap(
+         &gpioScript[i].state, PI_SCRIPT_FREE, PI_SCRIPT_RESERVED))
       {
-         gpioScript[i].state = PI_SCRIPT_RESERVED;
          slot = i;
          break;
       }
    }
 
    if (slot < 0)
+   {
+      pthread_mutex_unlock(&scriptCacheMutex);
       SOFT_ERROR(PI_NO_SCRIPT_ROOM, "no room for scripts");
+   }
 
    s = &gpioScript[slot];
 
-   status = cmdParseScript(script, &s->script, 0);
+   if (idx >= 0)
+   {
+      status = myScriptFromCache(idx, &s->script);
+   }
+   else
+   {
+      status = cmdParseScript(script, &s->script, 0);
+
+      if (status == 0) idx = myScriptCacheStore(script, len, hash, &s->script);
+   }
+
+   pthread_mutex_unlock(&scriptCacheMutex);
+
+   if (status == 0) status = scrTranslate(s);
 
    if (status == 0)
    {
       s->request   = PI_SCRIPT_HALT;
-      s->run_state = PI_SCRIPT_INITING;
+      s->run_state = PI_SCRIPT_HALTED;
+      s->sched     = SCR_IDLE;
+      s->waitBits  = 0;
 
-      pthread_cond_init(&s->pthCond, NULL);
-      pthread_mutex_init(&s->pthMutex, NULL);
+      s->profOn       = 0;
+      s->profThreaded = 0;
+      s->blockStep    = -1;
 
       s->id = slot;
 
       gpioScript[slot].state = PI_SCRIPT_IN_USE;
 
-      s->pthIdp = gpioStartThread(pthScript, s);
-
       status = slot;
-
    }
    else
    {
       if (s->script.par) free(s->script.par);
       s->script.par = NULL;
+      if (s->op) free(s->op);
+      s->op = NULL;
+      if (s->stack) free(s->stack);
+      s->stack = NULL;
+      s->buf = NULL;
       gpioScript[slot].state = PI_SCRIPT_FREE;
    }
 
@@ -9731,6 +15115,7 @@ int gpioStoreScript(char *script)
 
 int gpioRunScript(unsigned script_id, unsigned numParam, uint32_t *param)
 {
+   gpioScript_t *s;
    int status = 0;
 
    DBG(DBG_USER, "script_id=%d numParam=%d param=%08X",
@@ -9746,33 +15131,189 @@ int gpioRunScript(unsigned script_id, unsigned numParam, uint32_t *param)
 
    if (gpioScript[script_id].state == PI_SCRIPT_IN_USE)
    {
-      pthread_mutex_lock(&gpioScript[script_id].pthMutex);
+      s = &gpioScript[script_id];
 
-      if (gpioScript[script_id].run_state == PI_SCRIPT_HALTED)
+      pthread_mutex_lock(&scrMutex);
+
+      status = scrAlloc(s);
+
+      if (status == 0)
       {
-         if ((numParam > 0) && (param != 0))
+         if ((s->run_state == PI_SCRIPT_HALTED) && (s->sched == SCR_IDLE))
          {
-            memcpy(gpioScript[script_id].script.par, param,
-               sizeof(uint32_t) * numParam);
+            if ((numParam > 0) && (param != 0))
+            {
+               memcpy(s->script.par, param, sizeof(uint32_t) * numParam);
+            }
+
+            scrStart(s);
          }
+         else status = PI_NOT_HALTED;
+      }
 
-         gpioScript[script_id].request = PI_SCRIPT_RUN;
+      pthread_mutex_unlock(&scrMutex);
 
-         pthread_cond_signal(&gpioScript[script_id].pthCond);
-      }
+      return status;
+   }
+   else
+   {
+      return PI_BAD_SCRIPT_ID;
+   }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioScriptTrigger(unsigned script_id, unsigned gpio, unsigned edge)
+{
+   gpioScript_t *s;
+   int status;
+
+   DBG(DBG_USER, "script_id=%d gpio=%d edge=%d", script_id, gpio, edge);
+
+   CHECK_INITED;
+
+   if (script_id >= PI_MAX_SCRIPTS)
+      SOFT_ERROR(PI_BAD_SCRIPT_ID, "bad script id(%d)", script_id);
+
+   if (gpio > PI_MAX_USER_GPIO)
+      SOFT_ERROR(PI_BAD_USER_GPIO, "bad gpio (%d)", gpio);
+
+   if (edge > NO_EDGE)
+      SOFT_ERROR(PI_BAD_EDGE, "bad edge (%d)", edge);
+
+   if (gpioScript[script_id].state != PI_SCRIPT_IN_USE)
+      return PI_BAD_SCRIPT_ID;
+
+   s = &gpioScript[script_id];
+
+   pthread_mutex_lock(&scrMutex);
+
+   /* allocate now so the alert thread never has to */
+
+   status = scrAlloc(s);
+
+   if (status == 0)
+   {
+      if (edge == NO_EDGE) s->trigBit = 0;
       else
       {
-         status = PI_NOT_HALTED;
+         s->trigEdge = edge;
+         s->trigBit  = 1<<gpio;
       }
 
-      pthread_mutex_unlock(&gpioScript[script_id].pthMutex);
+      intScriptBits();
+   }
 
-      return status;
+   pthread_mutex_unlock(&scrMutex);
+
+   return status;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioScriptProfile(unsigned script_id, unsigned profile)
+{
+   gpioScript_t *s;
+   int i;
+
+   DBG(DBG_USER, "script_id=%d profile=%d", script_id, profile);
+
+   CHECK_INITED;
+
+   if (script_id >= PI_MAX_SCRIPTS)
+      SOFT_ERROR(PI_BAD_SCRIPT_ID, "bad script id(%d)", script_id);
+
+   if (profile > PI_PROF_CLEAR)
+      SOFT_ERROR(PI_BAD_PROF_MODE, "bad profile mode (%d)", profile);
+
+   if (gpioScript[script_id].state != PI_SCRIPT_IN_USE)
+      return PI_BAD_SCRIPT_ID;
+
+   s = &gpioScript[script_id];
+
+   pthread_mutex_lock(&scrMutex);
+
+   if ((profile != PI_PROF_OFF) && (s->prof == NULL))
+   {
+      s->prof = calloc(s->script.instrs + 1, sizeof(gpioScriptProf_t));
+
+      if (s->prof == NULL)
+      {
+         pthread_mutex_unlock(&scrMutex);
+         return PI_NO_MEMORY;
+      }
+
+      for (i=0; i<s->script.instrs; i++)
+      {
+         s->prof[i].step = i;
+         s->prof[i].cmd  = s->script.instr[i].p[0];
+      }
+   }
+
+   if (profile == PI_PROF_CLEAR)
+   {
+      for (i=0; i<s->script.instrs; i++)
+      {
+         s->prof[i].count       = 0;
+         s->prof[i].micros      = 0;
+         s->prof[i].blockMicros = 0;
+      }
    }
    else
    {
+      /* a running script switches at its next yield */
+
+      __sync_synchronize();
+
+      s->profOn = (profile == PI_PROF_ON);
+   }
+
+   pthread_mutex_unlock(&scrMutex);
+
+   return 0;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioScriptGetProfile(
+   unsigned script_id, gpioScriptProf_t *prof, unsigned maxProf)
+{
+   gpioScript_t *s;
+   int i, n;
+
+   DBG(DBG_USER, "script_id=%d prof=%08X maxProf=%d",
+      script_id, (uint32_t)prof, maxProf);
+
+   CHECK_INITED;
+
+   if (script_id >= PI_MAX_SCRIPTS)
+      SOFT_ERROR(PI_BAD_SCRIPT_ID, "bad script id(%d)", script_id);
+
+   if (!prof) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) prof pointer");
+
+   if (gpioScript[script_id].state != PI_SCRIPT_IN_USE)
       return PI_BAD_SCRIPT_ID;
+
+   s = &gpioScript[script_id];
+
+   n = 0;
+
+   pthread_mutex_lock(&scrMutex);
+
+   if (s->prof)
+   {
+      for (i=0; (i<s->script.instrs) && (n<maxProf); i++)
+      {
+         if (s->prof[i].count) prof[n++] = s->prof[i];
+      }
    }
+
+   pthread_mutex_unlock(&scrMutex);
+
+   return n;
 }
 
 
@@ -9814,16 +15355,14 @@ int gpioStopScript(unsigned script_id)
 
    if (gpioScript[script_id].state == PI_SCRIPT_IN_USE)
    {
-      pthread_mutex_lock(&gpioScript[script_id].pthMutex);
+      pthread_mutex_lock(&scrMutex);
 
       gpioScript[script_id].request = PI_SCRIPT_HALT;
 
-      if (gpioScript[script_id].run_state == PI_SCRIPT_WAITING)
-      {
-         pthread_cond_signal(&gpioScript[script_id].pthCond);
-      }
+      if (gpioScript[script_id].sched != SCR_ACTIVE)
+         scrHalt(&gpioScript[script_id]);
 
-      pthread_mutex_unlock(&gpioScript[script_id].pthMutex);
+      pthread_mutex_unlock(&scrMutex);
 
       return 0;
    }
@@ -9845,29 +15384,45 @@ int gpioDeleteScript(unsigned script_id)
    {
       gpioScript[script_id].state = PI_SCRIPT_DYING;
 
-      pthread_mutex_lock(&gpioScript[script_id].pthMutex);
+      pthread_mutex_lock(&scrMutex);
 
-      gpioScript[script_id].request = PI_SCRIPT_HALT;
+      gpioScript[script_id].trigBit = 0;
 
-      if (gpioScript[script_id].run_state == PI_SCRIPT_WAITING)
-      {
-         pthread_cond_signal(&gpioScript[script_id].pthCond);
-      }
+      intScriptBits();
+
+      gpioScript[script_id].request = PI_SCRIPT_HALT;
 
-      pthread_mutex_unlock(&gpioScript[script_id].pthMutex);
+      if (gpioScript[script_id].sched != SCR_ACTIVE)
+         scrHalt(&gpioScript[script_id]);
 
-      while (gpioScript[script_id].run_state == PI_SCRIPT_RUNNING)
+      while (gpioScript[script_id].sched != SCR_IDLE)
       {
+         pthread_mutex_unlock(&scrMutex);
          myGpioSleep(0, 5000); /* give script time to halt */
+         pthread_mutex_lock(&scrMutex);
       }
 
-      gpioStopThread(gpioScript[script_id].pthIdp);
+      pthread_mutex_unlock(&scrMutex);
+
+      if (gpioScript[script_id].stack) free(gpioScript[script_id].stack);
+
+      gpioScript[script_id].stack = NULL;
+      gpioScript[script_id].buf   = NULL;
 
       if (gpioScript[script_id].script.par)
          free(gpioScript[script_id].script.par);
 
       gpioScript[script_id].script.par = NULL;
 
+      if (gpioScript[script_id].op) free(gpioScript[script_id].op);
+
+      gpioScript[script_id].op = NULL;
+
+      if (gpioScript[script_id].prof) free(gpioScript[script_id].prof);
+
+      gpioScript[script_id].prof = NULL;
+      gpioScript[script_id].profOn = 0;
+
       gpioScript[script_id].state = PI_SCRIPT_FREE;
 
       return 0;
@@ -10306,6 +15861,48 @@ unsigned gpioVersion(void)
 }
 
 
+/* ----------------------------------------------------------------------- */
+
+int gpioCmdStats(gpioCmdStats_t *stats, unsigned maxStats)
+{
+   int i, n;
+
+   DBG(DBG_USER, "stats=%08X maxStats=%d", (uint32_t)stats, maxStats);
+
+   CHECK_INITED;
+
+   if (!stats) SOFT_ERROR(PI_BAD_POINTER, "bad (NULL) stats pointer");
+
+   n = 0;
+
+   for (i=0; (i<CMD_STATS_SLOTS) && (n<maxStats); i++)
+   {
+      if (cmdStats[i].calls)
+      {
+         stats[n] = cmdStats[i];
+         stats[n].cmd = i;
+         n++;
+      }
+   }
+
+   return n;
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+int gpioCmdStatsReset(void)
+{
+   DBG(DBG_USER, "");
+
+   CHECK_INITED;
+
+   memset(cmdStats, 0, sizeof(cmdStats));
+
+   return 0;
+}
+
+
 /* ----------------------------------------------------------------------- */
 
 unsigned gpioHardwareRevision(void)
@@ -10517,6 +16114,27 @@ int gpioCfgMemAlloc(unsigned memAllocMode)
 }
 
 
+/* ----------------------------------------------------------------------- */
+
+int gpioCfgScriptCache(char *path)
+{
+   DBG(DBG_USER, "path=%s", path);
+
+   CHECK_NOT_INITED;
+
+   if ((path == NULL) || (strlen(path) >= sizeof(scriptCachePath)))
+      SOFT_ERROR(PI_BAD_CACHE_PATH, "bad script cache path");
+
+   if (strcmp(path, scriptCachePath))
+   {
+      strcpy(scriptCachePath, path);
+      scriptCacheLoaded = 0;
+   }
+
+   return 0;
+}
+
+
 /* ----------------------------------------------------------------------- */
 
 int gpioCfgInternals(unsigned cfgWhat, int cfgVal)
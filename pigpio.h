@@ -173,6 +173,9 @@ gpioNotifyBegin            Start notifications for selected gpios
 gpioNotifyPause            Pause notifications
 gpioNotifyClose            Close a notification
 
+gpioFifoOpen               Request a private pipe command channel
+gpioFifoClose              Close a pipe command channel
+
 gpioSerialReadOpen         Opens a gpio for bit bang serial reads
 gpioSerialRead             Reads bit bang serial data from a gpio
 gpioSerialReadClose        Closes a gpio for bit bang serial reads
@@ -185,6 +188,9 @@ SCRIPTS
 gpioStoreScript            Store a script
 gpioRunScript              Run a stored script
 gpioScriptStatus           Get script status and parameters
+gpioScriptTrigger          Run a stored script on a gpio edge
+gpioScriptProfile          Start, stop, or clear script profiling
+gpioScriptGetProfile       Get per instruction script profile
 gpioStopScript             Stop a running script
 gpioDeleteScript           Delete a stored script
 
@@ -194,14 +200,28 @@ gpioWaveClear              Deletes all waveforms
 
 gpioWaveAddNew             Starts a new waveform
 gpioWaveAddGeneric         Adds a series of pulses to the waveform
+gpioWaveAddMulti           Adds several pulse trains to the waveform
 gpioWaveAddSerial          Adds serial data to the waveform
+gpioWaveAddSerialMulti     Adds serial data on several gpios at once
+gpioWaveAddSteps           Adds a coordinated stepper move to the waveform
 
 gpioWaveCreate             Creates a waveform from added data
-gpioWaveDelete             Deletes one or more waveforms
+gpioWaveCreateShared       Creates a waveform shared with identical ones
+gpioWaveCreatePatchable    Creates a waveform whose levels can be patched
+gpioWavePatch              Patches the levels of a patchable waveform
+gpioWaveDelete             Deletes a waveform
+gpioWaveLoadImage          Loads waveforms compiled by pigwave
 
 gpioWaveTxSend             Transmits a waveform
 
 gpioWaveChain              Transmits a chain of waveforms
+gpioWaveChainEx            Compiles and transmits a chain with nested loops
+
+gpioWaveStreamStart        Starts streaming pulses
+gpioWaveStreamWrite        Queues pulses on the stream
+gpioWaveStreamInfo         Stream space, backlog, and counters
+gpioWaveStreamSteps        Queues a coordinated stepper move on the stream
+gpioWaveStreamStop         Stops streaming pulses
 
 gpioWaveTxBusy             Checks to see if the waveform has ended
 gpioWaveTxStop             Aborts the current waveform
@@ -217,6 +237,8 @@ gpioWaveGetMaxPulses       Absolute maximum allowed pulses
 gpioWaveGetCbs             Length in control blocks of the current waveform
 gpioWaveGetHighCbs         Length of longest waveform so far
 gpioWaveGetMaxCbs          Absolute maximum allowed control blocks
+gpioWaveGetFreeCbs         Control blocks free for new waveforms
+gpioWaveGetLargestFreeCbs  Largest contiguous run of free control blocks
 
 gpioWaveTxStart            Creates/transmits a waveform (DEPRECATED)
 
@@ -285,6 +307,7 @@ gpioCfgInterfaces          Configure user interfaces
 gpioCfgInternals           Configure miscellaneous internals
 gpioCfgSocketPort          Configure socket port
 gpioCfgMemAlloc            Configure DMA memory allocation mode
+gpioCfgScriptCache         Configure compiled script cache file
 
 CUSTOM
 
@@ -298,6 +321,9 @@ gpioTick                   Get current tick (microseconds)
 gpioHardwareRevision       Get hardware revision
 gpioVersion                Get the pigpio version
 
+gpioCmdStats               Get per command call counts and latencies
+gpioCmdStatsReset          Clear per command call counts and latencies
+
 getBitInBytes              Get the value of a bit
 putBitInBytes              Set the value of a bit
 
@@ -327,11 +353,16 @@ OVERVIEW*/
 #define PI_OUTFIFO "/dev/pigout"
 #define PI_ERRFIFO "/dev/pigerr"
 
+#define PI_INPFIFO_CH "/dev/pigcmd%d"
+#define PI_OUTFIFO_CH "/dev/pigout%d"
+
 #define PI_ENVPORT "PIGPIO_PORT"
 #define PI_ENVADDR "PIGPIO_ADDR"
 
 #define PI_LOCKFILE "/var/run/pigpio.pid"
 
+#define PI_SCRIPT_CACHE "/var/cache/pigpio.scripts"
+
 #define PI_I2C_COMBINED "/sys/module/i2c_bcm2708/parameters/combined"
 
 #ifdef __cplusplus
@@ -372,6 +403,118 @@ typedef struct
    uint32_t usDelay;
 } gpioPulse_t;
 
+typedef struct
+{
+   uint32_t gpio;
+   uint32_t baud;
+   uint32_t dataBits;
+   uint32_t stopBits;   /* half bits */
+   uint32_t offset;
+   uint32_t numBytes;
+   char    *bstr;
+} gpioSerial_t;
+
+typedef struct
+{
+   uint32_t stepGpio;
+   uint32_t dirGpio;
+   int32_t  steps;      /* the sign sets the direction */
+} gpioStepAxis_t;
+
+typedef struct
+{
+   uint32_t startSpeed; /* steps per second */
+   uint32_t maxSpeed;
+   uint32_t endSpeed;
+   uint32_t accel;      /* steps per second per second */
+   uint32_t stepMicros; /* step pulse and direction setup */
+   uint32_t flags;
+} gpioStepProfile_t;
+
+#define PI_CMD_STATS_BUCKETS 20
+
+typedef struct
+{
+   uint32_t cmd;         /* command number                 */
+   uint32_t calls;       /* number of times executed       */
+   uint32_t errors;      /* number of calls returning < 0  */
+   uint32_t maxMicros;   /* longest execution time         */
+   uint64_t totalMicros; /* sum of execution times         */
+   uint32_t execHist[PI_CMD_STATS_BUCKETS]; /* log2 micros */
+} gpioCmdStats_t;
+
+typedef struct
+{
+   uint32_t step;        /* index of the compiled instruction   */
+   uint32_t cmd;         /* its command number                  */
+   uint32_t count;       /* number of times executed            */
+   uint32_t reserved;
+   uint64_t micros;      /* time spent executing the step       */
+   uint64_t blockMicros; /* time blocked in WAIT, MILS, or MICS */
+} gpioScriptProf_t;
+
+typedef struct
+{
+   uint32_t cbs;         /* DMA control blocks the chain uses   */
+   uint32_t ool;         /* OOL words the chain uses            */
+   uint32_t loops;       /* loops in the chain                  */
+   uint32_t forever;     /* 1 if the chain ends in a loop forever */
+   uint64_t micros;      /* duration, one pass of a loop forever */
+} gpioChainInfo_t;
+
+/* wave image, as written by pigwave for gpioWaveLoadImage */
+
+#define PI_WAVE_IMAGE_MAGIC    0x31495750 /* PWI1 */
+#define PI_WAVE_IMAGE_OOL_PAGE 79         /* OOL words per DMA page */
+
+/* image cb info */
+
+#define PI_WI_CB_COPY  0 /* copy a word */
+#define PI_WI_CB_BLOCK 1 /* copy length bytes of OOL */
+#define PI_WI_CB_PACED 2 /* wait length/4 microseconds */
+
+/* image cb src, dst, and next, and relocated OOL */
+
+#define PI_WI_REF_MASK 0x0FFFFFFF
+#define PI_WI_REF_CB   0x10000000 /* cb number * 32 + byte offset */
+#define PI_WI_REF_OOL  0x20000000 /* OOL number */
+#define PI_WI_REF_PERI 0x30000000 /* PI_WI_PERI_* */
+
+#define PI_WI_PERI_SET  0
+#define PI_WI_PERI_CLR  1
+#define PI_WI_PERI_LEV  2
+#define PI_WI_PERI_CLO  3
+#define PI_WI_PERI_PACE 4
+#define PI_WI_PERI_DATA 5
+
+typedef struct
+{
+   uint32_t magic;
+   uint32_t oolPage;     /* PI_WAVE_IMAGE_OOL_PAGE */
+   uint32_t numWaves;
+   uint32_t numCB;
+   uint32_t numOOL;
+   uint32_t numRelocs;   /* OOL words holding a reference */
+} gpioWaveImage_t;
+
+typedef struct
+{
+   uint64_t micros;
+   uint32_t botCB;       /* a leading delay, then the pulses */
+   uint32_t topCB;       /* the last cb */
+   uint32_t botOOL;
+   uint32_t topOOL;      /* one past the last OOL */
+} gpioWaveImageWave_t;
+
+typedef struct
+{
+   uint32_t info;        /* PI_WI_CB_* */
+   uint32_t src;
+   uint32_t dst;
+   uint32_t length;
+   uint32_t next;        /* 0 to end */
+} gpioWaveImageCb_t;
+
 #define WAVE_FLAG_READ  1
 #define WAVE_FLAG_TICK  2
 
@@ -518,13 +661,45 @@ typedef void *(gpioThreadFunc_t) (void *);
 
 #define PI_NOTIFY_SLOTS  32
 
+#define PI_FIFO_SLOTS    16
+
+#define PI_FIFO_FLAGS_BINARY 1
+
+#define PI_NTFY_FLAGS_EVENT    (1 <<7)
 #define PI_NTFY_FLAGS_ALIVE    (1 <<6)
 #define PI_NTFY_FLAGS_WDOG     (1 <<5)
 #define PI_NTFY_FLAGS_BIT(x) (((x)<<0)&31)
 
+/* script event reports */
+
+#define PI_NTFY_FLAGS_LAST     (1 <<4)
+#define PI_NTFY_FLAGS_IDX(x)   (((x)<<0)&15)
+#define PI_NTFY_FLAGS_SID(x)   (((x)&255)<<8)
+#define PI_NTFY_GET_IDX(f)     ((f)&15)
+#define PI_NTFY_GET_SID(f)     (((f)>>8)&255)
+
+#define PI_NTFY_MAX_RECORD 16
+
 #define PI_WAVE_BLOCKS     4
 #define PI_WAVE_MAX_PULSES (PI_WAVE_BLOCKS * 3000)
 #define PI_WAVE_MAX_CHARS  (PI_WAVE_BLOCKS *  300)
+#define PI_WAVE_MAX_TRAINS 32
+
+#define PI_WAVE_STREAM_SEGS       32
+#define PI_WAVE_STREAM_SEG_PULSES 64
+
+#define PI_MAX_STEP_AXES 8
+
+/* stepProfile flags */
+
+#define PI_STEP_SCURVE 1
+
+/* wave stream info */
+
+#define PI_WAVE_STREAM_SPACE     0
+#define PI_WAVE_STREAM_QUEUED    1
+#define PI_WAVE_STREAM_SENT      2
+#define PI_WAVE_STREAM_UNDERRUNS 3
 
 #define PI_BB_I2C_MIN_BAUD     50
 #define PI_BB_I2C_MAX_BAUD 500000
@@ -554,6 +729,10 @@ typedef void *(gpioThreadFunc_t) (void *);
 #define PI_MAX_WAVE_CYCLES 16777216
 #define PI_WAVE_COUNTERS   5
 
+/* gpioWaveChainEx flags */
+
+#define PI_CHAIN_DRY_RUN   1
+
 /* wave tx mode */
 
 #define PI_WAVE_MODE_ONE_SHOT 0
@@ -633,7 +812,7 @@ typedef void *(gpioThreadFunc_t) (void *);
 #define PI_MIN_MS 10
 #define PI_MAX_MS 60000
 
-#define PI_MAX_SCRIPTS       32
+#define PI_MAX_SCRIPTS      256
 
 #define PI_MAX_SCRIPT_TAGS   50
 #define PI_MAX_SCRIPT_VARS  150
@@ -647,6 +826,19 @@ typedef void *(gpioThreadFunc_t) (void *);
 #define PI_SCRIPT_WAITING 3
 #define PI_SCRIPT_FAILED  4
 
+/* profile: 0-2 */
+
+#define PI_PROF_OFF   0
+#define PI_PROF_ON    1
+#define PI_PROF_CLEAR 2
+
+/* edge: 0-3 */
+
+#define RISING_EDGE  0
+#define FALLING_EDGE 1
+#define EITHER_EDGE  2
+#define NO_EDGE      3
+
 /* signum: 0-63 */
 
 #define PI_MIN_SIGNUM 0
@@ -1300,6 +1492,14 @@ by one for each report.
 flags, if bit 5 is set then bits 0-4 of the flags indicate a gpio
 which has had a watchdog timeout.
 
+If bit 7 (PI_NTFY_FLAGS_EVENT) is set the report was emitted by a
+running script (see the EMIT, EMITV, and EMITP script commands).
+Bits 8-15 hold the script id, bits 0-3 the position of the value
+in the record, and bit 4 (PI_NTFY_FLAGS_LAST) marks the last value
+of the record.  level holds the value and tick the time it was
+emitted.  Event reports are sent whether or not any gpio bits are
+set, so a handle may be started with bits 0 just to receive them.
+
 tick is the number of microseconds since system boot.
 
 level indicates the level of each gpio.
@@ -1354,12 +1554,64 @@ gpioNotifyClose(h);
 D*/
 
 
+/*F*/
+int gpioFifoOpen(unsigned flags);
+/*D
+This function requests a private pipe command channel.  It behaves
+like the shared /dev/pigpio and /dev/pigout pair but is served by
+its own thread, so the replies of concurrent users are never
+interleaved.
+
+. .
+flags: 0 or PI_FIFO_FLAGS_BINARY
+. .
+
+Returns a handle greater than or equal to zero if OK,
+otherwise PI_BAD_FLAGS, PI_NO_HANDLE, or PI_BAD_PATHNAME.
+
+Commands for handle x are written to /dev/pigcmdx and the replies
+are read from /dev/pigoutx.
+
+If PI_FIFO_FLAGS_BINARY is set the replies are not formatted.  Each
+command replies with its 32 bit result followed, for commands which
+return data, by the data (result bytes, or the script parameters
+for PROCP).
+
+...
+h = gpioFifoOpen(0);
+
+if (h >= 0)
+{
+   // write commands to /dev/pigcmdh, read replies from /dev/pigouth
+}
+...
+D*/
+
+
+/*F*/
+int gpioFifoClose(unsigned handle);
+/*D
+This function closes a pipe command channel and removes its pipes.
+A channel may close itself, in which case the reply to the close
+command is still written.
+
+. .
+handle: >=0, as returned by [*gpioFifoOpen*]
+. .
+
+Returns 0 if OK, otherwise PI_BAD_HANDLE.
+D*/
+
+
 /*F*/
 int gpioWaveClear(void);
 /*D
 This function clears all waveforms and any data added by calls to the
 [*gpioWaveAdd**] functions.
 
+Every waveform is cleared, including one returned by more than one
+[*gpioWaveCreateShared*] whatever the number of its creates.
+
 Returns 0 if OK.
 
 ...
@@ -1443,6 +1695,50 @@ else
 D*/
 
 
+/*F*/
+int gpioWaveAddMulti(
+   unsigned numTrains, unsigned *trainPulses, gpioPulse_t *pulses);
+/*D
+This function adds several independent pulse trains to the current
+waveform in one pass.
+
+. .
+  numTrains: 1-PI_WAVE_MAX_TRAINS, the number of pulse trains
+trainPulses: an array of numTrains pulse counts
+     pulses: the pulses of all the trains, one train after another
+. .
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_TRAIN_CNT or PI_TOO_MANY_PULSES.
+
+The result is the same as adding each train with [*gpioWaveAddGeneric*]
+except that the waveform lasts until the end of the longest train.
+Each call to gpioWaveAddGeneric merges with the whole of the existing
+waveform, so building a waveform a channel at a time takes time
+proportional to the number of channels times the number of pulses.
+This function merges the existing waveform and all the trains at once
+in time order, taking time proportional to the number of pulses.
+
+...
+// Two phase shifted square waves on gpios 4 and 17.
+
+gpioPulse_t pulse[5];
+unsigned count[2] = {2, 3};
+
+pulse[0].gpioOn = 1<<4;  pulse[0].gpioOff = 0;     pulse[0].usDelay = 20;
+pulse[1].gpioOn = 0;     pulse[1].gpioOff = 1<<4;  pulse[1].usDelay = 20;
+
+pulse[2].gpioOn = 0;     pulse[2].gpioOff = 0;     pulse[2].usDelay = 10;
+pulse[3].gpioOn = 1<<17; pulse[3].gpioOff = 0;     pulse[3].usDelay = 20;
+pulse[4].gpioOn = 0;     pulse[4].gpioOff = 1<<17; pulse[4].usDelay = 10;
+
+gpioWaveAddNew();
+
+gpioWaveAddMulti(2, count, pulse);
+...
+D*/
+
+
 /*F*/
 int gpioWaveAddSerial
    (unsigned user_gpio,
@@ -1507,6 +1803,98 @@ gpioWaveAddSerial(4, 9600, 8, 2, 1000000, MSG_LEN, data);
 D*/
 
 
+/*F*/
+int gpioWaveAddSerialMulti(unsigned numChannels, gpioSerial_t *channels);
+/*D
+This function adds serial data on several gpios to the existing
+waveform (if any) in one operation.
+
+. .
+numChannels: 1-PI_WAVE_MAX_TRAINS
+  *channels: the gpio, framing, offset, and data of each channel
+. .
+
+Each channel is as described for [*gpioWaveAddSerial*] and may have
+its own baud rate and framing.  The channels are encoded and then
+merged with the waveform together, which is much quicker than a
+[*gpioWaveAddSerial*] call per channel.
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_TRAIN_CNT, PI_BAD_POINTER, PI_BAD_USER_GPIO,
+PI_BAD_WAVE_BAUD, PI_BAD_DATABITS, PI_BAD_STOPBITS, PI_TOO_MANY_CHARS,
+PI_BAD_SER_OFFSET, or PI_TOO_MANY_PULSES.
+
+...
+gpioSerial_t ch[2]=
+{
+   {14, 9600,   8, 2, 0, 5, "Hello"},
+   {15, 115200, 8, 2, 0, 5, "world"},
+};
+
+gpioWaveAddNew();
+
+gpioWaveAddSerialMulti(2, ch);
+...
+D*/
+
+
+/*F*/
+int gpioWaveAddSteps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile);
+/*D
+This function adds the step and direction pulses of a coordinated
+stepper motor move to the existing waveform (if any).
+
+. .
+    numAxes: 1-PI_MAX_STEP_AXES
+      *axes: the step gpio, direction gpio, and steps of each axis
+*stepProfile: the speeds and acceleration of the move
+. .
+
+The axis with the most steps is moved along a speed profile which
+starts at startSpeed, accelerates at accel up to maxSpeed, and
+decelerates to finish at endSpeed.  The other axes step in proportion
+so all the axes start and finish together.  If the move is too short
+to reach maxSpeed the peak is lowered, and if the start and end
+speeds can't both be met the end speed is missed.  An accel of 0
+moves at maxSpeed throughout.
+
+The acceleration is constant (a trapezoidal profile) unless flags
+has PI_STEP_SCURVE set.  An S-curve eases into and out of each speed
+change, accel is then the steepest acceleration.
+
+A positive steps sets the axis direction gpio high, a negative steps
+sets it low.  The directions are set at the start of the move.  The
+first step follows after stepMicros, each step is a high pulse of
+stepMicros, and maxSpeed may not exceed 1000000/(2*stepMicros).
+
+Moves after one another may be joined at speed by matching the end
+speed of one with the start speed of the next.
+
+The move is 2*steps+1 pulses for the axis with the most steps.
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_STEP_AXES, PI_BAD_STEP_PROFILE, PI_BAD_USER_GPIO,
+PI_BAD_POINTER, or PI_TOO_MANY_PULSES.
+
+...
+gpioStepAxis_t axes[2]=
+{
+   {17, 27, 2000},  // step 17, direction 27, 2000 steps forward
+   {22, 23, -500},  // step 22, direction 23, 500 steps back
+};
+
+gpioStepProfile_t prof={0, 4000, 0, 8000, 10, PI_STEP_SCURVE};
+
+gpioWaveAddNew();
+
+gpioWaveAddSteps(2, axes, &prof);
+
+wid = gpioWaveCreate();
+...
+D*/
+
+
 /*F*/
 int gpioWaveCreate(void);
 /*D
@@ -1556,27 +1944,168 @@ set all the fields to zero (the pulse will be ignored).
 When a waveform is started each pulse is executed in order with the
 specified delay between the pulse and the next.
 
+The lowest free wave id is used.  If the free DMA memory is enough
+for the waveform but is not in one piece the existing waveforms are
+moved together first.  A waveform being transmitted is never moved.
+
+A run of pulses which repeats (such as a carrier burst or a repeated
+frame) is stored once and sent round a DMA counter loop, so long
+periodic waveforms need far fewer control blocks.  Pulses which read
+the gpios are never looped.  A waveform holding a loop is not moved
+to make room for later waveforms.
+
+Each create gives a waveform of its own, even if another waveform
+has exactly the same pulses.  See [*gpioWaveCreateShared*] to reuse
+an existing waveform.
+
 Returns the new waveform id if OK, otherwise PI_EMPTY_WAVEFORM,
 PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, or PI_TOO_MANY_OOL.
 D*/
 
 
+/*F*/
+int gpioWaveCreateShared(void);
+/*D
+This function creates a waveform from the added data in the same way
+as [*gpioWaveCreate*] but shares the waveform with other shared
+creates of exactly the same pulses.
+
+If a waveform with exactly the same pulses was created by this
+function and has not been deleted its id is returned and nothing is
+built, so recreating a waveform is cheap.  Each such create must be
+matched by a [*gpioWaveDelete*] before the waveform is deleted.
+
+As shared creates of the same pulses give the same id the waveform
+can't be used twice in one [*gpioWaveChain*].  Use [*gpioWaveCreate*]
+to get a waveform of its own.  [*gpioWaveClear*] clears a shared
+waveform however many creates hold it.
+
+Returns the waveform id if OK, otherwise PI_EMPTY_WAVEFORM,
+PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+D*/
+
+
+/*F*/
+int gpioWaveCreatePatchable(uint32_t bits);
+/*D
+This function creates a waveform from the added data in the same way
+as [*gpioWaveCreate*] but the levels the waveform sets on the gpios in
+bits may be changed later by [*gpioWavePatch*] without rebuilding it.
+
+. .
+bits: the gpios whose levels may be patched
+. .
+
+Each pulse which switches any of the gpios in bits is a slot.  Slots
+are numbered from 0 in the order they are sent.  A patch sets every
+gpio in bits to a new level at the start of each patched slot, the
+other gpios switched by the pulse are unchanged.
+
+This suits sending a different payload in the same frame format.  For
+instance serial data added one bit per pulse (rather than with
+[*gpioWaveAddSerial*] which merges bits of the same level) gives one
+slot per data bit.
+
+A patchable waveform is never shared with another create and its
+repeated pulses are not looped.
+
+Returns the new waveform id if OK, otherwise PI_BAD_PATCH,
+PI_EMPTY_WAVEFORM, PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, PI_TOO_MANY_OOL,
+or PI_NO_MEMORY.
+D*/
+
+
+/*F*/
+int gpioWavePatch(
+   unsigned wave_id, unsigned slot, unsigned numSlots, uint32_t *levels);
+/*D
+This function sets the levels a patchable waveform sends in numSlots
+slots starting at slot.
+
+. .
+ wave_id: >=0, as returned by [*gpioWaveCreatePatchable*]
+    slot: the first slot to patch
+numSlots: the number of slots to patch
+ *levels: the gpio levels for each slot
+. .
+
+Bit n of levels[i] is the level gpio n is set to at the start of slot
+slot+i.  Only the gpios the waveform was created patchable for are
+changed.  Only a few words of DMA memory are written so the waveform
+may be patched and resent at a high rate.
+
+The new levels take effect when the slot is next sent.  Patching a
+waveform while it is being transmitted may mix old and new levels.
+
+A numSlots of 0 patches nothing and may be used to find the number
+of slots.
+
+Returns the number of slots in the waveform if OK, otherwise
+PI_BAD_WAVE_ID or PI_BAD_PATCH.
+D*/
+
+
 /*F*/
 int gpioWaveDelete(unsigned wave_id);
 /*D
-This function deletes all created waveforms with ids greater than or
-equal to wave_id.
+This function deletes the waveform with id wave_id.
 
 . .
 wave_id: >=0, as returned by [*gpioWaveCreate*]
 . .
 
-Wave ids are allocated in order, 0, 1, 2, etc.
+Other waveforms are not affected.  The id and memory of the deleted
+waveform are reused by later calls to [*gpioWaveCreate*].  A waveform
+deleted while it is being transmitted keeps its memory until the
+transmission ends.
+
+A waveform returned by more than one [*gpioWaveCreateShared*] is only
+deleted by the last matching delete.
 
 Returns 0 if OK, otherwise PI_BAD_WAVE_ID.
 D*/
 
 
+/*F*/
+int gpioWaveLoadImage(char *buf, unsigned bufSize, unsigned *wave_ids);
+/*D
+This function loads the waveforms of an image compiled by pigwave.
+
+. .
+     buf: the image
+ bufSize: the number of bytes in the image
+wave_ids: NULL or an array with room for an id per waveform
+. .
+
+Returns the number of waveforms loaded if OK, otherwise
+PI_BAD_WAVE_IMAGE, PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS,
+PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+
+pigwave compiles pulse lists and chains of them, with loops and
+delays, into DMA control blocks and OOL words on any Linux machine.
+Loading just relocates them into the memory free between the created
+waveforms, so a large library of waveforms is ready in a few
+milliseconds.
+
+The image is checked before anything is written.  Each waveform may
+only refer to its own control blocks and OOL.
+
+The waveforms are given the lowest free ids in image order, so on a
+daemon which has no waveforms they are numbered from 0.  They may be
+sent with [*gpioWaveTxSend*], chained with [*gpioWaveChainEx*], and
+deleted like created waveforms, but are never moved to make room and
+don't share content with [*gpioWaveCreate*].
+
+...
+unsigned wid[PI_MAX_WAVES];
+
+n = gpioWaveLoadImage(image, imageSize, wid);
+
+if (n > 0) gpioWaveTxSend(wid[0], PI_WAVE_MODE_ONE_SHOT);
+...
+D*/
+
+
 /*F*/
 int gpioWaveTxStart(unsigned wave_mode); /* DEPRECATED */
 /*D
@@ -1680,6 +2209,204 @@ status = gpioWaveChain(chain, sizeof(chain));
 D*/
 
 
+/*F*/
+int gpioWaveChainEx(
+   char *buf, unsigned bufSize, unsigned chainFlags, gpioChainInfo_t *info);
+/*D
+This function compiles a chain of waveforms, loops, and delays and,
+unless a dry run is asked for, transmits it.
+
+NOTE: Any hardware PWM started by [*gpioHardwarePWM*] will be cancelled.
+
+. .
+       buf: pointer to the wave_ids and command codes
+   bufSize: the number of bytes in buf
+chainFlags: 0 or PI_CHAIN_DRY_RUN
+      info: NULL or where to put the chain's size and duration
+. .
+
+Returns 0 if OK, otherwise PI_BAD_FLAGS, PI_BAD_CHAIN_CMD,
+PI_BAD_CHAIN_LOOP, PI_BAD_REPEAT_CNT, PI_BAD_WAVE_ID, PI_TOO_MANY_CBS,
+PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+
+The whole chain is checked, and its size and duration worked out,
+before any DMA memory is touched.  With PI_CHAIN_DRY_RUN nothing
+more is done, so the cost of a chain may be found without disturbing
+a transmission in progress.
+
+Otherwise any transmission is stopped and the chain is built in the
+memory free between the created waveforms.  Each loop has its own
+counter so loops may be nested to any depth and a waveform may be
+used any number of times.  The chain's memory is released by the
+next transmission.
+
+The duration is the sum of the pulse lengths, as rounded to the
+sample period, and of the delays.  It doesn't include the 20
+microseconds with which a waveform sent by [*gpioWaveTxSend*] starts,
+the chain doesn't send them.
+
+The following command codes are supported:
+
+Name         @ Cmd & Data @ Meaning
+Loop Start   @ 255 0      @ Identify start of a wave block
+Loop Repeat  @ 255 1 x y  @ loop x + y*256 times
+Delay        @ 255 2 x y  @ delay x + y*256 microseconds
+Loop Forever @ 255 3      @ loop forever
+
+A loop count must be at least 1.  A loop forever must be the last
+command and may not be inside another loop.
+
+...
+The following examples assume that waves with ids 0 to 3 exist.
+
+// 0, 1 ms, then 1+(2, 50 us)*10 five hundred times
+char chain[] = {
+   0, 255, 2, 0xe8, 0x03,
+   255, 0,
+      1,
+      255, 0, 2, 255, 2, 50, 0, 255, 1, 10, 0,
+   255, 1, 0xf4, 0x01};
+
+gpioChainInfo_t info;
+
+status = gpioWaveChainEx(chain, sizeof(chain), PI_CHAIN_DRY_RUN, &info);
+
+if (status == 0) printf("%u cbs %llu us\n", info.cbs, info.micros);
+
+// 3 then 2 forever
+status = gpioWaveChainEx((char []){255, 0, 3, 2, 255, 3}, 6, 0, NULL);
+...
+D*/
+
+
+/*F*/
+int gpioWaveStreamStart(void);
+/*D
+This function starts streaming pulses.  Pulses queued with
+[*gpioWaveStreamWrite*] are transmitted in order, with no limit on the
+total length, while earlier pulses are still being transmitted.
+
+Returns 0 if OK, otherwise PI_TOO_MANY_CBS or PI_TOO_MANY_OOL.
+
+The stream is a ring of PI_WAVE_STREAM_SEGS segments in the waveform
+memory, each holding up to PI_WAVE_STREAM_SEG_PULSES pulses.  The DMA
+engine follows the ring from segment to segment.  Segments it has
+finished with are refilled with new pulses.
+
+Starting the stream stops any waveform being transmitted, and a
+stream which has already been started is restarted empty.  Sending a
+waveform, or [*gpioWaveTxStop*], ends the stream.  Created waveforms
+are not affected.  The DMA engine is kept busy until the stream is
+stopped so [*gpioWaveTxBusy*] returns 1.
+
+...
+gpioPulse_t pulse[2];
+int i;
+
+pulse[0].gpioOn = 1<<4; pulse[0].gpioOff = 0;    pulse[0].usDelay = 50;
+pulse[1].gpioOn = 0;    pulse[1].gpioOff = 1<<4; pulse[1].usDelay = 50;
+
+gpioWaveStreamStart();
+
+for (i=0; i<100000; i++)
+{
+   while (gpioWaveStreamWrite(2, pulse) == 0) time_sleep(0.001);
+}
+
+while (gpioWaveStreamInfo(PI_WAVE_STREAM_QUEUED) > 0) time_sleep(0.01);
+
+gpioWaveStreamStop();
+...
+D*/
+
+
+/*F*/
+int gpioWaveStreamWrite(unsigned numPulses, gpioPulse_t *pulses);
+/*D
+This function queues pulses to be transmitted after those already
+queued on the stream.
+
+. .
+numPulses: the number of pulses
+   pulses: an array of pulses
+. .
+
+Returns the number of pulses queued if OK, otherwise PI_NO_WAVE_STREAM.
+
+Fewer than numPulses pulses are queued if the ring is full.  The rest
+should be written again once the DMA engine has made room.  Each call
+starts a new segment, so pulses are best written in blocks rather
+than one at a time.
+
+Each pulse switches its gpios on and off and then waits usDelay
+microseconds, as for [*gpioWaveAddGeneric*].  The stream's pulses
+are not merged with each other.
+
+If the DMA engine runs out of queued pulses, the gpios hold their
+levels until more are written and an underrun is counted.
+D*/
+
+
+/*F*/
+int gpioWaveStreamInfo(unsigned item);
+/*D
+This function returns information about the stream.
+
+. .
+item: 0-3
+. .
+
+The following items may be requested.
+
+. .
+PI_WAVE_STREAM_SPACE     the pulses which may be queued now
+PI_WAVE_STREAM_QUEUED    the pulses queued but not yet transmitted
+PI_WAVE_STREAM_SENT      the pulses transmitted since the start
+PI_WAVE_STREAM_UNDERRUNS the times the DMA engine ran out of pulses
+. .
+
+Returns the requested item if OK, otherwise PI_NO_WAVE_STREAM or
+PI_BAD_STREAM_INFO.
+
+The pulses of a segment are counted as transmitted when the DMA
+engine has moved on to the next segment.
+D*/
+
+
+/*F*/
+int gpioWaveStreamSteps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile);
+/*D
+This function queues the pulses of a coordinated stepper motor move
+on the wave stream.
+
+. .
+    numAxes: 1-PI_MAX_STEP_AXES
+      *axes: the step gpio, direction gpio, and steps of each axis
+*stepProfile: the speeds and acceleration of the move
+. .
+
+The move is generated as described for [*gpioWaveAddSteps*].  The
+whole move is queued or none of it is.  A move needs 2*steps+1
+pulses of stream space for the axis with the most steps, longer
+moves may be split into parts joined at speed.
+
+Returns the number of pulses queued if OK, otherwise
+PI_NO_WAVE_STREAM, PI_STREAM_FULL, PI_BAD_STEP_AXES,
+PI_BAD_STEP_PROFILE, PI_BAD_USER_GPIO, or PI_BAD_POINTER.
+D*/
+
+
+/*F*/
+int gpioWaveStreamStop(void);
+/*D
+This function stops the stream.  Any pulses still queued are not
+transmitted.  The stream's waveform memory is released.
+
+Returns 0 if OK, otherwise PI_NO_WAVE_STREAM.
+D*/
+
+
 /*F*/
 int gpioWaveTxBusy(void);
 /*D
@@ -1771,6 +2498,26 @@ control blocks.
 D*/
 
 
+/*F*/
+int gpioWaveGetFreeCbs(void);
+/*D
+This function returns the number of DMA control blocks not used by
+created waveforms.
+D*/
+
+
+/*F*/
+int gpioWaveGetLargestFreeCbs(void);
+/*D
+This function returns the largest number of contiguous DMA control
+blocks not used by created waveforms.
+
+A value well below that returned by [*gpioWaveGetFreeCbs*] means the
+free control blocks are fragmented.  [*gpioWaveCreate*] compacts the
+waveforms when it needs to.
+D*/
+
+
 /*F*/
 int gpioSerialReadOpen(unsigned user_gpio, unsigned baud, unsigned data_bits);
 /*D
@@ -2894,6 +3641,11 @@ script: the text of the script
 
 The function returns a script id if the script is valid,
 otherwise PI_BAD_SCRIPT.
+
+Compiled scripts are cached by their text.  Storing a script whose
+text is identical to one stored earlier reuses the compiled code
+but still returns a new script id, with its own parameters and run
+state, which must be deleted separately.  See [*gpioCfgScriptCache*].
 D*/
 
 
@@ -2913,6 +3665,43 @@ PI_TOO_MANY_PARAM.
 
 param is an array of up to 10 parameters which may be referenced in
 the script as p0 to p9.
+
+Running scripts share a small pool of threads.  A script gives up
+its thread while in WAIT or in a MILS or MICS delay, and after every
+thousand jumps or calls, so any number of scripts may be running.
+
+A script may push results to a client as they are produced rather
+than the client polling [*gpioScriptStatus*].  EMIT h x sends the
+value x, EMITV h n sends v0 to v(n-1), and EMITP h n sends p0 to
+p(n-1), as event reports on notification handle h (see
+[*gpioNotifyBegin*]).  A record holds at most 16 values (10 for
+EMITP as there are only 10 parameters).  A is set
+to 0, or to PI_BAD_HANDLE if h is not started, PI_BAD_EVENT_CNT, or
+PI_NOTIFY_FULL if the client has fallen behind.
+
+A WAIT ends as soon as the alert thread finds a change on one of
+its gpios, before any callbacks or notifications for the same
+samples.  A and F are set to the gpios which changed.  WTICK sets
+A and F to the tick of that change and WLEV to the levels of gpios
+0-31 just after it, so TICK less WTICK is the wake latency.
+
+Block commands work on A bytes of the script buffer (the buffer used
+by LDAB, STAB, and commands which return data) at native speed.
+
+. .
+BMOV d s    copy bytes from offset s to offset d
+BCMP d s    A = F = 0 if the bytes at d and s match, else 1 or -1
+BXOR s      A = F = the XOR of the bytes at s
+BCRC8 s x   A = F = CRC-8 of the bytes at s, x = poly + (init<<8)
+BCRC16 s x  A = F = CRC-16 of the bytes at s, x = poly + (init<<16)
+BLDB r s    r = the 1-4 bytes at s, most significant first
+BLDL r s    r = the 1-4 bytes at s, least significant first
+. .
+
+The CRCs are computed most significant bit first with no final XOR,
+e.g. BCRC8 s 0xFF31 for Sensirion sensors or BCRC16 s 0xFFFF1021 for
+CRC-16/CCITT-FALSE.  A is set to PI_BAD_BUF_RANGE if the bytes
+do not lie within the buffer.
 D*/
 
 
@@ -2944,6 +3733,102 @@ The current value of script parameters 0 to 9 are returned in param.
 D*/
 
 
+/*F*/
+int gpioScriptTrigger(unsigned script_id, unsigned gpio, unsigned edge);
+/*D
+This function binds a stored script to an edge on a gpio.  The
+script is started by the gpio sampling thread as soon as the edge
+is seen, without any client involvement.
+
+. .
+script_id: >=0, as returned by [*gpioStoreScript*]
+     gpio: 0-31
+     edge: RISING_EDGE, FALLING_EDGE, EITHER_EDGE, or NO_EDGE
+. .
+
+The function returns 0 if OK, otherwise PI_BAD_SCRIPT_ID,
+PI_BAD_USER_GPIO, PI_BAD_EDGE, or PI_NO_MEMORY.
+
+When started by an edge the script parameters are set as follows.
+
+. .
+p0: the gpio
+p1: the new level (0 or 1)
+p2: the tick of the edge
+. .
+
+Edges which occur while the script is running are ignored.  A
+script has at most one trigger, NO_EDGE removes it.  Edges are
+detected in the gpio samples so the script is normally started
+within a millisecond of the edge.
+
+...
+s = gpioStoreScript("w 17 1 mics 100 w 17 0");
+gpioScriptTrigger(s, 4, RISING_EDGE); // pulse gpio 17 on gpio 4 rising
+...
+D*/
+
+
+/*F*/
+int gpioScriptProfile(unsigned script_id, unsigned profile);
+/*D
+This function starts, stops, or clears the profiling of a stored
+script.  The script may be running.
+
+. .
+script_id: >=0, as returned by [*gpioStoreScript*]
+  profile: PI_PROF_OFF, PI_PROF_ON, or PI_PROF_CLEAR
+. .
+
+The function returns 0 if OK, otherwise PI_BAD_SCRIPT_ID,
+PI_BAD_PROF_MODE, or PI_NO_MEMORY.
+
+While profiling is on every instruction the script executes is
+counted and timed, see [*gpioScriptGetProfile*].  Profiling starts
+or stops the next time a running script gives up its thread, i.e.
+within a thousand jumps or at its next WAIT or delay.  A script
+which is not being profiled runs at full speed.
+
+PI_PROF_CLEAR zeroes the counts without changing whether profiling
+is on.
+D*/
+
+
+/*F*/
+int gpioScriptGetProfile(
+   unsigned script_id, gpioScriptProf_t *prof, unsigned maxProf);
+/*D
+This function returns the profile of a stored script.
+
+. .
+script_id: >=0, as returned by [*gpioStoreScript*]
+     prof: an array to receive the profile
+  maxProf: the number of entries in prof
+. .
+
+The function returns the number of entries copied to prof, otherwise
+PI_BAD_SCRIPT_ID.  Only instructions which have been executed at
+least once are returned.
+
+Each entry gives the step (the index of the instruction in the
+compiled script, see [*rawDumpScript*]), its command, the number of
+times it was executed, and the time spent executing it.
+
+The steps are those of the optimised script.  The optimiser threads
+jumps, folds constant arithmetic, removes unreachable steps and
+redundant LDA/STA, and fuses a CMP or DCR with the conditional jump
+after it (commands 900-904), so a step need not be the instruction
+at the same position in the script text.  pigs PARSE reports how a
+script was optimised.  The time
+of a command step is the time spent in the command.  WAIT, MILS,
+and MICS steps also report the time the script was blocked.
+
+Times are measured with the microsecond tick so the time of a step
+which executes much faster than a microsecond is an estimate,
+though its share of the total is accurate over many executions.
+D*/
+
+
 /*F*/
 int gpioStopScript(unsigned script_id);
 /*D
@@ -3316,6 +4201,53 @@ Returns the pigpio version.
 D*/
 
 
+/*F*/
+int gpioCmdStats(gpioCmdStats_t *stats, unsigned maxStats);
+/*D
+Returns the call counts and execution times of the commands
+received through the socket and pipe interfaces and from scripts.
+
+. .
+   stats: an array to receive the statistics
+maxStats: the number of entries in stats
+. .
+
+Returns the number of entries copied to stats.  Only commands which
+have been executed at least once are returned.
+
+The statistics are gathered for every command and cost a couple of
+tick reads and counter updates per command.
+
+The execution time histogram execHist is indexed by the number of
+significant bits in the execution time in microseconds.  Slot 0
+counts commands taking less than a microsecond, slot 1 one
+microsecond, slot 2 two to three microseconds, slot 3 four to seven
+microseconds, and so on.  The last slot counts everything longer.
+
+...
+gpioCmdStats_t stats[100];
+int i, n;
+
+n = gpioCmdStats(stats, 100);
+
+for (i=0; i<n; i++)
+{
+   printf("cmd %d calls %d max %d\n",
+      stats[i].cmd, stats[i].calls, stats[i].maxMicros);
+}
+...
+D*/
+
+
+/*F*/
+int gpioCmdStatsReset(void);
+/*D
+Clears the statistics returned by [*gpioCmdStats*].
+
+Returns 0 if OK.
+D*/
+
+
 /*F*/
 int gpioCfgBufferSize(unsigned cfgMillis);
 /*D
@@ -3480,6 +4412,28 @@ Auto will use the mailbox method unless a larger than default buffer
 size is requested with [*gpioCfgBufferSize*].
 D*/
 
+/*F*/
+int gpioCfgScriptCache(char *path);
+/*D
+Configures a file in which compiled scripts are kept between runs.
+
+. .
+path: the cache file name, "" to disable
+. .
+
+Returns 0 if OK, otherwise PI_BAD_CACHE_PATH.
+
+The cache is read at [*gpioInitialise*].  Each script stored by
+[*gpioStoreScript*] whose text is not already cached is compiled
+and appended to the file.  Later stores of the same text skip the
+compile step.
+
+Unreadable or stale (different library version) cache contents are
+discarded.
+
+The default setting is no cache file.  pigpiod uses PI_SCRIPT_CACHE.
+D*/
+
 /*F*/
 int gpioCfgInternals(unsigned cfgWhat, int cfgVal);
 /*D
@@ -3766,6 +4720,9 @@ meaning is defined by the customiser.
 argc::
 The count of bytes passed to a user customised function.
 
+*axes::
+An array of [*gpioStepAxis_t*] structures, one per stepper motor axis.
+
 *argx::
 A pointer to an array of bytes passed to a user customised function.
 Its meaning and content is defined by the customiser.
@@ -3836,6 +4793,14 @@ A number specifying a configuration item.
 562484977: print enhanced statistics at termination. 
 984762879: set the initial debug level.
 
+chainFlags::
+. .
+PI_CHAIN_DRY_RUN 1
+. .
+
+*channels::
+An array of [*gpioSerial_t*] structures, one per serial channel.
+
 char::
 
 A single character, an 8 bit quantity able to store 0-255.
@@ -3881,10 +4846,23 @@ A number representing the ratio of on time to off time for PWM.
 The number may vary between 0 and range (default 255) where
 0 is off and range is fully on.
 
+edge::0-3
+. .
+RISING_EDGE  0
+FALLING_EDGE 1
+EITHER_EDGE  2
+NO_EDGE      3
+. .
+
 f::
 
 A function.
 
+flags::
+. .
+PI_FIFO_FLAGS_BINARY 1
+. .
+
 frequency::0-
 
 The number of times a gpio is swiched on and off per second.  This
@@ -3945,7 +4923,33 @@ One of
 [*gpioCfgInterfaces*] 
 [*gpioCfgInternals*] 
 [*gpioCfgSocketPort*] 
-[*gpioCfgMemAlloc*]
+[*gpioCfgMemAlloc*] 
+[*gpioCfgScriptCache*]
+
+gpioChainInfo_t::
+. .
+typedef struct
+{
+   uint32_t cbs;
+   uint32_t ool;
+   uint32_t loops;
+   uint32_t forever;
+   uint64_t micros;
+} gpioChainInfo_t;
+. .
+
+gpioCmdStats_t::
+. .
+typedef struct
+{
+   uint32_t cmd;
+   uint32_t calls;
+   uint32_t errors;
+   uint32_t maxMicros;
+   uint64_t totalMicros;
+   uint32_t execHist[PI_CMD_STATS_BUCKETS];
+} gpioCmdStats_t;
+. .
 
 gpioGetSamplesFunc_t::
 . .
@@ -3978,6 +4982,33 @@ typedef struct
 } gpioSample_t;
 . .
 
+gpioScriptProf_t::
+. .
+typedef struct
+{
+   uint32_t step;
+   uint32_t cmd;
+   uint32_t count;
+   uint32_t reserved;
+   uint64_t micros;
+   uint64_t blockMicros;
+} gpioScriptProf_t;
+. .
+
+gpioSerial_t::
+. .
+typedef struct
+{
+   uint32_t gpio;
+   uint32_t baud;
+   uint32_t dataBits;
+   uint32_t stopBits;   // half bits
+   uint32_t offset;
+   uint32_t numBytes;
+   char    *bstr;
+} gpioSerial_t;
+. .
+
 gpioSignalFunc_t::
 . .
 typedef void (*gpioSignalFunc_t) (int signum);
@@ -3988,6 +5019,29 @@ gpioSignalFuncEx_t::
 typedef void (*gpioSignalFuncEx_t) (int signum, void *userdata);
 . .
 
+gpioStepAxis_t::
+. .
+typedef struct
+{
+   uint32_t stepGpio;
+   uint32_t dirGpio;
+   int32_t  steps;      // the sign sets the direction
+} gpioStepAxis_t;
+. .
+
+gpioStepProfile_t::
+. .
+typedef struct
+{
+   uint32_t startSpeed; // steps per second
+   uint32_t maxSpeed;
+   uint32_t endSpeed;
+   uint32_t accel;      // steps per second per second
+   uint32_t stepMicros; // step pulse and direction setup
+   uint32_t flags;      // PI_STEP_SCURVE
+} gpioStepProfile_t;
+. .
+
 gpioThreadFunc_t::
 . .
 typedef void *(gpioThreadFunc_t) (void *);
@@ -4017,6 +5071,7 @@ A number referencing an object opened by one of
 
 [*i2cOpen*] 
 [*gpioNotifyOpen*] 
+[*gpioFifoOpen*] 
 [*serOpen*] 
 [*spiOpen*]
 
@@ -4044,12 +5099,18 @@ PI_DISABLE_SOCK_IF 2
 *inBuf::
 A buffer used to pass data to a function.
 
+*info::
+Where to put the size and duration of a compiled chain.
+
 inLen::
 The number of bytes of data in a buffer.
 
 int::
 A whole number, negative or positive.
 
+item:: 0-3
+The item of wave stream information wanted.
+
 level::
 The level of a gpio.  Low or High.
 
@@ -4071,11 +5132,21 @@ reported as PI_TIMEOUT.  See [*gpioSetWatchdog*].
 PI_TIMEOUT 2
 . .
 
+*levels::
+An array of gpio levels, one 32 bit word per waveform slot.  Bit n
+is the level of gpio n.
+
 
 lVal::0-4294967295 (Hex 0x0-0xFFFFFFFF, Octal 0-37777777777)
 
 A 32-bit word value.
 
+maxProf::
+The number of [*gpioScriptProf_t*] entries which may be returned.
+
+maxStats::
+The number of [*gpioCmdStats_t*] entries which may be returned.
+
 memAllocMode:: 0-2
 
 The DMA memory allocation mode.
@@ -4113,6 +5184,9 @@ PI_ALT4 3
 PI_ALT5 2
 . .
 
+numAxes:: 1-PI_MAX_STEP_AXES
+The number of stepper motor axes in a move.
+
 numBits::
 
 The number of bits stored in a buffer.
@@ -4122,15 +5196,24 @@ The number of bytes used to store characters in a string.  Depending
 on the number of bits per character there may be 1, 2, or 4 bytes
 per character.
 
+numChannels:: 1-PI_WAVE_MAX_TRAINS
+The number of serial channels to add to a waveform.
+
 numPar:: 0-10
 The number of parameters passed to a script.
 
 numPulses::
-The number of pulses to be added to a waveform.
+The number of pulses to be added to a waveform or stream.
+
+numTrains:: 1-PI_WAVE_MAX_TRAINS
+The number of pulse trains to be merged into a waveform.
 
 numSegs::
 The number of segments in a combined I2C transaction.
 
+numSlots::
+The number of patchable waveform slots.
+
 offset::
 The associated data starts this number of microseconds from the start of
 the waveform.
@@ -4165,6 +5248,16 @@ primaryChannel:: 0-14
 The DMA channel used to time the sampling of gpios and to time servo and
 PWM pulses.
 
+*prof::
+An array of [*gpioScriptProf_t*] structures.
+
+profile::0-2
+. .
+PI_PROF_OFF   0
+PI_PROF_ON    1
+PI_PROF_CLEAR 2
+. .
+
 *pth::
 
 A thread identifier, returned by [*gpioStartThread*].
@@ -4189,7 +5282,11 @@ pulseLen::
 
 *pulses::
 
-An array of pulses to be added to a waveform.
+An array of pulses to be added to a waveform or stream.
+
+*trainPulses::
+
+An array holding the number of pulses in each pulse train.
 
 pulsewidth::0, 500-2500
 . .
@@ -4334,6 +5431,10 @@ size_t::
 
 A standard type used to indicate the size of an object in bytes.
 
+slot::
+A patchable waveform slot, from 0 for the first pulse which switches
+a patchable gpio.
+
 *spi::
 A pointer to a [*rawSPI_t*] structure.
 
@@ -4359,6 +5460,13 @@ The SPI slave select gpio in a raw SPI transaction.
 spiTxBits::
 The number of bits to transfer dring a raw SPI transaction
 
+*stats::
+An array of [*gpioCmdStats_t*] structures.
+
+*stepProfile::
+A pointer to a [*gpioStepProfile_t*] structure giving the speeds and
+acceleration of a stepper motor move.
+
 stop_bits::2-8
 The number of (half) stop bits to be used when adding serial data
 to a waveform.
@@ -4430,6 +5538,10 @@ wave_id::
 
 A number representing a waveform created by [*gpioWaveCreate*].
 
+*wave_ids::
+
+An array of waveform ids.
+
 wave_mode::
 
 The mode of waveform transmission, whether it is sent once or cycles
@@ -4552,8 +5664,43 @@ PARAMS*/
 
 #define PI_CMD_WVCHA 93
 
+#define PI_CMD_CSTAT  94
+#define PI_CMD_CSTATZ 95
+
+#define PI_CMD_SPIXS 96
+#define PI_CMD_SERRS 97
+#define PI_CMD_WVAGS 98
+
 #define PI_CMD_NOIB  99
 
+#define PI_CMD_FO   100
+#define PI_CMD_FC   101
+
+#define PI_CMD_PROCE 102
+#define PI_CMD_PROCF 103
+#define PI_CMD_PROCFG 104
+
+#define PI_CMD_WVAGM 105
+
+#define PI_CMD_WVSTR 106
+#define PI_CMD_WVSTW 107
+#define PI_CMD_WVSTI 108
+#define PI_CMD_WVSTH 109
+
+#define PI_CMD_WVCRP 110
+#define PI_CMD_WVPAT 111
+
+#define PI_CMD_WVAST 112
+#define PI_CMD_WVSTS 113
+
+#define PI_CMD_WVASM 114
+
+#define PI_CMD_WVCHX 115
+
+#define PI_CMD_WVLDI 116
+
+#define PI_CMD_WVCRS 117
+
 /*DEF_E*/
 
 /*
@@ -4566,6 +5713,43 @@ The socket should be dedicated to receiving notifications
 after this command is issued.
 */
 
+/*
+PI_CMD_SPIXS, PI_CMD_SERRS, and PI_CMD_WVAGS only work on the
+socket interface.  They stream a transfer of any length through
+the daemon in PI_STREAM_CHUNK sized pieces.
+
+The request is cmd, p1 (handle, 0 for WVAGS), p2 (total bytes),
+with a 4 byte extension (SPIXS: PI_STREAM_TX/PI_STREAM_RX flags,
+SERRS: idle timeout in milliseconds, WVAGS: 0).
+
+The daemon replies with a header whose result is the chunk size,
+or a negative error in which case the stream is over.
+
+Each chunk (the last may be short) is then acknowledged with a
+header of cmd, p1, byte offset, result.  For SPIXS with
+PI_STREAM_TX and for WVAGS the client sends the chunk data before
+the daemon acknowledges it.  For SPIXS with PI_STREAM_RX and for
+SERRS result bytes of data follow the acknowledgement.
+
+A client may send several chunks ahead of their acknowledgements
+(flow control is provided by TCP).  SPI chip select is held for
+the whole SPIXS transfer.  A SERRS stream ends early with a short
+chunk if no data arrives within the idle timeout.  WVAGS appends
+each chunk of pulses after the pulses already streamed and
+acknowledges with the total pulses in the waveform.
+
+An SPIXS client which leaves the daemon waiting to receive or send
+a chunk for more than PI_STREAM_TIMEOUT milliseconds has the
+transfer aborted, chip select released, and its socket closed.
+*/
+
+#define PI_STREAM_CHUNK 12288
+
+#define PI_STREAM_TIMEOUT 1000
+
+#define PI_STREAM_TX 1
+#define PI_STREAM_RX 2
+
 /* pseudo commands */
 
 #define PI_CMD_SCRIPT 800
@@ -4612,6 +5796,18 @@ after this command is issued.
 #define PI_CMD_X     839
 #define PI_CMD_XA    840
 #define PI_CMD_XOR   841
+#define PI_CMD_EMIT  842
+#define PI_CMD_EMITV 843
+#define PI_CMD_EMITP 844
+#define PI_CMD_BCMP  845
+#define PI_CMD_BCRC8 846
+#define PI_CMD_BCRC16 847
+#define PI_CMD_BLDB  848
+#define PI_CMD_BLDL  849
+#define PI_CMD_BMOV  850
+#define PI_CMD_BXOR  851
+#define PI_CMD_WTICK 852
+#define PI_CMD_WLEV  853
 
 /*DEF_S Error Codes*/
 
@@ -4734,6 +5930,22 @@ after this command is issued.
 #define PI_TOO_MANY_COUNTS -115 // too many chain counters
 #define PI_BAD_CHAIN_CMD   -116 // malformed chain command string
 #define PI_REUSED_WID      -117 // wave already used in chain
+#define PI_BAD_STREAM      -118 // bad streamed transfer length or flags
+#define PI_BAD_CACHE_PATH  -119 // bad script cache path
+#define PI_BAD_EDGE        -120 // edge not 0-3
+#define PI_NOTIFY_FULL     -121 // notification event queue full
+#define PI_BAD_EVENT_CNT   -122 // event record not 1-16 values
+#define PI_BAD_BUF_RANGE   -123 // script buffer offset or length too big
+#define PI_BAD_PROF_MODE   -124 // script profile mode not 0-2
+#define PI_BAD_TRAIN_CNT   -125 // bad number of pulse trains or pulses
+#define PI_NO_WAVE_STREAM  -126 // the wave stream isn't running
+#define PI_BAD_STREAM_INFO -127 // wave stream info item not 0-3
+#define PI_BAD_PATCH       -128 // wave not patchable or bad slots
+#define PI_BAD_STEP_AXES   -129 // bad number of stepper axes or steps
+#define PI_BAD_STEP_PROFILE -130 // bad stepper speeds or step micros
+#define PI_STREAM_FULL     -131 // not enough wave stream space
+#define PI_BAD_CHAIN_LOOP  -132 // chain loop not closed or badly placed
+#define PI_BAD_WAVE_IMAGE  -133 // wave image malformed or for another version
 
 #define PI_PIGIF_ERR_0    -2000
 #define PI_PIGIF_ERR_99   -2099
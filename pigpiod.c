@@ -61,6 +61,10 @@ static uint64_t updateMask             = -1;
 
 static int updateMaskSet = 0;
 
+static char *scriptCache = PI_SCRIPT_CACHE;
+
+static char *waveImage = NULL;
+
 static FILE * errFifo;
 
 void fatal(char *fmt, ...)
@@ -85,6 +89,7 @@ void usage()
       "Usage: sudo pigpiod [OPTION] ...\n" \
       "   -a value, DMA mode, 0=AUTO, 1=PMAP, 2=MBOX,   default AUTO\n" \
       "   -b value, gpio sample buffer in milliseconds, default 120\n" \
+      "   -c file,  compiled script cache, \"\" for none, default %s\n" \
       "   -d value, primary DMA channel, 0-14,          default 14\n" \
       "   -e value, secondary DMA channel, 0-6,         default 5\n" \
       "   -f,       disable fifo interface,             default enabled\n" \
@@ -92,12 +97,13 @@ void usage()
       "   -p value, socket port, 1024-32000,            default 8888\n" \
       "   -s value, sample rate, 1, 2, 4, 5, 8, or 10,  default 5\n" \
       "   -t value, clock peripheral, 0=PWM 1=PCM,      default PCM\n" \
+      "   -w file,  waveforms compiled by pigwave,      default none\n" \
       "   -x mask,  gpios which may be updated,         default board user gpios\n" \
       "EXAMPLE\n" \
       "sudo pigpiod -s 2 -b 200 -f\n" \
       "  Set a sample rate of 2 microseconds with a 200 millisecond\n" \
       "  buffer.  Disable the fifo interface.\n" \
-   "\n");
+   "\n", PI_SCRIPT_CACHE);
 }
 
 static void initOpts(int argc, char *argv[])
@@ -106,7 +112,7 @@ static void initOpts(int argc, char *argv[])
    uint64_t mask;
    char * endptr;
 
-   while ((opt = getopt(argc, argv, "a:b:d:e:fkp:s:t:x:")) != -1)
+   while ((opt = getopt(argc, argv, "a:b:c:d:e:fkp:s:t:w:x:")) != -1)
    {
       i = -1;
 
@@ -126,6 +132,11 @@ static void initOpts(int argc, char *argv[])
             else fatal("invalid -b option (%d)", i);
             break;
 
+         case 'c':
+            if (strlen(optarg) < 256) scriptCache = optarg;
+            else fatal("invalid -c option (%s)", optarg);
+            break;
+
          case 'd':
             i = atoi(optarg);
             if ((i >= PI_MIN_DMA_CHANNEL) && (i <= PI_MAX_PRIMARY_CHANNEL))
@@ -182,6 +193,10 @@ static void initOpts(int argc, char *argv[])
             else fatal("invalid -t option (%d)", i);
             break;
 
+         case 'w':
+            waveImage = optarg;
+            break;
+
          case 'x':
             mask = strtoll(optarg, &endptr, 0);
             if (!*endptr)
@@ -199,6 +214,37 @@ static void initOpts(int argc, char *argv[])
     }
 }
 
+static void loadWaves(char *name)
+{
+   FILE *f;
+   char *buf;
+   long size;
+   int n;
+
+   /* waves loaded at start get ids from 0 in image order */
+
+   f = fopen(name, "rb");
+
+   if (f == NULL) fatal("can't open wave image %s (%m)", name);
+
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   buf = malloc(size);
+
+   if ((buf == NULL) || (fread(buf, 1, size, f) != size))
+      fatal("can't read wave image %s", name);
+
+   fclose(f);
+
+   n = gpioWaveLoadImage(buf, size, NULL);
+
+   free(buf);
+
+   if (n < 0) fatal("can't load wave image %s (%d)", name, n);
+}
+
 void terminate(int signum)
 {
    /* only registered for SIGHUP/SIGTERM */
@@ -271,12 +317,16 @@ int main(int argc, char **argv)
 
    gpioCfgMemAlloc(memAllocMode);
 
+   gpioCfgScriptCache(scriptCache);
+
    if (updateMaskSet) gpioCfgPermissions(updateMask);
 
    /* start library */
 
    if (gpioInitialise()< 0) fatal("Can't initialise pigpio library");
 
+   if (waveImage) loadWaves(waveImage);
+
    /* create pipe for error reporting */
 
    unlink(PI_ERRFIFO);
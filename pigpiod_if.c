@@ -56,6 +56,8 @@ For more information, please refer to <http://unlicense.org/>
 
 #define STACK_SIZE (256*1024)
 
+#define STREAM_WINDOW 4 /* chunks sent ahead of their acknowledgement */
+
 typedef void (*CBF_t) ();
 
 struct callback_s
@@ -67,6 +69,7 @@ struct callback_s
    CBF_t f;
    void * user;
    int ex;
+   int event; /* gpio holds a script id */
    callback_t *prev;
    callback_t *next;
 };
@@ -80,6 +83,7 @@ static int gPigHandle = -1;
 static int gPigNotify = -1;
 
 static uint32_t gNotifyBits;
+static int gNotifyBegun = 0;
 
 callback_t *gCallBackFirst = 0;
 callback_t *gCallBackLast = 0;
@@ -160,6 +164,131 @@ static int pigpio_command_ext
    return cmd.res;
 }
 
+int recvMax(void *buf, int bufsize, int sent)
+{
+   uint8_t scratch[4096];
+   int remaining, fetch, count;
+
+   if (sent < bufsize) count = sent; else count = bufsize;
+
+   if (count) recv(gPigCommand, buf, count, MSG_WAITALL);
+
+   remaining = sent - count;
+
+   while (remaining)
+   {
+      fetch = remaining;
+      if (fetch > sizeof(scratch)) fetch = sizeof(scratch);
+      recv(gPigCommand, scratch, fetch, MSG_WAITALL);
+      remaining -= fetch;
+   }
+
+   return count;
+}
+
+static int pigpio_stream(
+   int command, int p1, unsigned count, uint32_t arg,
+   char *txBuf, char *rxBuf, int *last)
+{
+   cmdCmd_t cmd;
+   unsigned chunk, sent, acked, n;
+   int bytes, err;
+
+   cmd.cmd = command;
+   cmd.p1  = p1;
+   cmd.p2  = count;
+   cmd.p3  = 4;
+
+   pthread_mutex_lock(&command_mutex);
+
+   if ((send(gPigCommand, &cmd, sizeof(cmd), 0) != sizeof(cmd)) ||
+       (send(gPigCommand, &arg, 4, 0) != 4))
+   {
+      pthread_mutex_unlock(&command_mutex);
+      return pigif_bad_send;
+   }
+
+   if (recv(gPigCommand, &cmd, sizeof(cmd), MSG_WAITALL) != sizeof(cmd))
+   {
+      pthread_mutex_unlock(&command_mutex);
+      return pigif_bad_recv;
+   }
+
+   if ((int)cmd.res < 0)
+   {
+      pthread_mutex_unlock(&command_mutex);
+      return cmd.res;
+   }
+
+   chunk = cmd.res;
+
+   sent  = 0;
+   acked = 0;
+   bytes = 0;
+   err   = 0;
+
+   while (acked < count)
+   {
+      /* keep a few chunks in flight to hide the round trip */
+
+      while (txBuf && (sent < count) && ((sent-acked) < STREAM_WINDOW*chunk))
+      {
+         n = count - sent;
+         if (n > chunk) n = chunk;
+
+         if (send(gPigCommand, txBuf+sent, n, 0) != n)
+         {
+            pthread_mutex_unlock(&command_mutex);
+            return pigif_bad_send;
+         }
+
+         sent += n;
+      }
+
+      n = count - acked;
+      if (n > chunk) n = chunk;
+
+      if (recv(gPigCommand, &cmd, sizeof(cmd), MSG_WAITALL) != sizeof(cmd))
+      {
+         pthread_mutex_unlock(&command_mutex);
+         return pigif_bad_recv;
+      }
+
+      if ((int)cmd.res < 0)
+      {
+         if (!err) err = cmd.res;
+      }
+      else
+      {
+         if (rxBuf && cmd.res)
+         {
+            if (recv(gPigCommand, rxBuf+acked, cmd.res, MSG_WAITALL) !=
+               cmd.res)
+            {
+               pthread_mutex_unlock(&command_mutex);
+               return pigif_bad_recv;
+            }
+
+            bytes += cmd.res;
+         }
+
+         if (last) *last = cmd.res;
+      }
+
+      /* a short serial chunk ends the stream */
+
+      if ((command == PI_CMD_SERRS) && ((int)cmd.res < (int)n)) break;
+
+      acked += n;
+   }
+
+   pthread_mutex_unlock(&command_mutex);
+
+   if (err) return err;
+
+   return bytes;
+}
+
 static int pigpioOpenSocket(char *addr, char *port)
 {
    int sock, err, opt;
@@ -241,7 +370,7 @@ static void dispatch_notification(gpioReport_t *r)
 
       while (p)
       {
-         if (changed & (1<<(p->gpio)))
+         if ((!p->event) && (changed & (1<<(p->gpio))))
          {
             if ((r->level) & (1<<(p->gpio))) l = 1; else l = 0;
             if ((p->edge) ^ l)
@@ -253,7 +382,20 @@ static void dispatch_notification(gpioReport_t *r)
          p = p->next;
       }
    }
-   else
+   else if (r->flags & PI_NTFY_FLAGS_EVENT)
+   {
+      g = PI_NTFY_GET_SID(r->flags);
+
+      p = gCallBackFirst;
+
+      while (p)
+      {
+         if ((p->event) && ((p->gpio) == g))
+            (p->f)(g, PI_NTFY_GET_IDX(r->flags), r->level, r->tick, p->user);
+         p = p->next;
+      }
+   }
+   else if (r->flags & PI_NTFY_FLAGS_WDOG)
    {
       g = (r->flags) & 31;
 
@@ -261,7 +403,7 @@ static void dispatch_notification(gpioReport_t *r)
 
       while (p)
       {
-         if ((p->gpio) == g)
+         if ((!p->event) && ((p->gpio) == g))
          {
             if (p->ex) (p->f)(g, PI_TIMEOUT, r->tick, p->user);
             else       (p->f)(g, PI_TIMEOUT, r->tick);
@@ -306,18 +448,23 @@ static void findNotifyBits(void)
 {
    callback_t *p;
    uint32_t bits = 0;
+   int events = 0;
 
    p = gCallBackFirst;
 
    while (p)
    {
-      bits |= (1<<(p->gpio));
+      if (p->event) events = 1;
+      else bits |= (1<<(p->gpio));
       p = p->next;
    }
 
-   if (bits != gNotifyBits)
+   /* script events need the handle started even with no gpios */
+
+   if ((bits != gNotifyBits) || (events && !gNotifyBegun))
    {
       gNotifyBits = bits;
+      gNotifyBegun = 1;
       pigpio_command(gPigCommand, PI_CMD_NB, gPigHandle, gNotifyBits, 1);
    }
 }
@@ -327,12 +474,14 @@ static void _wfe(unsigned user_gpio, unsigned level, uint32_t tick, void *user)
    *(int *)user = 1;
 }
 
-static int intCallback(unsigned user_gpio, unsigned edge, void *f, void *user, int ex)
+static int intCallback(unsigned user_gpio, unsigned edge, void *f, void *user,
+   int ex, int event)
 {
    static int id = 0;
    callback_t *p;
 
-   if ((user_gpio >=0) && (user_gpio < 32) && (edge >=0) && (edge <= 2) && f)
+   if (event ? ((user_gpio < PI_MAX_SCRIPTS) && f) :
+      ((user_gpio >=0) && (user_gpio < 32) && (edge >=0) && (edge <= 2) && f))
    {
       /* prevent duplicates */
 
@@ -340,7 +489,8 @@ static int intCallback(unsigned user_gpio, unsigned edge, void *f, void *user, i
 
       while (p)
       {
-         if ((p->gpio == user_gpio) && (p->edge == edge) && (p->f == f))
+         if ((p->gpio == user_gpio) && (p->edge == edge) && (p->f == f) &&
+             (p->event == event))
          {
             return pigif_duplicate_callback;
          }
@@ -359,6 +509,7 @@ static int intCallback(unsigned user_gpio, unsigned edge, void *f, void *user, i
          p->f = f;
          p->user = user;
          p->ex = ex;
+         p->event = event;
          p->next = 0;
          p->prev = gCallBackLast;
 
@@ -526,6 +677,7 @@ int pigpio_start(char *addrStr, char *portStr)
 void pigpio_stop(void)
 {
    gPigStarted = 0;
+   gNotifyBegun = 0;
 
    if (pthNotify)
    {
@@ -691,6 +843,61 @@ int wave_add_generic(unsigned numPulses, gpioPulse_t *pulses)
       gPigCommand, PI_CMD_WVAG, 0, 0, ext[0].size, 1, ext, 1);
 }
 
+int wave_add_multi(
+   unsigned numTrains, unsigned *trainPulses, gpioPulse_t *pulses)
+{
+   unsigned i, numPulses;
+   gpioExtent_t ext[2];
+
+   /*
+   p1=numTrains
+   p2=0
+   p3=numTrains*4 + pulses*sizeof(gpioPulse_t)
+   ## extension ##
+   uint32_t[] trainPulses
+   gpioPulse_t[] pulses
+   */
+
+   numPulses = 0;
+
+   for (i=0; i<numTrains; i++) numPulses += trainPulses[i];
+
+   ext[0].size = numTrains * 4;
+   ext[0].ptr = trainPulses;
+
+   ext[1].size = numPulses * sizeof(gpioPulse_t);
+   ext[1].ptr = pulses;
+
+   return pigpio_command_ext(gPigCommand, PI_CMD_WVAGM, numTrains, 0,
+      ext[0].size + ext[1].size, 2, ext, 1);
+}
+
+int wave_add_generic_stream(unsigned numPulses, gpioPulse_t *pulses)
+{
+   int res, last;
+
+   /*
+   p1=0
+   p2=pulses*sizeof(gpioPulse_t)
+   p3=4
+   ## extension ##
+   uint32_t 0
+   ## stream ##
+   gpioPulse_t[] pulses
+   */
+
+   if (!numPulses) return 0;
+
+   last = 0;
+
+   res = pigpio_stream(PI_CMD_WVAGS, 0, numPulses * sizeof(gpioPulse_t),
+      0, (char *)pulses, NULL, &last);
+
+   if (res < 0) return res;
+
+   return last;
+}
+
 int wave_add_serial(
    unsigned user_gpio, unsigned baud, uint32_t databits,
    uint32_t stophalfbits, uint32_t offset,  unsigned numChar, char *str)
@@ -725,9 +932,100 @@ int wave_add_serial(
       user_gpio, baud, numChar+sizeof(buf), 2, ext, 1);
 }
 
+int wave_add_serial_multi(unsigned numChannels, gpioSerial_t *channels)
+{
+   gpioExtent_t ext[2*PI_WAVE_MAX_TRAINS];
+   unsigned i, len;
+
+   /*
+   p1=numChannels
+   p2=0
+   p3=len
+   ## extension ##
+   uint32_t gpio, baud, databits, stophalfbits, offset, numBytes
+   char[numBytes] bstr
+   ... for each channel
+   */
+
+   if ((numChannels < 1) || (numChannels > PI_WAVE_MAX_TRAINS))
+      return PI_BAD_TRAIN_CNT;
+
+   len = 0;
+
+   for (i=0; i<numChannels; i++)
+   {
+      /* the six words lead the structure */
+
+      ext[2*i].size = 24;
+      ext[2*i].ptr = &channels[i];
+
+      ext[(2*i)+1].size = channels[i].numBytes;
+      ext[(2*i)+1].ptr = channels[i].bstr;
+
+      len += 24 + channels[i].numBytes;
+   }
+
+   return pigpio_command_ext(
+      gPigCommand, PI_CMD_WVASM, numChannels, 0, len, 2*numChannels, ext, 1);
+}
+
+static int wave_steps(unsigned cmd,
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
+{
+   gpioExtent_t ext[2];
+
+   /*
+   p1=0
+   p2=0
+   p3=sizeof(gpioStepProfile_t)+axes*sizeof(gpioStepAxis_t)
+   ## extension ##
+   gpioStepProfile_t stepProfile
+   gpioStepAxis_t[] axes
+   */
+
+   ext[0].size = sizeof(gpioStepProfile_t);
+   ext[0].ptr = stepProfile;
+
+   ext[1].size = numAxes * sizeof(gpioStepAxis_t);
+   ext[1].ptr = axes;
+
+   return pigpio_command_ext(
+      gPigCommand, cmd, 0, 0, ext[0].size + ext[1].size, 2, ext, 1);
+}
+
+int wave_add_steps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
+   {return wave_steps(PI_CMD_WVAST, numAxes, axes, stepProfile);}
+
 int wave_create(void)
    {return pigpio_command(gPigCommand, PI_CMD_WVCRE, 0, 0, 1);}
 
+int wave_create_shared(void)
+   {return pigpio_command(gPigCommand, PI_CMD_WVCRS, 0, 0, 1);}
+
+int wave_create_patchable(uint32_t bits)
+   {return pigpio_command(gPigCommand, PI_CMD_WVCRP, bits, 0, 1);}
+
+int wave_patch(
+   unsigned wave_id, unsigned slot, unsigned numSlots, uint32_t *levels)
+{
+   gpioExtent_t ext[1];
+
+   /*
+   p1=wave_id
+   p2=slot
+   p3=numSlots*4
+   ## extension ##
+   uint32_t levels[numSlots]
+   */
+
+   ext[0].size = numSlots * 4;
+   ext[0].ptr = levels;
+
+   return pigpio_command_ext(
+      gPigCommand, PI_CMD_WVPAT, wave_id, slot, ext[0].size, 1, ext, 1);
+}
+
 int wave_delete(unsigned wave_id)
    {return pigpio_command(gPigCommand, PI_CMD_WVDEL, wave_id, 0, 1);}
 
@@ -762,6 +1060,110 @@ int wave_chain(char *buf, unsigned bufSize)
       (gPigCommand, PI_CMD_WVCHA, 0, 0, bufSize, 1, ext, 1);
 }
 
+int wave_chain_ex(
+   char *buf, unsigned bufSize, unsigned chainFlags, gpioChainInfo_t *info)
+{
+   int bytes;
+   gpioChainInfo_t chainInfo;
+   gpioExtent_t ext[1];
+
+   /*
+   p1=chainFlags
+   p2=0
+   p3=bufSize
+   ## extension ##
+   char buf[bufSize]
+   */
+
+   ext[0].size = bufSize;
+   ext[0].ptr = buf;
+
+   bytes = pigpio_command_ext
+      (gPigCommand, PI_CMD_WVCHX, chainFlags, 0, bufSize, 1, ext, 0);
+
+   if (bytes > 0)
+   {
+      recvMax(&chainInfo, sizeof(chainInfo), bytes);
+
+      if (info != NULL) *info = chainInfo;
+
+      bytes = 0;
+   }
+
+   pthread_mutex_unlock(&command_mutex);
+
+   return bytes;
+}
+
+int wave_load_image(char *buf, unsigned bufSize, unsigned *wave_ids)
+{
+   int bytes, i;
+   uint8_t ids[PI_MAX_WAVES];
+   gpioExtent_t ext[1];
+
+   /*
+   p1=0
+   p2=0
+   p3=bufSize
+   ## extension ##
+   char buf[bufSize]
+   */
+
+   ext[0].size = bufSize;
+   ext[0].ptr = buf;
+
+   bytes = pigpio_command_ext
+      (gPigCommand, PI_CMD_WVLDI, 0, 0, bufSize, 1, ext, 0);
+
+   if (bytes > 0)
+   {
+      bytes = recvMax(ids, sizeof(ids), bytes);
+
+      if (wave_ids != NULL)
+      {
+         for (i=0; i<bytes; i++) wave_ids[i] = ids[i];
+      }
+   }
+
+   pthread_mutex_unlock(&command_mutex);
+
+   return bytes;
+}
+
+int wave_stream_start(void)
+   {return pigpio_command(gPigCommand, PI_CMD_WVSTR, 0, 0, 1);}
+
+int wave_stream_write(unsigned numPulses, gpioPulse_t *pulses)
+{
+   gpioExtent_t ext[1];
+
+   /*
+   p1=0
+   p2=0
+   p3=pulses*sizeof(gpioPulse_t)
+   ## extension ##
+   gpioPulse_t[] pulses
+   */
+
+   if (!numPulses) return 0;
+
+   ext[0].size = numPulses * sizeof(gpioPulse_t);
+   ext[0].ptr = pulses;
+
+   return pigpio_command_ext(
+      gPigCommand, PI_CMD_WVSTW, 0, 0, ext[0].size, 1, ext, 1);
+}
+
+int wave_stream_info(unsigned item)
+   {return pigpio_command(gPigCommand, PI_CMD_WVSTI, item, 0, 1);}
+
+int wave_stream_steps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile)
+   {return wave_steps(PI_CMD_WVSTS, numAxes, axes, stepProfile);}
+
+int wave_stream_stop(void)
+   {return pigpio_command(gPigCommand, PI_CMD_WVSTH, 0, 0, 1);}
+
 int wave_tx_busy(void)
    {return pigpio_command(gPigCommand, PI_CMD_WVBSY, 0, 0, 1);}
 
@@ -795,6 +1197,12 @@ int wave_get_high_cbs(void)
 int wave_get_max_cbs(void)
    {return pigpio_command(gPigCommand, PI_CMD_WVSC, 2, 0, 1);}
 
+int wave_get_free_cbs(void)
+   {return pigpio_command(gPigCommand, PI_CMD_WVSC, 3, 0, 1);}
+
+int wave_get_largest_free_cbs(void)
+   {return pigpio_command(gPigCommand, PI_CMD_WVSC, 4, 0, 1);}
+
 int gpio_trigger(unsigned user_gpio, unsigned pulseLen, uint32_t level)
 {
    gpioExtent_t ext[1];
@@ -856,28 +1264,6 @@ int run_script(unsigned script_id, unsigned numPar, uint32_t *param)
       (gPigCommand, PI_CMD_PROCR, script_id, 0, numPar*4, 1, ext, 1);
 }
 
-int recvMax(void *buf, int bufsize, int sent)
-{
-   uint8_t scratch[4096];
-   int remaining, fetch, count;
-
-   if (sent < bufsize) count = sent; else count = bufsize;
-
-   if (count) recv(gPigCommand, buf, count, MSG_WAITALL);
-
-   remaining = sent - count;
-
-   while (remaining)
-   {
-      fetch = remaining;
-      if (fetch > sizeof(scratch)) fetch = sizeof(scratch);
-      recv(gPigCommand, scratch, fetch, MSG_WAITALL);
-      remaining -= fetch;
-   }
-
-   return count;
-}
-
 int script_status(unsigned script_id, uint32_t *param)
 {
    int status;
@@ -897,12 +1283,72 @@ int script_status(unsigned script_id, uint32_t *param)
    return status;
 }
 
+int script_trigger(unsigned script_id, unsigned gpio, uint32_t edge)
+{
+   gpioExtent_t ext[1];
+
+   /*
+   p1=script_id
+   p2=gpio
+   p3=4
+   ## extension ##
+   unsigned edge
+   */
+
+   ext[0].size = sizeof(uint32_t);
+   ext[0].ptr = &edge;
+
+   return pigpio_command_ext(
+      gPigCommand, PI_CMD_PROCE, script_id, gpio, 4, 1, ext, 1);
+}
+
 int stop_script(unsigned script_id)
    {return pigpio_command(gPigCommand, PI_CMD_PROCS, script_id, 0, 1);}
 
 int delete_script(unsigned script_id)
    {return pigpio_command(gPigCommand, PI_CMD_PROCD, script_id, 0, 1);}
 
+int script_profile(unsigned script_id, unsigned profile)
+   {return pigpio_command(gPigCommand, PI_CMD_PROCF, script_id, profile, 1);}
+
+int script_get_profile(
+   unsigned script_id, gpioScriptProf_t *prof, unsigned maxProf)
+{
+   int bytes;
+
+   bytes = pigpio_command(gPigCommand, PI_CMD_PROCFG, script_id, 0, 0);
+
+   if (bytes > 0)
+   {
+      bytes = recvMax(prof, maxProf*sizeof(gpioScriptProf_t), bytes);
+      bytes /= sizeof(gpioScriptProf_t);
+   }
+
+   pthread_mutex_unlock(&command_mutex);
+
+   return bytes;
+}
+
+int command_stats(gpioCmdStats_t *stats, unsigned maxStats)
+{
+   int bytes;
+
+   bytes = pigpio_command(gPigCommand, PI_CMD_CSTAT, 0, 0, 0);
+
+   if (bytes > 0)
+   {
+      bytes = recvMax(stats, maxStats*sizeof(gpioCmdStats_t), bytes);
+      bytes /= sizeof(gpioCmdStats_t);
+   }
+
+   pthread_mutex_unlock(&command_mutex);
+
+   return bytes;
+}
+
+int command_stats_reset(void)
+   {return pigpio_command(gPigCommand, PI_CMD_CSTATZ, 0, 0, 1);}
+
 int bb_serial_read_open(unsigned user_gpio, unsigned baud, uint32_t bbBits)
 {
    gpioExtent_t ext[1];
@@ -1364,6 +1810,32 @@ int spi_xfer(unsigned handle, char *txBuf, char *rxBuf, unsigned count)
    return bytes;
 }
 
+int spi_xfer_stream(unsigned handle, char *txBuf, char *rxBuf, unsigned count)
+{
+   uint32_t flags;
+   int res;
+
+   /*
+   p1=handle
+   p2=count
+   p3=4
+   ## extension ##
+   uint32_t PI_STREAM_TX|PI_STREAM_RX
+   ## stream ##
+   char txBuf[count] / char rxBuf[count]
+   */
+
+   flags = 0;
+   if (txBuf) flags |= PI_STREAM_TX;
+   if (rxBuf) flags |= PI_STREAM_RX;
+
+   res = pigpio_stream(PI_CMD_SPIXS, handle, count, flags, txBuf, rxBuf, 0);
+
+   if (res < 0) return res;
+
+   return count;
+}
+
 int serial_open(char *dev, unsigned baud, unsigned flags)
 {
    int len;
@@ -1431,6 +1903,22 @@ int serial_read(unsigned handle, char *buf, unsigned count)
    return bytes;
 }
 
+int serial_read_stream(
+   unsigned handle, char *buf, unsigned count, unsigned timeout)
+{
+   /*
+   p1=handle
+   p2=count
+   p3=4
+   ## extension ##
+   uint32_t timeout
+   ## stream ##
+   char buf[count]
+   */
+
+   return pigpio_stream(PI_CMD_SERRS, handle, count, timeout, NULL, buf, 0);
+}
+
 int serial_data_available(unsigned handle)
    {return pigpio_command(gPigCommand, PI_CMD_SERDA, handle, 0, 1);}
 
@@ -1486,10 +1974,16 @@ int custom_2(unsigned arg1, char *argx, unsigned count,
 
 
 int callback(unsigned user_gpio, unsigned edge, CBFunc_t f)
-   {return intCallback(user_gpio, edge, f, 0, 0);}
+   {return intCallback(user_gpio, edge, f, 0, 0, 0);}
 
 int callback_ex(unsigned user_gpio, unsigned edge, CBFuncEx_t f, void *user)
-   {return intCallback(user_gpio, edge, f, user, 1);}
+   {return intCallback(user_gpio, edge, f, user, 1, 0);}
+
+int event_callback(unsigned script_id, evtCBFunc_t f, void *user)
+   {return intCallback(script_id, 0, f, user, 1, 1);}
+
+int notify_handle(void)
+   {return gPigHandle;}
 
 int callback_cancel(unsigned id)
 {
@@ -125,6 +125,9 @@ callback_ex                Create gpio level change callback
 callback_cancel            Cancel a callback
 wait_for_edge              Wait for gpio level change
 
+event_callback             Create script event callback
+notify_handle              Get the notification handle used by callbacks
+
 INTERMEDIATE
 
 gpio_trigger               Send a trigger pulse to a gpio.
@@ -170,24 +173,43 @@ SCRIPTS
 store_script               Store a script
 run_script                 Run a stored script
 script_status              Get script status and parameters
+script_trigger             Run a stored script on a gpio edge
 stop_script                Stop a running script
 delete_script              Delete a stored script
 
+script_profile             Start, stop, or clear script profiling
+script_get_profile         Get per step counts and times of a script
+
 WAVES
 
 wave_clear                 Deletes all waveforms
 
 wave_add_new               Starts a new waveform
 wave_add_generic           Adds a series of pulses to the waveform
+wave_add_generic_stream    Streams any number of pulses to the waveform
+wave_add_multi             Adds several pulse trains to the waveform
 wave_add_serial            Adds serial data to the waveform
+wave_add_serial_multi      Adds serial data on several gpios at once
+wave_add_steps             Adds a coordinated stepper move to the waveform
 
 wave_create                Creates a waveform from added data
+wave_create_shared         Creates a waveform shared with identical ones
+wave_create_patchable      Creates a waveform whose levels can be patched
+wave_patch                 Patches the levels of a patchable waveform
 wave_delete                Deletes one or more waveforms
+wave_load_image            Loads waveforms compiled by pigwave
 
 wave_send_once             Transmits a waveform once
 wave_send_repeat           Transmits a waveform repeatedly
 
 wave_chain                 Transmits a chain of waveforms
+wave_chain_ex              Compiles and transmits a chain with nested loops
+
+wave_stream_start          Starts streaming pulses
+wave_stream_write          Queues pulses on the stream
+wave_stream_info           Stream space, backlog, and counters
+wave_stream_steps          Queues a coordinated stepper move on the stream
+wave_stream_stop           Stops streaming pulses
 
 wave_tx_busy               Checks to see if the waveform has ended
 wave_tx_stop               Aborts the current waveform
@@ -203,6 +225,8 @@ wave_get_max_pulses        Absolute maximum allowed pulses
 wave_get_cbs               Length in cbs of the current waveform
 wave_get_high_cbs          Length of longest waveform so far
 wave_get_max_cbs           Absolute maximum allowed cbs
+wave_get_free_cbs          Cbs free for new waveforms
+wave_get_largest_free_cbs  Largest contiguous run of free cbs
 
 wave_tx_start              Creates/transmits a waveform (DEPRECATED)
 wave_tx_repeat             Creates/transmits a waveform repeatedly (DEPRECATED)
@@ -244,6 +268,7 @@ spi_close                  Closes a SPI device
 spi_read                   Reads bytes from a SPI device
 spi_write                  Writes bytes to a SPI device
 spi_xfer                   Transfers bytes with a SPI device
+spi_xfer_stream            Streams a transfer of any length
 
 SERIAL
 
@@ -254,6 +279,7 @@ serial_write_byte          Writes a byte to a serial device
 serial_read_byte           Reads a byte from a serial device
 serial_write               Writes bytes to a serial device
 serial_read                Reads bytes from a serial device
+serial_read_stream         Streams a read of any length
 
 serial_data_available      Returns number of bytes ready to be read
 
@@ -270,6 +296,9 @@ get_hardware_revision      Get hardware revision
 get_pigpio_version         Get the pigpio version
 pigpiod_if_version         Get the pigpiod_if version
 
+command_stats              Get per command call counts and latencies
+command_stats_reset        Clear per command call counts and latencies
+
 pigpio_error               Get a text description of an error code.
 
 time_sleep                 Sleeps for a float number of seconds
@@ -283,6 +312,10 @@ typedef void (*CBFunc_t)  (unsigned user_gpio, unsigned level, uint32_t tick);
 typedef void (*CBFuncEx_t)
    (unsigned user_gpio, unsigned level, uint32_t tick, void * user);
 
+typedef void (*evtCBFunc_t)
+   (unsigned script_id, unsigned index, uint32_t value, uint32_t tick,
+    void * user);
+
 typedef struct callback_s callback_t;
 
 #define RISING_EDGE  0
@@ -994,6 +1027,33 @@ Returns the pigpio version.
 D*/
 
 
+/*F*/
+int command_stats(gpioCmdStats_t *stats, unsigned maxStats);
+/*D
+Returns the call counts and execution times of the commands
+executed by the pigpio daemon.
+
+. .
+   stats: an array to receive the statistics
+maxStats: the number of entries in stats
+. .
+
+Returns the number of entries copied to stats.  Only commands which
+have been executed at least once are returned.
+
+See [*gpioCmdStats*] in pigpio.h for the layout of the histogram.
+D*/
+
+
+/*F*/
+int command_stats_reset(void);
+/*D
+Clears the statistics returned by [*command_stats*].
+
+Returns 0 if OK.
+D*/
+
+
 /*F*/
 int wave_clear(void);
 /*D
@@ -1036,6 +1096,44 @@ If the added waveform is intended to start after or within the existing
 waveform then the first pulse should consist solely of a delay.
 D*/
 
+/*F*/
+int wave_add_multi(
+   unsigned numTrains, unsigned *trainPulses, gpioPulse_t *pulses);
+/*D
+This function adds several independent pulse trains to the current
+waveform in one pass.
+
+. .
+  numTrains: 1-PI_WAVE_MAX_TRAINS, the number of pulse trains.
+trainPulses: an array of numTrains pulse counts.
+     pulses: the pulses of all the trains, one train after another.
+. .
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_TRAIN_CNT or PI_TOO_MANY_PULSES.
+
+The result is the same as adding each train with [*wave_add_generic*]
+except that the waveform lasts until the end of the longest train,
+but the trains are merged with the existing waveform in one pass.
+D*/
+
+/*F*/
+int wave_add_generic_stream(unsigned numPulses, gpioPulse_t *pulses);
+/*D
+This function is the same as [*wave_add_generic*] but is not limited
+by the size of a single socket message.  The pulses are streamed to
+the daemon in chunks, each chunk starting where the previous one
+finished.
+
+. .
+numPulses: the number of pulses.
+   pulses: an array of pulses.
+. .
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_TOO_MANY_PULSES or PI_BAD_STREAM.
+D*/
+
 /*F*/
 int wave_add_serial
    (unsigned user_gpio, unsigned baud, unsigned data_bits,
@@ -1077,6 +1175,51 @@ For [*data_bits*] 9-16 there will be two bytes per character.
 For [*data_bits*] 17-32 there will be four bytes per character.
 D*/
 
+/*F*/
+int wave_add_serial_multi(unsigned numChannels, gpioSerial_t *channels);
+/*D
+This function adds serial data on several gpios to the existing
+waveform (if any) in one operation.
+
+. .
+numChannels: 1-PI_WAVE_MAX_TRAINS
+  *channels: the gpio, framing, offset, and data of each channel
+. .
+
+Each channel is as described for [*wave_add_serial*] and may have
+its own baud rate and framing.  The channels are encoded and merged
+with the waveform together in the daemon.
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_TRAIN_CNT, PI_BAD_USER_GPIO, PI_NOT_PERMITTED,
+PI_BAD_WAVE_BAUD, PI_BAD_DATABITS, PI_BAD_STOPBITS, PI_TOO_MANY_CHARS,
+PI_BAD_SER_OFFSET, or PI_TOO_MANY_PULSES.
+D*/
+
+/*F*/
+int wave_add_steps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile);
+/*D
+This function adds the step and direction pulses of a coordinated
+stepper motor move to the existing waveform (if any).  Only the
+move's description is sent to the daemon.
+
+. .
+    numAxes: 1-PI_MAX_STEP_AXES
+      *axes: the step gpio, direction gpio, and steps of each axis
+*stepProfile: the speeds and acceleration of the move
+. .
+
+The axis with the most steps follows a trapezoidal (or with
+PI_STEP_SCURVE an S-curve) speed profile from startSpeed up to
+maxSpeed and down to endSpeed.  The other axes step in proportion.
+See gpioWaveAddSteps in pigpio.h for the details.
+
+Returns the new total number of pulses in the current waveform if OK,
+otherwise PI_BAD_STEP_AXES, PI_BAD_STEP_PROFILE, PI_BAD_USER_GPIO,
+PI_NOT_PERMITTED, or PI_TOO_MANY_PULSES.
+D*/
+
 /*F*/
 int wave_create(void);
 /*D
@@ -1126,26 +1269,113 @@ set all the fields to zero (the pulse will be ignored).
 When a waveform is started each pulse is executed in order with the
 specified delay between the pulse and the next.
 
+Each create gives a waveform of its own, see [*wave_create_shared*]
+to reuse an existing waveform.
+
 Returns the new waveform id if OK, otherwise PI_EMPTY_WAVEFORM,
 PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, or PI_TOO_MANY_OOL.
 D*/
 
 
+/*F*/
+int wave_create_shared(void);
+/*D
+This function creates a waveform in the same way as [*wave_create*]
+but if a waveform with exactly the same pulses was created by this
+function and has not been deleted its id is returned and nothing is
+built.  Each such create must be matched by a [*wave_delete*] before
+the waveform is deleted.  A shared waveform can't be used twice in
+one [*wave_chain*].  [*wave_clear*] clears it however many creates
+hold it.
+
+Returns the waveform id if OK, otherwise PI_EMPTY_WAVEFORM,
+PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+D*/
+
+
+/*F*/
+int wave_create_patchable(uint32_t bits);
+/*D
+This function creates a waveform from the added data in the same way
+as [*wave_create*] but the levels the waveform sets on the gpios in
+bits may be changed later by [*wave_patch*] without rebuilding it.
+
+. .
+bits: the gpios whose levels may be patched
+. .
+
+Each pulse which switches any of the gpios in bits is a slot.  Slots
+are numbered from 0 in the order they are sent.  A patch sets every
+gpio in bits to a new level at the start of each patched slot.
+
+Gpios the client may not update are removed from bits.
+
+Returns the new waveform id if OK, otherwise PI_BAD_PATCH,
+PI_EMPTY_WAVEFORM, PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS, PI_TOO_MANY_OOL,
+or PI_NO_MEMORY.
+D*/
+
+/*F*/
+int wave_patch(
+   unsigned wave_id, unsigned slot, unsigned numSlots, uint32_t *levels);
+/*D
+This function sets the levels a patchable waveform sends in numSlots
+slots starting at slot.
+
+. .
+ wave_id: >=0, as returned by [*wave_create_patchable*]
+    slot: the first slot to patch
+numSlots: the number of slots to patch
+ *levels: the gpio levels for each slot
+. .
+
+Bit n of levels[i] is the level gpio n is set to at the start of slot
+slot+i.  The new levels take effect when the slot is next sent.
+
+Returns the number of slots in the waveform if OK, otherwise
+PI_BAD_WAVE_ID or PI_BAD_PATCH.
+D*/
+
 /*F*/
 int wave_delete(unsigned wave_id);
 /*D
-This function deletes all created waveforms with ids greater than or
-equal to wave_id.
+This function deletes the waveform with id wave_id.
 
 . .
 wave_id: >=0, as returned by [*wave_create*].
 . .
 
-Wave ids are allocated in order, 0, 1, 2, etc.
+Other waveforms are not affected.  The id and memory of the deleted
+waveform are reused by later calls to [*wave_create*].  A waveform
+returned by more than one [*wave_create_shared*] is only deleted by
+the last matching delete.
 
 Returns 0 if OK, otherwise PI_BAD_WAVE_ID.
 D*/
 
+/*F*/
+int wave_load_image(char *buf, unsigned bufSize, unsigned *wave_ids);
+/*D
+This function loads the waveforms of an image compiled by pigwave.
+
+. .
+     buf: the image
+ bufSize: the number of bytes in the image
+wave_ids: NULL or an array with room for an id per waveform
+. .
+
+Returns the number of waveforms loaded if OK, otherwise
+PI_BAD_WAVE_IMAGE, PI_NO_WAVEFORM_ID, PI_TOO_MANY_CBS,
+PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+
+The image must be smaller than the 64K a command may carry, a larger
+one may be loaded when the daemon starts (pigpiod -w).  Gpios the
+client may not update are removed from the image's levels.
+
+The waveforms are given the lowest free ids in image order.  They
+are sent, chained, and deleted like created waveforms.
+D*/
+
 /*F*/
 int wave_tx_start(void);
 /*D
@@ -1263,6 +1493,126 @@ status = wave_chain(chain, sizeof(chain));
 ...
 D*/
 
+/*F*/
+int wave_chain_ex(
+   char *buf, unsigned bufSize, unsigned chainFlags, gpioChainInfo_t *info);
+/*D
+This function compiles a chain of waveforms, loops, and delays and,
+unless a dry run is asked for, transmits it.
+
+NOTE: Any hardware PWM started by [*hardware_PWM*] will be cancelled.
+
+. .
+       buf: pointer to the wave_ids and command codes
+   bufSize: the number of bytes in buf
+chainFlags: 0 or PI_CHAIN_DRY_RUN
+      info: NULL or where to put the chain's size and duration
+. .
+
+Returns 0 if OK, otherwise PI_BAD_FLAGS, PI_BAD_CHAIN_CMD,
+PI_BAD_CHAIN_LOOP, PI_BAD_REPEAT_CNT, PI_BAD_WAVE_ID, PI_TOO_MANY_CBS,
+PI_TOO_MANY_OOL, or PI_NO_MEMORY.
+
+The whole chain is checked, and its size and duration worked out,
+before any DMA memory is touched.  With PI_CHAIN_DRY_RUN nothing
+more is done.  Otherwise any transmission is stopped and the chain
+is sent.  Loops may be nested to any depth and a waveform may be used
+any number of times.
+
+The following command codes are supported:
+
+Name         @ Cmd & Data @ Meaning
+Loop Start   @ 255 0      @ Identify start of a wave block
+Loop Repeat  @ 255 1 x y  @ loop x + y*256 times
+Delay        @ 255 2 x y  @ delay x + y*256 microseconds
+Loop Forever @ 255 3      @ loop forever
+
+A loop count must be at least 1.  A loop forever must be the last
+command and may not be inside another loop.
+
+...
+// 3 then 2 forever
+status = wave_chain_ex((char []){255, 0, 3, 2, 255, 3}, 6, 0, NULL);
+...
+D*/
+
+
+/*F*/
+int wave_stream_start(void);
+/*D
+This function starts streaming pulses.  Pulses queued with
+[*wave_stream_write*] are transmitted in order, with no limit on the
+total length, while earlier pulses are still being transmitted.
+
+Returns 0 if OK, otherwise PI_TOO_MANY_CBS or PI_TOO_MANY_OOL.
+
+Starting the stream stops any waveform being transmitted.  Sending a
+waveform, or [*wave_tx_stop*], ends the stream.
+D*/
+
+/*F*/
+int wave_stream_write(unsigned numPulses, gpioPulse_t *pulses);
+/*D
+This function queues pulses to be transmitted after those already
+queued on the stream.
+
+. .
+numPulses: the number of pulses.
+   pulses: an array of pulses.
+. .
+
+Returns the number of pulses queued if OK, otherwise PI_NO_WAVE_STREAM.
+
+Fewer than numPulses pulses are queued if the stream is full.  The
+rest should be written again once there is room.  Pulses are best
+written in blocks rather than one at a time.  Gpios which may not be
+updated are ignored.
+D*/
+
+/*F*/
+int wave_stream_info(unsigned item);
+/*D
+This function returns information about the stream.
+
+. .
+item: PI_WAVE_STREAM_SPACE, PI_WAVE_STREAM_QUEUED,
+      PI_WAVE_STREAM_SENT, or PI_WAVE_STREAM_UNDERRUNS.
+. .
+
+Returns the pulses which may be queued now, the pulses queued but not
+yet transmitted, the pulses transmitted, or the times the stream ran
+out of pulses, otherwise PI_NO_WAVE_STREAM or PI_BAD_STREAM_INFO.
+D*/
+
+/*F*/
+int wave_stream_steps(
+   unsigned numAxes, gpioStepAxis_t *axes, gpioStepProfile_t *stepProfile);
+/*D
+This function queues the pulses of a coordinated stepper motor move
+on the stream.  The move is generated as for [*wave_add_steps*].
+
+. .
+    numAxes: 1-PI_MAX_STEP_AXES
+      *axes: the step gpio, direction gpio, and steps of each axis
+*stepProfile: the speeds and acceleration of the move
+. .
+
+The whole move is queued or none of it is.  Longer moves may be split
+into parts whose end and start speeds match.
+
+Returns the number of pulses queued if OK, otherwise
+PI_NO_WAVE_STREAM, PI_STREAM_FULL, PI_BAD_STEP_AXES,
+PI_BAD_STEP_PROFILE, PI_BAD_USER_GPIO, or PI_NOT_PERMITTED.
+D*/
+
+/*F*/
+int wave_stream_stop(void);
+/*D
+This function stops the stream.  Any pulses still queued are not
+transmitted.
+
+Returns 0 if OK, otherwise PI_NO_WAVE_STREAM.
+D*/
 
 /*F*/
 int wave_tx_busy(void);
@@ -1344,6 +1694,22 @@ This function returns the maximum possible size of a waveform in DMA
 control blocks.
 D*/
 
+/*F*/
+int wave_get_free_cbs(void);
+/*D
+This function returns the number of DMA control blocks not used by
+created waveforms.
+D*/
+
+/*F*/
+int wave_get_largest_free_cbs(void);
+/*D
+This function returns the largest number of contiguous DMA control
+blocks not used by created waveforms.  A value well below that
+returned by [*wave_get_free_cbs*] means the free control blocks are
+fragmented.
+D*/
+
 /*F*/
 int gpio_trigger(unsigned user_gpio, unsigned pulseLen, unsigned level);
 /*D
@@ -1418,6 +1784,26 @@ PI_SCRIPT_FAILED
 The current value of script parameters 0 to 9 are returned in param.
 D*/
 
+/*F*/
+int script_trigger(unsigned script_id, unsigned gpio, unsigned edge);
+/*D
+This function binds a stored script to an edge on a gpio.  pigpiod
+starts the script as soon as the edge is seen.
+
+. .
+script_id: >=0, as returned by [*store_script*].
+     gpio: 0-31.
+     edge: RISING_EDGE, FALLING_EDGE, EITHER_EDGE, or NO_EDGE.
+. .
+
+The function returns 0 if OK, otherwise PI_BAD_SCRIPT_ID,
+PI_BAD_USER_GPIO, PI_BAD_EDGE, or PI_NO_MEMORY.
+
+When started by an edge p0 is set to the gpio, p1 to the new
+level, and p2 to the tick of the edge.  Edges which occur while
+the script is running are ignored.  NO_EDGE removes the trigger.
+D*/
+
 /*F*/
 int stop_script(unsigned script_id);
 /*D
@@ -1442,6 +1828,42 @@ script_id: >=0, as returned by [*store_script*].
 The function returns 0 if OK, otherwise PI_BAD_SCRIPT_ID.
 D*/
 
+/*F*/
+int script_profile(unsigned script_id, unsigned profile);
+/*D
+This function starts, stops, or clears profiling of a stored script.
+
+. .
+script_id: >=0, as returned by [*store_script*].
+  profile: PI_PROF_ON, PI_PROF_OFF, or PI_PROF_CLEAR.
+. .
+
+The function returns 0 if OK, otherwise PI_BAD_SCRIPT_ID,
+PI_BAD_PROF_MODE, or PI_NO_MEMORY.
+
+A running script picks up the change at its next wait or yield.
+D*/
+
+/*F*/
+int script_get_profile(
+   unsigned script_id, gpioScriptProf_t *prof, unsigned maxProf);
+/*D
+This function returns the profile of a stored script.
+
+. .
+script_id: >=0, as returned by [*store_script*].
+     prof: an array to receive the profile.
+  maxProf: the number of entries in prof.
+. .
+
+Returns the number of entries copied to prof, otherwise
+PI_BAD_SCRIPT_ID.  Only steps which have been executed are
+returned.
+
+See [*gpioScriptGetProfile*] in pigpio.h for the meaning of the
+fields.
+D*/
+
 /*F*/
 int bb_serial_read_open(unsigned user_gpio, unsigned baud, unsigned data_bits);
 /*D
@@ -2100,6 +2522,31 @@ Returns the number of bytes transferred if OK, otherwise
 PI_BAD_HANDLE, PI_BAD_SPI_COUNT, or PI_SPI_XFER_FAILED.
 D*/
 
+/*F*/
+int spi_xfer_stream(
+   unsigned handle, char *txBuf, char *rxBuf, unsigned count);
+/*D
+This function transfers count bytes with the SPI device associated
+with the handle.  Unlike [*spi_xfer*] count is not limited by the
+size of a single socket message.  The data is streamed through the
+daemon in chunks while chip select stays asserted for the whole
+transfer, so (for example) a complete flash device may be dumped
+with a single read command.
+
+If txBuf is NULL zero bytes are transmitted.  If rxBuf is NULL the
+received bytes are discarded (and not sent over the network).
+
+. .
+handle: >=0, as returned by a call to [*spi_open*].
+ txBuf: the data bytes to write, or NULL.
+ rxBuf: the received data bytes, or NULL.
+ count: the number of bytes to transfer.
+. .
+
+Returns the number of bytes transferred if OK, otherwise
+PI_BAD_HANDLE or PI_BAD_STREAM.
+D*/
+
 /*F*/
 int serial_open(char *ser_tty, unsigned baud, unsigned ser_flags);
 /*D
@@ -2192,6 +2639,26 @@ Returns the number of bytes read (>0) if OK, otherwise PI_BAD_HANDLE,
 PI_BAD_PARAM, PI_SER_READ_NO_DATA, or PI_SER_WRITE_FAILED.
 D*/
 
+/*F*/
+int serial_read_stream(
+   unsigned handle, char *buf, unsigned count, unsigned timeout);
+/*D
+This function reads count bytes from the serial port associated with
+handle and writes them to buf.  The data is streamed from the daemon
+in chunks as it arrives.  The read ends early if no data arrives for
+timeout milliseconds.
+
+. .
+ handle: >=0, as returned by a call to [*serial_open*].
+    buf: an array to receive the read data.
+  count: the number of bytes to read.
+timeout: the idle timeout in milliseconds.
+. .
+
+Returns the number of bytes read if OK, otherwise PI_BAD_HANDLE or
+PI_SER_READ_FAILED.
+D*/
+
 /*F*/
 int serial_data_available(unsigned handle);
 /*D
@@ -2317,6 +2784,43 @@ The function returns 1 if the edge occurred, otherwise 0.
 The function returns when the edge occurs or after the timeout.
 D*/
 
+/*F*/
+int event_callback(unsigned script_id, evtCBFunc_t f, void *userdata);
+/*D
+This function initialises a new script event callback.
+
+. .
+script_id: >=0, as returned by [*store_script*].
+        f: the callback function.
+ userdata: a pointer to arbitrary user data.
+. .
+
+The function returns a callback id if OK, otherwise pigif_bad_malloc,
+pigif_duplicate_callback, or pigif_bad_callback.
+
+The callback is called with the script id, the position of the value
+in the record, the value, the tick, and user, for each value the
+script emits on the [*notify_handle*] handle with EMIT, EMITV, or
+EMITP.  The callback is cancelled with [*callback_cancel*].
+
+...
+// script emits a count each time gpio p1 goes high
+sid = store_script(
+   "tag 1 r p1 jz 1 inr v0 emit p0 v0 tag 2 r p1 jnz 2 jmp 1");
+event_callback(sid, myEvent, NULL);
+p[0] = notify_handle(); p[1] = 4;
+run_script(sid, 2, p);
+...
+D*/
+
+/*F*/
+int notify_handle(void);
+/*D
+This function returns the handle of the notification used to deliver
+callbacks, or a negative value if not connected.  Scripts need it to
+emit events to [*event_callback*] callbacks.
+D*/
+
 /*PARAMS
 
 *addrStr::
@@ -2336,6 +2840,18 @@ meaning is defined by the customiser.
 argc::
 The count of bytes passed to a user customised function.
 
+*axes::
+An array of gpioStepAxis_t structures, one per stepper motor axis.
+
+. .
+typedef struct
+{
+   uint32_t stepGpio;
+   uint32_t dirGpio;
+   int32_t  steps;      // the sign sets the direction
+} gpioStepAxis_t;
+. .
+
 *argx::
 A pointer to an array of bytes passed to a user customised function.
 Its meaning and content is defined by the customiser.
@@ -2366,7 +2882,8 @@ bVal::0-255 (Hex 0x0-0xFF, Octal 0-0377)
 An 8-bit byte value.
 
 callback_id::
-A >=0, as returned by a call to [*callback*] or [*callback_ex*].  This is
+A >=0, as returned by a call to [*callback*], [*callback_ex*], or
+[*event_callback*].  This is
 passed to [*callback_cancel*] to cancel the callback.
 
 CBFunc_t::
@@ -2381,6 +2898,34 @@ typedef void (*CBFuncEx_t)
    (unsigned user_gpio, unsigned level, uint32_t tick, void * user);
 . .
 
+evtCBFunc_t::
+. .
+typedef void (*evtCBFunc_t)
+   (unsigned script_id, unsigned index, uint32_t value, uint32_t tick,
+    void * user);
+. .
+
+*channels::
+An array of gpioSerial_t structures, one per serial channel.
+
+. .
+typedef struct
+{
+   uint32_t gpio;
+   uint32_t baud;
+   uint32_t dataBits;
+   uint32_t stopBits;   // half bits
+   uint32_t offset;
+   uint32_t numBytes;
+   char    *bstr;
+} gpioSerial_t;
+. .
+
+chainFlags::
+. .
+PI_CHAIN_DRY_RUN 1
+. .
+
 char::
 A single character, an 8 bit quantity able to store 0-255.
 
@@ -2461,6 +3006,18 @@ Type 2    -  X  X  -  -  -  X  X  X  X  -  X  X  X  X  X
 Type 3    X  X  X  X  X  X  X  X  X  X  X  X  -  -  -  -
 . .
 
+gpioChainInfo_t::
+. .
+typedef struct
+{
+   uint32_t cbs;
+   uint32_t ool;
+   uint32_t loops;
+   uint32_t forever;
+   uint64_t micros;
+} gpioChainInfo_t;
+. .
+
 gpioPulse_t::
 . .
 typedef struct
@@ -2495,12 +3052,18 @@ A register of an I2C device.
 *inBuf::
 A buffer used to pass data to a function.
 
+*info::
+Where to put the size and duration of a compiled chain.
+
 inLen::
 The number of bytes of data in a buffer.
 
 int::
 A whole number, negative or positive.
 
+item::
+The item of wave stream information wanted.
+
 level::
 The level of a gpio.  Low or High.
 
@@ -2522,6 +3085,13 @@ reported as PI_TIMEOUT.  See [*set_watchdog*].
 PI_TIMEOUT 2
 . .
 
+*levels::
+An array of gpio levels, one 32 bit word per waveform slot.  Bit n
+is the level of gpio n.
+
+maxStats::
+The number of gpioCmdStats_t entries which may be returned.
+
 mode::0-7
 The operational mode of a gpio, normally INPUT or OUTPUT.
 
@@ -2536,16 +3106,25 @@ PI_ALT4 3
 PI_ALT5 2
 . .
 
+numAxes:: 1-PI_MAX_STEP_AXES
+The number of stepper motor axes in a move.
+
 numBytes::
 The number of bytes used to store characters in a string.  Depending
 on the number of bits per character there may be 1, 2, or 4 bytes
 per character.
 
+numChannels:: 1-PI_WAVE_MAX_TRAINS
+The number of serial channels to add to a waveform.
+
 numPar:: 0-10
 The number of parameters passed to a script.
 
 numPulses::
-The number of pulses to be added to a waveform.
+The number of pulses to be added to a waveform or stream.
+
+numSlots::
+The number of patchable waveform slots.
 
 offset::
 The associated data starts this number of microseconds from the start of
@@ -2586,7 +3165,7 @@ pulseLen::
 1-100, the length of a trigger pulse in microseconds.
 
 *pulses::
-An array of pulses to be added to a waveform.
+An array of pulses to be added to a waveform or stream.
 
 pulsewidth::0, 500-2500
 . .
@@ -2651,12 +3230,34 @@ The name of a serial tty device, e.g. /dev/ttyAMA0, /dev/ttyUSB0, /dev/tty1.
 size_t::
 A standard type used to indicate the size of an object in bytes.
 
+slot::
+A patchable waveform slot, from 0 for the first pulse which switches
+a patchable gpio.
+
 spi_channel::
 A SPI channel, 0-2.
 
 spi_flags::
 See [*spi_open*].
 
+*stats::
+An array of gpioCmdStats_t structures, see pigpio.h.
+
+*stepProfile::
+The speeds and acceleration of a stepper motor move.
+
+. .
+typedef struct
+{
+   uint32_t startSpeed; // steps per second
+   uint32_t maxSpeed;
+   uint32_t endSpeed;
+   uint32_t accel;      // steps per second per second
+   uint32_t stepMicros; // step pulse and direction setup
+   uint32_t flags;      // PI_STEP_SCURVE
+} gpioStepProfile_t;
+. .
+
 stop_bits::2-8
 The number of (half) stop bits to be used when adding serial data
 to a waveform.
@@ -2706,6 +3307,10 @@ One of [*wave_add_new*], [*wave_add_generic*], [*wave_add_serial*].
 wave_id::
 A number representing a waveform created by [*wave_create*].
 
+*wave_ids::
+
+An array of waveform ids.
+
 wave_send_*::
 One of [*wave_send_once*], [*wave_send_repeat*].
 
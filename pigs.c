@@ -49,7 +49,7 @@ the commands available from pigpio.
 */
 
 char command_buf[8192];
-char response_buf[8192];
+char response_buf[CMD_MAX_EXTENSION];
 
 int printFlags = 0;
 
@@ -138,8 +138,11 @@ static int openSocket(void)
 
 void print_result(int sock, int rv, cmdCmd_t cmd)
 {
-   int i, r, ch;
+   int i, j, r, ch;
    uint32_t *p;
+   gpioCmdStats_t *cs;
+   gpioScriptProf_t *sp;
+   gpioChainInfo_t *ci;
 
    r = cmd.res;
 
@@ -212,6 +215,74 @@ void print_result(int sock, int rv, cmdCmd_t cmd)
          }
          printf("\n");
          break;
+
+      case 8: /* CSTAT */
+         if (r < 0)
+         {
+            printf("%d\n", r);
+            fatal("ERROR: %s", cmdErrStr(r));
+         }
+         else
+         {
+            /* name calls errors avg max, then the latency histogram */
+
+            cs = (gpioCmdStats_t *)response_buf;
+
+            for (i=0; i<(r/sizeof(gpioCmdStats_t)); i++)
+            {
+               printf("%s %u %u %u %u", cmdName(cs[i].cmd),
+                  cs[i].calls, cs[i].errors,
+                  cs[i].calls ?
+                     (unsigned)(cs[i].totalMicros/cs[i].calls) : 0,
+                  cs[i].maxMicros);
+
+               for (j=0; j<PI_CMD_STATS_BUCKETS; j++)
+               {
+                  printf(" %u", cs[i].execHist[j]);
+               }
+               printf("\n");
+            }
+         }
+         break;
+
+      case 9: /* PROCFG */
+         if (r < 0)
+         {
+            printf("%d\n", r);
+            fatal("ERROR: %s", cmdErrStr(r));
+         }
+         else
+         {
+            /* step command count micros blocked-micros */
+
+            sp = (gpioScriptProf_t *)response_buf;
+
+            for (i=0; i<(r/sizeof(gpioScriptProf_t)); i++)
+            {
+               printf("%u %s %u %llu %llu\n", sp[i].step,
+                  cmdName(sp[i].cmd), sp[i].count,
+                  (unsigned long long)sp[i].micros,
+                  (unsigned long long)sp[i].blockMicros);
+            }
+         }
+         break;
+
+      case 10: /* WVCHX */
+         if (r != sizeof(gpioChainInfo_t))
+         {
+            printf("%d\n", r);
+            fatal("ERROR: %s", cmdErrStr(r));
+         }
+         else
+         {
+            /* cbs ool loops forever micros */
+
+            ci = (gpioChainInfo_t *)response_buf;
+
+            printf("%u %u %u %u %llu\n", ci->cbs, ci->ool, ci->loops,
+               ci->forever, (unsigned long long)ci->micros);
+         }
+         break;
    }
 }
 
@@ -221,16 +292,20 @@ void get_extensions(int sock, int command, int res)
    {
       case PI_CMD_BI2CZ:
       case PI_CMD_CF2:
+      case PI_CMD_CSTAT:
       case PI_CMD_I2CPK:
       case PI_CMD_I2CRD:
       case PI_CMD_I2CRI:
       case PI_CMD_I2CRK:
       case PI_CMD_I2CZ:
+      case PI_CMD_PROCFG:
       case PI_CMD_PROCP:
       case PI_CMD_SERR:
       case PI_CMD_SLR:
       case PI_CMD_SPIX:
       case PI_CMD_SPIR:
+      case PI_CMD_WVCHX:
+      case PI_CMD_WVLDI:
 
          if (res > 0)
          {
@@ -0,0 +1,672 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/*
+This version is for pigpio version 48+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pigpio.h"
+
+/*
+This software compiles waveforms into an image which
+gpioWaveLoadImage (or pigpiod -w) loads without building them.
+
+Usage: pigwave [-o image] [source]
+
+The source (default stdin) holds any number of
+
+wave NAME
+on off delay
+...
+end
+
+chain NAME
+item ...
+end
+
+A wave is a list of pulses, the gpios switched on, the gpios switched
+off, and the microseconds to the next pulse.  A chain is a list of
+the names of earlier waves, delay MICROS, loop, repeat COUNT (closes
+the innermost loop), and forever (closes the outermost loop and ends
+the chain).  # starts a comment.
+
+Each wave and chain is an image waveform, given ids in source order.
+The image (default waves.pwi) is written and the cbs, OOL, and
+duration of each waveform reported.
+*/
+
+#define LOOP_BLKLEN     8
+#define LOOP_MAX_BLOCKS 8
+#define LOOP_MAX_COUNT  (1<<(3*LOOP_MAX_BLOCKS))
+
+#define MAX_NAME   32
+#define MAX_DEPTH  32
+#define MAX_LINE   4096
+
+#define CB_REF(cb, offset) (PI_WI_REF_CB | (((cb)*32) + (offset)))
+#define OOL_REF(pos)       (PI_WI_REF_OOL | (pos))
+#define PERI_REF(peri)     (PI_WI_REF_PERI | (peri))
+
+typedef struct
+{
+   char name[MAX_NAME];
+   int isChain;
+   int numPulses;
+   gpioPulse_t *pulses;
+} entry_t;
+
+#define ITEM_WAVE    0
+#define ITEM_DELAY   1
+#define ITEM_LOOP    2
+#define ITEM_REPEAT  3
+#define ITEM_FOREVER 4
+
+typedef struct
+{
+   int type;
+   int value;
+} item_t;
+
+typedef struct
+{
+   int count;
+   int bodyCB;
+   int blocks;
+   int ring[LOOP_MAX_BLOCKS];
+   int saved[LOOP_MAX_BLOCKS];
+   uint64_t micros;
+} loop_t;
+
+static entry_t *entry;
+static int numEntries;
+
+static gpioWaveImageWave_t *wave;
+
+static gpioWaveImageCb_t *cbs;
+static int numCB, maxCB;
+
+static uint32_t *ool;
+static int numOOL, maxOOL;
+
+static uint32_t *reloc;
+static int numRelocs, maxRelocs;
+
+static char *source = "stdin";
+static int lineNum;
+
+static void fatal(char *fmt, ...)
+{
+   va_list ap;
+
+   fprintf(stderr, "%s:%d: ", source, lineNum);
+
+   va_start(ap, fmt);
+   vfprintf(stderr, fmt, ap);
+   va_end(ap);
+
+   fprintf(stderr, "\n");
+
+   exit(1);
+}
+
+static void *grow(void *p, int *max, int need, int size)
+{
+   if (need <= *max) return p;
+
+   *max = (need * 2) + 64;
+
+   p = realloc(p, *max * size);
+
+   if (p == NULL) fatal("out of memory");
+
+   return p;
+}
+
+static int newCB(uint32_t info, uint32_t src, uint32_t dst, uint32_t len)
+{
+   gpioWaveImageCb_t *c;
+
+   /* each cb runs on to the next unless told otherwise */
+
+   cbs = grow(cbs, &maxCB, numCB+1, sizeof(gpioWaveImageCb_t));
+
+   c = &cbs[numCB];
+
+   c->info   = info;
+   c->src    = src;
+   c->dst    = dst;
+   c->length = len;
+   c->next   = CB_REF(numCB+1, 0);
+
+   return numCB++;
+}
+
+static int newOOL(uint32_t val, int isRef)
+{
+   ool = grow(ool, &maxOOL, numOOL+1, sizeof(uint32_t));
+
+   if (isRef)
+   {
+      reloc = grow(reloc, &maxRelocs, numRelocs+1, sizeof(uint32_t));
+      reloc[numRelocs++] = numOOL;
+   }
+
+   ool[numOOL] = val;
+
+   return numOOL++;
+}
+
+static int oolRun(int len, uint32_t val)
+{
+   int pos, i;
+
+   /* len OOL in one page, a DMA copy can't cross pages */
+
+   if (((numOOL % PI_WAVE_IMAGE_OOL_PAGE) + len) > PI_WAVE_IMAGE_OOL_PAGE)
+   {
+      while (numOOL % PI_WAVE_IMAGE_OOL_PAGE) newOOL(0, 0);
+   }
+
+   pos = numOOL;
+
+   for (i=0; i<len; i++) newOOL(val, 1);
+
+   return pos;
+}
+
+static void delayCB(uint32_t micros)
+{
+   if (micros)
+      newCB(PI_WI_CB_PACED, PERI_REF(PI_WI_PERI_DATA),
+         PERI_REF(PI_WI_PERI_PACE), 4 * micros);
+}
+
+static uint64_t emitWave(entry_t *e)
+{
+   gpioPulse_t *p;
+   uint64_t micros;
+   int i;
+
+   micros = 0;
+
+   for (i=0; i<e->numPulses; i++)
+   {
+      p = &e->pulses[i];
+
+      if (p->gpioOn)
+         newCB(PI_WI_CB_COPY, OOL_REF(newOOL(p->gpioOn, 0)),
+            PERI_REF(PI_WI_PERI_SET), 4);
+
+      if (p->gpioOff)
+         newCB(PI_WI_CB_COPY, OOL_REF(newOOL(p->gpioOff, 0)),
+            PERI_REF(PI_WI_PERI_CLR), 4);
+
+      delayCB(p->usDelay);
+
+      micros += p->usDelay;
+   }
+
+   return micros;
+}
+
+static void loopStart(loop_t *l)
+{
+   int b;
+
+   /* reload the counter from its saved copy each time round */
+
+   l->blocks = 0;
+
+   if (l->count > 1)
+   {
+      b = l->count - 1;
+
+      do {l->blocks++; b /= LOOP_BLKLEN;} while (b);
+
+      for (b=0; b<l->blocks; b++)
+      {
+         l->ring[b]  = oolRun(LOOP_BLKLEN+1, 0);
+         l->saved[b] = oolRun(LOOP_BLKLEN, 0);
+
+         newCB(PI_WI_CB_BLOCK, OOL_REF(l->saved[b]), OOL_REF(l->ring[b]),
+            LOOP_BLKLEN*4);
+      }
+   }
+
+   l->bodyCB = numCB;
+}
+
+static int loopEnd(loop_t *l)
+{
+   int b, dig, baseCB, count, cb;
+   uint32_t repeat;
+
+   /*
+      The counter pigpio builds for a repeated wave.  Each block's
+      cbs pop the bottom of its ring into the next of its last cb
+      and rotate the ring.
+   */
+
+   if (!l->blocks) return 0;
+
+   baseCB = numCB;
+   repeat = CB_REF(l->bodyCB, 0);
+
+   for (b=0; b<l->blocks; b++)
+   {
+      for (dig=0; dig<LOOP_BLKLEN; dig++) ool[l->ring[b]+dig] = repeat;
+
+      ool[l->ring[b]+LOOP_BLKLEN] = CB_REF(baseCB+(b*3)+3, 0);
+   }
+
+   count = l->count - 1;
+
+   for (b=0; count && (b<l->blocks); b++)
+   {
+      dig = count % LOOP_BLKLEN;
+      count /= LOOP_BLKLEN;
+
+      if (count) ool[l->ring[b]+dig] = ool[l->ring[b]+LOOP_BLKLEN];
+      else       ool[l->ring[b]+dig] = CB_REF(baseCB+(3*l->blocks), 0);
+   }
+
+   for (b=0; b<l->blocks; b++)
+   {
+      memcpy(&ool[l->saved[b]], &ool[l->ring[b]], LOOP_BLKLEN*4);
+
+      newCB(PI_WI_CB_COPY, OOL_REF(l->ring[b]), CB_REF(numCB+2, 20), 4);
+
+      newCB(PI_WI_CB_COPY, OOL_REF(l->ring[b]),
+         OOL_REF(l->ring[b]+LOOP_BLKLEN), 4);
+
+      cb = newCB(PI_WI_CB_BLOCK, OOL_REF(l->ring[b]+1),
+         OOL_REF(l->ring[b]), LOOP_BLKLEN*4);
+
+      cbs[cb].next = repeat;
+   }
+
+   return 1;
+}
+
+static int findWave(char *name)
+{
+   int i;
+
+   for (i=0; i<numEntries; i++)
+   {
+      if (!entry[i].isChain && !strcmp(entry[i].name, name)) return i;
+   }
+
+   return -1;
+}
+
+static void beginEntry(void)
+{
+   gpioWaveImageWave_t *w;
+
+   wave = realloc(wave, (numEntries+1) * sizeof(gpioWaveImageWave_t));
+
+   if (wave == NULL) fatal("out of memory");
+
+   w = &wave[numEntries];
+
+   w->botCB  = numCB;
+   w->botOOL = numOOL;
+
+   /* the leading delay skipped by a repeat or a chain */
+
+   delayCB(20);
+}
+
+static void endEntry(uint64_t micros, int needNop, int scratch)
+{
+   gpioWaveImageWave_t *w;
+
+   w = &wave[numEntries];
+
+   /*
+      A counter exits to the cb after it and its next is dynamic, and
+      a loop forever jumps back to its start.  As a send or a chain
+      repoints the last cb, end on a cb which does nothing.
+   */
+
+   if (needNop)
+      newCB(PI_WI_CB_COPY, OOL_REF(scratch), OOL_REF(scratch), 4);
+
+   cbs[numCB-1].next = 0;
+
+   w->topCB  = numCB - 1;
+   w->topOOL = numOOL;
+   w->micros = micros;
+}
+
+static char *nextLine(FILE *in, char *buf, int size)
+{
+   char *p;
+
+   while (fgets(buf, size, in))
+   {
+      lineNum++;
+
+      if (!strchr(buf, '\n') && !feof(in)) fatal("line too long");
+
+      if ((p = strchr(buf, '#'))) *p = 0;
+
+      p = strtok(buf, " \t\r\n");
+
+      if (p) return p;
+   }
+
+   return NULL;
+}
+
+static uint32_t number(char *tok, uint32_t max)
+{
+   char *end;
+   unsigned long v;
+
+   if (tok == NULL) fatal("number missing");
+
+   v = strtoul(tok, &end, 0);
+
+   if (*end || (v > max)) fatal("bad number (%s)", tok);
+
+   return v;
+}
+
+static void compileWave(FILE *in, entry_t *e)
+{
+   char line[MAX_LINE], *tok;
+   int max;
+
+   max = 0;
+
+   while ((tok = nextLine(in, line, sizeof(line))))
+   {
+      if (!strcmp(tok, "end"))
+      {
+         beginEntry();
+         endEntry(emitWave(e), 0, 0);
+         return;
+      }
+
+      e->pulses = grow(e->pulses, &max, e->numPulses+1, sizeof(gpioPulse_t));
+
+      e->pulses[e->numPulses].gpioOn  = number(tok, 0xFFFFFFFF);
+      e->pulses[e->numPulses].gpioOff = number(strtok(NULL, " \t\r\n"),
+         0xFFFFFFFF);
+      e->pulses[e->numPulses].usDelay = number(strtok(NULL, " \t\r\n"),
+         0x0FFFFFFF);
+
+      e->numPulses++;
+   }
+
+   fatal("wave %s not ended", e->name);
+}
+
+static void compileChain(FILE *in, entry_t *e)
+{
+   char line[MAX_LINE], *tok;
+   item_t *item;
+   loop_t *l, loop[MAX_DEPTH];
+   uint64_t micros;
+   int numItems, maxItems, stack[MAX_DEPTH];
+   int i, depth, nopEnd, scratch;
+
+   /* gather the chain, then give each loop start its count */
+
+   item = NULL;
+   numItems = 0;
+   maxItems = 0;
+   depth = 0;
+
+   while ((tok = nextLine(in, line, sizeof(line))))
+   {
+      if (!strcmp(tok, "end")) break;
+
+      for (; tok; tok=strtok(NULL, " \t\r\n"))
+      {
+         item = grow(item, &maxItems, numItems+1, sizeof(item_t));
+
+         i = numItems++;
+
+         if ((i > 0) && (item[i-1].type == ITEM_FOREVER))
+            fatal("forever not last");
+
+         if (!strcmp(tok, "loop"))
+         {
+            if (depth >= MAX_DEPTH) fatal("loops nested too deep");
+
+            item[i].type = ITEM_LOOP;
+            stack[depth++] = i;
+         }
+         else if (!strcmp(tok, "repeat"))
+         {
+            item[i].type = ITEM_REPEAT;
+            item[i].value = number(strtok(NULL, " \t\r\n"), LOOP_MAX_COUNT);
+
+            if (!item[i].value) fatal("bad repeat count");
+            if (!depth) fatal("repeat without loop");
+
+            item[stack[--depth]].value = item[i].value;
+         }
+         else if (!strcmp(tok, "forever"))
+         {
+            if (depth != 1) fatal("forever not outermost");
+
+            item[i].type = ITEM_FOREVER;
+            item[stack[--depth]].value = 0;
+         }
+         else if (!strcmp(tok, "delay"))
+         {
+            item[i].type = ITEM_DELAY;
+            item[i].value = number(strtok(NULL, " \t\r\n"), 0x0FFFFFFF);
+         }
+         else
+         {
+            item[i].type = ITEM_WAVE;
+            item[i].value = findWave(tok);
+
+            if (item[i].value < 0) fatal("unknown wave (%s)", tok);
+         }
+      }
+   }
+
+   if (tok == NULL) fatal("chain %s not ended", e->name);
+
+   if (depth) fatal("%d loops not closed", depth);
+
+   beginEntry();
+
+   scratch = newOOL(0, 0);
+
+   micros = 0;
+   depth = 0;
+   nopEnd = -1;
+
+   for (i=0; i<numItems; i++)
+   {
+      switch (item[i].type)
+      {
+         case ITEM_WAVE:
+            micros += emitWave(&entry[item[i].value]);
+            break;
+
+         case ITEM_DELAY:
+            delayCB(item[i].value);
+            micros += item[i].value;
+            break;
+
+         case ITEM_LOOP:
+            l = &loop[depth++];
+            l->count = item[i].value;
+            l->micros = micros;
+            micros = 0;
+            loopStart(l);
+            break;
+
+         case ITEM_REPEAT:
+            l = &loop[--depth];
+            if (loopEnd(l)) nopEnd = numCB;
+            micros = l->micros + (micros * l->count);
+            break;
+
+         case ITEM_FOREVER:
+            l = &loop[--depth];
+            newCB(PI_WI_CB_COPY, OOL_REF(scratch), OOL_REF(scratch), 4);
+            cbs[numCB-1].next = CB_REF(l->bodyCB, 0);
+            nopEnd = numCB;
+            micros += l->micros;
+            break;
+      }
+   }
+
+   endEntry(micros, nopEnd == numCB, scratch);
+
+   free(item);
+}
+
+static void usage(void)
+{
+   fprintf(stderr, "Usage: pigwave [-o image] [source]\n");
+   exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+   gpioWaveImage_t img;
+   FILE *in, *out;
+   char line[MAX_LINE], *tok, *name, *image;
+   entry_t *e;
+   uint64_t totMicros;
+   int opt, maxEntries, cb, ol;
+
+   image = "waves.pwi";
+
+   while ((opt = getopt(argc, argv, "o:")) != -1)
+   {
+      if (opt == 'o') image = optarg;
+      else usage();
+   }
+
+   if (optind < (argc-1)) usage();
+
+   in = stdin;
+
+   if (optind < argc)
+   {
+      source = argv[optind];
+
+      in = fopen(source, "r");
+
+      if (in == NULL)
+      {
+         fprintf(stderr, "can't open %s\n", source);
+         return 1;
+      }
+   }
+
+   maxEntries = 0;
+
+   while ((tok = nextLine(in, line, sizeof(line))))
+   {
+      name = strtok(NULL, " \t\r\n");
+
+      if ((name == NULL) || (strlen(name) >= MAX_NAME))
+         fatal("bad name");
+
+      if (strcmp(tok, "wave") && strcmp(tok, "chain"))
+         fatal("expected wave or chain (%s)", tok);
+
+      if (numEntries >= PI_MAX_WAVES) fatal("too many waves");
+
+      entry = grow(entry, &maxEntries, numEntries+1, sizeof(entry_t));
+
+      e = &entry[numEntries];
+
+      memset(e, 0, sizeof(entry_t));
+
+      strcpy(e->name, name);
+
+      e->isChain = !strcmp(tok, "chain");
+
+      if (e->isChain) compileChain(in, e);
+      else            compileWave(in, e);
+
+      numEntries++;
+   }
+
+   if (!numEntries) fatal("no waves");
+
+   img.magic     = PI_WAVE_IMAGE_MAGIC;
+   img.oolPage   = PI_WAVE_IMAGE_OOL_PAGE;
+   img.numWaves  = numEntries;
+   img.numCB     = numCB;
+   img.numOOL    = numOOL;
+   img.numRelocs = numRelocs;
+
+   out = fopen(image, "wb");
+
+   if ((out == NULL) ||
+       (fwrite(&img, sizeof(img), 1, out) != 1) ||
+       (fwrite(wave, sizeof(gpioWaveImageWave_t), numEntries, out) !=
+          numEntries) ||
+       (fwrite(cbs, sizeof(gpioWaveImageCb_t), numCB, out) != numCB) ||
+       (fwrite(ool, sizeof(uint32_t), numOOL, out) != numOOL) ||
+       (fwrite(reloc, sizeof(uint32_t), numRelocs, out) != numRelocs) ||
+       fclose(out))
+   {
+      fprintf(stderr, "can't write %s\n", image);
+      return 1;
+   }
+
+   /* id name cbs ool micros */
+
+   totMicros = 0;
+
+   for (opt=0; opt<numEntries; opt++)
+   {
+      cb = wave[opt].topCB - wave[opt].botCB + 1;
+      ol = wave[opt].topOOL - wave[opt].botOOL;
+
+      printf("%d %s %d %d %llu\n", opt, entry[opt].name, cb, ol,
+         (unsigned long long)wave[opt].micros);
+
+      totMicros += wave[opt].micros;
+   }
+
+   printf("total %d %d %llu\n", numCB, numOOL, (unsigned long long)totMicros);
+
+   return 0;
+}
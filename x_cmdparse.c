@@ -0,0 +1,526 @@
+/*
+gcc -o x_cmdparse x_cmdparse.c command.c
+./x_cmdparse [seconds]
+
+Micro-benchmark for the command parser used by the pipe interface,
+pigs, and the script compiler.
+
+It parses a fixed mix of command lines with cmdParse and reports
+parsed commands per second.  For comparison it also runs the lookup
+and numeric scanning the parser used to do (a linear strcasecmp scan
+of cmdInfo and up to three sscanf calls per parameter) over the same
+lines, and checks that both agree on the command and its first two
+parameters.
+
+The script optimiser is checked by compiling scripts which exercise
+each of its passes (jump threading, removal of unreachable steps,
+constant folding, LDA/STA elision, and compare or decrement and jump
+fusion) with and without optimisation.  Both are run by a small model
+of the script interpreter over a range of parameters and must agree
+on A, the vars, the params, and the commands issued.
+
+No pigpio daemon or hardware is needed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "pigpio.h"
+#include "command.h"
+
+static char *lines[]=
+{
+   "pwm 4 128",
+   "PWM 17 255",
+   "servo 18 1500",
+   "w 4 1",
+   "r 4",
+   "bs1 0x10",
+   "bc1 0x00FFFF00",
+   "br1",
+   "tick",
+   "gdc 4",
+   "modes 4 w",
+   "pud 4 u",
+   "i2crb 0 0x20",
+   "i2cwb 0 0x20 0xff",
+   "spix 0 1 2 3 4 5 6 7 8",
+   "wvclr",
+   "wvcre",
+   "wvtx 0",
+   "mils 100",
+   "ld v1 p3",
+   "add v0",
+   "tag 100",
+   "jnz 100",
+   "prs 4 1000",
+   "pfs 4 800",
+};
+
+#define LINES (sizeof(lines)/sizeof(char *))
+
+typedef struct
+{
+   char    *name;
+   char    *text;
+   uint32_t cmd; /* a command the optimised script must hold, or 0 */
+} optCase_t;
+
+static optCase_t optCases[]=
+{
+   {"thread",
+    "lda p0 jz 1 w 4 1 tag 1 jz 2 w 4 0 jmp 3 tag 2 jmp 4 "
+    "tag 3 w 5 1 tag 4 sta v0", 0},
+
+   {"dead",
+    "lda p0 jmp 1 w 4 1 add 7 tag 1 sta v0 halt w 6 1 sta v1", 0},
+
+   {"fold",
+    "lda p0 add 3 sub 1 mlt 2 mlt 3 xor 5 xor 6 rla 1 rla 2 sta v0 "
+    "lda 4 add 6 sta v1 lda p1 add 0 or 0 sta v2 "
+    "lda p0 add 0 jz 1 w 4 1 tag 1", 0},
+
+   {"elide",
+    "lda p0 sta v0 lda v0 sta v0 sta v0 lda 3 lda p1 sta v1 "
+    "lda v1 add v0 sta v2", 0},
+
+   {"fuse",
+    "lda p0 and 7 add 1 sta v0 tag 1 inr v1 w 4 1 dcr v0 jnz 1 "
+    "lda v1 cmp 3 jz 2 cmp 5 jm 3 cmp 7 jp 4 w 5 0 halt "
+    "tag 2 w 5 1 halt tag 3 w 6 1 halt "
+    "tag 4 w 7 1 cmp 8 jnz 5 halt tag 5 w 8 1", CMD_DCRJNZ},
+
+   {"call",
+    "lda p0 and 3 add 1 sta v0 tag 1 call 9 dcr v0 jnz 1 halt "
+    "tag 9 inr v1 w 4 1 w 4 0 lda v1 rla 0 sta v2 ret", CMD_DCRJNZ},
+};
+
+#define OPT_CASES (sizeof(optCases)/sizeof(optCase_t))
+
+#define OPT_STEPS 100000
+#define OPT_TRACE 256
+#define OPT_STACK 64
+
+#define OPT_END     0 /* ran past the last step */
+#define OPT_HALT    1
+#define OPT_LIMIT   2 /* still running after OPT_STEPS */
+#define OPT_UNKNOWN 3 /* a command the model doesn't handle */
+
+typedef struct
+{
+   int      end;
+   int      steps;
+   int      A;
+   int      var[PI_MAX_SCRIPT_VARS];
+   int      par[PI_MAX_SCRIPT_PARAMS];
+   int      numTrace;
+   uint32_t trace[OPT_TRACE][3];
+} optRun_t;
+
+static int legacyMatch(char *str)
+{
+   int i;
+
+   for (i=0; i<cmdInfoEntries; i++)
+   {
+      if (strcasecmp(str, cmdInfo[i].name) == 0) return i;
+   }
+   return CMD_UNKNOWN_CMD;
+}
+
+static int legacyGetNum(char *str, unsigned *val, int8_t *opt)
+{
+   int f, n;
+   unsigned v;
+
+   *opt = 0;
+
+   f = sscanf(str, " %i %n", &v, &n);
+
+   if (f == 1)
+   {
+      *val = v;
+      *opt = CMD_NUMERIC;
+      return n;
+   }
+
+   f = sscanf(str, " v%i %n", &v, &n);
+
+   if (f == 1)
+   {
+      *val = v;
+      *opt = CMD_VAR;
+      return n;
+   }
+
+   f = sscanf(str, " p%i %n", &v, &n);
+
+   if (f == 1)
+   {
+      *val = v;
+      *opt = CMD_PAR;
+      return n;
+   }
+
+   return 0;
+}
+
+static int legacyParse(char *buf, uint32_t *p)
+{
+   char name[32];
+   int idx, pp, n, i;
+   int8_t opt;
+
+   pp = 0;
+
+   sscanf(buf, " %31s %n", name, &pp);
+
+   idx = legacyMatch(name);
+
+   if (idx < 0) return idx;
+
+   p[0] = cmdInfo[idx].cmd;
+   p[1] = 0;
+   p[2] = 0;
+
+   for (i=1; i<CMD_P_ARR; i++)
+   {
+      n = legacyGetNum(buf+pp, &p[i < 3 ? i : 3], &opt);
+      if (!n) break;
+      pp += n;
+   }
+
+   return idx;
+}
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec + (ts.tv_nsec / 1E9);
+}
+
+static double timeParse(int legacy, double seconds)
+{
+   uint32_t p[CMD_P_ARR];
+   char v[CMD_MAX_EXTENSION];
+   cmdCtlParse_t ctl;
+   double start, elapsed;
+   long count;
+   int i;
+
+   count = 0;
+   start = now();
+
+   do
+   {
+      for (i=0; i<LINES; i++)
+      {
+         if (legacy) legacyParse(lines[i], p);
+         else
+         {
+            ctl.eaten = 0;
+            cmdParse(lines[i], p, sizeof(v), v, &ctl);
+         }
+      }
+
+      count += LINES;
+
+      elapsed = now() - start;
+
+   } while (elapsed < seconds);
+
+   return count / elapsed;
+}
+
+static int *optOperand(optRun_t *r, int opt, uint32_t val, int *imm)
+{
+   if ((opt == CMD_VAR) && (val < PI_MAX_SCRIPT_VARS)) return &r->var[val];
+
+   if ((opt == CMD_PAR) && (val < PI_MAX_SCRIPT_PARAMS)) return &r->par[val];
+
+   *imm = val;
+
+   return imm;
+}
+
+static int *optLvalue(optRun_t *r, int opt, uint32_t val)
+{
+   if (opt == CMD_PAR)
+   {
+      if (val < PI_MAX_SCRIPT_PARAMS) return &r->par[val];
+   }
+   else if (val < PI_MAX_SCRIPT_VARS) return &r->var[val];
+
+   return &r->var[0];
+}
+
+static void optRun(cmdScript_t *s, int *par, optRun_t *r)
+{
+   cmdInstr_t *in;
+   uint32_t cmd;
+   int pc, F, i1, i2, sp, t, *a1, *a2, stack[OPT_STACK];
+
+   /*
+      Runs a compiled script as pigpio's interpreter would.  Commands
+      other than the script's own are not issued, they are recorded
+      and A and F set to a value which depends on their parameters.
+   */
+
+   memset(r, 0, sizeof(optRun_t));
+   memcpy(r->par, par, sizeof(r->par));
+
+   F = 0;
+   pc = 0;
+   sp = 0;
+
+   while (pc < s->instrs)
+   {
+      if (++r->steps > OPT_STEPS) {r->end = OPT_LIMIT; return;}
+
+      in  = &s->instr[pc++];
+      cmd = in->p[0];
+
+      a1 = optOperand(r, in->opt[1], in->p[1], &i1);
+      a2 = optOperand(r, in->opt[2], in->p[2], &i2);
+
+      if (cmd < PI_CMD_SCRIPT)
+      {
+         if (r->numTrace < OPT_TRACE)
+         {
+            r->trace[r->numTrace][0] = cmd;
+            r->trace[r->numTrace][1] = *a1;
+            r->trace[r->numTrace][2] = *a2;
+            r->numTrace++;
+         }
+
+         F = r->A = (cmd * 1000) + *a1;
+         continue;
+      }
+
+      switch (cmd)
+      {
+         case PI_CMD_ADD:  r->A = (unsigned)r->A + *a1; F = r->A; break;
+         case PI_CMD_AND:  r->A &= *a1; F = r->A;                 break;
+         case PI_CMD_CMP:  F = (unsigned)r->A - *a1;              break;
+         case PI_CMD_DCRA: r->A = (unsigned)r->A - 1; F = r->A;  break;
+         case PI_CMD_INRA: r->A = (unsigned)r->A + 1; F = r->A;  break;
+         case PI_CMD_LDA:  r->A = *a1;                            break;
+         case PI_CMD_MLT:  r->A = (unsigned)r->A * *a1; F = r->A; break;
+         case PI_CMD_NOP:                                         break;
+         case PI_CMD_OR:   r->A |= *a1; F = r->A;                 break;
+         case PI_CMD_RLA:  r->A = (unsigned)r->A << *a1; F = r->A; break;
+         case PI_CMD_RRA:  r->A >>= *a1; F = r->A;                break;
+         case PI_CMD_SUB:  r->A = (unsigned)r->A - *a1; F = r->A; break;
+         case PI_CMD_XOR:  r->A ^= *a1; F = r->A;                 break;
+
+         case PI_CMD_DCR:
+            a1 = optLvalue(r, in->opt[1], in->p[1]);
+            F = *a1 = (unsigned)*a1 - 1;
+            break;
+
+         case PI_CMD_INR:
+            a1 = optLvalue(r, in->opt[1], in->p[1]);
+            F = *a1 = (unsigned)*a1 + 1;
+            break;
+
+         case PI_CMD_LD:
+            *optLvalue(r, in->opt[1], in->p[1]) = *a2;
+            break;
+
+         case PI_CMD_STA:
+            *optLvalue(r, in->opt[1], in->p[1]) = r->A;
+            break;
+
+         case PI_CMD_JMP:               pc = in->p[1]; break;
+         case PI_CMD_JM:  if (F < 0)    pc = in->p[1]; break;
+         case PI_CMD_JNZ: if (F)        pc = in->p[1]; break;
+         case PI_CMD_JP:  if (F >= 0)   pc = in->p[1]; break;
+         case PI_CMD_JZ:  if (!F)       pc = in->p[1]; break;
+
+         case CMD_CMPJZ:
+            F = (unsigned)r->A - *a1; if (!F) pc = in->p[2];
+            break;
+
+         case CMD_CMPJNZ:
+            F = (unsigned)r->A - *a1; if (F) pc = in->p[2];
+            break;
+
+         case CMD_CMPJM:
+            F = (unsigned)r->A - *a1; if (F < 0) pc = in->p[2];
+            break;
+
+         case CMD_CMPJP:
+            F = (unsigned)r->A - *a1; if (F >= 0) pc = in->p[2];
+            break;
+
+         case CMD_DCRJNZ:
+            a1 = optLvalue(r, in->opt[1], in->p[1]);
+            F = *a1 = (unsigned)*a1 - 1;
+            if (F) pc = in->p[2];
+            break;
+
+         case PI_CMD_CALL:
+            if (sp < OPT_STACK) stack[sp++] = pc;
+            pc = in->p[1];
+            break;
+
+         case PI_CMD_RET:
+            if (sp) t = stack[--sp]; else t = s->instrs;
+            pc = t;
+            break;
+
+         case PI_CMD_HALT:
+            r->end = OPT_HALT;
+            return;
+
+         default:
+            r->end = OPT_UNKNOWN;
+            return;
+      }
+   }
+
+   r->end = OPT_END;
+}
+
+static int optSameRun(optRun_t *a, optRun_t *b)
+{
+   /* F may differ, the optimiser only keeps an F a later step tests */
+
+   return (a->end == b->end) && (a->A == b->A) &&
+          (a->numTrace == b->numTrace) &&
+          !memcmp(a->var, b->var, sizeof(a->var)) &&
+          !memcmp(a->par, b->par, sizeof(a->par)) &&
+          !memcmp(a->trace, b->trace, a->numTrace * sizeof(a->trace[0]));
+}
+
+static int optCheck(void)
+{
+   static int params[][2]={{0, 0}, {1, 7}, {2, 0}, {5, 7}, {10, 3},
+                           {-3, 1}, {6, -1}, {0x7fffffff, 8}};
+   static optRun_t plain, opt;
+   cmdScript_t ps, os;
+   int par[PI_MAX_SCRIPT_PARAMS];
+   int i, j, k, runs, bad, has;
+
+   bad = 0;
+
+   for (i=0; i<OPT_CASES; i++)
+   {
+      cmdOptimise = 0;
+      k = cmdParseScript(optCases[i].text, &ps, 1);
+      cmdOptimise = 1;
+
+      if (k || cmdParseScript(optCases[i].text, &os, 1))
+      {
+         fprintf(stderr, "OPTIMISER %s doesn't compile\n", optCases[i].name);
+         bad++;
+         continue;
+      }
+
+      has = (optCases[i].cmd == 0);
+
+      for (j=0; j<os.instrs; j++)
+      {
+         if (os.instr[j].p[0] == optCases[i].cmd) has = 1;
+      }
+
+      if ((os.instrs >= ps.instrs) || !has)
+      {
+         fprintf(stderr, "OPTIMISER %s not optimised (%d steps to %d)\n",
+            optCases[i].name, ps.instrs, os.instrs);
+         bad++;
+      }
+
+      runs = 0;
+
+      for (j=0; j<(sizeof(params)/sizeof(params[0])); j++)
+      {
+         memset(par, 0, sizeof(par));
+         par[0] = params[j][0];
+         par[1] = params[j][1];
+
+         optRun(&ps, par, &plain);
+         optRun(&os, par, &opt);
+
+         if ((plain.end > OPT_HALT) || !optSameRun(&plain, &opt))
+         {
+            fprintf(stderr, "OPTIMISER %s p0=%d p1=%d: end %d/%d A %d/%d "
+               "commands %d/%d\n", optCases[i].name, par[0], par[1],
+               plain.end, opt.end, plain.A, opt.A,
+               plain.numTrace, opt.numTrace);
+            bad++;
+         }
+         else runs++;
+      }
+
+      printf("optimiser %-6s %2d steps to %2d, %d runs agree\n",
+         optCases[i].name, ps.instrs, os.instrs, runs);
+
+      free(ps.par);
+      free(os.par);
+   }
+
+   return bad;
+}
+
+static int check(void)
+{
+   uint32_t p[CMD_P_ARR], q[CMD_P_ARR];
+   char v[CMD_MAX_EXTENSION];
+   cmdCtlParse_t ctl;
+   int i, idx, bad;
+
+   bad = 0;
+
+   for (i=0; i<LINES; i++)
+   {
+      ctl.eaten = 0;
+      idx = cmdParse(lines[i], p, sizeof(v), v, &ctl);
+
+      legacyParse(lines[i], q);
+
+      /* MODES/PUD take letters, 19x commands pack data into ext */
+
+      if ((idx < 0) || (p[0] != q[0]) ||
+         ((cmdInfo[idx].vt != 125) && (cmdInfo[idx].vt != 126) &&
+          (cmdInfo[idx].vt < 190) && ((p[1] != q[1]) || (p[2] != q[2]))))
+      {
+         fprintf(stderr, "MISMATCH [%s] %d %d %d / %d %d %d\n",
+            lines[i], p[0], p[1], p[2], q[0], q[1], q[2]);
+         bad++;
+      }
+   }
+
+   return bad;
+}
+
+int main(int argc, char *argv[])
+{
+   double seconds, before, after;
+   int bad;
+
+   seconds = 2.0;
+
+   if (argc > 1) seconds = atof(argv[1]);
+
+   bad = check();
+
+   bad += optCheck();
+
+   before = timeParse(1, seconds);
+   after  = timeParse(0, seconds);
+
+   printf("legacy scan  %10.0f commands/s\n", before);
+   printf("cmdParse     %10.0f commands/s (x%.1f)\n", after, after/before);
+
+   if (bad) fprintf(stderr, "PARSE CHECK FAILED (%d)\n", bad);
+   else printf("PARSE CHECK PASS\n");
+
+   return bad ? 1 : 0;
+}
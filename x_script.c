@@ -0,0 +1,136 @@
+/*
+gcc -o x_script x_script.c -lpigpiod_if -lrt -lpthread
+./x_script [seconds [gpio]]
+
+*** WARNING ************************************************
+*                                                          *
+* The bit-bang loop toggles gpio 4 (or the gpio given).    *
+* Ensure that either nothing or just a LED is connected to *
+* it before running the benchmark.                         *
+************************************************************
+
+Script interpreter benchmark for pigpiod.
+
+Each script is a tight loop which counts p0 down to zero.  The
+loop is first run briefly to size p0 so that the timed run lasts
+about the requested number of seconds, then the interpreter
+throughput is reported in script instructions per second.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pigpiod_if.h"
+
+typedef struct
+{
+   char *name;
+   char *text;
+   int   perLoop; /* instructions per loop iteration */
+} bench_t;
+
+static bench_t bench[]=
+{
+   {"count",  "ld v0 p0 tag 1 dcr v0 jnz 1", 2},
+
+   {"alu",    "ld v0 p0 tag 1 lda v0 add 3 and 255 xor 85 sta v1 "
+              "dcr v0 jnz 1", 7},
+
+   {"call",   "ld v0 p0 tag 1 call 2 dcr v0 jnz 1 halt "
+              "tag 2 inr v1 ret", 5},
+
+   {"bitbang","ld v0 p0 tag 1 w p1 1 w p1 0 r p1 dcr v0 jnz 1", 5},
+};
+
+#define BENCHES (sizeof(bench)/sizeof(bench_t))
+
+static double runLoop(int sid, uint32_t loops, uint32_t gpio)
+{
+   uint32_t param[PI_MAX_SCRIPT_PARAMS];
+   double start;
+   int status;
+
+   param[0] = loops;
+   param[1] = gpio;
+
+   while (script_status(sid, NULL) != PI_SCRIPT_HALTED) time_sleep(0.01);
+
+   start = time_time();
+
+   if (run_script(sid, 2, param) < 0) return -1.0;
+
+   do
+   {
+      time_sleep(0.001);
+      status = script_status(sid, NULL);
+   }
+   while ((status == PI_SCRIPT_RUNNING) || (status == PI_SCRIPT_WAITING));
+
+   if (status != PI_SCRIPT_HALTED) return -1.0;
+
+   return time_time() - start;
+}
+
+int main(int argc, char *argv[])
+{
+   double seconds, t;
+   uint32_t loops, gpio;
+   int i, sid, bad;
+
+   seconds = 2.0;
+   gpio = 4;
+
+   if (argc > 1) seconds = atof(argv[1]);
+   if (argc > 2) gpio = atoi(argv[2]);
+
+   if (pigpio_start(0, 0) < 0)
+   {
+      fprintf(stderr, "can't connect to pigpiod\n");
+      return 1;
+   }
+
+   set_mode(gpio, PI_OUTPUT);
+
+   bad = 0;
+
+   for (i=0; i<BENCHES; i++)
+   {
+      sid = store_script(bench[i].text);
+
+      if (sid < 0)
+      {
+         fprintf(stderr, "%-8s store failed (%d)\n", bench[i].name, sid);
+         bad++;
+         continue;
+      }
+
+      /* size the timed run from a short one */
+
+      loops = 100000;
+
+      t = runLoop(sid, loops, gpio);
+
+      if (t > 0.0) loops = loops * (seconds / t);
+
+      t = runLoop(sid, loops, gpio);
+
+      if (t > 0.0)
+      {
+         printf("%-8s %10.0f instructions/s\n",
+            bench[i].name, ((double)loops * bench[i].perLoop) / t);
+      }
+      else
+      {
+         fprintf(stderr, "%-8s run failed\n", bench[i].name);
+         bad++;
+      }
+
+      delete_script(sid);
+   }
+
+   gpio_write(gpio, 0);
+
+   pigpio_stop();
+
+   return bad ? 1 : 0;
+}
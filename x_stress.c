@@ -0,0 +1,345 @@
+/*
+gcc -o x_stress x_stress.c -lpthread
+./x_stress [seconds [i2c_bus i2c_addr]]
+
+*** WARNING ************************************************
+*                                                          *
+* The PWM workers drive gpios 4, 17, 22, and 27.  Ensure   *
+* that either nothing or just a LED is connected to each   *
+* of them before running the benchmark.                    *
+*                                                          *
+* The wave worker transmits nothing but builds and         *
+* deletes waveforms on gpio 4.                             *
+*                                                          *
+* The I2C workers only run if a bus and address are given  *
+* and just read byte register 0 of that device.            *
+************************************************************
+
+Multi-threaded stress benchmark for pigpiod.
+
+Each worker opens its own socket so that its commands are executed by
+its own pigpiod thread.  Each subsystem is first exercised on its own
+and then all subsystems are exercised together.  Independent subsystems
+should keep (most of) their stand-alone throughput when run together
+and no worker should ever read back a value it did not write.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "pigpio.h"
+#include "command.h"
+
+#define PWM_WORKERS 4
+#define I2C_WORKERS 2
+#define BR_WORKERS  2
+
+#define W_PWM  0
+#define W_WAVE 1
+#define W_I2C  2
+#define W_BR   3
+#define W_TYPES 4
+
+static char *typeName[W_TYPES] = {"PWM", "wave", "I2C", "BR1"};
+
+static unsigned pwmGpio[PWM_WORKERS] = {4, 17, 22, 27};
+
+static int i2cBus = -1, i2cAddr = -1;
+
+static volatile int running;
+
+typedef struct
+{
+   int      type;
+   int      index;
+   uint32_t ops;
+   uint32_t errors;
+   uint32_t corrupt;
+} worker_t;
+
+static int openSocket(void)
+{
+   int sock, err;
+   struct addrinfo hints, *res, *rp;
+   const char *addrStr, *portStr;
+
+   portStr = getenv(PI_ENVPORT);
+
+   if (!portStr) portStr = PI_DEFAULT_SOCKET_PORT_STR;
+
+   addrStr = getenv(PI_ENVADDR);
+
+   if (!addrStr) addrStr = PI_DEFAULT_SOCKET_ADDR_STR;
+
+   memset (&hints, 0, sizeof (hints));
+
+   hints.ai_family   = PF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   err = getaddrinfo(addrStr, portStr, &hints, &res);
+
+   if (err) return -1;
+
+   for (rp=res; rp!=NULL; rp=rp->ai_next)
+   {
+      sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+
+      if (sock == -1) continue;
+
+      if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) break;
+
+      close(sock);
+   }
+
+   freeaddrinfo(res);
+
+   if (rp == NULL) return -1;
+
+   return sock;
+}
+
+static int command(int sock, unsigned cmd, unsigned p1, unsigned p2,
+                   unsigned extLen, void *ext)
+{
+   cmdCmd_t c;
+
+   c.cmd = cmd;
+   c.p1  = p1;
+   c.p2  = p2;
+   c.p3  = extLen;
+
+   if (send(sock, &c, sizeof(c), 0) != sizeof(c)) return PI_SOCK_WRIT_FAILED;
+
+   if (extLen)
+      if (send(sock, ext, extLen, 0) != extLen) return PI_SOCK_WRIT_FAILED;
+
+   if (recv(sock, &c, sizeof(c), MSG_WAITALL) != sizeof(c))
+      return PI_SOCK_READ_FAILED;
+
+   return c.res;
+}
+
+static void doPWM(int sock, worker_t *w)
+{
+   unsigned gpio, dc;
+   int res;
+
+   gpio = pwmGpio[w->index];
+   dc = (w->ops * 7 + w->index) & 255;
+
+   if (command(sock, PI_CMD_PWM, gpio, dc, 0, NULL) < 0) w->errors++;
+
+   res = command(sock, PI_CMD_GDC, gpio, 0, 0, NULL);
+
+   if (res < 0) w->errors++;
+   else if (res != dc) w->corrupt++;
+}
+
+static void doWave(int sock, worker_t *w)
+{
+   gpioPulse_t pulse[2];
+   int wid;
+
+   pulse[0].gpioOn  = 1<<4;
+   pulse[0].gpioOff = 0;
+   pulse[0].usDelay = 10 + (w->ops & 15);
+
+   pulse[1].gpioOn  = 0;
+   pulse[1].gpioOff = 1<<4;
+   pulse[1].usDelay = 10;
+
+   command(sock, PI_CMD_WVCLR, 0, 0, 0, NULL);
+
+   if (command(sock, PI_CMD_WVAG, 0, 0, sizeof(pulse), pulse) != 2)
+      w->corrupt++;
+
+   if (command(sock, PI_CMD_WVSP, 0, 0, 0, NULL) != 2) w->corrupt++;
+
+   wid = command(sock, PI_CMD_WVCRE, 0, 0, 0, NULL);
+
+   if (wid < 0) w->errors++;
+   else
+   {
+      if (wid != 0) w->corrupt++; /* WVCLR released every wave */
+
+      if (command(sock, PI_CMD_WVDEL, wid, 0, 0, NULL) < 0) w->errors++;
+   }
+}
+
+static void doI2C(int sock, worker_t *w, int handle)
+{
+   if (command(sock, PI_CMD_I2CRB, handle, 0, 0, NULL) < 0) w->errors++;
+}
+
+static void doBR(int sock, worker_t *w)
+{
+   command(sock, PI_CMD_BR1, 0, 0, 0, NULL);
+}
+
+static void *worker(void *arg)
+{
+   worker_t *w = arg;
+   int sock, handle = -1;
+
+   sock = openSocket();
+
+   if (sock < 0)
+   {
+      w->errors++;
+      return NULL;
+   }
+
+   if (w->type == W_PWM)
+      command(sock, PI_CMD_MODES, pwmGpio[w->index], PI_OUTPUT, 0, NULL);
+
+   if (w->type == W_I2C)
+   {
+      handle = command(sock, PI_CMD_I2CO, i2cBus, i2cAddr, 4, "\0\0\0\0");
+
+      if (handle < 0)
+      {
+         w->errors++;
+         close(sock);
+         return NULL;
+      }
+   }
+
+   while (running)
+   {
+      switch (w->type)
+      {
+         case W_PWM:  doPWM(sock, w);          break;
+         case W_WAVE: doWave(sock, w);         break;
+         case W_I2C:  doI2C(sock, w, handle);  break;
+         case W_BR:   doBR(sock, w);           break;
+      }
+      w->ops++;
+   }
+
+   if (w->type == W_PWM)
+      command(sock, PI_CMD_PWM, pwmGpio[w->index], 0, 0, NULL);
+
+   if (handle >= 0) command(sock, PI_CMD_I2CC, handle, 0, 0, NULL);
+
+   close(sock);
+
+   return NULL;
+}
+
+static int addWorkers(worker_t *w, int n, int type)
+{
+   int count, i;
+
+   switch (type)
+   {
+      case W_PWM:  count = PWM_WORKERS;                 break;
+      case W_WAVE: count = 1;                           break;
+      case W_I2C:  count = (i2cBus >= 0) ? I2C_WORKERS : 0; break;
+      default:     count = BR_WORKERS;                  break;
+   }
+
+   for (i=0; i<count; i++)
+   {
+      memset(&w[n+i], 0, sizeof(worker_t));
+      w[n+i].type  = type;
+      w[n+i].index = i;
+   }
+
+   return n + count;
+}
+
+static int run(char *title, worker_t *w, int n, int seconds, double *rate)
+{
+   pthread_t thr[16];
+   uint32_t ops[W_TYPES], errors[W_TYPES], corrupt[W_TYPES];
+   int i, t, bad;
+
+   running = 1;
+
+   for (i=0; i<n; i++) pthread_create(&thr[i], NULL, worker, &w[i]);
+
+   sleep(seconds);
+
+   running = 0;
+
+   for (i=0; i<n; i++) pthread_join(thr[i], NULL);
+
+   memset(ops,     0, sizeof(ops));
+   memset(errors,  0, sizeof(errors));
+   memset(corrupt, 0, sizeof(corrupt));
+
+   for (i=0; i<n; i++)
+   {
+      ops[w[i].type]     += w[i].ops;
+      errors[w[i].type]  += w[i].errors;
+      corrupt[w[i].type] += w[i].corrupt;
+   }
+
+   bad = 0;
+
+   for (t=0; t<W_TYPES; t++)
+   {
+      if (!ops[t] && !errors[t]) continue;
+
+      rate[t] = (double)ops[t] / seconds;
+
+      printf("%-10s %-5s %9.0f ops/s  errors=%u  corrupt=%u\n",
+         title, typeName[t], rate[t], errors[t], corrupt[t]);
+
+      bad += corrupt[t];
+   }
+
+   return bad;
+}
+
+int main(int argc, char *argv[])
+{
+   worker_t w[16];
+   double alone[W_TYPES], together[W_TYPES];
+   int seconds, n, t, bad;
+
+   seconds = 5;
+
+   if (argc > 1) seconds = atoi(argv[1]);
+
+   if (argc > 3)
+   {
+      i2cBus  = atoi(argv[2]);
+      i2cAddr = strtol(argv[3], NULL, 0);
+   }
+
+   memset(alone,    0, sizeof(alone));
+   memset(together, 0, sizeof(together));
+
+   bad = 0;
+
+   for (t=0; t<W_TYPES; t++)
+   {
+      n = addWorkers(w, 0, t);
+      if (n) bad += run("alone", w, n, seconds, alone);
+   }
+
+   n = 0;
+
+   for (t=0; t<W_TYPES; t++) n = addWorkers(w, n, t);
+
+   bad += run("together", w, n, seconds, together);
+
+   for (t=0; t<W_TYPES; t++)
+   {
+      if (alone[t] > 0.0)
+         printf("%-5s keeps %3.0f%% of its stand-alone rate\n",
+            typeName[t], 100.0 * together[t] / alone[t]);
+   }
+
+   if (bad) fprintf(stderr, "STRESS FAILED (%d corrupt results)\n", bad);
+   else printf("STRESS PASS\n");
+
+   return bad ? 1 : 0;
+}
@@ -0,0 +1,1006 @@
+/*
+gcc -o x_wavebench x_wavebench.c command.c -lpthread -lrt
+./x_wavebench [seconds]
+
+Benchmark for the waveform builder, gpioWaveAddGeneric,
+gpioWaveAddSerial, gpioWaveAddSerialMulti, gpioWaveCreate,
+gpioWaveChain, and gpioWaveChainEx.
+
+pigpio.c is compiled in and pointed at DMA pages in ordinary memory,
+so no pigpio daemon, root, or hardware is needed.  Each workload is
+built repeatedly for about the given seconds and the add and create
+(or chain) times reported.
+
+The control blocks of the first build are then followed as the DMA
+would, copying words and counting paced delays, to reconstruct when
+each gpio changes level.  Those changes are compared with the ideal
+timeline worked out from the request (serial bits at exact multiples
+of the bit time).  The timelines are aligned on their first change.
+A difference in the changes, or a timing error over a workload's
+tolerance, fails the check.
+
+Lastly a serial wave which overfills the pulses must be refused, a
+wave image ending in a loop forever must keep looping when sent once,
+and only shared creates of the same pulses may share a wave.
+*/
+
+#include <sys/mman.h>
+
+#include "pigpio.c"
+
+#define MAX_TRAINS 8
+#define MAX_EDGES  (1<<20)
+
+typedef struct
+{
+   double   t;
+   uint32_t gpio;
+   uint32_t level;
+} edge_t;
+
+typedef struct
+{
+   int       level[32];
+   int       numEdges;
+   edge_t   *edge;
+   double    end;
+} track_t;
+
+typedef struct
+{
+   char        *name;
+   int          serial; /* 0 generic, 1 serial, 2 serial multi */
+   int          numTrains;
+   unsigned     len[MAX_TRAINS];
+   gpioPulse_t *train[MAX_TRAINS];
+   gpioSerial_t ch[MAX_TRAINS];
+   double       tolerance; /* micros, < 0 to only report */
+   int          wave_id;
+} spec_t;
+
+static uint32_t fakeDMA[64];
+
+static uint32_t gpset, gpclr;
+
+static track_t got, ideal;
+
+static double absDiff(double a, double b)
+{
+   if (a > b) return a - b; else return b - a;
+}
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec + (ts.tv_nsec / 1E9);
+}
+
+static int benchInit(void)
+{
+   char *mem;
+   int i, flags;
+
+   /* the cbs hold 32 bit addresses of each other and of the OOL */
+
+   flags = MAP_PRIVATE|MAP_ANONYMOUS;
+
+#ifdef MAP_32BIT
+   flags |= MAP_32BIT;
+#endif
+
+   mem = mmap(0, DMAO_PAGES*sizeof(dmaOPage_t), PROT_READ|PROT_WRITE,
+      flags, -1, 0);
+
+   if (mem == MAP_FAILED) return -1;
+
+   dmaOVirt = malloc(DMAO_PAGES*sizeof(dmaOPage_t *));
+
+   if (dmaOVirt == NULL) return -1;
+
+   for (i=0; i<DMAO_PAGES; i++)
+      dmaOVirt[i] = (dmaOPage_t *)(mem + (i*sizeof(dmaOPage_t)));
+
+   /* bus and virtual addresses are the same */
+
+   dmaOBus = dmaOVirt;
+
+   dmaOut = fakeDMA;
+
+   libInitialised = 1;
+   waveClockInited = 1;
+
+   gpset = ((GPIO_BASE + (GPSET0*4)) & 0x00ffffff) | PI_PERI_BUS;
+   gpclr = ((GPIO_BASE + (GPCLR0*4)) & 0x00ffffff) | PI_PERI_BUS;
+
+   got.edge   = malloc(MAX_EDGES*sizeof(edge_t));
+   ideal.edge = malloc(MAX_EDGES*sizeof(edge_t));
+
+   if ((got.edge == NULL) || (ideal.edge == NULL)) return -1;
+
+   return gpioWaveClear();
+}
+
+static void trackReset(track_t *tr)
+{
+   int g;
+
+   for (g=0; g<32; g++) tr->level[g] = -1;
+
+   tr->numEdges = 0;
+   tr->end = 0.0;
+}
+
+static void trackWrite(track_t *tr, double t, uint32_t bits, int level)
+{
+   int g;
+
+   /* only level changes are kept, the first write is a change */
+
+   for (g=0; g<32; g++)
+   {
+      if ((bits & (1<<g)) && (tr->level[g] != level) &&
+          (tr->numEdges < MAX_EDGES))
+      {
+         tr->edge[tr->numEdges].t     = t;
+         tr->edge[tr->numEdges].gpio  = g;
+         tr->edge[tr->numEdges].level = level;
+         tr->numEdges++;
+
+         tr->level[g] = level;
+      }
+   }
+}
+
+static void reconstruct(uint32_t cbAddr, track_t *tr)
+{
+   rawCbs_t *p;
+   double t;
+   long steps;
+
+   /*
+      Follows the cbs as the DMA would.  Paced cbs wait length/4
+      ticks, writes to GPSET0/GPCLR0 change the gpios, and other
+      cbs copy memory (reads of the gpio levels or the clock are
+      peripheral addresses and skipped).
+   */
+
+   trackReset(tr);
+
+   t = 0.0;
+   steps = 0;
+
+   while (cbAddr && (steps++ < 100000000))
+   {
+      p = (rawCbs_t *)(uintptr_t)cbAddr;
+
+      if (p->dst == gpset)
+         trackWrite(tr, t, *(uint32_t *)(uintptr_t)p->src, 1);
+      else if (p->dst == gpclr)
+         trackWrite(tr, t, *(uint32_t *)(uintptr_t)p->src, 0);
+      else if (p->info & DMA_DEST_DREQ)
+         t += (p->length / 4) * PI_WF_MICROS;
+      else if ((p->src & 0xFF000000) != PI_PERI_BUS)
+         memmove((void *)(uintptr_t)p->dst, (void *)(uintptr_t)p->src,
+            (p->info & DMA_SRC_INC) ? p->length : 4);
+
+      cbAddr = p->next;
+   }
+
+   tr->end = t;
+}
+
+static double idealSerial(gpioSerial_t *ch, double t0, track_t *tr)
+{
+   double bitTime, t;
+   uint32_t c;
+   int i, b, chars;
+
+   bitTime = 1E6 / ch->baud;
+
+   chars = ch->numBytes;
+
+   if (ch->dataBits > 8)  chars /= 2;
+   if (ch->dataBits > 16) chars /= 2;
+
+   /* the line idles high until the first start bit */
+
+   trackWrite(tr, t0, 1<<ch->gpio, 1);
+
+   t = t0 + ch->offset;
+
+   for (i=0; i<chars; i++)
+   {
+      if (ch->dataBits < 9) c = (uint8_t)ch->bstr[i];
+      else if (ch->dataBits < 17) c = ((uint16_t *)ch->bstr)[i];
+      else c = ((uint32_t *)ch->bstr)[i];
+
+      trackWrite(tr, t, 1<<ch->gpio, 0);
+
+      for (b=0; b<ch->dataBits; b++)
+         trackWrite(tr, t + ((b+1)*bitTime), 1<<ch->gpio, (c>>b) & 1);
+
+      trackWrite(tr, t + ((ch->dataBits+1)*bitTime), 1<<ch->gpio, 1);
+
+      t += ((ch->dataBits+1) * bitTime) + ((ch->stopBits * bitTime) / 2);
+   }
+
+   return t;
+}
+
+static double idealWave(spec_t *s, double t0, track_t *tr)
+{
+   double t, end;
+   int i, j;
+
+   /* each train starts at the start of the waveform */
+
+   end = t0;
+
+   for (i=0; i<s->numTrains; i++)
+   {
+      if (s->serial) t = idealSerial(&s->ch[i], t0, tr);
+      else
+      {
+         t = t0;
+
+         for (j=0; j<s->len[i]; j++)
+         {
+            trackWrite(tr, t, s->train[i][j].gpioOn,  1);
+            trackWrite(tr, t, s->train[i][j].gpioOff, 0);
+            t += s->train[i][j].usDelay;
+         }
+      }
+
+      if (t > end) end = t;
+   }
+
+   return end;
+}
+
+static int compare(char *name, double tolerance, double *maxErr)
+{
+   edge_t *a, *b;
+   double err, sumErr, t0a, t0b, dur;
+   int g, i, j, n, bad;
+
+   /* each gpio must change in the same order, at about the same time */
+
+   bad = 0;
+   n = 0;
+   sumErr = 0.0;
+   *maxErr = 0.0;
+
+   t0a = got.numEdges   ? got.edge[0].t   : 0.0;
+   t0b = ideal.numEdges ? ideal.edge[0].t : 0.0;
+
+   if (got.numEdges != ideal.numEdges)
+   {
+      fprintf(stderr, "%s: %d level changes, expected %d\n",
+         name, got.numEdges, ideal.numEdges);
+      bad++;
+   }
+
+   for (g=0; g<32; g++)
+   {
+      i = 0;
+      j = 0;
+
+      while (1)
+      {
+         while ((i < got.numEdges) && (got.edge[i].gpio != g)) i++;
+         while ((j < ideal.numEdges) && (ideal.edge[j].gpio != g)) j++;
+
+         if ((i >= got.numEdges) || (j >= ideal.numEdges)) break;
+
+         a = &got.edge[i++];
+         b = &ideal.edge[j++];
+
+         if (a->level != b->level)
+         {
+            if (!bad++) fprintf(stderr, "%s: gpio %d level differs at %.1f\n",
+               name, g, a->t - t0a);
+         }
+
+         err = absDiff(a->t - t0a, b->t - t0b);
+
+         if (err > *maxErr) *maxErr = err;
+
+         sumErr += err;
+         n++;
+      }
+   }
+
+   dur = absDiff(got.end - t0a, ideal.end - t0b);
+
+   if ((tolerance >= 0.0) && ((*maxErr > tolerance) || (dur > tolerance)))
+   {
+      fprintf(stderr, "%s: timing error %.1f micros, duration %.1f\n",
+         name, *maxErr, dur);
+      bad++;
+   }
+
+   printf("  %-8s %7d changes, error max %6.2f mean %6.3f, "
+      "duration %+.1f micros\n", name, got.numEdges, *maxErr,
+      n ? sumErr/n : 0.0, (got.end - t0a) - (ideal.end - t0b));
+
+   return bad;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static gpioPulse_t *pulseAlloc(int n)
+{
+   gpioPulse_t *p;
+
+   p = calloc(n, sizeof(gpioPulse_t));
+
+   if (p == NULL)
+   {
+      fprintf(stderr, "no memory\n");
+      exit(1);
+   }
+
+   return p;
+}
+
+static void specPwm(spec_t *s, char *name, int gpio, int cycles)
+{
+   int i;
+
+   /* a fixed square wave, repeats which the builder loops */
+
+   memset(s, 0, sizeof(spec_t));
+
+   s->name = name;
+   s->numTrains = 1;
+   s->len[0] = 2 * cycles;
+   s->train[0] = pulseAlloc(2 * cycles);
+
+   for (i=0; i<cycles; i++)
+   {
+      s->train[0][2*i].gpioOn    = 1<<gpio;
+      s->train[0][2*i].usDelay   = 10;
+      s->train[0][2*i+1].gpioOff = 1<<gpio;
+      s->train[0][2*i+1].usDelay = 40;
+   }
+}
+
+static void specServo(spec_t *s, char *name, int frames)
+{
+   int i, f, w;
+
+   /* 8 servo trains merged, each pulse a different width */
+
+   memset(s, 0, sizeof(spec_t));
+
+   s->name = name;
+   s->numTrains = 8;
+
+   for (i=0; i<8; i++)
+   {
+      s->len[i] = 2 * frames;
+      s->train[i] = pulseAlloc(2 * frames);
+
+      for (f=0; f<frames; f++)
+      {
+         w = 1000 + (i * 125) + (f * 7);
+
+         s->train[i][2*f].gpioOn    = 1<<(4+i);
+         s->train[i][2*f].usDelay   = w;
+         s->train[i][2*f+1].gpioOff = 1<<(4+i);
+         s->train[i][2*f+1].usDelay = 20000 - w;
+      }
+   }
+}
+
+static void specRandom(spec_t *s, char *name, int pulses)
+{
+   uint32_t on;
+   int i;
+
+   /* unrelated gpios switched at random times */
+
+   memset(s, 0, sizeof(spec_t));
+
+   s->name = name;
+   s->numTrains = 1;
+   s->len[0] = pulses;
+   s->train[0] = pulseAlloc(pulses);
+
+   for (i=0; i<pulses; i++)
+   {
+      on = (rand() & 0x0FFFFFFC) & -(rand() & 1);
+
+      s->train[0][i].gpioOn  = on;
+      s->train[0][i].gpioOff = (rand() & 0x0FFFFFFC) & ~on;
+      s->train[0][i].usDelay = 1 + (rand() % 100);
+   }
+}
+
+static void specSerial(spec_t *s, char *name, int multi)
+{
+   static unsigned baud[MAX_TRAINS]={9600, 19200, 38400, 115200};
+   int i, j;
+
+   /* 64 bytes on each of four gpios at different bauds */
+
+   memset(s, 0, sizeof(spec_t));
+
+   s->name = name;
+   s->serial = multi ? 2 : 1;
+   s->numTrains = 4;
+   s->tolerance = -1.0;
+
+   for (i=0; i<4; i++)
+   {
+      s->ch[i].bstr = malloc(64);
+
+      if (s->ch[i].bstr == NULL)
+      {
+         fprintf(stderr, "no memory\n");
+         exit(1);
+      }
+
+      for (j=0; j<64; j++) s->ch[i].bstr[j] = rand();
+
+      s->ch[i].gpio     = 20 + i;
+      s->ch[i].baud     = baud[i];
+      s->ch[i].dataBits = 8;
+      s->ch[i].stopBits = 2;
+      s->ch[i].offset   = 200;
+      s->ch[i].numBytes = 64;
+   }
+}
+
+static int specAdd(spec_t *s)
+{
+   int i, status;
+
+   status = gpioWaveAddNew();
+
+   if (s->serial == 2) return gpioWaveAddSerialMulti(s->numTrains, s->ch);
+
+   for (i=0; i<s->numTrains; i++)
+   {
+      if (s->serial)
+         status = gpioWaveAddSerial(s->ch[i].gpio, s->ch[i].baud,
+            s->ch[i].dataBits, s->ch[i].stopBits, s->ch[i].offset,
+            s->ch[i].numBytes, s->ch[i].bstr);
+      else
+         status = gpioWaveAddGeneric(s->len[i], s->train[i]);
+
+      if (status < 0) return status;
+   }
+
+   return status;
+}
+
+static int benchWave(spec_t *s, double seconds)
+{
+   double start, addTime, createTime, maxErr, t;
+   long count;
+   int pulses, cbs, wid, bad;
+
+   /* time adding and creating, then check one built waveform */
+
+   count = 0;
+   addTime = 0.0;
+   createTime = 0.0;
+
+   start = now();
+
+   do
+   {
+      t = now();
+
+      pulses = specAdd(s);
+
+      addTime += now() - t;
+
+      if (pulses < 0)
+      {
+         fprintf(stderr, "%s: add failed (%d)\n", s->name, pulses);
+         return 1;
+      }
+
+      t = now();
+
+      wid = gpioWaveCreate();
+
+      createTime += now() - t;
+
+      if (wid < 0)
+      {
+         fprintf(stderr, "%s: create failed (%d)\n", s->name, wid);
+         return 1;
+      }
+
+      gpioWaveDelete(wid);
+
+      count++;
+
+   } while ((now() - start) < seconds);
+
+   specAdd(s);
+
+   s->wave_id = gpioWaveCreate();
+
+   cbs = waveInfo[s->wave_id].topCB - waveInfo[s->wave_id].botCB + 1;
+
+   printf("%-8s %6d pulses %6d cbs, add %8.1f create %8.1f micros, "
+      "%6.2f Mpulses/s\n", s->name, pulses, cbs,
+      1E6 * addTime / count, 1E6 * createTime / count,
+      (pulses * count) / ((addTime + createTime) * 1E6));
+
+   reconstruct(waveCbPOadr(waveInfo[s->wave_id].botCB), &got);
+
+   trackReset(&ideal);
+
+   ideal.end = idealWave(s, 0.0, &ideal);
+
+   bad = compare(s->name, s->tolerance, &maxErr);
+
+   return bad;
+}
+
+static double idealChainEx(
+   char *buf, int from, int to, spec_t **w, double t)
+{
+   int i, j, depth, cnt, rep;
+
+   /* the extended chain from byte from to byte to, loops unrolled */
+
+   i = from;
+
+   while (i < to)
+   {
+      if ((uint8_t)buf[i] != 255)
+      {
+         t = idealWave(w[(uint8_t)buf[i]], t, &ideal);
+         i++;
+         continue;
+      }
+
+      switch (buf[i+1])
+      {
+         case 0: /* find the repeat which closes the loop */
+
+            depth = 0;
+
+            for (j=i+2; j<to; j++)
+            {
+               if ((uint8_t)buf[j] != 255) continue;
+
+               if (buf[j+1] == 0) {depth++; j++; continue;}
+
+               if ((buf[j+1] == 1) && (depth-- == 0)) break;
+
+               j += (buf[j+1] == 2) ? 3 : 1;
+            }
+
+            cnt = (uint8_t)buf[j+2] + ((uint8_t)buf[j+3]<<8);
+
+            for (rep=0; rep<cnt; rep++)
+               t = idealChainEx(buf, i+2, j, w, t);
+
+            i = j + 4;
+            break;
+
+         case 2:
+            t += (uint8_t)buf[i+2] + ((uint8_t)buf[i+3]<<8);
+            i += 4;
+            break;
+      }
+   }
+
+   return t;
+}
+
+static int benchChain(
+   char *name, int ex, int *chain, int bufSize, spec_t **w, double seconds)
+{
+   char buf[64];
+   double start, chainTime, maxErr, t;
+   long count;
+   int i, j, n, cnt, rep, status, bad;
+
+   /* time the chain, then check what it sends */
+
+   for (i=0; i<bufSize; i++) buf[i] = chain[i];
+
+   count = 0;
+   chainTime = 0.0;
+
+   start = now();
+
+   do
+   {
+      t = now();
+
+      if (ex) status = gpioWaveChainEx(buf, bufSize, 0, NULL);
+      else    status = gpioWaveChain(buf, bufSize);
+
+      chainTime += now() - t;
+
+      /* the "transmission" ends at once */
+
+      fakeDMA[DMA_CONBLK_AD] = 0;
+
+      if (status < 0)
+      {
+         fprintf(stderr, "%s: chain failed (%d)\n", name, status);
+         return 1;
+      }
+
+      count++;
+
+   } while ((now() - start) < seconds);
+
+   if (ex) status = gpioWaveChainEx(buf, bufSize, 0, NULL);
+   else    status = gpioWaveChain(buf, bufSize);
+
+   printf("%-8s %6d bytes, chain %8.1f micros\n",
+      name, bufSize, 1E6 * chainTime / count);
+
+   reconstruct(fakeDMA[DMA_CONBLK_AD], &got);
+
+   fakeDMA[DMA_CONBLK_AD] = 0;
+
+   /*
+      The ideal is worked out from the chain, loops are unrolled.
+      The legacy chain repeats from its wave to the counter, the
+      extended chain from its loop start.
+   */
+
+   trackReset(&ideal);
+
+   if (ex) t = idealChainEx(buf, 0, bufSize, w, 0.0);
+   else
+   {
+      t = 0.0;
+      i = 0;
+
+      while (i < bufSize)
+      {
+         n = (uint8_t)buf[i];
+
+         if (n != 255) {t = idealWave(w[n], t, &ideal); i++; continue;}
+
+         /* 255 wave cycles(3 bytes), repeat from wave to here */
+
+         cnt = (uint8_t)buf[i+2] + ((uint8_t)buf[i+3]<<8) +
+            ((uint8_t)buf[i+4]<<16);
+
+         for (n=0; n<i; n++)
+         {
+            if (buf[n] == buf[i+1]) break;
+         }
+
+         for (rep=1; rep<cnt; rep++)
+         {
+            for (j=n; j<i; j++) t = idealWave(w[(uint8_t)buf[j]], t, &ideal);
+         }
+
+         i += 5;
+      }
+   }
+
+   ideal.end = t;
+
+   bad = compare(name, 0.0, &maxErr);
+
+   return bad;
+}
+
+static int checkSerialFull(void)
+{
+   static char data[3][600];
+   gpioSerial_t ch[3];
+   int i, status;
+
+   /*
+      The first two channels fill the pulse buffer exactly (5999 and
+      6001 pulses), the third must be refused rather than written
+      past its end.
+   */
+
+   for (i=0; i<3; i++)
+   {
+      memset(data[i], 0x55, 600);
+
+      ch[i].gpio     = 20 + i;
+      ch[i].baud     = 9600;
+      ch[i].dataBits = 8;
+      ch[i].stopBits = 2;
+      ch[i].offset   = 200;
+      ch[i].numBytes = (i < 2) ? 600 : 1;
+      ch[i].bstr     = data[i];
+   }
+
+   data[0][599] = 0x54;
+
+   gpioWaveAddNew();
+
+   status = gpioWaveAddSerialMulti(3, ch);
+
+   printf("serialf  3 channels filling the pulses, status %d\n", status);
+
+   if (status != PI_TOO_MANY_PULSES)
+   {
+      fprintf(stderr, "serialf: expected %d, got %d\n",
+         PI_TOO_MANY_PULSES, status);
+      return 1;
+   }
+
+   return 0;
+}
+
+static int createFrame(int shared)
+{
+   gpioPulse_t pulse[2];
+
+   pulse[0].gpioOn  = 1<<5;
+   pulse[0].gpioOff = 0;
+   pulse[0].usDelay = 50;
+
+   pulse[1].gpioOn  = 0;
+   pulse[1].gpioOff = 1<<5;
+   pulse[1].usDelay = 50;
+
+   gpioWaveAddNew();
+   gpioWaveAddGeneric(2, pulse);
+
+   if (shared) return gpioWaveCreateShared();
+   else        return gpioWaveCreate();
+}
+
+static int checkShared(void)
+{
+   char chain[2];
+   int a, b, c, d, status, bad;
+
+   /*
+      Plain creates of the same pulses are separate waves which may
+      be chained together.  Shared creates of them share one wave
+      which lives until its last delete.
+   */
+
+   bad = 0;
+
+   a = createFrame(0);
+   b = createFrame(0);
+
+   chain[0] = a;
+   chain[1] = b;
+
+   status = gpioWaveChain(chain, 2);
+
+   fakeDMA[DMA_CONBLK_AD] = 0;
+
+   printf("shared   plain creates %d %d chain %d", a, b, status);
+
+   if ((a < 0) || (a == b) || (status < 0)) bad++;
+
+   gpioWaveDelete(a);
+   gpioWaveDelete(b);
+
+   c = createFrame(1);
+   d = createFrame(1);
+
+   printf(", shared creates %d %d", c, d);
+
+   if ((c < 0) || (c != d)) bad++;
+
+   gpioWaveDelete(c);
+
+   status = waveState[c];
+
+   gpioWaveDelete(d);
+
+   printf(", live after one delete %d, after both %d\n",
+      status == WAVE_LIVE, waveState[c] == WAVE_LIVE);
+
+   if ((status != WAVE_LIVE) || (waveState[c] == WAVE_LIVE)) bad++;
+
+   if (bad) fprintf(stderr, "shared: plain or shared creates wrong\n");
+
+   return bad;
+}
+
+static int imageForever(int backJumpLast, unsigned *wave_id)
+{
+   static char buf[256];
+   gpioWaveImage_t img;
+   gpioWaveImageWave_t w;
+   gpioWaveImageCb_t c[7];
+   uint32_t ool[2];
+   int i, numCB, size;
+
+   /*
+      A loop forever as pigwave writes it.  A leading delay, the
+      body (gpio 4 on for 100 and off for 100 micros), a nop which
+      jumps back to the body, and a nop which ends the wave.
+   */
+
+   numCB = backJumpLast ? 6 : 7;
+
+   for (i=0; i<numCB; i++)
+   {
+      c[i].info   = PI_WI_CB_COPY;
+      c[i].src    = PI_WI_REF_OOL | 0;
+      c[i].dst    = PI_WI_REF_OOL | 0;
+      c[i].length = 4;
+      c[i].next   = PI_WI_REF_CB | ((i+1)*32);
+   }
+
+   for (i=0; i<5; i+=2)
+   {
+      c[i].info   = PI_WI_CB_PACED;
+      c[i].src    = PI_WI_REF_PERI | PI_WI_PERI_DATA;
+      c[i].dst    = PI_WI_REF_PERI | PI_WI_PERI_PACE;
+      c[i].length = 4 * (i ? 100 : 20);
+   }
+
+   c[1].src = PI_WI_REF_OOL | 1;
+   c[1].dst = PI_WI_REF_PERI | PI_WI_PERI_SET;
+   c[3].src = PI_WI_REF_OOL | 1;
+   c[3].dst = PI_WI_REF_PERI | PI_WI_PERI_CLR;
+
+   c[numCB-1].next = 0;
+   c[5].next = PI_WI_REF_CB | (1*32);
+
+   ool[0] = 0;
+   ool[1] = 1<<4;
+
+   img.magic     = PI_WAVE_IMAGE_MAGIC;
+   img.oolPage   = PI_WAVE_IMAGE_OOL_PAGE;
+   img.numWaves  = 1;
+   img.numCB     = numCB;
+   img.numOOL    = 2;
+   img.numRelocs = 0;
+
+   w.micros = 200;
+   w.botCB  = 0;
+   w.topCB  = numCB - 1;
+   w.botOOL = 0;
+   w.topOOL = 2;
+
+   size = 0;
+   memcpy(buf+size, &img, sizeof(img));         size += sizeof(img);
+   memcpy(buf+size, &w, sizeof(w));             size += sizeof(w);
+   memcpy(buf+size, c, numCB*sizeof(c[0]));     size += numCB*sizeof(c[0]);
+   memcpy(buf+size, ool, sizeof(ool));          size += sizeof(ool);
+
+   return gpioWaveLoadImage(buf, size, wave_id);
+}
+
+static int checkImageForever(void)
+{
+   rawCbs_t *p;
+   uint32_t cbAddr;
+   unsigned wid;
+   int status, steps, sets;
+
+   /*
+      A one shot send of a loop forever must keep looping, so the
+      send may not end the wave on the body's back jump.  An image
+      whose last cb is the back jump is refused.
+   */
+
+   status = imageForever(1, &wid);
+
+   if (status != PI_BAD_WAVE_IMAGE)
+   {
+      fprintf(stderr, "forever: back jump last, expected %d, got %d\n",
+         PI_BAD_WAVE_IMAGE, status);
+      return 1;
+   }
+
+   status = imageForever(0, &wid);
+
+   if (status != 1)
+   {
+      fprintf(stderr, "forever: load failed (%d)\n", status);
+      return 1;
+   }
+
+   gpioWaveTxSend(wid, PI_WAVE_MODE_ONE_SHOT);
+
+   cbAddr = waveCbPOadr(waveInfo[wid].botCB);
+
+   sets = 0;
+
+   for (steps=0; cbAddr && (steps < 1000); steps++)
+   {
+      p = (rawCbs_t *)(uintptr_t)cbAddr;
+
+      if (p->dst == gpset) sets++;
+
+      cbAddr = p->next;
+   }
+
+   fakeDMA[DMA_CONBLK_AD] = 0;
+
+   gpioWaveTxStop();
+   gpioWaveDelete(wid);
+
+   printf("forever  image loop forever, %d passes in %d cbs%s\n",
+      sets, steps, cbAddr ? "" : ", ended");
+
+   if (!cbAddr)
+   {
+      fprintf(stderr, "forever: one shot send ended the loop forever\n");
+      return 1;
+   }
+
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   spec_t spec[6], *w[PI_MAX_WAVES];
+   int legacy[8]    = {0, 0, 255, 0, 100, 0, 0, 0};
+   int extended[20] = {255, 0, 0, 255, 0, 0, 0, 255, 1, 3, 0,
+                       255, 2, 100, 0, 255, 1, 4, 0, 0};
+   double seconds;
+   int i, bad;
+
+   seconds = 0.5;
+
+   if (argc > 1) seconds = atof(argv[1]);
+
+   if (benchInit() < 0)
+   {
+      fprintf(stderr, "can't set up the DMA pages\n");
+      return 1;
+   }
+
+   srand(1);
+
+   specPwm   (&spec[0], "pwm",     4, 2000);
+   specServo (&spec[1], "servo",   10);
+   specRandom(&spec[2], "random",  3000);
+   specSerial(&spec[3], "serial",  0);
+   specSerial(&spec[4], "serialm", 1);
+   specRandom(&spec[5], "short",   50);
+
+   bad = 0;
+
+   for (i=0; i<6; i++) bad += benchWave(&spec[i], seconds);
+
+   memset(w, 0, sizeof(w));
+
+   for (i=0; i<6; i++) w[spec[i].wave_id] = &spec[i];
+
+   /*
+      The serial waves are left out of the chains, their drift from
+      the ideal bit times would add up across repeats.
+   */
+
+   legacy[0] = spec[1].wave_id;
+   legacy[1] = spec[5].wave_id;
+   legacy[3] = spec[5].wave_id;
+   legacy[7] = spec[0].wave_id;
+
+   extended[2]  = spec[5].wave_id;
+   extended[5]  = spec[1].wave_id;
+   extended[6]  = spec[5].wave_id;
+   extended[19] = spec[0].wave_id;
+
+   bad += benchChain("chain",  0, legacy,   8,  w, seconds);
+   bad += benchChain("chainx", 1, extended, 20, w, seconds);
+
+   bad += checkSerialFull();
+
+   bad += checkImageForever();
+
+   bad += checkShared();
+
+   if (bad) fprintf(stderr, "TIMING CHECK FAILED (%d)\n", bad);
+   else printf("TIMING CHECK PASS\n");
+
+   return bad ? 1 : 0;
+}